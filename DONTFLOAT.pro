@@ -92,6 +92,10 @@ SOURCES += \
         src/main.cpp\
         src/mainwindow.cpp \
         src/waveformview.cpp \
+        src/timewarpmap.cpp \
+        src/waveformrasterizer.cpp \
+        src/spectrogramcache.cpp \
+        src/analysiscache.cpp \
         src/markerengine.cpp \
         src/pitchgridwidget.cpp \
         src/pianoroll_engine.cpp \
@@ -102,6 +106,9 @@ SOURCES += \
         src/notepreviewplayer.cpp \
         src/waveformcolors.cpp \
         src/bpmanalyzer.cpp \
+        src/deviationmodel.cpp \
+        src/tempomap.cpp \
+        src/onsetstream.cpp \
         src/keyanalyzer.cpp \
         src/waveformanalyzer.cpp \
         src/audiocommand.cpp \
@@ -115,6 +122,7 @@ SOURCES += \
         src/timeutils.cpp \
         src/wavwriter.cpp \
         src/audiofileservice.cpp \
+        src/loadpipeline.cpp \
         src/keyselectionmenu.cpp \
         src/keymodulationstrip.cpp \
         src/svgiconloader.cpp \
@@ -125,6 +133,10 @@ SOURCES += \
 HEADERS += \
         include/mainwindow.h \
         include/waveformview.h \
+        include/timewarpmap.h \
+        include/waveformrasterizer.h \
+        include/spectrogramcache.h \
+        include/analysiscache.h \
         include/markerengine.h \
         include/pitchgridwidget.h \
         include/pianoroll_engine.h \
@@ -136,8 +148,13 @@ HEADERS += \
         include/pitchnotesplitcommand.h \
         include/notepreviewplayer.h \
         include/waveformcolors.h \
+        include/beatgridfit.h \
         include/bpmanalyzer.h \
+        include/deviationmodel.h \
+        include/tempomap.h \
+        include/onsetstream.h \
         include/keyanalyzer.h \
+        include/keyprofile.h \
         include/waveformanalyzer.h \
         include/audiocommand.h \
         include/loadfiledialog.h \
@@ -150,6 +167,7 @@ HEADERS += \
         include/timeutils.h \
         include/wavwriter.h \
         include/audiofileservice.h \
+        include/loadpipeline.h \
         include/uiconstants.h \
         include/keyselectionmenu.h \
         include/keymodulationstrip.h \
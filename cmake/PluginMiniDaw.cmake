@@ -120,6 +120,8 @@ function(dontfloat_add_mini_daw_gui)
         src/audiofileservice.cpp
         # Огибающая волны и тактовая сетка дорожки — те же, что в приложении
         src/pianoroll_engine.cpp
+        src/tempomap.cpp
+        src/waveformpeaks.cpp
         # Тестовый хост — в оформлении DONTFLOAT (как главное окно)
         plugins/ui/dontfloat_plugin_theme.cpp
         plugins/ui/dontfloat_plugin_theme.h
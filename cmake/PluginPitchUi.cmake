@@ -28,10 +28,16 @@ set(DONTFLOAT_PLUGIN_SCRATCH_UI_SOURCES
     plugins/ui/dontfloat_scratch_editor.cpp
     plugins/ui/dontfloat_scratch_editor.h
     src/waveformview.cpp
+    src/tempomap.cpp
     src/waveformcolors.cpp
     src/waveformpeaks.cpp
+    src/timewarpmap.cpp
+    src/waveformrasterizer.cpp
+    src/spectrogramcache.cpp
     src/beatvisualizer.cpp
     src/bpmanalyzer.cpp
+    src/deviationmodel.cpp
+    src/onsetstream.cpp
     src/timestretchprocessor.cpp
     src/markerengine.cpp
     src/timeutils.cpp
@@ -41,8 +47,14 @@ set(DONTFLOAT_PLUGIN_SCRATCH_UI_SOURCES
     include/waveformview.h
     include/waveformcolors.h
     include/waveformpeaks.h
+    include/timewarpmap.h
+    include/waveformrasterizer.h
+    include/spectrogramcache.h
     include/beatvisualizer.h
     include/bpmanalyzer.h
+    include/deviationmodel.h
+    include/tempomap.h
+    include/onsetstream.h
     include/timestretchprocessor.h
     include/markerengine.h
     include/timeutils.h
@@ -60,6 +72,7 @@ set(DONTFLOAT_PLUGIN_PITCH_UI_SOURCES
     plugins/ui/dontfloat_pitch_editor.cpp
     plugins/ui/dontfloat_pitch_editor.h
     src/pitchgridwidget.cpp
+    src/tempomap.cpp
     src/pianoroll_toolbar.cpp
     include/pianoroll_toolbar.h
     src/midiexporter.cpp
@@ -0,0 +1,105 @@
+#ifndef ANALYSISCACHE_H
+#define ANALYSISCACHE_H
+
+/**
+ * @brief Кеш анализа дорожек на диске, по хешу содержимого файла.
+ *
+ * Открытие дорожки — это декодирование, пирамида пиков и BPMAnalyzer::analyzeBPM
+ * (самое долгое), а потом ещё тональности по тактам и ноты. Стемы одного
+ * проекта открываются снова и снова, и всё это считалось каждый раз заново.
+ *
+ * Здесь результаты лежат в папке кеша пользователя, по файлу на дорожку. Имя
+ * файла — хеш содержимого аудио, а не путь: переименованный или скопированный
+ * стем узнаётся, а перезаписанный под тем же именем — нет.
+ *
+ * Формат — двоичный, секции выровнены по 8 байт (см. analysiscache.cpp):
+ * файл отображается в память (QFile::map), и пики копируются в пирамиду одним
+ * memcpy без разбора. Запись идёт через QSaveFile — читатель не увидит
+ * недописанный файл. Старые записи вытесняются по времени изменения, когда
+ * папка превышает бюджет.
+ */
+
+#include <QtCore/QByteArray>
+#include <QtCore/QString>
+#include <QtCore/QVector>
+#include <QtCore/QtGlobal>
+
+#include "bpmanalyzer.h"
+#include "keyanalyzer.h"
+#include "pitchdetector.h"
+#include "waveformpeaks.h"
+
+/** Всё, что известно о дорожке; секции без флага has* в файл не пишутся. */
+struct AnalysisCacheEntry {
+    int sampleRate = 0;
+    int channelCount = 0;
+    qint64 sampleCount = 0;
+
+    /** Пики нормированного аудио (как их рисует WaveformView). */
+    WaveformPeaks peaks;
+
+    bool hasBeats = false;
+    BPMAnalyzer::AnalysisResult beats;
+    /**
+     * AnalysisCache::optionsKey настроек, с которыми считались доли: размер
+     * такта (фаза сильной доли), алгоритм, диапазон BPM. Другие настройки —
+     * промах, а не старая сетка.
+     */
+    quint64 beatsOptionsKey = 0;
+
+    /** Тональности по тактам и ноты: считаются вместе, по кнопке анализа. */
+    bool hasPitchAnalysis = false;
+    KeyAnalyzer::BarGrid keyGrid;  // сетка, по которой резались такты
+    KeyAnalyzer::PerBarKeyResult perBarKey;
+    QVector<PitchDetector::PitchNote> notes;
+};
+
+class AnalysisCache
+{
+public:
+    /** Бюджет папки кеша по умолчанию, байт (≈ тысяча часовых стерео-дорожек). */
+    static constexpr qint64 kDefaultBudgetBytes = qint64(512) * 1024 * 1024;
+
+    explicit AnalysisCache(const QString& directory = defaultDirectory());
+
+    /** <кеш пользователя>/analysis. */
+    static QString defaultDirectory();
+    /**
+     * Хеш содержимого файла (hex) — ключ записи. Читает файл целиком, поэтому
+     * его стоит считать в фоне, параллельно с декодированием.
+     * @return пустой массив, если файл не читается
+     */
+    static QByteArray contentHash(const QString& filePath);
+    /**
+     * Отпечаток настроек BPMAnalyzer, от которых зависят доли и сетка (прогресс,
+     * отмена и число потоков не входят). Сверяется с beatsOptionsKey записи.
+     */
+    static quint64 optionsKey(const BPMAnalyzer::AnalysisOptions& options);
+
+    /**
+     * Запись по ключу. false — записи нет, она другой версии формата или
+     * повреждена (такой файл удаляется).
+     */
+    bool load(const QByteArray& hash, AnalysisCacheEntry& entry) const;
+    /** Пишет запись целиком (заменяя прежнюю) и вытесняет старые сверх бюджета. */
+    bool store(const QByteArray& hash, const AnalysisCacheEntry& entry);
+    void remove(const QByteArray& hash);
+
+    /** Запись в байты и обратно — то же, что load/store, но без файла. */
+    static QByteArray encode(const AnalysisCacheEntry& entry);
+    static bool decode(const char* data, qint64 size, AnalysisCacheEntry& entry);
+
+    QString directory() const { return directory_; }
+    void setBudgetBytes(qint64 bytes) { budgetBytes_ = bytes; }
+    qint64 budgetBytes() const { return budgetBytes_; }
+
+private:
+    QString pathFor(const QByteArray& hash) const;
+    /** Удаляет самые давние записи, пока папка не влезет в бюджет. */
+    void prune() const;
+
+    QString directory_;
+    qint64 budgetBytes_ = kDefaultBudgetBytes;
+};
+
+#endif // ANALYSISCACHE_H
@@ -3,6 +3,7 @@
 
 #include <QtCore/QString>
 #include <QtCore/QVector>
+#include <atomic>
 #include <functional>
 
 // Декодирование аудиофайлов в float-сэмплы. UI-независимо (QtCore + QtMultimedia).
@@ -14,12 +15,22 @@ struct DecodeResult {
     QVector<QVector<float>> channels; // 1 (моно) или 2 (стерео) канала
     int sampleRate = 0;               // нативная частота дискретизации файла
     bool ok = false;
+    bool cancelled = false;           // декодирование прервано флагом cancel
     QString error;                    // текст ошибки, когда ok == false
 };
 
-// Декодирует файл. onProgress (если задан) вызывается с процентом декодирования (0..99).
+// Очередной декодированный блок: частота файла и кадры левого и правого (nullptr
+// для моно) каналов. Указатели действительны только на время вызова.
+using BlockCallback = std::function<void(int sampleRate, const float* left, const float* right, int frames)>;
+
+// Декодирует файл. onProgress (если задан) вызывается с процентом декодирования (0..99),
+// onBlock — с каждым блоком сразу после декодирования (например, для OnsetStream).
+// cancel (если задан) проверяется перед каждым блоком: выставленный из другого
+// потока флаг прерывает декодирование, результат — ok == false, cancelled == true.
 DecodeResult decode(const QString& filePath,
-                    const std::function<void(int)>& onProgress = {});
+                    const std::function<void(int)>& onProgress = {},
+                    const BlockCallback& onBlock = {},
+                    const std::atomic<bool>* cancel = nullptr);
 
 // Усреднение каналов в моно-сигнал (для анализа BPM/тональности).
 QVector<float> toMono(const QVector<QVector<float>>& channels);
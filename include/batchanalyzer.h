@@ -0,0 +1,98 @@
+#ifndef BATCHANALYZER_H
+#define BATCHANALYZER_H
+
+#include <QtCore/QJsonObject>
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+#include <QtCore/QVector>
+#include <functional>
+
+#include "bpmanalyzer.h"
+#include "keyanalyzer.h"
+#include "pitchdetector.h"
+
+// Пакетный анализ без окна: декодирование (AudioFileService), доли и BPM
+// (BPMAnalyzer), потактовая тональность (KeyAnalyzer::analyzeKeyPerBar) и ноты
+// (PitchDetector::detectNotes) для целой папки. UI-независимо (QtCore +
+// QtMultimedia) — на нём построена утилита dontfloat-analyze.
+//
+// Файлы раздаются рабочим потокам по одному из общей очереди: освободившийся
+// поток сам забирает следующий, так что длинный файл не держит остальных.
+// Очередь отсортирована от больших файлов к малым — к концу остаются короткие.
+// Когда очередь пуста и потоки начинают простаивать, последние файлы считают
+// тональность и ноты параллельно друг другу.
+namespace BatchAnalyzer {
+
+enum class OutputFormat {
+    Json,     // <имя>.dontfloat.json — доли, карта темпа, тональности, ноты
+    Markers,  // <имя>_markers.txt — метки на долях (MarkersFile::writeFile)
+    Both
+};
+
+struct Options {
+    int jobs = 0;                      // рабочих потоков; 0 — по числу ядер
+    OutputFormat format = OutputFormat::Json;
+    QString inputRoot;                 // корень обхода: относительно него пути в outputDir
+    QString outputDir;                 // пусто — результат рядом с аудиофайлом
+    int beatsPerBar = 4;               // размер для потактовой тональности и меток
+    bool analyzeKeys = true;
+    bool detectNotes = true;
+    bool skipExisting = false;         // не трогать файлы, для которых результат уже есть
+    BPMAnalyzer::AnalysisOptions bpmOptions;
+};
+
+struct FileResult {
+    QString path;
+    bool ok = false;
+    bool skipped = false;              // результат уже был (skipExisting)
+    QString error;
+    int sampleRate = 0;
+    int channelCount = 0;
+    qint64 sampleCount = 0;
+    BPMAnalyzer::AnalysisResult beats;
+    KeyAnalyzer::PerBarKeyResult keys;
+    QVector<PitchDetector::PitchNote> notes;
+    QStringList outputs;               // записанные файлы
+    qint64 elapsedMs = 0;
+};
+
+struct Summary {
+    int analyzed = 0;
+    int skipped = 0;
+    int failed = 0;
+};
+
+// Расширения, которые берутся из папки (без точки, в нижнем регистре).
+QStringList audioSuffixes();
+
+// Аудиофайлы по путям: файлы берутся как есть, папки обходятся (рекурсивно,
+// если recursive). Без повторов; порядок — от больших файлов к малым.
+QStringList collectAudioFiles(const QStringList& paths, bool recursive = true);
+
+// Путь результата для аудиофайла: рядом с ним или в outputDir с той же
+// структурой подпапок относительно inputRoot. suffix — например ".dontfloat.json".
+QString outputPathFor(const QString& audioPath, const Options& options, const QString& suffix);
+
+// Полный анализ одного файла и запись результатов. threadBudget — потоков на
+// анализ внутри файла (BPM, хрома, ноты; 0 — по числу ядер). От двух потоков
+// тональность и ноты считаются параллельно, бюджет делится между ними.
+FileResult analyzeFile(const QString& path, const Options& options, int threadBudget = 0);
+
+// То же, но бюджет спрашивается заново перед каждым этапом (BPM, затем
+// тональность и ноты): пакет отдаёт файлу ядра, освободившиеся за это время.
+FileResult analyzeFile(const QString& path,
+                       const Options& options,
+                       const std::function<int()>& threadBudget);
+
+// Результат в JSON (формат файла .dontfloat.json).
+QJsonObject toJson(const FileResult& result);
+
+// Анализ списка файлов на options.jobs потоках. onFinished вызывается по
+// готовности каждого файла, по одному вызову за раз (из рабочих потоков).
+Summary run(const QStringList& files,
+            const Options& options,
+            const std::function<void(const FileResult&, int done, int total)>& onFinished = {});
+
+} // namespace BatchAnalyzer
+
+#endif // BATCHANALYZER_H
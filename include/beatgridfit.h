@@ -0,0 +1,215 @@
+#ifndef BEATGRIDFIT_H
+#define BEATGRIDFIT_H
+
+/**
+ * @brief Сетка по долям трекера — общая для приложения и ядра плагина.
+ *
+ * Без Qt: BPMAnalyzer (analyzeDetectionFunction, findBarPhase) и
+ * Dontfloat::PluginCore (analyzeTrackAudio) выбирают гармонику BPM, фазу
+ * сетки и сильную долю одними функциями — на одном звуке сетки совпадают.
+ *
+ * Доли — позиции в сэмплах по возрастанию (TempoTrackV2). Фазы считаются в
+ * double: у float позиции дальше ~6 минут при 44.1 кГц теряют целые сэмплы.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#ifdef USE_MIXXX_QM_DSP
+#include <dsp/tempotracking/DownBeat.h>
+#endif
+
+namespace BeatGridFit {
+
+constexpr std::size_t kScoreBeats = 512;    // долей в оценке гармоники и разброса
+constexpr std::size_t kPhaseBeats = 256;    // долей в оценке фазы
+constexpr std::size_t kPhaseCandidates = 5; // фаза — от одной из первых долей
+constexpr double kMaxGridStartSecs = 2.0;   // сетка начинается не дальше 2 с
+
+/** Разброс долей вокруг сетки, в долях: среднее и максимум |фаза − ближайшая доля|. */
+struct Deviation {
+    float average = 1.0f;
+    float maximum = 0.0f;
+};
+
+/** Разброс первых \a limit долей вокруг сетки с шагом \a samplesPerBeat от \a gridStart. */
+inline Deviation gridDeviation(const std::int64_t* beats, std::size_t count, double samplesPerBeat,
+                               double gridStart, std::size_t limit)
+{
+    Deviation result;
+    const std::size_t n = std::min(count, limit);
+    if (n == 0 || samplesPerBeat <= 0.0) {
+        return result;
+    }
+    double total = 0.0;
+    double worst = 0.0;
+    for (std::size_t i = 0; i < n; ++i) {
+        const double phase = (double(beats[i]) - gridStart) / samplesPerBeat;
+        const double deviation = std::abs(phase - std::round(phase));
+        total += deviation;
+        worst = std::max(worst, deviation);
+    }
+    result.average = float(total / double(n));
+    result.maximum = float(worst);
+    return result;
+}
+
+/** Постоянная сетка, подобранная по долям. */
+struct Fit {
+    float baseBpm = 0.0f;        // по среднему интервалу долей, до выбора гармоники
+    float bpm = 0.0f;            // 0 — меньше двух долей
+    std::int64_t gridStart = 0;  // сэмпл первой доли сетки
+    Deviation deviation;         // разброс первых kScoreBeats долей вокруг сетки
+};
+
+/**
+ * Гармоника BPM (×1, ×2, ×4, ×0.5, ×0.25, приведённые в minBpm..maxBpm), при
+ * которой доли ровнее всего ложатся на сетку (0.7 среднего + 0.3 максимума
+ * разброса), и фаза сетки по первым kPhaseCandidates долям. \a fixedBpm > 0 —
+ * темп известен, гармоника не подбирается.
+ */
+inline Fit fitGrid(const std::int64_t* beats, std::size_t count, int sampleRate,
+                   float minBpm, float maxBpm, float fixedBpm = 0.0f)
+{
+    Fit fit;
+    if (count == 0 || sampleRate <= 0) {
+        return fit;
+    }
+    const std::int64_t maxGridStart = std::llround(kMaxGridStartSecs * sampleRate);
+    fit.gridStart = beats[0] <= maxGridStart ? beats[0] : 0;
+    if (count < 2 || beats[count - 1] <= beats[0]) {
+        return fit;
+    }
+
+    const double averageInterval = double(beats[count - 1] - beats[0]) / double(count - 1);
+    fit.baseBpm = float(60.0 * sampleRate / averageInterval);
+
+    std::vector<float> candidates;
+    if (fixedBpm > 0.0f) {
+        candidates.push_back(fixedBpm);
+    } else {
+        for (const float factor : { 1.0f, 2.0f, 4.0f, 0.5f, 0.25f }) {
+            float bpm = fit.baseBpm * factor;
+            while (bpm < minBpm) bpm *= 2.0f;
+            while (bpm > maxBpm) bpm *= 0.5f;
+            candidates.push_back(bpm);
+        }
+    }
+    fit.bpm = candidates.front();
+    float bestScore = std::numeric_limits<float>::infinity();
+    for (const float candidate : candidates) {
+        const Deviation d =
+            gridDeviation(beats, count, 60.0 * sampleRate / candidate, double(fit.gridStart), kScoreBeats);
+        const float score = d.average * 0.7f + d.maximum * 0.3f;
+        if (score < bestScore) {
+            bestScore = score;
+            fit.bpm = candidate;
+        }
+    }
+
+    const double samplesPerBeat = 60.0 * sampleRate / fit.bpm;
+    float bestPhase =
+        gridDeviation(beats, count, samplesPerBeat, double(fit.gridStart), kPhaseBeats).average;
+    for (std::size_t i = 0; i < std::min(kPhaseCandidates, count); ++i) {
+        const std::int64_t candidate = beats[i] - std::int64_t(double(i) * samplesPerBeat);
+        if (candidate < 0 || candidate > maxGridStart) {
+            continue;
+        }
+        const float average =
+            gridDeviation(beats, count, samplesPerBeat, double(candidate), kPhaseBeats).average;
+        if (average < bestPhase) {
+            bestPhase = average;
+            fit.gridStart = candidate;
+        }
+    }
+    fit.deviation = gridDeviation(beats, count, samplesPerBeat, double(fit.gridStart), kScoreBeats);
+    return fit;
+}
+
+/** Такт в долях сетки — как у BarGrid и номеров тактов: 6/8 и 12/8 по четвертям. */
+constexpr int gridBeatsPerBar(int beatsPerBar)
+{
+    return beatsPerBar == 6 ? 3 : (beatsPerBar == 12 ? 6 : beatsPerBar);
+}
+
+/**
+ * Доли трекера могут идти через одну или вдвое чаще сетки: масштаб —
+ * ближайшая к отношению интервалов степень двойки (от ¼ до 4).
+ */
+inline double trackerBeatScale(const std::int64_t* beats, std::size_t count, double samplesPerBeat)
+{
+    if (count < 2 || samplesPerBeat <= 0.0) {
+        return 1.0;
+    }
+    const double trackerInterval = double(beats[count - 1] - beats[0]) / double(count - 1);
+    if (trackerInterval <= 0.0) {
+        return 1.0;
+    }
+    return std::pow(2.0, std::clamp(std::round(std::log2(trackerInterval / samplesPerBeat)), -2.0, 2.0));
+}
+
+/**
+ * Такт в долях трекера для DownBeat; 0 — такт не укладывается в целое число
+ * долей трекера или долей меньше двух тактов.
+ */
+inline int trackerBeatsPerBar(const std::int64_t* beats, std::size_t count, double samplesPerBeat,
+                              int beatsPerBar)
+{
+    if (beatsPerBar < 2 || count < 3) {
+        return 0;
+    }
+    const double trackerBeats =
+        gridBeatsPerBar(beatsPerBar) / trackerBeatScale(beats, count, samplesPerBeat);
+    const int timesig = int(std::llround(trackerBeats));
+    if (timesig < 2 || std::abs(trackerBeats - timesig) > 1e-9 || count < std::size_t(2 * timesig + 1)) {
+        return 0;
+    }
+    return timesig;
+}
+
+/** Номер доли сетки \a gridBeat по модулю такта — фаза сильной доли. */
+inline int barPhase(double gridBeat, int beatsPerBar)
+{
+    const int barBeats = gridBeatsPerBar(beatsPerBar);
+    if (barBeats < 1) {
+        return 0;
+    }
+    const std::int64_t index = std::llround(gridBeat);
+    return int(((index % barBeats) + barBeats) % barBeats);
+}
+
+#ifdef USE_MIXXX_QM_DSP
+/**
+ * Индекс доли трекера с первой сильной долей (qm-dsp DownBeat по сигналу,
+ * прорежённому в \a decimation раз) или −1. \a timesig — из trackerBeatsPerBar.
+ */
+inline int firstDownbeat(const float* decimated, std::size_t decimatedCount, const std::int64_t* beats,
+                         std::size_t count, int sampleRate, int decimation, int timesig)
+{
+    if (!decimated || decimatedCount == 0 || timesig < 2 || sampleRate <= 0 || decimation <= 0) {
+        return -1;
+    }
+    // Позиции долей — в шагах прореживания (шаг функции DownBeat = decimation)
+    std::vector<double> beatFrames;
+    beatFrames.reserve(count);
+    for (std::size_t i = 0; i < count; ++i) {
+        beatFrames.push_back(double(beats[i]) / decimation);
+    }
+    DownBeat downBeat(float(sampleRate), decimation, decimation);
+    downBeat.setBeatsPerBar(timesig);
+    std::vector<int> downbeats;
+    downBeat.findDownBeats(decimated, decimatedCount, beatFrames, downbeats);
+    if (downbeats.empty() || downbeats.front() < 0 || std::size_t(downbeats.front()) >= count) {
+        return -1;
+    }
+    return downbeats.front();
+}
+#endif
+
+} // namespace BeatGridFit
+
+#endif // BEATGRIDFIT_H
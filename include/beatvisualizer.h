@@ -11,6 +11,7 @@
 #include <QSet>
 #include <memory>
 #include "bpmanalyzer.h"
+#include "deviationmodel.h"
 
 // Forward declaration для Essentia интеграции
 namespace essentia {
@@ -157,12 +158,11 @@ public:
                               int startSample,
                               const VisualizationSettings& settings);
 
-    // Новые методы для отклонений долей
+    // Новые методы для отклонений долей. Доли и их линии сетки — из модели
+    // волны (WaveformView::getDeviationModel), сдвиг сетки виден сразу
     static void drawBeatDeviations(QPainter& painter,
-                                   const QVector<BPMAnalyzer::BeatInfo>& beats,
+                                   const DeviationModel& deviations,
                                    const QRectF& rect,
-                                   float bpm,
-                                   int sampleRate,
                                    float samplesPerPixel,
                                    int startSample,
                                    const VisualizationSettings& settings,
@@ -178,6 +178,7 @@ public:
                                 const VisualizationSettings& settings);
 
     // Вспомогательные методы
+    /** Средний амплитудный спектр (окно Ханна, перекрытие 50%), nextPow2(windowSize)/2+1 бинов. */
     static QVector<float> calculateFrequencySpectrum(const QVector<float>& samples,
                                                      int sampleRate,
                                                      int windowSize = 1024);
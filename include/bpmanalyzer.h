@@ -3,12 +3,17 @@
 
 #include <QtCore/QVector>
 #include <QtCore/QPair>
+#include <atomic>
+#include <functional>
 #include <memory>
 #include <vector>
 
+#include "tempomap.h"
+
 // Forward declarations for Mixxx integration
 class DetectionFunction;
 class TempoTrackV2;
+class OnsetStream;
 
 class BPMAnalyzer
 {
@@ -31,6 +36,13 @@ public:
         qint64 gridStartSample = 0;    // Опорная позиция сетки (первая доля)
         float preliminaryBPM = 0.0f;   // Предварительный BPM (например, базовый из Mixxx до гармоник)
         bool hasPreliminaryBPM = false; // Признак наличия предварительного BPM
+        // Карта темпа по найденным долям (см. buildTempoMap). Для ровного темпа —
+        // один сегмент с bpm и gridStartSample; isVariable() — темп плывёт
+        TempoMap tempoMap;
+        // Сильная доля (qm-dsp DownBeat): сколько долей сетки от gridStartSample
+        // до начала первого такта, 0..длина такта-1. 0 — такт начинается с
+        // gridStartSample (или сильную долю найти не удалось). См. barStartSample
+        int barPhase = 0;
     };
 
     // Настройки поиска неровных долей (см. calculateDeviations)
@@ -87,6 +99,15 @@ public:
         bool useInitialBPM;      // Использовать ли предварительно определенный BPM
         float fileBPM;           // BPM из метаданных файла
         bool trustFileBPM;       // Доверять ли BPM из метаданных файла
+        int beatsPerBar;         // Размер такта для поиска сильной доли (как KeyAnalyzer::BarGrid)
+        // Прогресс анализа 0..100 — из потока анализа, по кадрам onset-функции
+        // и этапам TempoTrackV2
+        std::function<void(int)> onProgress;
+        // Флаг отмены, проверяется там же: отменённый анализ возвращает пустой результат
+        const std::atomic<bool>* cancel;
+        // Потоков на анализ: 0 — по числу ядер. Пакетный анализ, где ядра уже
+        // заняты другими файлами, даёт 1
+        int maxThreads;
 
         AnalysisOptions()
             : assumeFixedTempo(true)
@@ -99,6 +120,9 @@ public:
             , useInitialBPM(false)
             , fileBPM(0.0f)
             , trustFileBPM(false)
+            , beatsPerBar(4)
+            , cancel(nullptr)
+            , maxThreads(0)
         {}
     };
 
@@ -116,6 +140,12 @@ public:
                                               float bpm,
                                               int sampleRate,
                                               const DeviationOptions& options);
+    // То же по карте переменного темпа: каждая доля сопоставляется ближайшей
+    // целой доле карты, отклонение — в долях интервала своего сегмента.
+    // gridBPM в статистике — темп на опорной линии (доля 0).
+    static DeviationStats calculateDeviations(QVector<BeatInfo>& beats,
+                                              const TempoMap& tempoMap,
+                                              int sampleRate);
 
     // Индексы долей с |deviation| строго больше порога. Доли с confidence ниже
     // minConfidence и с нечисловым deviation пропускаются.
@@ -137,10 +167,35 @@ public:
     static AnalysisResult analyzeBPMUsingMixxx(const QVector<float>& samples,
                                               int sampleRate,
                                               const AnalysisOptions& options);
+    // То же по onset-функции, набранной при декодировании (см. OnsetStream):
+    // сигнал целиком не нужен, после декодирования остаётся только TempoTrackV2
+    static AnalysisResult analyzeOnsetStream(const OnsetStream& stream,
+                                             const AnalysisOptions& options = AnalysisOptions());
+
+    // Карта темпа по долям результата: сегменты постоянного темпа по долям
+    // TempoTrackV2, доли пронумерованы от gridStartSample в единицах bpm (с учётом
+    // выбранной гармоники). Темп не меняется — карта постоянная по bpm.
+    static TempoMap buildTempoMap(const AnalysisResult& result, int sampleRate);
+
+    // Начало первого такта: gridStartSample, сдвинутый на barPhase долей (по
+    // карте темпа). От него считают такты KeyAnalyzer::BarGrid, номера тактов
+    // на волне и метки — сетку больше не нужно сдвигать на доли вручную.
+    static qint64 barStartSample(const AnalysisResult& result, int sampleRate);
+
+    // Номер доли сетки (от gridStartSample) первой сильной доли: DownBeat по
+    // прорежённому сигналу (OnsetStream::decimated) и долям result. Нужны bpm и
+    // карта темпа результата. Так же, как при анализе с options.beatsPerBar, —
+    // размер такта можно сменить без повторного анализа. Без qm-dsp — 0
+    static int findBarPhase(const QVector<float>& decimated,
+                            int sampleRate,
+                            const AnalysisResult& result,
+                            int beatsPerBar);
 
 private:
     // Улучшенные методы анализа
-    static QVector<QPair<int, float>> detectPeaks(const QVector<float>& samples,
+    // Пики огибающей энергии (см. beatEnergyEnvelope) на участке из count сэмплов
+    static QVector<QPair<int, float>> detectPeaks(const float* energy,
+                                                int count,
                                                 float minEnergy = 0.1f);
 
     static float calculateAverageInterval(const QVector<QPair<int, float>>& peaks,
@@ -151,28 +206,47 @@ private:
                            int sampleRate,
                            const AnalysisOptions& options);
 
-    static QVector<BeatInfo> findBeats(const QVector<float>& samples,
+    // Доли по огибающей энергии участка из count сэмплов
+    static QVector<BeatInfo> findBeats(const float* energy,
+                                    int count,
                                     float bpm,
                                     int sampleRate,
                                     const AnalysisOptions& options);
 
-    // Новые вспомогательные методы
-    static float calculateBeatEnergy(const QVector<float>& samples,
-                                  int position,
-                                  int windowSize);
+    // Огибающая энергии: RMS в окне 1024 сэмпла вокруг каждого сэмпла.
+    // Считается один раз на анализ, по ней работают detectPeaks и findBeats.
+    // maxThreads — как в AnalysisOptions
+    static QVector<float> beatEnergyEnvelope(const QVector<float>& samples, int maxThreads = 0);
 
     static bool isValidBPM(float bpm, const AnalysisOptions& options);
 
     static float normalizeConfidence(float rawConfidence);
 
     // Вспомогательные методы для Mixxx интеграции
+    // Прогресс onset-функции идёт в options.onProgress от 0 до progressTo;
+    // decimated — тот же сигнал, прорежённый для DownBeat (OnsetStream::decimated)
     static QVector<double> detectOnsets(const QVector<float>& samples,
                                        int sampleRate,
                                        int& stepSize,
-                                       int& windowSize);
+                                       int& windowSize,
+                                       const AnalysisOptions& options,
+                                       int progressTo,
+                                       QVector<float>* decimated = nullptr);
+    // progressFrom — сколько процентов анализа уже пройдено до TempoTrackV2;
+    // по decimated (если не пуст) ищется сильная доля
+    static AnalysisResult analyzeDetectionFunction(const QVector<double>& detectionFunction,
+                                                   int sampleRate,
+                                                   int stepSize,
+                                                   const AnalysisOptions& options,
+                                                   int progressFrom = 0,
+                                                   const QVector<float>& decimated = QVector<float>());
+    // Прогресс этапов TempoTrackV2 — от progressFrom до progressTo
     static QVector<BeatInfo> trackBeats(const QVector<double>& detectionFunction,
                                        int sampleRate,
-                                       int stepSize);
+                                       int stepSize,
+                                       const AnalysisOptions& options,
+                                       int progressFrom,
+                                       int progressTo);
 };
 
 #endif // BPMANALYZER_H
@@ -0,0 +1,111 @@
+#ifndef DEVIATIONMODEL_H
+#define DEVIATIONMODEL_H
+
+/**
+ * @brief Отклонения долей от сетки, пересчитываемые на месте при сдвиге сетки.
+ *
+ * Раньше calculateDeviations каждый раз заново раскладывал доли по сетке,
+ * копировал остатки в новые векторы для медианы и прогонял регрессию темпа,
+ * а стрелки «сдвинуть сетку» и перетаскивание сетки вызывали его на каждый
+ * шаг. На 2000-дольном DJ-миксе сдвиг сетки стрелками заметно подтормаживал.
+ *
+ * Модель держит доли в виде структуры массивов (позиции, номера линий сетки,
+ * ожидаемые позиции, отклонения — по отдельному массиву double), буферы
+ * выделяются один раз в setBeats(). Ожидаемые позиции, отклонения и суммы
+ * статистики (|d|, d², max|d|) считает SIMD-ядро (см. DFEngine::SimdKernel),
+ * медиана — nth_element по заранее выделенному буферу.
+ *
+ * shiftGrid() — сдвиг сетки без смены темпа: O(долей) и без выделений памяти.
+ * Номера линий сетки при этом переназначаются (доля могла перейти к соседней
+ * линии), так что результат совпадает с полным evaluate() по сдвинутой сетке.
+ */
+
+#include <QtCore/QVector>
+#include <QtCore/QtGlobal>
+#include <vector>
+
+#include "bpmanalyzer.h"
+#include "fft_engine.h"
+#include "tempomap.h"
+
+class DeviationModel
+{
+public:
+    explicit DeviationModel(DFEngine::SimdKernel kernel = DFEngine::bestSimdKernel());
+
+    /** Позиции долей (буферы переразмечаются только при смене числа долей). */
+    void setBeats(const QVector<BPMAnalyzer::BeatInfo>& beats);
+    void clear();
+
+    int size() const { return int(position_.size()); }
+    bool isEmpty() const { return position_.empty(); }
+    /** Посчитаны ли отклонения после последнего setBeats(). */
+    bool isEvaluated() const { return evaluated_; }
+
+    /**
+     * Раскладка долей по сетке BPM — как BPMAnalyzer::calculateDeviations:
+     * фаза по медиане остатков, если опорная линия не задана, и уточнение
+     * интервала регрессией при refineTempo.
+     */
+    const BPMAnalyzer::DeviationStats& evaluate(float bpm, int sampleRate,
+                                                const BPMAnalyzer::DeviationOptions& options);
+    /** То же по карте переменного темпа (см. BPMAnalyzer::calculateDeviations). */
+    const BPMAnalyzer::DeviationStats& evaluate(const TempoMap& tempoMap, int sampleRate);
+
+    /**
+     * Сетка сдвинута на \a sampleDelta сэмплов, темп прежний. Без выделений;
+     * до первого evaluate() ничего не делает.
+     */
+    const BPMAnalyzer::DeviationStats& shiftGrid(double sampleDelta);
+
+    const BPMAnalyzer::DeviationStats& stats() const { return stats_; }
+
+    // Покадровые данные для отрисовки (size() элементов, после evaluate)
+    const double* positions() const { return position_.data(); }
+    const double* expectedPositions() const { return expected_.data(); }
+    /** Отклонение доли в долях интервала сетки. */
+    const double* deviations() const { return deviation_.data(); }
+    /** Отклонение доли от своей линии сетки в сэмплах. */
+    double deltaSamples(int index) const
+    {
+        return position_[size_t(index)] - expected_[size_t(index)];
+    }
+
+    /** Заполняет BeatInfo::expectedPosition и BeatInfo::deviation (доли — те же, что в setBeats). */
+    void writeTo(QVector<BPMAnalyzer::BeatInfo>& beats) const;
+
+private:
+    using ResidualsKernel = void (*)(const double* position, const double* gridIndex, qint64 count,
+                                     double origin, double interval,
+                                     double* expected, double* deviation);
+    using ReduceKernel = void (*)(const double* deviation, qint64 count,
+                                  double& sumAbs, double& sumSquares, double& maxAbs);
+
+    void assignGridIndices();
+    void fillResiduals();
+    double medianOfScratch();
+    void refineInterval(double nominalInterval, float maxTempoCorrection);
+    void evaluateTempoMap();
+    void finish();
+
+    ResidualsKernel residualsKernel_;
+    ReduceKernel reduceKernel_;
+
+    // Структура массивов: по одному элементу на долю
+    std::vector<double> position_;
+    std::vector<double> gridIndex_;
+    std::vector<double> expected_;
+    std::vector<double> deviation_;
+    std::vector<double> scratch_;   // остатки и |отклонения| для медианы
+
+    double origin_ = 0.0;           // опорная линия сетки (доля 0)
+    double interval_ = 0.0;         // интервал сетки в сэмплах
+    int sampleRate_ = 0;
+    bool snapToNearestGrid_ = true;
+    bool useTempoMap_ = false;
+    TempoMap tempoMap_;
+    bool evaluated_ = false;
+    BPMAnalyzer::DeviationStats stats_;
+};
+
+#endif // DEVIATIONMODEL_H
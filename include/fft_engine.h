@@ -1,9 +1,11 @@
 /**
  * fft_engine.h — самодостаточный Cooley-Tukey FFT для спектрограммы DONTFLOAT.
+ * Вещественный FFT идёт через план (FFTPlan) с готовыми таблицами и
+ * SIMD-бабочками (AVX2/SSE2/NEON), ядро выбирается по CPU при запуске.
  * Алгоритм оконных функций адаптирован из LMMS fft_helpers.cpp
  * (Copyright (c) 2008-2012 Tobias Doerffel, 2019 Martin Pavelek, GPL-2).
  *
- * Требования: C++17, <cmath>, <complex>, <vector>, <algorithm>
+ * Требования: C++17, <cmath>, <complex>, <vector>, <algorithm>, <map>, <mutex>
  */
 
 #ifndef FFT_ENGINE_H
@@ -13,6 +15,9 @@
 #include <complex>
 #include <vector>
 #include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
 
 namespace DFEngine {
 
@@ -61,7 +66,212 @@ inline void precomputeWindow(std::vector<float>& w, unsigned length,
     }
 }
 
-// ─── Cooley-Tukey FFT (radix-2 in-place DIT) ─────────────────────────────────
+// ─── SIMD-ядра бабочек ───────────────────────────────────────────────────────
+/// Набор инструкций для бабочек FFT. Выбирается один раз при запуске по CPU.
+enum class SimdKernel {
+    Scalar = 0,
+    Sse2,
+    Avx2,     // AVX2 + FMA, x86-64
+    Neon      // AArch64 / ARMv7 с NEON
+};
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__) \
+    || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DFENGINE_HAS_X86_SIMD 1
+#endif
+#if defined(__aarch64__) || defined(_M_ARM64) || defined(__ARM_NEON)
+#define DFENGINE_HAS_NEON 1
+#endif
+
+// GCC/Clang компилируют AVX2-ядро отдельно от остального файла (target),
+// MSVC пускает интринсики без флагов. Вызывается только после проверки CPU.
+#if defined(DFENGINE_HAS_X86_SIMD) && (defined(__GNUC__) || defined(__clang__))
+#define DFENGINE_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#else
+#define DFENGINE_TARGET_AVX2
+#endif
+
+} // namespace DFEngine
+
+#if defined(DFENGINE_HAS_X86_SIMD)
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+#endif
+#if defined(DFENGINE_HAS_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace DFEngine {
+
+namespace detail {
+
+/// Одна стадия radix-2 DIT: блоки по 2*half, tw — half поворотных множителей.
+using ButterflyStage = void (*)(Complex* data, unsigned n, unsigned half, const Complex* tw);
+
+// std::complex::operator* проверяет NaN/Inf и без -ffast-math уходит в
+// __mulsc3 — на горячем пути умножаем руками
+inline Complex complexMul(Complex a, Complex b)
+{
+    return Complex(a.real() * b.real() - a.imag() * b.imag(),
+                   a.real() * b.imag() + a.imag() * b.real());
+}
+
+inline void butterflyStageScalar(Complex* data, unsigned n, unsigned half, const Complex* tw)
+{
+    for (unsigned i = 0; i < n; i += 2 * half) {
+        Complex* lo = data + i;
+        Complex* hi = lo + half;
+        for (unsigned j = 0; j < half; ++j) {
+            const Complex u = lo[j];
+            const Complex v = complexMul(hi[j], tw[j]);
+            lo[j] = u + v;
+            hi[j] = u - v;
+        }
+    }
+}
+
+#if defined(DFENGINE_HAS_X86_SIMD)
+/// Два комплексных числа в __m128 (re0, im0, re1, im1); нужна стадия с half >= 2.
+inline void butterflyStageSse2(Complex* data, unsigned n, unsigned half, const Complex* tw)
+{
+    // Знак для вещественных дорожек: re = vr*wr - vi*wi
+    const __m128 negReal = _mm_castsi128_ps(_mm_set_epi32(0, int(0x80000000u), 0, int(0x80000000u)));
+    for (unsigned i = 0; i < n; i += 2 * half) {
+        float* lo = reinterpret_cast<float*>(data + i);
+        float* hi = reinterpret_cast<float*>(data + i + half);
+        const float* w = reinterpret_cast<const float*>(tw);
+        for (unsigned j = 0; j < half * 2; j += 4) {
+            const __m128 wv = _mm_loadu_ps(w + j);
+            const __m128 v = _mm_loadu_ps(hi + j);
+            const __m128 wr = _mm_shuffle_ps(wv, wv, _MM_SHUFFLE(2, 2, 0, 0));
+            const __m128 wi = _mm_shuffle_ps(wv, wv, _MM_SHUFFLE(3, 3, 1, 1));
+            const __m128 vs = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1));
+            const __m128 prod = _mm_add_ps(_mm_mul_ps(v, wr),
+                                           _mm_xor_ps(_mm_mul_ps(vs, wi), negReal));
+            const __m128 u = _mm_loadu_ps(lo + j);
+            _mm_storeu_ps(lo + j, _mm_add_ps(u, prod));
+            _mm_storeu_ps(hi + j, _mm_sub_ps(u, prod));
+        }
+    }
+}
+
+/// Четыре комплексных числа в __m256; нужна стадия с half >= 4.
+DFENGINE_TARGET_AVX2
+inline void butterflyStageAvx2(Complex* data, unsigned n, unsigned half, const Complex* tw)
+{
+    for (unsigned i = 0; i < n; i += 2 * half) {
+        float* lo = reinterpret_cast<float*>(data + i);
+        float* hi = reinterpret_cast<float*>(data + i + half);
+        const float* w = reinterpret_cast<const float*>(tw);
+        for (unsigned j = 0; j < half * 2; j += 8) {
+            const __m256 wv = _mm256_loadu_ps(w + j);
+            const __m256 v = _mm256_loadu_ps(hi + j);
+            const __m256 wr = _mm256_moveldup_ps(wv);
+            const __m256 wi = _mm256_movehdup_ps(wv);
+            const __m256 vs = _mm256_permute_ps(v, 0xB1);
+            // чётные дорожки: vr*wr - vi*wi, нечётные: vi*wr + vr*wi
+            const __m256 prod = _mm256_fmaddsub_ps(v, wr, _mm256_mul_ps(vs, wi));
+            const __m256 u = _mm256_loadu_ps(lo + j);
+            _mm256_storeu_ps(lo + j, _mm256_add_ps(u, prod));
+            _mm256_storeu_ps(hi + j, _mm256_sub_ps(u, prod));
+        }
+    }
+}
+#endif
+
+#if defined(DFENGINE_HAS_NEON)
+/// vld2q раскладывает по re/im: четыре комплексных числа, стадия с half >= 4.
+inline void butterflyStageNeon(Complex* data, unsigned n, unsigned half, const Complex* tw)
+{
+    for (unsigned i = 0; i < n; i += 2 * half) {
+        float* lo = reinterpret_cast<float*>(data + i);
+        float* hi = reinterpret_cast<float*>(data + i + half);
+        const float* w = reinterpret_cast<const float*>(tw);
+        for (unsigned j = 0; j < half * 2; j += 8) {
+            const float32x4x2_t wv = vld2q_f32(w + j);
+            const float32x4x2_t v = vld2q_f32(hi + j);
+            const float32x4_t pr = vmlsq_f32(vmulq_f32(v.val[0], wv.val[0]), v.val[1], wv.val[1]);
+            const float32x4_t pi = vmlaq_f32(vmulq_f32(v.val[0], wv.val[1]), v.val[1], wv.val[0]);
+            const float32x4x2_t u = vld2q_f32(lo + j);
+            float32x4x2_t outLo;
+            float32x4x2_t outHi;
+            outLo.val[0] = vaddq_f32(u.val[0], pr);
+            outLo.val[1] = vaddq_f32(u.val[1], pi);
+            outHi.val[0] = vsubq_f32(u.val[0], pr);
+            outHi.val[1] = vsubq_f32(u.val[1], pi);
+            vst2q_f32(lo + j, outLo);
+            vst2q_f32(hi + j, outHi);
+        }
+    }
+}
+#endif
+
+inline bool cpuHasAvx2Fma()
+{
+#if defined(DFENGINE_HAS_X86_SIMD)
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4] = {};
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return false;
+    }
+    __cpuid(info, 1);
+    const bool fma = (info[2] & (1 << 12)) != 0;
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    __cpuidex(info, 7, 0);
+    const bool avx2 = (info[1] & (1 << 5)) != 0;
+    // ОС должна сохранять регистры YMM при переключении потоков
+    return fma && avx2 && osxsave && (_xgetbv(0) & 0x6) == 0x6;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+#else
+    return false;
+#endif
+}
+
+} // namespace detail
+
+/// Поддерживает ли текущий CPU ядро \a kernel (Scalar есть всегда).
+inline bool isSimdKernelSupported(SimdKernel kernel)
+{
+    switch (kernel) {
+    case SimdKernel::Scalar:
+        return true;
+    case SimdKernel::Sse2:
+#if defined(DFENGINE_HAS_X86_SIMD)
+        return true;
+#else
+        return false;
+#endif
+    case SimdKernel::Avx2:
+        return detail::cpuHasAvx2Fma();
+    case SimdKernel::Neon:
+#if defined(DFENGINE_HAS_NEON)
+        return true;
+#else
+        return false;
+#endif
+    }
+    return false;
+}
+
+/// Лучшее ядро для этого CPU; определяется один раз за процесс.
+inline SimdKernel bestSimdKernel()
+{
+    static const SimdKernel best = []() {
+        if (isSimdKernelSupported(SimdKernel::Avx2)) return SimdKernel::Avx2;
+        if (isSimdKernelSupported(SimdKernel::Neon)) return SimdKernel::Neon;
+        if (isSimdKernelSupported(SimdKernel::Sse2)) return SimdKernel::Sse2;
+        return SimdKernel::Scalar;
+    }();
+    return best;
+}
+
+// ─── План FFT ────────────────────────────────────────────────────────────────
 /// Возвращает наименьшую степень 2, >= n.
 inline unsigned nextPow2(unsigned n)
 {
@@ -71,35 +281,203 @@ inline unsigned nextPow2(unsigned n)
     return n + 1;
 }
 
-/// In-place FFT (DIT). `buf` должен иметь размер степени 2.
-inline void fft(std::vector<Complex>& buf)
+/**
+ * План вещественного FFT фиксированного размера (степень 2).
+ *
+ * Всё, что зависит только от размера, считается один раз в конструкторе:
+ * таблица бит-реверса, поворотные множители каждой стадии (в double, без
+ * накопления ошибки `w *= wlen`) и множители «распаковки» спектра.
+ * Вещественный сигнал длины N упаковывается в комплексный длины N/2
+ * (чётные отсчёты — re, нечётные — im), так что сама бабочка вдвое короче.
+ *
+ * План неизменяем после создания: один экземпляр можно звать из многих
+ * потоков одновременно, у каждого вызова свой выходной буфер.
+ */
+class FFTPlan
 {
-    const unsigned N = static_cast<unsigned>(buf.size());
-    if (N < 2) return;
+public:
+    explicit FFTPlan(unsigned size, SimdKernel kernel = bestSimdKernel())
+        : size_(std::max(2u, nextPow2(size)))
+        , complexSize_(size_ / 2)
+        , kernel_(isSimdKernelSupported(kernel) ? kernel : SimdKernel::Scalar)
+    {
+        const unsigned m = complexSize_;
+        unsigned bits = 0;
+        while ((1u << bits) < m) ++bits;
+
+        bitReverse_.resize(m);
+        for (unsigned i = 0; i < m; ++i) {
+            unsigned r = 0;
+            for (unsigned b = 0; b < bits; ++b) {
+                r |= ((i >> b) & 1u) << (bits - 1 - b);
+            }
+            bitReverse_[i] = r;
+        }
 
-    // bit-reversal permutation
-    for (unsigned i = 1, j = 0; i < N; ++i) {
-        unsigned bit = N >> 1;
-        for (; j & bit; bit >>= 1) j ^= bit;
-        j ^= bit;
-        if (i < j) std::swap(buf[i], buf[j]);
-    }
-
-    // butterfly stages
-    for (unsigned len = 2; len <= N; len <<= 1) {
-        float angle = -6.28318530717958647692f / float(len);
-        Complex wlen(std::cos(angle), std::sin(angle));
-        for (unsigned i = 0; i < N; i += len) {
-            Complex w(1.f, 0.f);
-            for (unsigned j = 0; j < len / 2; ++j) {
-                Complex u = buf[i + j];
-                Complex v = buf[i + j + len/2] * w;
-                buf[i + j]           = u + v;
-                buf[i + j + len / 2] = u - v;
-                w *= wlen;
+        // Стадия с половиной блока half лежит с отступа half-1: 1+2+4+... = m-1
+        constexpr double pi2 = 6.28318530717958647692;
+        twiddles_.resize(m > 1 ? m - 1 : 0);
+        for (unsigned half = 1; half < m; half <<= 1) {
+            Complex* tw = twiddles_.data() + half - 1;
+            for (unsigned j = 0; j < half; ++j) {
+                const double angle = -pi2 * double(j) / double(2 * half);
+                tw[j] = Complex(float(std::cos(angle)), float(std::sin(angle)));
             }
         }
+
+        realTwiddles_.resize(m / 2 + 1);
+        for (unsigned k = 0; k <= m / 2; ++k) {
+            const double angle = -pi2 * double(k) / double(size_);
+            realTwiddles_[k] = Complex(float(std::cos(angle)), float(std::sin(angle)));
+        }
+
+        switch (kernel_) {
+#if defined(DFENGINE_HAS_X86_SIMD)
+        case SimdKernel::Sse2:
+            simdStage_ = detail::butterflyStageSse2;
+            simdMinHalf_ = 2;
+            break;
+        case SimdKernel::Avx2:
+            simdStage_ = detail::butterflyStageAvx2;
+            simdMinHalf_ = 4;
+            break;
+#endif
+#if defined(DFENGINE_HAS_NEON)
+        case SimdKernel::Neon:
+            simdStage_ = detail::butterflyStageNeon;
+            simdMinHalf_ = 4;
+            break;
+#endif
+        default:
+            break;
+        }
+    }
+
+    /// Общий план для размера \a size: строится при первом запросе и живёт до конца процесса.
+    static const FFTPlan& forSize(unsigned size)
+    {
+        static std::mutex mutex;
+        static std::map<unsigned, std::unique_ptr<FFTPlan>> plans;
+        const unsigned key = std::max(2u, nextPow2(size));
+        std::lock_guard<std::mutex> lock(mutex);
+        std::unique_ptr<FFTPlan>& plan = plans[key];
+        if (!plan) {
+            plan = std::make_unique<FFTPlan>(key);
+        }
+        return *plan;
     }
+
+    unsigned size() const { return size_; }
+    unsigned binCount() const { return size_ / 2 + 1; }
+    SimdKernel kernel() const { return kernel_; }
+
+    /**
+     * Спектр вещественного сигнала.
+     *
+     * @param samples  входные отсчёты; берутся первые min(count, size()),
+     *                 остаток блока дополняется нулями
+     * @param window   окно длиной >= count или nullptr (прямоугольное)
+     * @param spectrum выход, binCount() комплексных бинов
+     */
+    void forward(const float* samples, unsigned count, const float* window,
+                 Complex* spectrum) const
+    {
+        const unsigned m = complexSize_;
+        count = std::min(count, size_);
+
+        // Упаковка сразу в бит-реверсном порядке: отдельной перестановки нет
+        for (unsigned n = 0; n < m; ++n) {
+            const unsigned i0 = 2 * n;
+            const unsigned i1 = i0 + 1;
+            float re = 0.f;
+            float im = 0.f;
+            if (i0 < count) re = window ? samples[i0] * window[i0] : samples[i0];
+            if (i1 < count) im = window ? samples[i1] * window[i1] : samples[i1];
+            spectrum[bitReverse_[n]] = Complex(re, im);
+        }
+
+        runStages(spectrum);
+
+        // Распаковка: X[k] = E[k] + W^k·O[k], X[m-k] = conj(E[k] - W^k·O[k])
+        const Complex z0 = spectrum[0];
+        spectrum[0] = Complex(z0.real() + z0.imag(), 0.f);
+        spectrum[m] = Complex(z0.real() - z0.imag(), 0.f);
+        for (unsigned k = 1; k <= m / 2; ++k) {
+            const Complex a = spectrum[k];
+            const Complex b = std::conj(spectrum[m - k]);
+            const Complex even = (a + b) * 0.5f;
+            const Complex diff = (a - b) * 0.5f;
+            const Complex odd(diff.imag(), -diff.real());  // diff / i
+            const Complex rotated = detail::complexMul(realTwiddles_[k], odd);
+            spectrum[k] = even + rotated;
+            spectrum[m - k] = std::conj(even - rotated);
+        }
+    }
+
+    /// Амплитуды |X[k]|, binCount() значений. \a scratch переиспользуется между вызовами.
+    void magnitudes(const float* samples, unsigned count, const float* window,
+                    std::vector<float>& magnitudesOut, std::vector<Complex>& scratch) const
+    {
+        const unsigned bins = binCount();
+        scratch.resize(bins);
+        forward(samples, count, window, scratch.data());
+        magnitudesOut.resize(bins);
+        for (unsigned k = 0; k < bins; ++k) {
+            const float re = scratch[k].real();
+            const float im = scratch[k].imag();
+            magnitudesOut[k] = std::sqrt(re * re + im * im);
+        }
+    }
+
+    /// Комплексный FFT длины size()/2 на месте (прямой порядок на входе и выходе).
+    unsigned complexSize() const { return complexSize_; }
+    void complexForward(Complex* data) const
+    {
+        for (unsigned i = 0; i < complexSize_; ++i) {
+            const unsigned j = bitReverse_[i];
+            if (i < j) std::swap(data[i], data[j]);
+        }
+        runStages(data);
+    }
+
+private:
+    void runStages(Complex* data) const
+    {
+        const unsigned m = complexSize_;
+        // Первая стадия: множитель 1, умножать нечего
+        for (unsigned i = 0; i + 1 < m; i += 2) {
+            const Complex u = data[i];
+            const Complex v = data[i + 1];
+            data[i] = u + v;
+            data[i + 1] = u - v;
+        }
+        for (unsigned half = 2; half < m; half <<= 1) {
+            const Complex* tw = twiddles_.data() + half - 1;
+            if (simdStage_ && half >= simdMinHalf_) {
+                simdStage_(data, m, half, tw);
+            } else {
+                detail::butterflyStageScalar(data, m, half, tw);
+            }
+        }
+    }
+
+    unsigned size_;
+    unsigned complexSize_;
+    SimdKernel kernel_;
+    std::vector<unsigned> bitReverse_;
+    std::vector<Complex> twiddles_;
+    std::vector<Complex> realTwiddles_;
+    detail::ButterflyStage simdStage_ = nullptr;
+    unsigned simdMinHalf_ = 0;
+};
+
+// ─── Совместимые обёртки ─────────────────────────────────────────────────────
+/// In-place комплексный FFT. `buf` должен иметь размер степени 2.
+inline void fft(std::vector<Complex>& buf)
+{
+    const unsigned N = static_cast<unsigned>(buf.size());
+    if (N < 2) return;
+    FFTPlan::forSize(N * 2).complexForward(buf.data());
 }
 
 // ─── Real-FFT удобная обёртка ────────────────────────────────────────────────
@@ -111,26 +489,30 @@ inline void fft(std::vector<Complex>& buf)
  * @param window       предвычисленное окно (size == count)
  * @param zeroPadFactor zero-padding: итоговый FFT-блок = nextPow2(count) * zeroPadFactor
  * @param magnitudes   выходной массив амплитуд, size = fftSize/2+1
+ *
+ * В цикле по кадрам лучше взять FFTPlan::forSize() один раз и звать
+ * FFTPlan::magnitudes() напрямую; здесь план и буфер берутся из кеша потока.
  */
 inline void realFFT(const float* samples, unsigned count,
                     const std::vector<float>& window,
                     unsigned zeroPadFactor,
                     std::vector<float>& magnitudes)
 {
-    const unsigned fftSize = nextPow2(count) * zeroPadFactor;
+    const unsigned fftSize = nextPow2(count) * std::max(1u, zeroPadFactor);
 
-    std::vector<Complex> buf(fftSize, Complex(0.f, 0.f));
-    for (unsigned i = 0; i < count && i < fftSize; ++i) {
-        float w = (i < window.size()) ? window[i] : 1.f;
-        buf[i] = Complex(samples[i] * w, 0.f);
+    thread_local const FFTPlan* plan = nullptr;
+    thread_local std::vector<Complex> scratch;
+    if (!plan || plan->size() != fftSize) {
+        plan = &FFTPlan::forSize(fftSize);
     }
 
-    fft(buf);
-
-    const unsigned binCount = fftSize / 2 + 1;
-    magnitudes.resize(binCount);
-    for (unsigned k = 0; k < binCount; ++k) {
-        magnitudes[k] = std::abs(buf[k]);
+    // Окно короче блока — хвост без оконного множителя, как раньше
+    if (window.size() >= count) {
+        plan->magnitudes(samples, count, window.data(), magnitudes, scratch);
+    } else {
+        std::vector<float> fullWindow(count, 1.f);
+        std::copy(window.begin(), window.end(), fullWindow.begin());
+        plan->magnitudes(samples, count, fullWindow.data(), magnitudes, scratch);
     }
 }
 
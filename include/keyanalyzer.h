@@ -3,8 +3,11 @@
 
 #include <QVector>
 #include <QString>
+#include <complex>
 #include <memory>
 
+#include "fft_engine.h"
+
 // Forward declarations for qm-dsp integration
 class GetKeyMode;
 class Chromagram;
@@ -47,25 +50,30 @@ public:
 
     struct AnalysisOptions {
         float tuningFrequency;   // Частота настройки (обычно 440 Гц)
-        int frameSize;          // Размер кадра для анализа
-        int hopSize;            // Размер шага между кадрами
+        int frameSize;          // Окно покадровой тональности (сэмплы, кратно кадру хромы)
+        int hopSize;            // Шаг между окнами (сэмплы)
         bool detectKeyChanges;  // Определять ли смены тональности
-        float keyChangeThreshold; // Порог для определения смены тональности
+        float keyChangeThreshold; // Порог смены тональности между кадрами (путь qm-dsp)
+        float keyChangePenalty; // Цена смены тональности при сглаживании (в единицах корреляции с профилем)
+        int maxThreads;         // Потоков на кадры хромы (0 — по числу ядер)
 
         AnalysisOptions() 
             : tuningFrequency(440.0f)
-            , frameSize(4096)
-            , hopSize(2048)
+            , frameSize(131072)  // ~3 с при 44.1 кГц: на таком окне тональность уже слышна
+            , hopSize(65536)
             , detectKeyChanges(true)
             , keyChangeThreshold(0.3f)
+            , keyChangePenalty(0.5f)
+            , maxThreads(0)
         {}
     };
 
+    /// Тональность трека: computeChromaFrames и analyzeKey по кадрам.
     static AnalysisResult analyzeKey(const QVector<float>& samples, 
                                    int sampleRate,
                                    const AnalysisOptions& options = AnalysisOptions());
     
-    // Методы интеграции с qm-dsp
+    // Методы интеграции с qm-dsp (GetKeyMode; в analyzeKey не участвует)
     static AnalysisResult analyzeKeyUsingQM(const QVector<float>& samples, 
                                           int sampleRate,
                                           const AnalysisOptions& options);
@@ -103,14 +111,63 @@ public:
         bool hasModulation = false;         // обнаружено больше одной тональности
     };
 
+    /// Хрома всего трека по кадрам фиксированного шага — считается один раз на звук.
+    /// Хранит префиксные суммы комплексных откликов резонаторов Гёрцеля
+    /// (MIDI 36..95) в общей фазе трека: отклик любого отрезка — разность двух
+    /// префиксов, и хрома такта совпадает с computeChromaGoertzel по его сэмплам
+    /// с точностью до границы кадра. Смена сетки или размера такта — только
+    /// пересчёт сумм (analyzeKeyPerBar по кадрам), без прохода по звуку.
+    struct ChromaFrames {
+        static constexpr int kBinCount = 60;
+
+        int sampleRate = 0;
+        qint64 sampleCount = 0;
+        int hopSamples = 0;
+        int frameCount = 0;
+        /// Класс высоты (0..11) каждого резонатора; −1 — выше Найквиста, не считается.
+        QVector<int> binPitchClass;
+        /// (frameCount + 1) × kBinCount: [f * kBinCount + b] — сумма кадров [0, f).
+        /// В double: отклик отрезка — разность сумм, накопленных по всему треку.
+        QVector<std::complex<double>> prefix;
+
+        bool isEmpty() const { return frameCount <= 0; }
+    };
+
     /// Длина такта в сэмплах для заданной сетки (как в WaveformView::drawBarMarkers).
     static double samplesPerBar(const BarGrid& grid, int sampleRate);
 
+    /// Кадры хромы для analyzeKeyPerBar; длинный трек считается на нескольких ядрах
+    /// (не больше maxThreads, 0 — по числу ядер).
+    static ChromaFrames computeChromaFrames(const QVector<float>& samples, int sampleRate,
+                                            DFEngine::SimdKernel kernel = DFEngine::bestSimdKernel(),
+                                            int maxThreads = 0);
+
     /// Потактово определяет тональность и группирует такты в регионы модуляции.
     static PerBarKeyResult analyzeKeyPerBar(const QVector<float>& samples,
                                             int sampleRate,
                                             const BarGrid& grid,
                                             const AnalysisOptions& options = AnalysisOptions());
+    /// То же по готовым кадрам: такты не копируются, звук не читается — миллисекунды.
+    /// Тональности тактов сглаживаются decodeKeyPath с options.keyChangePenalty.
+    static PerBarKeyResult analyzeKeyPerBar(const ChromaFrames& frames, const BarGrid& grid,
+                                            const AnalysisOptions& options = AnalysisOptions());
+
+    /// Тональность трека по тем же кадрам, что и потактовый анализ: хрома
+    /// трека, основная и вторичная тональность, смены тональности — по окнам
+    /// options.frameSize с шагом options.hopSize; основная — самая долгая на
+    /// сглаженном пути окон (decodeKeyPath). Один проход по звуку
+    /// (computeChromaFrames) даёт и тональность трека, и такты.
+    static AnalysisResult analyzeKey(const ChromaFrames& frames,
+                                     const AnalysisOptions& options = AnalysisOptions());
+
+    /// Сглаженная последовательность тональностей: скрытая марковская модель
+    /// на 24 тональности, декодируется Витерби. chroma — хрома шагов (тактов
+    /// или окон) по 12 полутонов; наблюдение — корреляция хромы шага с
+    /// профилем тональности (KeyProfile), смена тональности между шагами стоит
+    /// changePenalty в тех же единицах. 0 — каждый шаг сам по себе, как detectKeyFromChroma; чем больше,
+    /// тем длиннее должна звучать новая гамма, чтобы путь в неё перешёл.
+    /// O(шагов × 24): на трек в 5 минут — доли миллисекунды.
+    static QVector<Key> decodeKeyPath(const QVector<QVector<float>>& chroma, float changePenalty);
 
     /// Объединяет соседние такты с одинаковой тональностью в регионы.
     static QVector<KeyRegion> mergeBarsIntoRegions(const QVector<BarKey>& bars);
@@ -132,7 +189,11 @@ public:
 
     /// Хроматический вектор (12 полутонов) через алгоритм Гёрцеля.
     /// Самодостаточный анализ высоты — не зависит от qm-dsp, поэтому детерминирован в тестах.
-    static QVector<float> computeChromaGoertzel(const QVector<float>& samples, int sampleRate);
+    /// Резонаторы MIDI 36..95 идут банком за один проход на октавный уровень
+    /// (нижние октавы — на прореженном сигнале); kernel — набор инструкций банка.
+    static QVector<float> computeChromaGoertzel(
+        const QVector<float>& samples, int sampleRate,
+        DFEngine::SimdKernel kernel = DFEngine::bestSimdKernel());
 
     /// Тональность по готовому хроматическому вектору (12 полутонов).
     /// Публично: тем же способом определяется тональность референсного MIDI,
@@ -141,15 +202,9 @@ public:
 
 private:
     // Методы для работы с qm-dsp
-    static QVector<double> convertToDouble(const QVector<float>& samples);
     static QVector<float> convertToFloat(const QVector<double>& samples);
     
     // Методы анализа
-    static QVector<float> extractChromaFeatures(const QVector<float>& samples, 
-                                               int sampleRate,
-                                               int frameSize, 
-                                               int hopSize);
-    
     static QVector<KeyInfo> detectKeyChanges(const QVector<QVector<float>>& chromaFrames,
                                             float threshold);
 
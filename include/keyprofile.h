@@ -0,0 +1,91 @@
+#ifndef KEYPROFILE_H
+#define KEYPROFILE_H
+
+/**
+ * @brief Оценка тональности по хроме — общая для приложения и ядра плагина.
+ *
+ * Без Qt: KeyAnalyzer (detectKeyFromChroma, наблюдения Витерби) и
+ * Dontfloat::PluginCore считают тональность одной и той же функцией, чтобы
+ * на одном звуке не расходиться.
+ *
+ * Профили — Крумхансл–Кесслер (веса ступеней из экспериментов с
+ * восприятием), оценка — корреляция Пирсона хромы с профилем, повёрнутым на
+ * тонику. У двоичной гаммы мажор и параллельный минор (C — Am) — одно
+ * множество нот и ровно одна оценка; веса разводят их: у мажора тяжелее
+ * I, III и V ступени мажора, у минора — тоника и терция минора.
+ *
+ * Индекс тональности — как у KeyAnalyzer::Key и TrackKey: тоника × 2, плюс 1
+ * у минора (0 — C, 1 — Cm, 2 — C#, …).
+ */
+
+#include <cmath>
+
+namespace KeyProfile {
+
+constexpr int kKeyCount = 24;
+
+constexpr float kMajor[12] = {
+    6.35f, 2.23f, 3.48f, 2.33f, 4.38f, 4.09f, 2.52f, 5.19f, 2.39f, 3.66f, 2.29f, 2.88f
+};
+constexpr float kMinor[12] = {
+    6.33f, 2.68f, 3.52f, 5.38f, 2.60f, 3.53f, 2.54f, 4.75f, 3.98f, 2.69f, 3.34f, 3.17f
+};
+
+constexpr bool isMajor(int key) { return key % 2 == 0; }
+constexpr int tonic(int key) { return key / 2; }
+
+/**
+ * Корреляция Пирсона 12 классов высоты \a chroma с профилем \a key, −1..1:
+ * класс i — ступень (i − тоника). Ровная хрома (и тишина) — 0.
+ */
+inline float correlation(const float* chroma, int key)
+{
+    const float* profile = isMajor(key) ? kMajor : kMinor;
+    const int root = tonic(key);
+    float chromaMean = 0.0f;
+    float profileMean = 0.0f;
+    for (int i = 0; i < 12; ++i) {
+        chromaMean += chroma[i];
+        profileMean += profile[i];
+    }
+    chromaMean /= 12.0f;
+    profileMean /= 12.0f;
+
+    float cross = 0.0f;
+    float chromaVar = 0.0f;
+    float profileVar = 0.0f;
+    for (int i = 0; i < 12; ++i) {
+        const float c = chroma[i] - chromaMean;
+        const float p = profile[(i - root + 12) % 12] - profileMean;
+        cross += c * p;
+        chromaVar += c * c;
+        profileVar += p * p;
+    }
+    const float denom = std::sqrt(chromaVar * profileVar);
+    return denom > 1e-12f ? cross / denom : 0.0f;
+}
+
+/**
+ * Тональность с наибольшей корреляцией; \a best — её корреляция. −1, если ни
+ * одна не положительна (тишина, ровная хрома).
+ */
+inline int bestKey(const float* chroma, float* best = nullptr)
+{
+    int key = -1;
+    float top = 0.0f;
+    for (int k = 0; k < kKeyCount; ++k) {
+        const float r = correlation(chroma, k);
+        if (r > top) {
+            top = r;
+            key = k;
+        }
+    }
+    if (best) {
+        *best = top;
+    }
+    return key;
+}
+
+} // namespace KeyProfile
+
+#endif // KEYPROFILE_H
@@ -0,0 +1,81 @@
+#ifndef LOADPIPELINE_H
+#define LOADPIPELINE_H
+
+#include <QtCore/QByteArray>
+#include <QtCore/QString>
+#include <QtCore/QVector>
+#include <atomic>
+#include <functional>
+
+#include "analysiscache.h"
+#include "bpmanalyzer.h"
+
+// Загрузка файла в окно: декодирование → моно → BPM → отклонения долей.
+// UI-независимо (QtCore + QtMultimedia): MainWindow запускает run() в рабочем
+// потоке, а результаты этапов переносит в UI-поток сам (QueuedConnection).
+//
+// Onset-функция набирается из блоков декодера по среднему каналов, так что к
+// концу декодирования остаётся только TempoTrackV2. Хеш содержимого (ключ
+// AnalysisCache) и чтение записи по нему идут параллельно с декодированием:
+// при попадании запись уходит в onCached сразу, как только найдена, а
+// onset-функция и анализ больше не считаются (сигнал только прореживается —
+// для Result::downbeatSignal).
+//
+// Отмена кооперативная: флаг cancel проверяется между блоками декодера, кадрами
+// onset-функции и этапами TempoTrackV2. Отменённая загрузка возвращает
+// cancelled == true, onDecoded после отмены не вызывается.
+namespace LoadPipeline {
+
+enum class Stage {
+    Decoding,    // декодирование (и onset-функция по его блокам)
+    Analyzing,   // BPM и доли
+    Deviations   // отклонения долей от сетки
+};
+
+struct Callbacks {
+    // Общий прогресс загрузки 0..100 — из рабочего потока, только при изменении
+    std::function<void(Stage stage, int percent)> onProgress;
+    // Декодирование закончено, анализ ещё идёт: волну уже можно показать
+    std::function<void(const QVector<QVector<float>>& channels, int sampleRate)> onDecoded;
+    // Анализ найден в кеше — обычно ещё во время декодирования, до onDecoded.
+    // Длина сигнала сверяется только после декодирования: окончательный ответ —
+    // Result::cacheHit (при расхождении запись отбрасывается и анализ идёт)
+    std::function<void(const AnalysisCacheEntry& cached)> onCached;
+};
+
+struct Result {
+    bool ok = false;
+    bool cancelled = false;
+    QString error;                      // текст ошибки декодирования
+    QVector<QVector<float>> channels;   // 1 или 2 канала в нативной частоте
+    int sampleRate = 0;
+    QByteArray contentHash;             // пусто без кеша
+    bool cacheHit = false;
+    AnalysisCacheEntry cached;          // запись кеша при cacheHit (пики, ноты, тональности)
+    BPMAnalyzer::AnalysisResult analysis;
+    // Отклонения долей от сетки анализа (по карте темпа, если темп плывёт);
+    // BeatInfo::expectedPosition и deviation в analysis.beats уже заполнены
+    BPMAnalyzer::DeviationStats deviations;
+    // Сигнал, прорежённый для DownBeat (OnsetStream::decimated), — и при
+    // попадании в кеш. По нему BPMAnalyzer::findBarPhase находит сильную долю
+    // в другом размере такта без повторного анализа. Пуст без qm-dsp и без
+    // алгоритма Mixxx
+    QVector<float> downbeatSignal;
+};
+
+// Доли прогресса этапов: декодирование до kDecodedPercent, анализ до kAnalyzedPercent
+constexpr int kDecodedPercent = 50;
+constexpr int kAnalyzedPercent = 95;
+
+// Полная загрузка файла. cache (если задан) — поиск готового анализа по хешу
+// содержимого и AnalysisCache::optionsKey(options); запись в кеш остаётся за
+// вызывающим (пики строит окно), beatsOptionsKey — по тем же options.
+Result run(const QString& filePath,
+           const BPMAnalyzer::AnalysisOptions& options,
+           const AnalysisCache* cache = nullptr,
+           const std::atomic<bool>* cancel = nullptr,
+           const Callbacks& callbacks = {});
+
+} // namespace LoadPipeline
+
+#endif // LOADPIPELINE_H
@@ -27,10 +27,14 @@
 #include <QTranslator>
 #include <QFutureWatcher>
 #include <QPair>
+#include <QPointer>
 #include <functional>
 #include <memory>
 #include <atomic>
 #include "waveformview.h"
+#include "analysiscache.h"
+#include "audiofileservice.h"
+#include "loadpipeline.h"
 #include "keyanalyzer.h"
 #include "pitchdetector.h"
 #include "notepreviewplayer.h"
@@ -46,8 +50,11 @@
 QT_BEGIN_NAMESPACE
 namespace Ui { class MainWindow; }
 class QProgressBar;
+class QSlider;
 QT_END_NAMESPACE
 
+class LoadFileDialog;
+
 class MainWindow : public QMainWindow
 {
     Q_OBJECT
@@ -141,6 +148,8 @@ private:
     void setupKeyModulationStrip();
     void applyPerBarKeyResult(const KeyAnalyzer::PerBarKeyResult& perBar,
                               const KeyAnalyzer::AnalysisResult& trackKey);
+    /** Сетка сменилась: тональности тактов — заново из keyChromaFrames, без анализа. */
+    void rebinKeyBars();
     void layoutPitchGridScrollOverlay();
     /** Панель кнопок под пианороллом («Разделить», режим реза). */
     void setupPianoRollToolbar();
@@ -173,13 +182,28 @@ private:
     bool maybeSave();
     bool doSaveAudioFile();
     void resetAudioState();
+    /// Загрузка файла в фоне (LoadPipeline): волна — сразу после декодирования,
+    /// доли и диалог выравнивания — по готовности анализа. Прежняя загрузка отменяется.
     void processAudioFile(const QString& filePath);
-    /// Декодирует аудиофайл в его нативном формате (без принудительного ресемплинга).
-    /// \a ok (если задан) выставляется в true только при успешном декодировании.
-    /// \a onProgress (если задан) вызывается с процентом декодирования (0..100).
-    QVector<QVector<float>> loadAudioFile(const QString& filePath,
-                                          bool* ok = nullptr,
-                                          const std::function<void(int)>& onProgress = {});
+    /// Отмена идущей загрузки: рабочий поток останавливается, её поздние сигналы
+    /// отбрасываются по loadEpoch.
+    void cancelAudioLoad();
+    /// Волна нового файла, пока анализ ещё идёт (доли прошлого файла убираются;
+    /// если анализ уже нашёлся в кеше — сразу с его долями и пиками).
+    void showDecodedAudio(const QVector<QVector<float>>& channels, int sampleRate);
+    /// Анализ готов: доли на волне, итог и выбор в диалоге загрузки.
+    void finishAudioLoad(qint64 epoch, const std::shared_ptr<LoadPipeline::Result>& result);
+    /// Диалог закрыт: сильная доля в выбранном размере, метки неровных долей,
+    /// сетка тактов, кеш, ноты из кеша.
+    void completeAudioLoad(const LoadPipeline::Result& result, bool fixBeats, bool keepMarkers,
+                           int beatsPerBar);
+    /// Кладёт в кеш анализа (в фоне) пики и доли только что открытого файла;
+    /// beatsPerBar — размер, в котором искалась сильная доля (часть ключа).
+    void storeLoadedAnalysis(const BPMAnalyzer::AnalysisResult& analysis, int beatsPerBar);
+    /// Тональности и ноты из кеша, если они считались по той же тактовой сетке.
+    bool restoreCachedPitchAnalysis(const AnalysisCacheEntry& cached);
+    /// Исходное аудио в окне всё ещё то, что прочитано из файла currentContentHash.
+    bool isSourceAudioFromFile() const;
     /// Сброс A/B цикла и кнопок после загрузки нового файла
     void resetLoopStateAfterNewFile();
     void createDeviationMarkers(float tolerancePercent, bool neutralMarkers = false);
@@ -191,8 +215,7 @@ private:
     void shiftBeatGridByBeats(int beatDelta);
 
     // Вспомогательные методы для рефакторинга
-    void updateUIAfterAnalysis(const QVector<QVector<float>>& audioData,
-                                const BPMAnalyzer::AnalysisResult& analysis,
+    void updateUIAfterAnalysis(const BPMAnalyzer::AnalysisResult& analysis,
                                 int beatsPerBar);
     void updateUIAfterBeatFix(const QVector<QVector<float>>& fixedData,
                               const BPMAnalyzer::AnalysisResult& analysis,
@@ -273,6 +296,11 @@ private:
 
     // File management
     QString currentFileName;
+    /** Кеш анализа на диске: ключ — хеш содержимого открытого файла. */
+    AnalysisCache analysisCache;
+    QByteArray currentContentHash;
+    /** Буфер исходного аудио сразу после загрузки: правки его заменяют. */
+    const float* currentContentSource = nullptr;
     bool hasUnsavedChanges;
     bool isShuttingDown = false;
 
@@ -289,6 +317,16 @@ private:
     std::shared_ptr<std::atomic_bool> markerPreviewRunning =
         std::make_shared<std::atomic_bool>(false);
     qint64 markerPreviewEpoch = 0;
+
+    // Загрузка файла в фоне (см. processAudioFile): эпоха отбрасывает сигналы
+    // отменённой загрузки, флаг останавливает её рабочий поток
+    qint64 loadEpoch = 0;
+    std::shared_ptr<std::atomic<bool>> loadCancel;
+    QPointer<LoadFileDialog> loadDialog;
+    /** Запись кеша из LoadPipeline::Callbacks::onCached (с картой темпа) до конца загрузки. */
+    std::shared_ptr<const AnalysisCacheEntry> loadCachedEntry;
+    /** Размер такта, в котором загрузка ищет сильную долю (loadAnalysisOptions). */
+    int loadBeatsPerBar = 4;
     qint64 previewRestorePosition;  // Позиция воспроизведения до пересчёта
     qint64 previewOldDuration;      // Длительность до пересчёта (для масштабирования позиции)
     bool previewWasPlaying;         // Продолжить воспроизведение после переключения источника
@@ -318,6 +356,11 @@ private:
     KeySelectionMenu *keyRegionMenu = nullptr; // меню для потактовой полосы
     KeyModulationStrip *keyModulationStrip = nullptr;
     KeyAnalyzer::PerBarKeyResult lastPerBarKey;
+    /** Кадры хромы звука, по которому посчитан lastPerBarKey (пусто — из кеша на диске). */
+    std::shared_ptr<const KeyAnalyzer::ChromaFrames> keyChromaFrames;
+    /** Настройки тональности; keyChangePenalty задаёт ползунок у полосы тактов. */
+    KeyAnalyzer::AnalysisOptions keyAnalysisOptions;
+    QSlider *keyChangePenaltySlider = nullptr;
     int editingKeyRegionIndex = -1;
 
     // Pitch analysis (тональность + ноты) в фоне.
@@ -327,6 +370,7 @@ private:
     struct PitchAnalysisOutcome {
         KeyAnalyzer::AnalysisResult key;
         KeyAnalyzer::PerBarKeyResult perBarKey; // потактовая модуляция (смены тональности)
+        std::shared_ptr<const KeyAnalyzer::ChromaFrames> chromaFrames;
         QVector<PitchDetector::PitchNote> notes;
     };
     std::shared_ptr<std::atomic<int>> pitchAnalysisProgressValue;
@@ -13,6 +13,7 @@
 #include <QtCore/QVector>
 
 #include "pitchdetector.h"
+#include "tempomap.h"
 
 namespace MidiExporter {
 
@@ -27,6 +28,12 @@ struct Options {
     int velocity = 96;
     /** Канал MIDI (0-15). */
     int channel = 0;
+    /**
+     * Карта темпа дорожки. Если темп в ней меняется (isVariable()), тики
+     * считаются по карте, а на начало каждого сегмента пишется своё
+     * мета-событие темпа; bpm тогда не используется.
+     */
+    TempoMap tempoMap;
 };
 
 /**
@@ -0,0 +1,107 @@
+#ifndef ONSETSTREAM_H
+#define ONSETSTREAM_H
+
+/**
+ * @brief Потоковая onset-функция (detection function) для анализа BPM.
+ *
+ * Раньше функция считалась только по всему сигналу целиком: каждое окно
+ * заново копировалось по сэмплу из QVector<float> в QVector<double>, то есть
+ * из-за перекрытия окон каждый сэмпл переводился в double несколько раз, а
+ * анализ начинался лишь после декодирования всего файла.
+ *
+ * Здесь сэмплы подаются блоками по мере декодирования (см. колбэк onBlock у
+ * AudioFileService::decode). Поток держит ровно одно окно в double: каждый
+ * сэмпл переводится один раз, после очередного значения окно сдвигается на
+ * шаг. К концу декодирования функция уже готова — остаётся TempoTrackV2.
+ *
+ * Значения совпадают с прежним расчётом по целому сигналу при любом
+ * разбиении на блоки: окно с началом i считается, когда пришёл сэмпл
+ * i + windowSize (как условие i < size - windowSize).
+ *
+ * Попутно тот же моно-сигнал прореживается в kDownbeatDecimation раз
+ * (decimated()): по нему и по долям TempoTrackV2 ищется сильная доля
+ * (qm-dsp DownBeat), так что второго прохода по аудио не нужно.
+ */
+
+#include <QtCore/QVector>
+#include <QtCore/QtGlobal>
+#include <memory>
+
+class DetectionFunction;
+class Decimator;
+
+class OnsetStream
+{
+public:
+    explicit OnsetStream(int sampleRate);
+    ~OnsetStream();
+
+    OnsetStream(const OnsetStream&) = delete;
+    OnsetStream& operator=(const OnsetStream&) = delete;
+
+    /** Шаг функции в сэмплах (~11.6 мс, как в Mixxx). */
+    static int stepSizeFor(int sampleRate);
+    /** Длина окна в сэмплах: степень двойки, бин не шире 50 Гц. */
+    static int windowSizeFor(int sampleRate);
+    /** Прореживание сигнала для DownBeat (~2.7 кГц на 44.1 кГц, как в qm-dsp). */
+    static constexpr int kDownbeatDecimation = 16;
+
+    /** Очередной блок моно-сигнала. */
+    void push(const float* samples, int count);
+    /**
+     * Очередной блок стерео: в функцию идёт среднее каналов, как у
+     * AudioFileService::toMono. \a right == nullptr — моно.
+     */
+    void push(const float* left, const float* right, int frames);
+
+    /**
+     * Дальше только прореживание: onset-функция не нужна (анализ взят из
+     * кеша), а decimated() ещё нужен — найти сильную долю в другом размере.
+     * values() обрывается на поданном к этому моменту.
+     */
+    void stopDetection() { detecting_ = false; }
+    bool isDetecting() const { return detecting_; }
+
+    int sampleRate() const { return sampleRate_; }
+    int stepSize() const { return stepSize_; }
+    int windowSize() const { return windowSize_; }
+    /** Сколько сэмплов подано. */
+    qint64 sampleCount() const { return sampleCount_; }
+
+    /** Значения функции, по одному на шаг. */
+    const QVector<double>& values() const { return values_; }
+    /**
+     * Моно-сигнал, прорежённый в kDownbeatDecimation раз с антиалиасингом
+     * (qm-dsp Decimator). Неполный последний блок не входит. Без qm-dsp пуст.
+     */
+    const QVector<float>& decimated() const { return decimated_; }
+
+private:
+    void pushConverted(const float* samples, int count, const float* right);
+    void emitWindow();
+    void decimate(const float* samples, int count, const float* right);
+
+    int sampleRate_ = 0;
+    int stepSize_ = 1;
+    int windowSize_ = 1;
+    qint64 sampleCount_ = 0;
+    bool detecting_ = true;
+
+    QVector<double> window_;  // текущее окно, заполнено на filled_
+    int filled_ = 0;
+    int skip_ = 0;            // сэмплы между окнами, если шаг длиннее окна
+    QVector<double> values_;
+
+    QVector<float> decimateBlock_;  // вход прореживания, заполнен на decimateFilled_
+    int decimateFilled_ = 0;
+    QVector<float> decimateStage_;  // между ступенями ×8 и ×2
+    QVector<float> decimated_;
+
+#ifdef USE_MIXXX_QM_DSP
+    std::unique_ptr<DetectionFunction> detection_;
+    std::unique_ptr<Decimator> decimator8_;
+    std::unique_ptr<Decimator> decimator2_;
+#endif
+};
+
+#endif // ONSETSTREAM_H
@@ -9,6 +9,9 @@
 #include <QtCore/QString>
 #include <QtCore/QVector>
 
+#include "tempomap.h"
+#include "waveformpeaks.h"
+
 namespace PianoRollEngine {
 
 struct Viewport {
@@ -44,9 +47,51 @@ struct BeatGridMetrics {
 
 BeatGridMetrics computeBeatGridMetrics(float bpm, int beatsPerBar, int sampleRate);
 
+/**
+ * Сведённая в моно пирамида пиков дорожки (см. WaveformPeaks) — источник
+ * огибающей для любого окна. Раньше огибающая на каждый ресайз и масштаб
+ * заново сводила и перебирала все сэмплы всех каналов (O(N) на кадр); здесь
+ * сведение и пирамида строятся один раз на набор буферов, а окно шириной W
+ * столбцов стоит O(W · log N).
+ */
+class EnvelopePyramid
+{
+public:
+    /**
+     * Пересобирает пирамиду, если \a channels — не те буферы, по которым она
+     * построена (сверяются адреса данных и длина, как у кеша пиков WaveformView).
+     * @return true, если пирамида пересобрана
+     */
+    bool ensureBuilt(const QVector<QVector<float>>& channels);
+    void clear();
+
+    bool isEmpty() const { return mix_.isEmpty(); }
+    qint64 sampleCount() const { return mix_.size(); }
+
+    /**
+     * Огибающая \a pixelWidth столбцов по \a samplesPerPixel сэмплов, начиная
+     * с \a startSample; Y — в пикселях виджета высотой \a widgetHeight.
+     * Столбцы за концом дорожки — нулевая линия.
+     */
+    WaveformEnvelope envelope(qint64 startSample, float samplesPerPixel,
+                              int pixelWidth, int widgetHeight) const;
+
+private:
+    QVector<const float*> sources_;
+    qint64 sourceSize_ = 0;
+    QVector<float> mix_;        // среднее каналов
+    WaveformPeaks peaks_;
+};
+
+/** Огибающая всей дорожки на \a pixelWidth столбцов (пирамида строится на один вызов). */
 WaveformEnvelope buildWaveformEnvelope(const QVector<QVector<float>>& channels,
                                        int pixelWidth,
                                        int widgetHeight);
+/** Огибающая окна \a viewport по готовой пирамиде — без прохода по сэмплам. */
+WaveformEnvelope buildWaveformEnvelope(const EnvelopePyramid& pyramid,
+                                       const Viewport& viewport,
+                                       int pixelWidth,
+                                       int widgetHeight);
 
 QVector<GridLine> visibleGridLines(const Viewport& viewport,
                                    const BeatGridMetrics& metrics,
@@ -72,6 +117,20 @@ qint64 snapToGrid(qint64 sample,
                   qint64 gridStartSample,
                   bool enabled);
 
+/**
+ * Сетка по карте переменного темпа (TempoMap::isVariable()): деление такта
+ * то же, что у computeBeatGridMetrics, но позиции долей берутся из карты.
+ */
+QVector<GridLine> visibleGridLines(const Viewport& viewport,
+                                   const TempoMap& tempoMap,
+                                   int beatsPerBar,
+                                   int widthPx);
+
+qint64 snapToGrid(qint64 sample,
+                  const TempoMap& tempoMap,
+                  int beatsPerBar,
+                  bool enabled);
+
 /** Минимальная длина каждой части при разрезе ноты (сэмплы, ~1 мс при 44.1 кГц). */
 constexpr qint64 kMinNotePartSamples = 48;
 
@@ -1,6 +1,7 @@
 #ifndef PITCHCORRECTION_H
 #define PITCHCORRECTION_H
 
+#include <QtCore/QPair>
 #include <QtCore/QVector>
 #include "pitchdetector.h"
 
@@ -29,6 +30,13 @@ QVector<QVector<float>> apply(const QVector<QVector<float>>& channels,
                               const QVector<PitchDetector::PitchNote>& notes,
                               int sampleRate);
 
+/**
+ * Участок [first, second), вне которого apply() оставляет сэмплы как были:
+ * исходные и новые места правленых нот. Правок нет — пустой (first == second).
+ */
+QPair<qint64, qint64> editedRange(const QVector<PitchDetector::PitchNote>& notes,
+                                  qint64 totalSamples);
+
 /** Есть ли правки, которые надо пересчитать: смена высоты или перенос ноты. */
 bool hasPendingEdits(const QVector<PitchDetector::PitchNote>& notes);
 
@@ -69,6 +69,9 @@ struct Options {
      * работает коррекция, эталон не влияет — обе величины в одном строе.
      */
     float referenceHz = 440.0f;
+
+    /** Потоков на кадры: 0 — по числу ядер; пакетный анализ, где ядра заняты файлами, даёт 1. */
+    int maxThreads = 0;
 };
 
 /** Стандартные строи для UI: подпись + частота A4. */
@@ -47,6 +47,8 @@ public:
     void setBPM(float bpm);
     void setBeatsPerBar(int beatsPerBar);
     void setGridStartSample(qint64 sample);
+    /** Карта переменного темпа: при isVariable() сетка и snap идут по ней. */
+    void setTempoMap(const TempoMap& map);
     void setPitchRange(int minPitch, int maxPitch);
     void setColorScheme(const QString& scheme);
     void setBeatGridSnapEnabled(bool enabled);
@@ -162,6 +164,8 @@ private:
     int noteIndexAt(const QPoint& pos) const;
     void changeSelectedNotePitch(int semitoneDelta);
 
+    /** Snap к сетке: по карте темпа, если он переменный, иначе по bpm. */
+    qint64 snapSampleToGrid(qint64 sample, bool enabled) const;
     /** Сэмпл таймлайна под X с учётом режима реза (snap к сетке / свободно). */
     qint64 cutSampleFromX(int x) const;
     /** Сэмпл каретки воспроизведения в координатах таймлайна. */
@@ -209,6 +213,7 @@ private:
     int sampleRate;
     qint64 playbackPosition;
     qint64 gridStartSample;
+    TempoMap tempoMap;
     float cursorXPosition;
     float horizontalOffset;
     float verticalOffset;
@@ -0,0 +1,103 @@
+#ifndef SPECTROGRAMCACHE_H
+#define SPECTROGRAMCACHE_H
+
+/**
+ * @brief Многоуровневый кеш плиток спектрограммы (mip-пирамида по шагу STFT).
+ *
+ * Раньше спектрограмма была одной картинкой на канал с фиксированным числом
+ * столбцов на весь трек: при приближении столбец растягивался на десятки
+ * пикселей, а смена настроек выбрасывала всё.
+ *
+ * Здесь, как у WaveformPeaks, есть уровни: на уровне L шаг кадра равен
+ * kMinHop << L сэмплов. Виджет берёт уровень под текущий масштаб и считает
+ * только видимые плитки; плитка — kTileColumns столбцов одного канала.
+ * Ключ плитки включает подпись настроек (окно, шкалы, цвета), поэтому плитки
+ * прежних настроек не мешают новым и снова пригождаются при возврате к ним.
+ * Старые плитки вытесняются по LRU в пределах бюджета памяти.
+ */
+
+#include <QtCore/QCache>
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtCore/QSet>
+#include <QtCore/QtGlobal>
+#include <QtGui/QImage>
+
+/** Адрес плитки: подпись настроек, канал, уровень (шаг) и номер плитки на уровне. */
+struct SpectrogramTileKey {
+    quint64 settingsKey = 0;
+    int channel = 0;
+    int level = 0;
+    int tile = 0;
+
+    bool operator==(const SpectrogramTileKey& o) const {
+        return settingsKey == o.settingsKey && channel == o.channel
+            && level == o.level && tile == o.tile;
+    }
+};
+
+inline size_t qHash(const SpectrogramTileKey& key, size_t seed = 0)
+{
+    return qHashMulti(seed, key.settingsKey, key.channel, key.level, key.tile);
+}
+
+class SpectrogramCache
+{
+public:
+    /** Столбцов (кадров STFT) в одной плитке. */
+    static constexpr int kTileColumns = 64;
+    /** Шаг кадра на самом мелком уровне, сэмплов. */
+    static constexpr int kMinHop = 16;
+    /** Самый грубый уровень: шаг kMinHop << kMaxLevel (≈ 24 с при 44.1 кГц). */
+    static constexpr int kMaxLevel = 16;
+    /** Бюджет памяти по умолчанию, байт. */
+    static constexpr qint64 kDefaultBudgetBytes = qint64(64) * 1024 * 1024;
+
+    SpectrogramCache();
+
+    static int hopForLevel(int level) { return kMinHop << qBound(0, level, kMaxLevel); }
+    /**
+     * Самый грубый уровень, у которого на один столбец экрана приходится не
+     * больше \a samplesPerColumn сэмплов: картинка не растягивается.
+     */
+    static int levelForSamplesPerColumn(double samplesPerColumn);
+    /**
+     * Кадров на уровне для канала длиной \a sampleCount при окне \a windowSize;
+     * канал ровно в окно — один кадр, короче окна — ни одного.
+     */
+    static qint64 frameCount(qint64 sampleCount, int windowSize, int level);
+    static qint64 tileCount(qint64 sampleCount, int windowSize, int level);
+
+    /** Готовая плитка или nullptr; найденная плитка становится самой свежей. */
+    const QImage* find(const SpectrogramTileKey& key);
+    bool contains(const SpectrogramTileKey& key) const { return tiles_.contains(key); }
+    void insert(const SpectrogramTileKey& key, const QImage& image);
+    void clear() { tiles_.clear(); }
+
+    void setBudgetBytes(qint64 bytes);
+    qint64 budgetBytes() const { return qint64(tiles_.maxCost()) * 1024; }
+    /** Занято плитками, байт (с точностью до килобайта на плитку). */
+    qint64 usedBytes() const { return qint64(tiles_.totalCost()) * 1024; }
+    qsizetype tileCount() const { return tiles_.count(); }
+
+private:
+    QCache<SpectrogramTileKey, QImage> tiles_;  // стоимость — килобайты
+};
+
+/**
+ * Плитки, нужные виджету прямо сейчас. Фоновая задача сверяется с набором
+ * перед стартом: пока плитка стояла в очереди, окно могло уехать, и считать
+ * её уже незачем. Виджет меняет набор при каждом запросе видимой области.
+ */
+class SpectrogramWantedTiles
+{
+public:
+    void assign(const QSet<SpectrogramTileKey>& keys);
+    bool contains(const SpectrogramTileKey& key) const;
+
+private:
+    mutable QMutex mutex_;
+    QSet<SpectrogramTileKey> keys_;
+};
+
+#endif // SPECTROGRAMCACHE_H
@@ -0,0 +1,78 @@
+#ifndef TEMPOMAP_H
+#define TEMPOMAP_H
+
+/**
+ * @brief Карта темпа дорожки: «сэмпл ↔ доля» для переменного BPM.
+ *
+ * Раньше у анализа был один BPM и одна опорная линия сетки. Живая запись с
+ * плывущим темпом получала одну сетку, и к концу трека доли расходились с
+ * ней на десятки процентов — calculateDeviations принимал смену темпа за
+ * неровные доли, а длинный концерт приходилось резать на куски вручную.
+ *
+ * Карта — последовательность сегментов постоянного темпа, стыкующихся без
+ * разрывов (плавное ускорение — цепочка коротких сегментов). Доли считаются
+ * в четвертях от опорной линии сетки (доля 0), как у BPM. Поиск в обе
+ * стороны — двоичный по таблице начал сегментов; до первого и после
+ * последнего сегмента темп продолжается крайним сегментом.
+ *
+ * Карта с одним сегментом — обычная сетка BPM (см. constant()); у неё
+ * isVariable() == false, и потребители рисуют сетку прежним способом.
+ */
+
+#include <QtCore/QVector>
+#include <QtCore/QtGlobal>
+
+class TempoMap
+{
+public:
+    struct Segment {
+        double startSample = 0.0;     // начало сегмента (сэмплы)
+        double startBeat = 0.0;       // доля на startSample
+        double samplesPerBeat = 0.0;  // длина доли в сегменте
+    };
+
+    /** Предел отклонения доли от прямой сегмента (в долях) для fromBeats. */
+    static constexpr double kDefaultMaxResidualBeats = 0.05;
+
+    TempoMap() = default;
+
+    /** Постоянный темп: доля 0 на \a gridStartSample. */
+    static TempoMap constant(double samplesPerBeat, qint64 gridStartSample);
+
+    /**
+     * Карта по найденным долям (отсортированы, по одной на удар). Доли
+     * объединяются в сегмент, пока все они лежат на одной прямой с точностью
+     * \a maxResidualBeats; одиночный выброс, после которого доли снова ложатся
+     * на прямую, пропускается. \a beatScale — сколько долей сетки приходится
+     * на интервал между найденными долями (выбранная гармоника BPM: 0.5, 1, 2…).
+     */
+    static TempoMap fromBeats(const QVector<qint64>& beatPositions,
+                              double beatScale = 1.0,
+                              double maxResidualBeats = kDefaultMaxResidualBeats);
+
+    bool isEmpty() const { return segments_.isEmpty(); }
+    /** Больше одного сегмента — темп меняется по ходу дорожки. */
+    bool isVariable() const { return segments_.size() > 1; }
+    const QVector<Segment>& segments() const { return segments_; }
+
+    /** Доля (дробная) на позиции \a sample. Пустая карта — 0. */
+    double beatAtSample(double sample) const;
+    /** Позиция доли \a beat в сэмплах. Пустая карта — 0. */
+    double sampleAtBeat(double beat) const;
+    /** Длина доли в сегменте, где лежит \a sample. */
+    double samplesPerBeatAt(double sample) const;
+    double bpmAt(double sample, int sampleRate) const;
+
+    /** Сдвигает всю карту на \a sampleDelta (перенос опорной линии сетки). */
+    void shift(double sampleDelta);
+    /** Перенумеровывает доли: доля 0 — ближайшая к \a gridStartSample. */
+    void rebase(qint64 gridStartSample);
+
+private:
+    int segmentAtSample(double sample) const;
+    int segmentAtBeat(double beat) const;
+
+    QVector<Segment> segments_;  // по возрастанию startSample (и startBeat)
+};
+
+#endif // TEMPOMAP_H
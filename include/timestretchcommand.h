@@ -33,6 +33,14 @@ public:
                       const QString& text,
                       QUndoCommand* parent = nullptr);
 
+    /**
+     * @brief Участок, которым newData отличается от исходника при создании команды
+     *
+     * Тогда redo правит пирамиду пиков только на нём (WaveformView::SourceEdit).
+     * После undo исходник уже другой — повторный redo строит её заново.
+     */
+    void setSourceEdit(const WaveformView::SourceEdit& edit);
+
     /**
      * @brief Отменить команду (вернуть старое состояние)
      */
@@ -49,6 +57,8 @@ private:
     QVector<QVector<float>> newAudioData;
     QVector<Marker> oldMarkerData;
     QVector<Marker> newMarkerData;
+    WaveformView::SourceEdit sourceEdit;
+    bool hasSourceEdit = false;
 };
 
 #endif // TIMESTRETCHCOMMAND_H
@@ -5,6 +5,7 @@
 #include <QString>
 #include <cmath>
 #include "markerengine.h"
+#include "tempomap.h"
 
 /**
  * @brief Процессор для изменения времени аудио с сохранением высоты тона
@@ -117,6 +118,18 @@ public:
         qint64 totalSamples,
         int sampleRate);
 
+    /**
+     * @brief То же по карте темпа: ближайшая линия — целая доля карты
+     *
+     * Для живой записи с плывущим темпом доли ставятся на сетку своего
+     * сегмента, а не на одну сетку на весь трек.
+     */
+    static QVector<MarkerData> buildBeatAlignmentMarkers(
+        const QVector<qint64>& beatPositions,
+        const TempoMap& tempoMap,
+        qint64 totalSamples,
+        int sampleRate);
+
     /**
      * @brief Ставит доли на сетку BPM растяжением участков между ними
      *
@@ -134,6 +147,14 @@ public:
         qint64 gridStartSample,
         bool preservePitch = true);
 
+    /** То же по карте темпа (переменный BPM). */
+    static StretchResult alignBeatsToGrid(
+        const QVector<QVector<float>>& audioData,
+        const QVector<qint64>& beatPositions,
+        const TempoMap& tempoMap,
+        int sampleRate,
+        bool preservePitch = true);
+
     /**
      * @brief Вычисляет сегменты для обработки на основе меток
      *
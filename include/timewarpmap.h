@@ -0,0 +1,64 @@
+#ifndef TIMEWARPMAP_H
+#define TIMEWARPMAP_H
+
+/**
+ * @brief Кусочно-линейная карта времени «исходное аудио ↔ таймлайн» по меткам.
+ *
+ * Перетащенные метки растягивают отрезки между собой; пока полное превью
+ * растяжения не посчитано, волна рисуется по исходным сэмплам через эту
+ * карту. Раньше каждое преобразование копировало и сортировало весь вектор
+ * меток (а длина таймлайна — ещё раз), дважды на каждый столбец экрана.
+ *
+ * Здесь опорные точки сортируются один раз при смене меток, а запрос — это
+ * двоичный поиск по таблице. Правила краёв те же, что были у WaveformView:
+ * до первой метки — масштаб от нуля, после последней — хвост тянется с
+ * коэффициентом последнего отрезка.
+ */
+
+#include <QtCore/QVector>
+#include <QtCore/QtGlobal>
+
+#include "markerengine.h"
+
+class TimeWarpMap
+{
+public:
+    TimeWarpMap() = default;
+    /** Карта для \a markers над исходным аудио длиной \a originalSize сэмплов. */
+    TimeWarpMap(const QVector<Marker>& markers, qint64 originalSize);
+
+    /**
+     * Карта построена ровно по этим позициям меток и длине. Сравнение без
+     * выделений памяти — дешевле пересборки, поэтому карту можно сверять на
+     * каждом запросе, не отслеживая все места правки меток.
+     */
+    bool isBuiltFor(const QVector<Marker>& markers, qint64 originalSize) const;
+
+    /** Хотя бы одна метка сдвинута с исходного места. */
+    bool changesTimeline() const { return changesTimeline_; }
+    qint64 originalSize() const { return originalSize_; }
+    /** Длина таймлайна с учётом растяжения (без сдвинутых меток — исходная). */
+    qint64 displaySize() const { return displaySize_; }
+
+    /** Позиция исходного аудио → позиция на таймлайне. */
+    qint64 toDisplay(qint64 originalPos) const;
+    /** Позиция на таймлайне → сэмпл исходного аудио (в пределах [0, originalSize)). */
+    qint64 toOriginal(qint64 displayPos) const;
+
+private:
+    struct Anchor {
+        qint64 original = 0;
+        qint64 display = 0;
+    };
+
+    qint64 clampOriginal(qint64 pos) const;
+
+    QVector<Anchor> anchors_;   // по возрастанию original
+    QVector<Anchor> source_;    // позиции меток в исходном порядке — для isBuiltFor
+    qint64 originalSize_ = 0;
+    qint64 displaySize_ = 0;
+    bool changesTimeline_ = false;
+    bool displayMonotonic_ = true;  // display не убывает — обратный поиск двоичный
+};
+
+#endif // TIMEWARPMAP_H
@@ -12,11 +12,19 @@
  * уровни (каждый следующий вдвое грубее). Отрисовка берёт готовые значения
  * подходящего уровня — десятки чтений на столбец вместо сотен, и ни один
  * всплеск не теряется. Память: около 1.5% от размера самого аудио.
+ *
+ * Каналы одной дорожки лежат в одной пирамиде вперемешку (корзина 0 всех
+ * каналов, затем корзина 1 и т.д.): столбец стерео-волны читает соседние
+ * ячейки, а не две далёкие таблицы. Нижний уровень считается SIMD-ядром
+ * (см. DFEngine::SimdKernel) параллельно по кускам дорожки.
  */
 
+#include <QtCore/QByteArray>
 #include <QtCore/QVector>
 #include <QtCore/QtGlobal>
 
+#include "fft_engine.h"
+
 class WaveformPeaks
 {
 public:
@@ -26,11 +34,40 @@ public:
     static constexpr int kMinBucketsPerRange = 16;
 
     /** Пересобирает пирамиду под \a samples (пустой вектор — очистка). */
-    void build(const QVector<float>& samples);
+    void build(const QVector<float>& samples,
+               DFEngine::SimdKernel kernel = DFEngine::bestSimdKernel());
+    /**
+     * Пирамида сразу для всех каналов дорожки. Каналы должны быть одной длины,
+     * иначе пирамида остаётся пустой и вызывающий считает по сэмплам сам.
+     */
+    void buildChannels(const QVector<QVector<float>>& channels,
+                       DFEngine::SimdKernel kernel = DFEngine::bestSimdKernel());
     void clear();
 
+    /**
+     * Сэмплы [from, to) изменились, длина та же: пересчитываются только
+     * затронутые корзины нижнего уровня и их предки.
+     */
+    void update(const QVector<QVector<float>>& channels, qint64 from, qint64 to);
+    /**
+     * Отрезок [at, at + removed) заменён на \a inserted новых сэмплов (длина
+     * изменилась; дозапись в конец — at = sampleCount(), removed = 0). Корзины
+     * до правки остаются, хвост сдвигается или пересчитывается. \a channels —
+     * уже изменённые данные. Если пирамида к ним не подходит, строится заново.
+     */
+    void splice(const QVector<QVector<float>>& channels, qint64 at, qint64 removed, qint64 inserted);
+
+    /**
+     * Нижний уровень пирамиды одним блоком — для кеша на диске (AnalysisCache).
+     * Верхние уровни не пишутся: при чтении они досчитываются за доли миллисекунды.
+     */
+    QByteArray serialize() const;
+    /** Пирамида из serialize(); false (пирамида пуста) — блок повреждён. */
+    bool deserialize(const char* data, qint64 size);
+
     bool isValid() const { return sampleCount_ > 0 && !levels_.isEmpty(); }
     qint64 sampleCount() const { return sampleCount_; }
+    int channelCount() const { return channelCount_; }
 
     /**
      * Точные min/max на отрезке [from, to) исходных сэмплов.
@@ -39,6 +76,15 @@ public:
      */
     bool range(const QVector<float>& samples, qint64 from, qint64 to,
                float& minValue, float& maxValue) const;
+    /** То же для канала \a channel многоканальной пирамиды. */
+    bool range(int channel, const QVector<float>& samples, qint64 from, qint64 to,
+               float& minValue, float& maxValue) const;
+    /**
+     * min/max всех каналов за один проход по корзинам: \a minValues и
+     * \a maxValues — массивы на channelCount() значений.
+     */
+    bool rangeAll(const QVector<QVector<float>>& channels, qint64 from, qint64 to,
+                  float* minValues, float* maxValues) const;
 
 private:
     struct Bucket {
@@ -46,14 +92,25 @@ private:
         float max = 0.0f;
     };
 
-    /** Уровень пирамиды: корзины по bucketSamples сэмплов. */
+    /** Уровень пирамиды: корзины по bucketSamples сэмплов, channelCount_ на корзину. */
     struct Level {
         qint64 bucketSamples = kBaseBucketSamples;
+        qint64 bucketCount = 0;
         QVector<Bucket> buckets;
     };
 
+    static bool matchesChannels(const QVector<QVector<float>>& channels, qint64 sampleCount);
+    /** Корзины [firstBucket, lastBucket) нижнего уровня — по сэмплам. */
+    void computeBaseBuckets(const QVector<QVector<float>>& channels, qint64 firstBucket,
+                            qint64 lastBucket, DFEngine::SimdKernel kernel);
+    /** Предки корзин [firstBucket, lastBucket) нижнего уровня; число уровней — по длине. */
+    void updateUpperLevels(qint64 firstBucket, qint64 lastBucket);
+    /** Уровень для отрезка длиной \a span (см. kMinBucketsPerRange). */
+    int levelForSpan(qint64 span) const;
+
     QVector<Level> levels_;
     qint64 sampleCount_ = 0;
+    int channelCount_ = 0;
 };
 
 #endif // WAVEFORMPEAKS_H
@@ -0,0 +1,54 @@
+#ifndef WAVEFORMRASTERIZER_H
+#define WAVEFORMRASTERIZER_H
+
+/**
+ * @brief Программная растеризация волны прямо в строки QImage.
+ *
+ * Раньше волна рисовалась через QPainter: на каждый столбец и канал —
+ * setPen и drawLine. На 4K-мониторе это тысячи вызовов с подготовкой пера и
+ * отсечением на каждый, и именно они были основной ценой перестройки кеша волны.
+ *
+ * Здесь столбцы (min/max всех каналов) сначала переводятся в отрезки строк
+ * с цветом полосы, а затем изображение заполняется построчно: внутренний цикл
+ * по столбцам одной строки — без ветвлений на непрозрачных цветах. Результат
+ * один раз выводится на экран. Только CPU, без OpenGL — работает и без
+ * дисплея (рендер-ферма), и в окне плагина.
+ */
+
+#include <QtCore/QVector>
+#include <QtCore/QtGlobal>
+#include <QtGui/QColor>
+#include <QtGui/QImage>
+
+class WaveformRasterizer
+{
+public:
+    /** Цвет столбца по размаху max − min: меньше 0.3, меньше 0.6 и остальное. */
+    WaveformRasterizer(const QColor& low, const QColor& mid, const QColor& high);
+
+    /**
+     * Рисует \a columnCount столбцов в \a image, начиная с пикселя \a left.
+     * Значения канала ch столбца x лежат по индексу x * channelCount + ch — в
+     * том же порядке, что отдаёт WaveformPeaks::rangeAll. \a centerY — середина
+     * полосы каждого канала, \a halfHeight — высота полуволны в пикселях.
+     * Столбец всегда проходит через центр полосы и занимает хотя бы один
+     * пиксель (тишина — линия по центру).
+     *
+     * \a image — Format_ARGB32_Premultiplied или Format_RGB32; другие форматы
+     * не рисуются.
+     */
+    void draw(QImage& image, int left, int columnCount, int channelCount,
+              const float* minValues, const float* maxValues,
+              const float* centerY, float halfHeight);
+
+private:
+    quint32 bandColor_[3];      // premultiplied ARGB
+    bool opaque_ = true;        // все три цвета непрозрачны — запись без смешивания
+
+    // Отрезки строк одного канала; буферы переживают вызовы
+    QVector<int> spanTop_;
+    QVector<int> spanBottom_;
+    QVector<quint32> spanColor_;
+};
+
+#endif // WAVEFORMRASTERIZER_H
@@ -6,9 +6,11 @@
 #include <QtCore/QTimer>
 #include <QtCore/QRect>
 #include <QtCore/QPointer>
+#include <QtCore/QSet>
 #include <QtCore/QFutureWatcher>
 #include <QtGui/QPixmap>
 #include <atomic>
+#include <memory>
 #include <QtGui/QPainter>
 #include <QtGui/QWheelEvent>
 #include <QtGui/QMouseEvent>
@@ -17,13 +19,19 @@
 #include <QtGui/QFontMetrics>
 #include <QtMultimedia/QAudioBuffer>
 #include "bpmanalyzer.h"
+#include "deviationmodel.h"
 #include "waveformcolors.h"
 #include "waveformpeaks.h"
+#include "timewarpmap.h"
 #include "timeutils.h"
 #include "beatvisualizer.h"
 #include "markerengine.h"
 #include "timestretchprocessor.h"
+#include "tempomap.h"
 #include "fft_engine.h"
+#include "spectrogramcache.h"
+
+class QThreadPool;
 
 class WaveformView : public QWidget
 {
@@ -53,7 +61,7 @@ public:
 
     struct SpectrogramSettings {
         int windowSize    = 1024;   // размер FFT-окна (256/512/1024/2048)
-        int maxFrames     = 512;    // максимальное кол-во временных кадров
+        int maxFrames     = 512;    // максимум столбцов на видимую ширину (не больше ширины виджета)
         int freqBins      = 256;    // частотных полос на дисплее
         bool logFreqScale = true;   // логарифмическая шкала частот
         bool dbAmplitude  = true;   // dB амплитуда
@@ -76,14 +84,65 @@ public:
     };
 
     void setAudioData(const QVector<QVector<float>>& data);
+    /**
+     * Заменяет сэмплы с \a fromSample до конца на \a tail (дозапись захвата:
+     * fromSample = длине). Масштаб и прокрутка сохраняются, пики досчитываются
+     * только с места правки. false — так нельзя (другие каналы, включено
+     * превью растяжения и т.п.): вызывающему нужен setAudioData.
+     */
+    bool updateAudioTail(qint64 fromSample, const QVector<QVector<float>>& tail);
+    /**
+     * Правка исходного аудио без смены длины: вне [from, to) сэмплы те же, что
+     * у исходника поколения sourceGeneration (см. sourceGeneration()).
+     */
+    struct SourceEdit {
+        qint64 from = 0;
+        qint64 to = 0;
+        quint64 sourceGeneration = 0;
+    };
+    /** Поколение исходного аудио: меняется при каждой его замене. */
+    quint64 sourceGeneration() const { return audioSourceGeneration; }
+    /**
+     * setAudioData для данных, отличающихся от исходника только на \a edit:
+     * пирамида пиков исходника правится на месте (WaveformPeaks::update), а не
+     * строится заново. Исходник с тех пор сменился или правка сдвинула
+     * нормализацию канала — как обычный setAudioData.
+     */
+    void setAudioData(const QVector<QVector<float>>& data, const SourceEdit& edit);
+    /** Пирамида пиков исходного (нормированного) аудио; строится при первом запросе. */
+    const WaveformPeaks* sourcePeaks();
+    /**
+     * Готовая пирамида исходного аудио (из кеша на диске) вместо пересчёта.
+     * false — пирамида от другого аудио (число каналов или длина не сходятся).
+     */
+    bool adoptSourcePeaks(const WaveformPeaks& peaks);
     void setBeatInfo(const QVector<BPMAnalyzer::BeatInfo>& beats);
     QVector<BPMAnalyzer::BeatInfo> getBeatInfo() const { return beats; }
-    void setGridStartSample(qint64 sample) { gridStartSample = sample; update(); }
+    void setGridStartSample(qint64 sample)
+    {
+        tempoMap.shift(double(sample - gridStartSample));
+        deviationModel.shiftGrid(double(sample - gridStartSample));
+        gridStartSample = sample;
+        update();
+    }
     qint64 getGridStartSample() const { return gridStartSample; }
     /** Сдвиг начала тактовой сетки; moveMarkers — сдвинуть нефиксированные метки вместе с сеткой */
     void shiftGridBySamples(qint64 sampleDelta, bool moveMarkers = false);
     void setBPM(float bpm);
     float getBPM() const { return bpm; }
+    /**
+     * Карта переменного темпа (BPMAnalyzer::AnalysisResult::tempoMap). Пока
+     * isVariable() — сетка и привязка идут по ней, иначе по bpm и
+     * gridStartSample. Пустая карта — обычная сетка.
+     */
+    void setTempoMap(const TempoMap& map);
+    const TempoMap& getTempoMap() const { return tempoMap; }
+    /**
+     * Отклонения долей от текущей сетки (bpm и gridStartSample или карта темпа).
+     * Пересчитывается при смене долей и темпа; сдвиг сетки обновляет его на
+     * месте (DeviationModel::shiftGrid), без полного calculateDeviations.
+     */
+    const DeviationModel& getDeviationModel() const { return deviationModel; }
     void setSampleRate(int rate);
     int getSampleRate() const { return sampleRate; }
     void setPlaybackPosition(qint64 position); // position в миллисекундах
@@ -191,16 +250,50 @@ protected:
     ViewportGeometry getViewportGeometry(qint64 sampleCount, float viewWidth) const;
 
 private:
-    void drawWaveform(QPainter& painter, const QVector<float>& samples, const QRectF& rect);
     /**
-     * Пирамида пиков для канала: строится один раз на буфер и переживает
-     * перерисовки. Без неё каждый пиксель волны пересчитывался по сырым
-     * сэмплам с прореживанием (и терял короткие всплески).
+     * Окно, под которое нарисовано изображение волны. Изображение шире окна на
+     * marginColumns столбцов с каждой стороны. Только числа — снимок свободно
+     * ходит между потоками (QPixmap вне потока GUI создавать нельзя).
+     */
+    struct WaveRaster {
+        qint64 startSample = 0;         // первый видимый сэмпл окна (без поля)
+        float samplesPerPixel = 0.0f;
+        int marginColumns = 0;
+        int viewWidth = 0;
+        int viewHeight = 0;
+        float verticalOffset = 0.0f;
+        quint64 audioGeneration = 0;    // audioSourceGeneration на момент запроса
+        quint64 contentVersion = 0;     // waveContentVersion на момент запроса
+        bool warped = false;            // исходные сэмплы через карту времени меток
+    };
+    struct WaveRenderJob;
+    struct WaveRenderResult;
+
+    /** Какое изображение волны нужно окну \a vp сейчас. */
+    WaveRaster waveRasterTarget(const ViewportGeometry& vp) const;
+    /** Готовое изображение подходит к \a target — его достаточно сдвинуть. */
+    bool waveRasterCovers(const WaveRaster& target) const;
+    /** Ставит отрисовку волны под \a target в wavePool (если задача ещё не идёт). */
+    void requestWaveRaster(const WaveRaster& target);
+    void onWaveRasterReady(const std::shared_ptr<WaveRenderResult>& result);
+    /** Готовое изображение волны на своё место в окне (или растянутое, пока новое не готово). */
+    void drawWaveRaster(QPainter& painter, const WaveRaster& target);
+    /**
+     * Волна по снимку \a job (см. WaveformRasterizer); выполняется в wavePool.
+     * Бросает работу (изображение пустое), если \a audioGeneration ушло вперёд.
      */
-    const WaveformPeaks* peaksFor(const QVector<float>& samples);
+    static std::shared_ptr<WaveRenderResult> renderWaveRaster(const WaveRenderJob& job,
+                                                              const std::atomic<quint64>& audioGeneration);
+    /**
+     * Пирамида пиков всех каналов дорожки: строится один раз на набор буферов
+     * и переживает перерисовки. Без неё каждый пиксель волны пересчитывался по
+     * сырым сэмплам с прореживанием (и терял короткие всплески).
+     */
+    const WaveformPeaks* peaksFor(const QVector<QVector<float>>& channels);
     /** Аудио сменилось — пики пересчитываем заново. */
     void invalidateWavePeaks();
-    void drawWarpedWaveformPreview(QPainter& painter, const QVector<float>& samples, const QRectF& rect);
+    /** Карта времени по меткам; пересобирается, только когда метки или длина аудио сменились. */
+    const TimeWarpMap& timeWarpMap() const;
     bool needsWarpedWaveformPreview() const;
     void drawWaveformChannel(QPainter& painter, const QVector<float>& samples, const QRectF& rect);
     void drawGrid(QPainter& painter, const QRect& rect);
@@ -223,14 +316,21 @@ private:
     void adjustHorizontalOffset(float delta);
     void adjustZoomLevel(float delta);
     void applyGridStartSample(qint64 newGrid, bool moveMarkers);
+    /** Полный пересчёт deviationModel по текущим beats, bpm/карте и сетке. */
+    void refreshDeviations();
     QString getPositionText(qint64 position) const;
     QString getBarText(float beatPosition) const;
     void scheduleUpdate(const QRect& rect = QRect()); // Throttled update для производительности
-    void scheduleSpectrogramRegeneration();
-    void onSpectrogramReady();
+    /** Аудио сменилось: выбрасывает кеш плиток и отменяет ещё не досчитанные. */
+    void invalidateSpectrogram();
+    quint64 spectrogramSettingsKey() const;
+    /** Уровень пирамиды под текущий масштаб (столбцов не меньше, чем нужно экрану). */
+    int spectrogramLevelFor(const ViewportGeometry& vp) const;
+    /** Ставит в пул видимые плитки нужного уровня, которых нет в кеше. */
+    void requestSpectrogramTiles(const ViewportGeometry& vp);
+    void onSpectrogramTileReady(quint64 generation, const SpectrogramTileKey& key, const QImage& image);
+    void drawSpectrogram(QPainter& painter, const ViewportGeometry& vp);
     void invalidateWavePixmapCache();
-    void regenerateWavePixmap();
-    bool isWavePixmapCacheValid() const;
     void markMarkersCacheDirty();
     void ensureSortedMarkersCache();
 
@@ -238,13 +338,19 @@ private:
     void scheduleRealtimeProcess(); // Пометить превью устаревшим и запустить фоновый пересчёт
     void startRealtimeStretchJob(); // Запуск фоновой задачи, если она не выполняется
 
-    /** Кеш пиков одного канала: к каким сэмплам он относится. */
-    struct ChannelPeaks {
-        const float* source = nullptr;
+    /** Кеш пиков дорожки: к каким буферам каналов он относится. */
+    struct TrackPeaks {
+        QVector<const float*> sources;
         qint64 size = 0;
         WaveformPeaks peaks;
     };
-    QVector<ChannelPeaks> wavePeaks;
+    QVector<TrackPeaks> wavePeaks;
+    const TrackPeaks* findTrackPeaks(const QVector<QVector<float>>& channels) const;
+    /** Кладёт пирамиду в кеш, вытесняя самую старую (держим не больше двух). */
+    void storeTrackPeaks(TrackPeaks entry);
+    mutable TimeWarpMap timeWarp;
+    /** Пики |x| каналов до нормализации: дозапись нормализуется тем же делителем. */
+    QVector<float> audioChannelPeaks;
 
     QVector<QVector<float>> audioData;        // Текущие данные для визуализации
     QVector<QVector<float>> originalAudioData; // Исходные данные для пересчета в реальном времени
@@ -254,6 +360,8 @@ private:
     int sampleRate;
     qint64 playbackPosition;
     qint64 gridStartSample;
+    TempoMap tempoMap;  // переменный темп; доля 0 — на gridStartSample
+    DeviationModel deviationModel;  // отклонения beats от сетки (см. refreshDeviations)
     float horizontalOffset;
     float verticalOffset;
     float zoomLevel;
@@ -286,7 +394,7 @@ private:
     bool realtimeStretchJobActive;    // Сейчас выполняется фоновая задача
     bool realtimeStretchShuttingDown;
     std::atomic<int> realtimeStretchJobsRunning;
-    quint64 audioSourceGeneration;    // Инкремент при каждой загрузке/замене аудиоданных
+    std::atomic<quint64> audioSourceGeneration; // Инкремент при каждой загрузке/замене аудиоданных
     quint64 realtimeJobGeneration;    // Поколение данных, с которым запущена текущая задача
     QVector<MarkerData> realtimeJobMarkers; // Метки, с которыми запущена текущая задача
 
@@ -302,19 +410,27 @@ private:
 
     WaveformRenderMode renderMode;
     SpectrogramSettings spectrogramSettings;
-    QVector<QImage> spectrogramImages; // по одному изображению на канал
-    bool spectrogramDirty;
-    QFutureWatcher<QVector<QImage>>* spectrogramWatcher = nullptr;
-    std::atomic<bool> spectrogramComputationInProgress{false};
+    /**
+     * Плитки спектрограммы по уровням шага (см. SpectrogramCache): считаются
+     * только видимые, каждая — отдельной задачей пула, и рисуются, как только
+     * готовы. Пока плитки нужного уровня нет, на её месте рисуется соседний уровень.
+     */
+    SpectrogramCache spectrogramCache;
+    QSet<SpectrogramTileKey> spectrogramPendingTiles;  // в очереди пула или считаются
+    std::shared_ptr<SpectrogramWantedTiles> spectrogramWanted;
+    QThreadPool* spectrogramPool = nullptr;
+    std::atomic<quint64> spectrogramGeneration{0}; // плитки чужого поколения отбрасываются
 
+    /**
+     * Волна рисуется в фоне (wavePool) в изображение с полями по бокам:
+     * прокрутка в их пределах только сдвигает готовое изображение. Пока новое
+     * считается, на экране остаётся прежнее, сдвинутое и растянутое под окно.
+     */
     QPixmap cachedWavePixmap;
-    bool wavePixmapDirty = true;
-    int cachedWaveZoomKey = 0;
-    int cachedWaveHorizontalOffsetKey = 0;
-    int cachedWaveVerticalOffsetKey = 0;
-    QSize cachedWaveSize;
-    quint64 cachedWaveAudioGeneration = 0;
-    bool cachedWaveUsesWarpedPreview = false;
+    WaveRaster cachedWaveRaster;        // окно, под которое нарисован cachedWavePixmap
+    quint64 waveContentVersion = 0;     // цвета, метки, пики — всё, кроме геометрии окна
+    bool waveRenderActive = false;      // задача волны в пуле
+    QThreadPool* wavePool = nullptr;
 
     QVector<Marker> cachedSortedMarkers;
     bool markersSortDirty = true;
@@ -0,0 +1,246 @@
+#include "dontfloat_analysis_cache.h"
+
+#include <algorithm>
+#include <cstring>
+#include <list>
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <utility>
+
+namespace Dontfloat::PluginCore {
+namespace {
+
+enum class EntryKind : int {
+    Analysis,
+    Pitch,
+};
+
+struct EntryKey {
+    std::uint64_t hash = 0;
+    std::int64_t lengthFrames = 0;
+    int sampleRate = 0;
+    std::uint64_t optionsKey = 0;
+    EntryKind kind = EntryKind::Analysis;
+
+    bool operator<(const EntryKey& other) const
+    {
+        return std::tie(hash, lengthFrames, sampleRate, optionsKey, kind)
+            < std::tie(other.hash, other.lengthFrames, other.sampleRate, other.optionsKey, other.kind);
+    }
+};
+
+/** Позиции — от начала содержимого (см. rebase). */
+struct Entry {
+    EntryKey key;
+    TrackAnalysisResult analysis;
+    TrackPitchAnalysis pitch;
+};
+
+struct CacheState {
+    std::mutex mutex;
+    std::size_t capacity = SharedAnalysisCache::kDefaultCapacity;
+    /** Спереди — последние использованные. */
+    std::list<Entry> entries;
+    std::map<EntryKey, std::list<Entry>::iterator> index;
+};
+
+/** Один кеш на процесс; создаётся при первом обращении. */
+CacheState& cache()
+{
+    static CacheState state;
+    return state;
+}
+
+EntryKey makeKey(const TrackContentFingerprint& content, int sampleRate, std::uint64_t optionsKey,
+                 EntryKind kind)
+{
+    EntryKey key;
+    key.hash = content.hash;
+    key.lengthFrames = content.lengthFrames;
+    key.sampleRate = sampleRate;
+    key.optionsKey = optionsKey;
+    key.kind = kind;
+    return key;
+}
+
+void rebase(TrackAnalysisResult& result, std::int64_t delta)
+{
+    result.gridStartFrame += delta;
+    for (TrackBeat& beat : result.beats) {
+        beat.positionFrames += delta;
+        beat.expectedPositionFrames += delta;
+    }
+}
+
+void rebase(TrackPitchAnalysis& analysis, std::int64_t delta)
+{
+    for (TrackPitchNote& note : analysis.notes) {
+        note.startSample += delta;
+        note.endSample += delta;
+        if (note.sourceStartSample >= 0) {
+            note.sourceStartSample += delta;
+        }
+        if (note.sourceEndSample >= 0) {
+            note.sourceEndSample += delta;
+        }
+    }
+}
+
+void evictOverCapacity(CacheState& state)
+{
+    while (state.entries.size() > state.capacity) {
+        state.index.erase(state.entries.back().key);
+        state.entries.pop_back();
+    }
+}
+
+/** Запись по ключу (поднимается в начало) или nullptr. Под мьютексом. */
+Entry* touch(CacheState& state, const EntryKey& key)
+{
+    const auto found = state.index.find(key);
+    if (found == state.index.end()) {
+        return nullptr;
+    }
+    state.entries.splice(state.entries.begin(), state.entries, found->second);
+    return &*found->second;
+}
+
+/** Новая или прежняя запись по ключу, в начале списка. Под мьютексом. */
+Entry& insert(CacheState& state, const EntryKey& key)
+{
+    if (Entry* existing = touch(state, key)) {
+        return *existing;
+    }
+    state.entries.emplace_front();
+    state.entries.front().key = key;
+    state.index[key] = state.entries.begin();
+    evictOverCapacity(state);
+    return state.entries.front();
+}
+
+std::uint64_t mixKey(std::uint64_t hash, std::uint32_t value)
+{
+    constexpr std::uint64_t kFnvPrime = 1099511628211ULL;
+    for (int byte = 0; byte < 4; ++byte) {
+        hash = (hash ^ ((value >> (8 * byte)) & 0xFFu)) * kFnvPrime;
+    }
+    return hash;
+}
+
+std::uint64_t mixKey(std::uint64_t hash, float value)
+{
+    std::uint32_t bits = 0;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return mixKey(hash, bits);
+}
+
+} // namespace
+
+bool SharedAnalysisCache::findAnalysis(const TrackContentFingerprint& content, int sampleRate,
+                                       std::uint64_t optionsKey, TrackAnalysisResult* result)
+{
+    if (content.empty() || !result) {
+        return false;
+    }
+    CacheState& state = cache();
+    {
+        const std::lock_guard<std::mutex> lock(state.mutex);
+        const Entry* entry = touch(state, makeKey(content, sampleRate, optionsKey, EntryKind::Analysis));
+        if (!entry) {
+            return false;
+        }
+        *result = entry->analysis;
+    }
+    rebase(*result, content.startFrame);
+    return true;
+}
+
+void SharedAnalysisCache::storeAnalysis(const TrackContentFingerprint& content, int sampleRate,
+                                        std::uint64_t optionsKey, const TrackAnalysisResult& result)
+{
+    if (content.empty() || result.status != TrackToolStatus::Ok) {
+        return;
+    }
+    TrackAnalysisResult relative = result;
+    rebase(relative, -content.startFrame);
+
+    CacheState& state = cache();
+    const std::lock_guard<std::mutex> lock(state.mutex);
+    insert(state, makeKey(content, sampleRate, optionsKey, EntryKind::Analysis)).analysis =
+        std::move(relative);
+}
+
+bool SharedAnalysisCache::findPitch(const TrackContentFingerprint& content, int sampleRate,
+                                    std::uint64_t optionsKey, TrackPitchAnalysis* analysis)
+{
+    if (content.empty() || !analysis) {
+        return false;
+    }
+    CacheState& state = cache();
+    {
+        const std::lock_guard<std::mutex> lock(state.mutex);
+        const Entry* entry = touch(state, makeKey(content, sampleRate, optionsKey, EntryKind::Pitch));
+        if (!entry) {
+            return false;
+        }
+        *analysis = entry->pitch;
+    }
+    rebase(*analysis, content.startFrame);
+    return true;
+}
+
+void SharedAnalysisCache::storePitch(const TrackContentFingerprint& content, int sampleRate,
+                                     std::uint64_t optionsKey, const TrackPitchAnalysis& analysis)
+{
+    if (content.empty() || !analysis.valid) {
+        return;
+    }
+    TrackPitchAnalysis relative = analysis;
+    rebase(relative, -content.startFrame);
+
+    CacheState& state = cache();
+    const std::lock_guard<std::mutex> lock(state.mutex);
+    insert(state, makeKey(content, sampleRate, optionsKey, EntryKind::Pitch)).pitch = std::move(relative);
+}
+
+void SharedAnalysisCache::setCapacity(std::size_t entries)
+{
+    CacheState& state = cache();
+    const std::lock_guard<std::mutex> lock(state.mutex);
+    state.capacity = std::max<std::size_t>(1, entries);
+    evictOverCapacity(state);
+}
+
+std::size_t SharedAnalysisCache::size()
+{
+    CacheState& state = cache();
+    const std::lock_guard<std::mutex> lock(state.mutex);
+    return state.entries.size();
+}
+
+void SharedAnalysisCache::resetForTests()
+{
+    CacheState& state = cache();
+    const std::lock_guard<std::mutex> lock(state.mutex);
+    state.entries.clear();
+    state.index.clear();
+    state.capacity = kDefaultCapacity;
+}
+
+std::uint64_t analysisOptionsKey(const TrackAnalysisOptions& options)
+{
+    const TrackAnalysisOptions sanitized = sanitizeAnalysisOptions(options);
+    std::uint64_t hash = 1469598103934665603ULL;  // FNV-1a, как у отпечатка
+    hash = mixKey(hash, std::uint32_t(sanitized.analyzeBpm) | std::uint32_t(sanitized.analyzeKey) << 1
+                            | std::uint32_t(sanitized.assumeFixedTempo) << 2
+                            | std::uint32_t(sanitized.fastAnalysis) << 3
+                            | std::uint32_t(sanitized.useInitialBpm) << 4);
+    hash = mixKey(hash, sanitized.minBpm);
+    hash = mixKey(hash, sanitized.maxBpm);
+    hash = mixKey(hash, sanitized.useInitialBpm ? sanitized.initialBpm : 0.0f);
+    hash = mixKey(hash, std::uint32_t(sanitized.beatsPerBar));
+    return hash;
+}
+
+} // namespace Dontfloat::PluginCore
@@ -0,0 +1,62 @@
+#ifndef DONTFLOAT_ANALYSIS_CACHE_H
+#define DONTFLOAT_ANALYSIS_CACHE_H
+
+/**
+ * Общий на процесс кеш результатов анализа по отпечатку содержимого.
+ *
+ * Зачем: каждый проход DAW по дорожке заново наполняет захват, applyCaptureBlock
+ * сбрасывает pitchAnalysis_, и редакторы снова считают BPM, тональность и ноты
+ * на том же самом материале. При открытии проекта с десятками экземпляров
+ * DONTFLOAT это десятки полных анализов подряд.
+ *
+ * Ключ — отпечаток (computeContentFingerprint: хеш и длина без тишины по
+ * краям), частота дискретизации и ключ настроек анализа. Отпечаток не зависит
+ * от позиции клипа, поэтому позиции в записи хранятся от начала содержимого и
+ * при выдаче переносятся на его нынешнее место: клип, сдвинутый в DAW, тоже
+ * находится в кеше.
+ *
+ * Как и SharedNoteBoard, кеш — статика ядра: его делят все экземпляры плагина
+ * из одного бинарника в процессе хоста. Вытесняется давно не нужная запись
+ * (LRU). Все методы потокобезопасны.
+ */
+
+#include <cstddef>
+#include <cstdint>
+
+#include "dontfloat_plugin_core.h"
+
+namespace Dontfloat::PluginCore {
+
+class SharedAnalysisCache {
+public:
+    /** Записей по умолчанию: результат — доли и ноты, без сэмплов, это десятки КБ. */
+    static constexpr std::size_t kDefaultCapacity = 64;
+
+    /** BPM, доли и тональность (TrackAnalysisResult) по \a optionsKey. */
+    static bool findAnalysis(const TrackContentFingerprint& content, int sampleRate,
+                             std::uint64_t optionsKey, TrackAnalysisResult* result);
+    /** Кладёт результат со status Ok; пустой отпечаток не кешируется. */
+    static void storeAnalysis(const TrackContentFingerprint& content, int sampleRate,
+                              std::uint64_t optionsKey, const TrackAnalysisResult& result);
+
+    /** Ноты и тональности (TrackPitchAnalysis) по \a optionsKey. */
+    static bool findPitch(const TrackContentFingerprint& content, int sampleRate,
+                          std::uint64_t optionsKey, TrackPitchAnalysis* analysis);
+    /** Кладёт valid-анализ; пустой отпечаток не кешируется. */
+    static void storePitch(const TrackContentFingerprint& content, int sampleRate,
+                           std::uint64_t optionsKey, const TrackPitchAnalysis& analysis);
+
+    /** Меняет предел записей (минимум 1); лишние вытесняются сразу. */
+    static void setCapacity(std::size_t entries);
+    static std::size_t size();
+
+    /** Только для тестов: очищает кеш и возвращает предел по умолчанию. */
+    static void resetForTests();
+};
+
+/** Ключ настроек для findAnalysis: одинаков у настроек с одним результатом. */
+std::uint64_t analysisOptionsKey(const TrackAnalysisOptions& options);
+
+} // namespace Dontfloat::PluginCore
+
+#endif // DONTFLOAT_ANALYSIS_CACHE_H
@@ -0,0 +1,312 @@
+#include "dontfloat_live_beat_tracker.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+namespace Dontfloat::PluginCore {
+namespace {
+
+constexpr double kPi = 3.14159265358979323846;
+constexpr double kStepSecs = 0.01161;        // шаг onset-функции — как у анализатора
+constexpr double kCrossoverHz = 150.0;       // граница полос: бочка/бас и всё остальное
+constexpr double kEnergyScale = 1000.0;      // −20 dBFS ≈ log1p(10), тишина ≈ 0
+constexpr double kAcfSeconds = 8.0;          // память автокорреляции
+constexpr double kMeanSeconds = 1.0;         // адаптивный порог onset-функции
+constexpr double kPreferredBpm = 120.0;      // центр веса темпа
+constexpr double kPreferredWidthOctaves = 1.0;
+constexpr int kCombBeats = 4;                // периодов в гребёнке фазы
+constexpr float kCombDecay = 0.8f;           // вес более старых ударов
+constexpr double kPeriodFollow = 0.1;        // сглаживание периода при малых изменениях
+constexpr double kPeriodJumpRatio = 1.2;     // новый пик сильнее нынешнего — темп сменился
+
+int nextPowerOfTwo(int value)
+{
+    int result = 1;
+    while (result < value) {
+        result *= 2;
+    }
+    return result;
+}
+
+} // namespace
+
+void LiveBeatTracker::prepare(int sampleRate, float minBpm, float maxBpm)
+{
+    if (sampleRate <= 0) {
+        hop_ = 0;
+        return;
+    }
+    minBpm = std::clamp(minBpm, 20.0f, 400.0f);
+    maxBpm = std::clamp(maxBpm, 20.0f, 400.0f);
+    if (maxBpm < minBpm) {
+        std::swap(minBpm, maxBpm);
+    }
+
+    sampleRate_ = sampleRate;
+    hop_ = std::max(1, int(sampleRate * kStepSecs));
+    const double hopsPerSecond = double(sampleRate) / double(hop_);
+    minLag_ = std::max(1, int(std::floor(60.0 * hopsPerSecond / maxBpm)));
+    maxLag_ = std::max(minLag_ + 2, int(std::ceil(60.0 * hopsPerSecond / minBpm)));
+    lowpassCoeff_ = float(1.0 - std::exp(-2.0 * kPi * kCrossoverHz / sampleRate));
+    acfDecay_ = float(std::exp(-1.0 / (kAcfSeconds * hopsPerSecond)));
+    meanDecay_ = float(std::exp(-1.0 / (kMeanSeconds * hopsPerSecond)));
+
+    // Кольцо вмещает и удвоенный лаг автокорреляции, и гребёнку фазы
+    const int history = std::max(2 * maxLag_, (kCombBeats + 1) * maxLag_) + 1;
+    onsets_.assign(std::size_t(nextPowerOfTwo(history)), 0.0f);
+    acf_.assign(std::size_t(2 * maxLag_ + 1), 0.0);
+    score_.assign(std::size_t(maxLag_ - minLag_ + 1), 0.0f);
+    resetRequested_.store(false, std::memory_order_relaxed);
+    resetTracking();
+    publish();
+}
+
+void LiveBeatTracker::resetTracking() noexcept
+{
+    std::fill(onsets_.begin(), onsets_.end(), 0.0f);
+    std::fill(acf_.begin(), acf_.end(), 0.0);
+    nextFrame_ = -1;
+    hopEndFrame_ = 0;
+    hopCount_ = 0;
+    hopFill_ = 0;
+    lowState_ = 0.0f;
+    lowEnergy_ = 0.0;
+    highEnergy_ = 0.0;
+    prevLowLog_ = 0.0f;
+    prevHighLog_ = 0.0f;
+    onsetMean_ = 0.0f;
+    period_ = 0.0;
+    confidence_ = 0.0f;
+    lastBeatFrame_ = -1;
+}
+
+void LiveBeatTracker::process(const float* const* inputs, int channelCount, int frameCount,
+                              std::int64_t startFrame) noexcept
+{
+    if (resetRequested_.exchange(false, std::memory_order_acq_rel)) {
+        resetTracking();
+    }
+    if (!isPrepared() || !inputs || channelCount <= 0 || frameCount <= 0) {
+        return;
+    }
+
+    if (startFrame < 0) {
+        startFrame = nextFrame_ < 0 ? 0 : nextFrame_;
+    } else if (nextFrame_ >= 0 && std::llabs(startFrame - nextFrame_) > hop_) {
+        // Перемотка или новый проход DAW: прошлые доли к этому месту не относятся
+        resetTracking();
+    }
+    nextFrame_ = startFrame + frameCount;
+
+    int usedChannels = 0;
+    for (int c = 0; c < channelCount; ++c) {
+        usedChannels += inputs[c] ? 1 : 0;
+    }
+    if (usedChannels == 0) {
+        return;
+    }
+    const float channelScale = 1.0f / float(usedChannels);
+
+    for (int i = 0; i < frameCount; ++i) {
+        float x = 0.0f;
+        for (int c = 0; c < channelCount; ++c) {
+            if (inputs[c]) {
+                x += inputs[c][i];
+            }
+        }
+        x *= channelScale;
+        lowState_ += lowpassCoeff_ * (x - lowState_);
+        const float high = x - lowState_;
+        lowEnergy_ += double(lowState_) * lowState_;
+        highEnergy_ += double(high) * high;
+
+        if (++hopFill_ < hop_) {
+            continue;
+        }
+        hopEndFrame_ = startFrame + i + 1;
+        const float lowLog = float(std::log1p(kEnergyScale * lowEnergy_ / hop_));
+        const float highLog = float(std::log1p(kEnergyScale * highEnergy_ / hop_));
+        const float onset = std::max(0.0f, lowLog - prevLowLog_) + std::max(0.0f, highLog - prevHighLog_);
+        prevLowLog_ = lowLog;
+        prevHighLog_ = highLog;
+        lowEnergy_ = 0.0;
+        highEnergy_ = 0.0;
+        hopFill_ = 0;
+
+        // Над скользящим средним — чтобы ровная громкость не давала пиков
+        onsetMean_ = meanDecay_ * onsetMean_ + (1.0f - meanDecay_) * onset;
+        pushOnset(std::max(0.0f, onset - onsetMean_));
+        updateTempo();
+        updatePhase();
+    }
+    publish();
+}
+
+float LiveBeatTracker::onsetAt(int hopsAgo) const noexcept
+{
+    if (hopsAgo < 0 || std::int64_t(hopsAgo) >= hopCount_ || std::size_t(hopsAgo) >= onsets_.size()) {
+        return 0.0f;
+    }
+    const std::size_t mask = onsets_.size() - 1;
+    return onsets_[std::size_t(hopCount_ - 1 - hopsAgo) & mask];
+}
+
+void LiveBeatTracker::pushOnset(float onset) noexcept
+{
+    const std::size_t mask = onsets_.size() - 1;
+    onsets_[std::size_t(hopCount_) & mask] = onset;
+    ++hopCount_;
+    // Автокорреляция с забыванием: O(лагов) на шаг, без пересчёта окна
+    for (std::size_t lag = 0; lag < acf_.size(); ++lag) {
+        acf_[lag] = acfDecay_ * acf_[lag] + double(onset) * onsetAt(int(lag));
+    }
+}
+
+void LiveBeatTracker::updateTempo() noexcept
+{
+    if (hopCount_ < 2 * maxLag_) {
+        return;  // в кольце ещё нет двух самых длинных периодов
+    }
+    const double hopsPerSecond = double(sampleRate_) / double(hop_);
+    const double preferredLag = 60.0 * hopsPerSecond / kPreferredBpm;
+
+    int best = -1;
+    float bestScore = 0.0f;
+    double total = 0.0;
+    for (int lag = minLag_; lag <= maxLag_; ++lag) {
+        // Удвоенный лаг тоже совпадает у настоящего периода, а у половинного нет
+        const double octaves = std::log2(double(lag) / preferredLag) / kPreferredWidthOctaves;
+        const double weight = std::exp(-0.5 * octaves * octaves);
+        const float score = float(weight * (acf_[std::size_t(lag)] + 0.5 * acf_[std::size_t(2 * lag)]));
+        score_[std::size_t(lag - minLag_)] = score;
+        total += score;
+        if (score > bestScore) {
+            bestScore = score;
+            best = lag;
+        }
+    }
+    if (best < 0 || bestScore <= 0.0f) {
+        confidence_ = 0.0f;
+        return;
+    }
+
+    // Дробный лаг — парабола по соседям пика
+    double lag = best;
+    if (best > minLag_ && best < maxLag_) {
+        const double left = score_[std::size_t(best - 1 - minLag_)];
+        const double right = score_[std::size_t(best + 1 - minLag_)];
+        const double denominator = left - 2.0 * bestScore + right;
+        if (denominator < 0.0) {
+            lag += std::clamp(0.5 * (left - right) / denominator, -0.5, 0.5);
+        }
+    }
+    // Шаг ~11.6 мс грубоват для BPM: пик на удвоенном лаге делит ошибку пополам
+    const int doubled = int(std::lround(2.0 * lag));
+    if (doubled - 2 >= 1 && doubled + 2 < int(acf_.size())) {
+        int peak = doubled;
+        for (int l = doubled - 2; l <= doubled + 2; ++l) {
+            if (acf_[std::size_t(l)] > acf_[std::size_t(peak)]) {
+                peak = l;
+            }
+        }
+        if (peak > doubled - 2 && peak < doubled + 2) {
+            const double left = acf_[std::size_t(peak - 1)];
+            const double center = acf_[std::size_t(peak)];
+            const double right = acf_[std::size_t(peak + 1)];
+            const double denominator = left - 2.0 * center + right;
+            if (denominator < 0.0) {
+                lag = 0.5 * (peak + std::clamp(0.5 * (left - right) / denominator, -0.5, 0.5));
+            }
+        }
+    }
+
+    // Мелкие колебания пика сглаживаются, явная смена темпа — сразу
+    if (period_ > 0.0 && std::abs(lag / period_ - 1.0) < 0.04) {
+        period_ += kPeriodFollow * (lag - period_);
+    } else {
+        const int current = int(std::lround(period_));
+        const float currentScore = current >= minLag_ && current <= maxLag_
+            ? score_[std::size_t(current - minLag_)] : 0.0f;
+        if (period_ <= 0.0 || bestScore > kPeriodJumpRatio * currentScore) {
+            period_ = lag;
+        }
+    }
+
+    const double mean = total / double(maxLag_ - minLag_ + 1);
+    const double warmup = std::min(1.0, double(hopCount_) / double(4 * maxLag_));
+    confidence_ = float(std::clamp((bestScore - mean) / bestScore, 0.0, 1.0) * warmup);
+}
+
+void LiveBeatTracker::updatePhase() noexcept
+{
+    if (period_ <= 0.0) {
+        return;
+    }
+    // Гребёнка: сколько шагов назад был последний удар, если удары идут с периодом
+    const int periodHops = std::max(1, int(std::ceil(period_)));
+    int bestOffset = -1;
+    float bestScore = 0.0f;
+    for (int offset = 0; offset < periodHops; ++offset) {
+        float score = 0.0f;
+        float weight = 1.0f;
+        for (int k = 0; k < kCombBeats; ++k) {
+            score += weight * onsetAt(offset + int(std::lround(k * period_)));
+            weight *= kCombDecay;
+        }
+        if (score > bestScore) {
+            bestScore = score;
+            bestOffset = offset;
+        }
+    }
+    if (bestOffset >= 0) {
+        // Прирост энергии шага относится к его середине
+        lastBeatFrame_ = hopEndFrame_ - std::int64_t(bestOffset) * hop_ - hop_ / 2;
+    }
+}
+
+void LiveBeatTracker::publish() noexcept
+{
+    float bpm = 0.0f;
+    float phase = 0.0f;
+    if (period_ > 0.0) {
+        const double beatFrames = period_ * hop_;
+        bpm = float(60.0 * sampleRate_ / beatFrames);
+        if (lastBeatFrame_ >= 0) {
+            const double elapsed = double(nextFrame_ - lastBeatFrame_) / beatFrames;
+            phase = float(elapsed - std::floor(elapsed));
+        }
+    }
+
+    const std::uint32_t sequence = sequence_.load(std::memory_order_relaxed);
+    sequence_.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    publishedBpm_.store(bpm, std::memory_order_relaxed);
+    publishedConfidence_.store(period_ > 0.0 ? confidence_ : 0.0f, std::memory_order_relaxed);
+    publishedPhase_.store(phase, std::memory_order_relaxed);
+    publishedBeatFrame_.store(period_ > 0.0 ? lastBeatFrame_ : -1, std::memory_order_relaxed);
+    publishedFrame_.store(std::max<std::int64_t>(0, nextFrame_), std::memory_order_relaxed);
+    sequence_.store(sequence + 2, std::memory_order_release);
+}
+
+LiveBeatState LiveBeatTracker::state() const noexcept
+{
+    LiveBeatState out;
+    for (;;) {
+        const std::uint32_t before = sequence_.load(std::memory_order_acquire);
+        if (before & 1u) {
+            continue;  // аудиопоток как раз пишет — снимок займёт наносекунды
+        }
+        out.bpm = publishedBpm_.load(std::memory_order_relaxed);
+        out.confidence = publishedConfidence_.load(std::memory_order_relaxed);
+        out.beatPhase = publishedPhase_.load(std::memory_order_relaxed);
+        out.lastBeatFrame = publishedBeatFrame_.load(std::memory_order_relaxed);
+        out.frame = publishedFrame_.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (sequence_.load(std::memory_order_relaxed) == before) {
+            return out;
+        }
+    }
+}
+
+} // namespace Dontfloat::PluginCore
@@ -0,0 +1,114 @@
+#ifndef DONTFLOAT_LIVE_BEAT_TRACKER_H
+#define DONTFLOAT_LIVE_BEAT_TRACKER_H
+
+/**
+ * @brief Причинный трекер темпа и долей прямо в аудиопотоке (`process()`).
+ *
+ * Плагин видел темп только после того, как DAW доиграет дорожку: захват
+ * копился в HostCaptureQueue, а анализ стартовал по паузе в потоке блоков
+ * (autoAnalysisTimer_ редактора) и проходил трек целиком. Пока DAW играет,
+ * сетки на волне не было.
+ *
+ * Этот трекер смотрит только в прошлое и работает по блокам хоста:
+ * - onset-функция — положительный прирост логарифма энергии в двух полосах
+ *   (ниже ~150 Гц и выше), по одному значению на шаг ~11.6 мс, как у onset
+ *   qm-dsp в анализаторе;
+ * - кольцо onset-значений фиксированного размера и автокорреляция по нему
+ *   с забыванием (~8 с): на каждом шаге обновляются только лаги диапазона
+ *   BPM, O(лагов);
+ * - темп — пик автокорреляции с учётом удвоенного лага и весом вокруг 120
+ *   BPM, фаза — гребёнка из нескольких периодов по кольцу.
+ *
+ * Память выделяется только в prepare(); process() не выделяет, не
+ * блокируется и тратит на блок не больше O(шагов × лагов). Результат
+ * публикуется через атомики (seqlock): state() из любого потока отдаёт
+ * согласованный снимок без блокировок.
+ */
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+namespace Dontfloat::PluginCore {
+
+/** Снимок живого трекера. Кадры — в координатах захвата (см. process()). */
+struct LiveBeatState {
+    float bpm = 0.0f;                 ///< 0 — темп ещё не найден
+    float confidence = 0.0f;          ///< 0..1: насколько выражен пик темпа
+    float beatPhase = 0.0f;           ///< 0..1: часть доли, прошедшая с последнего удара
+    std::int64_t lastBeatFrame = -1;  ///< кадр последней доли; −1 — долей ещё нет
+    std::int64_t frame = 0;           ///< конец последнего обработанного блока
+};
+
+class LiveBeatTracker {
+public:
+    /** Выделяет буферы под частоту. Не из аудиопотока. */
+    void prepare(int sampleRate, float minBpm = 60.0f, float maxBpm = 200.0f);
+    bool isPrepared() const { return hop_ > 0; }
+
+    /**
+     * Аудиопоток: блок хоста. Без выделений памяти и блокировок.
+     * @param startFrame позиция блока на таймлайне; отрицательная — сразу за
+     *        предыдущим. Скачок позиции (перемотка, новый проход) начинает
+     *        слежение заново.
+     */
+    void process(const float* const* inputs, int channelCount, int frameCount,
+                 std::int64_t startFrame) noexcept;
+
+    /** Любой поток: сброс выполнится в начале следующего process(). */
+    void requestReset() noexcept { resetRequested_.store(true, std::memory_order_release); }
+
+    /** Любой поток: последний опубликованный снимок. */
+    LiveBeatState state() const noexcept;
+
+private:
+    void resetTracking() noexcept;
+    void pushOnset(float onset) noexcept;
+    void updateTempo() noexcept;
+    void updatePhase() noexcept;
+    void publish() noexcept;
+    float onsetAt(int hopsAgo) const noexcept;
+
+    // Параметры (prepare)
+    int sampleRate_ = 0;
+    int hop_ = 0;                 // кадров на шаг onset-функции
+    int minLag_ = 0;              // лаги в шагах для maxBpm / minBpm
+    int maxLag_ = 0;
+    float lowpassCoeff_ = 0.0f;
+    float acfDecay_ = 0.0f;
+    float meanDecay_ = 0.0f;
+
+    // Буферы фиксированного размера
+    std::vector<float> onsets_;   // кольцо, размер — степень двойки
+    std::vector<double> acf_;     // 0..2*maxLag_
+    std::vector<float> score_;    // minLag_..maxLag_
+
+    // Состояние слежения (только аудиопоток)
+    std::int64_t nextFrame_ = -1;
+    std::int64_t hopEndFrame_ = 0;
+    std::int64_t hopCount_ = 0;
+    int hopFill_ = 0;
+    float lowState_ = 0.0f;
+    double lowEnergy_ = 0.0;
+    double highEnergy_ = 0.0;
+    float prevLowLog_ = 0.0f;
+    float prevHighLog_ = 0.0f;
+    float onsetMean_ = 0.0f;
+    double period_ = 0.0;         // период доли в шагах; 0 — не найден
+    float confidence_ = 0.0f;
+    std::int64_t lastBeatFrame_ = -1;
+
+    std::atomic<bool> resetRequested_ { false };
+
+    // Публикация: seqlock, нечётный номер — запись идёт
+    std::atomic<std::uint32_t> sequence_ { 0 };
+    std::atomic<float> publishedBpm_ { 0.0f };
+    std::atomic<float> publishedConfidence_ { 0.0f };
+    std::atomic<float> publishedPhase_ { 0.0f };
+    std::atomic<std::int64_t> publishedBeatFrame_ { -1 };
+    std::atomic<std::int64_t> publishedFrame_ { 0 };
+};
+
+} // namespace Dontfloat::PluginCore
+
+#endif // DONTFLOAT_LIVE_BEAT_TRACKER_H
@@ -1,8 +1,11 @@
 #include "dontfloat_plugin_core.h"
+#include "dontfloat_analysis_cache.h"
+#include "dontfloat_track_analysis.h"
 
 #include <algorithm>
 #include <cmath>
 #include <cstdlib>
+#include <utility>
 
 namespace Dontfloat::PluginCore {
 namespace {
@@ -159,8 +162,15 @@ void HostCaptureQueue::clear() noexcept
     overflow_.store(false, std::memory_order_relaxed);
 }
 
+TrackToolSession::~TrackToolSession()
+{
+    stopAnalysis();
+}
+
 void TrackToolSession::reset()
 {
+    stopAnalysis();
+    liveBeat_.requestReset();
     audioInfo_ = {};
     analysisOptions_ = {};
     analysis_ = {};
@@ -168,6 +178,7 @@ void TrackToolSession::reset()
     renderOptions_ = {};
     markers_.clear();
     audioBuffer_ = {};
+    captureDirtyFrame_ = 0;
     pitchAnalysis_ = {};
     prepared_ = false;
     analysisValid_ = false;
@@ -176,6 +187,11 @@ void TrackToolSession::reset()
 
 TrackToolStatus TrackToolSession::prepare(const TrackAudioInfo& audioInfo)
 {
+    // Хост зовёт prepare (activate) не из аудиопотока и не во время process():
+    // здесь живой трекер и выделяет свои буферы
+    if (isValidAudioInfo(audioInfo)) {
+        liveBeat_.prepare(audioInfo.sampleRate);
+    }
     return setAudioInfo(audioInfo);
 }
 
@@ -200,7 +216,9 @@ TrackToolStatus TrackToolSession::setAudioBuffer(const TrackAudioBuffer& buffer)
         return TrackToolStatus::InvalidAudioInfo;
     }
 
+    stopAnalysis();
     audioBuffer_ = buffer;
+    captureDirtyFrame_ = 0;
     if (audioBuffer_.channelCount <= 0) {
         audioBuffer_.channelCount = audioBuffer_.right.empty() ? 1 : 2;
     }
@@ -228,6 +246,7 @@ TrackToolStatus TrackToolSession::writeHostFrames(const float* const* inputs,
         return TrackToolStatus::InvalidAudioInfo;
     }
     capture_.push(inputs, channelCount, frameCount, timelineFrame);
+    liveBeat_.process(inputs, channelCount, frameCount, timelineFrame);
     return TrackToolStatus::Ok;
 }
 
@@ -248,6 +267,13 @@ bool TrackToolSession::captureOverflowed()
     return capture_.takeOverflow();
 }
 
+std::int64_t TrackToolSession::takeCaptureDirtyFrame()
+{
+    const std::int64_t frame = captureDirtyFrame_;
+    captureDirtyFrame_ = -1;
+    return frame;
+}
+
 TrackToolStatus TrackToolSession::applyCaptureBlock(const HostCaptureQueue::Block& block)
 {
     const int channelCount = block.channelCount;
@@ -259,6 +285,8 @@ TrackToolStatus TrackToolSession::applyCaptureBlock(const HostCaptureQueue::Bloc
 
     const float* left = block.left.data();
     const float* right = block.right.empty() ? nullptr : block.right.data();
+    // Фоновый анализ читает audioBuffer_ на месте — буфер меняется, результат устарел
+    stopAnalysis();
 
     // Host-captured audio must use the sample rate the plugin was activated with,
     // not the TrackAudioBuffer default (44100). Otherwise analysis (BPM/pitch)
@@ -290,6 +318,7 @@ TrackToolStatus TrackToolSession::applyCaptureBlock(const HostCaptureQueue::Bloc
             audioBuffer_.left.clear();
             audioBuffer_.right.clear();
             audioBuffer_.mono.clear();
+            captureDirtyFrame_ = 0;
         }
     }
 
@@ -309,6 +338,8 @@ TrackToolStatus TrackToolSession::applyCaptureBlock(const HostCaptureQueue::Bloc
         }
     }
     lastWriteEndFrame_ = static_cast<std::int64_t>(requiredSize);
+    captureDirtyFrame_ = captureDirtyFrame_ < 0 ? writeStart
+                                                : std::min(captureDirtyFrame_, writeStart);
 
     rebuildMonoFromChannels(audioBuffer_);
     pitchAnalysis_ = {};
@@ -369,11 +400,14 @@ bool TrackToolSession::readRenderedOutput(float* const* outputs, int channelCoun
 void TrackToolSession::clearHostCapture()
 {
     // Незабранные блоки тоже выбрасываем: иначе они всплывут после сброса
+    stopAnalysis();
     capture_.clear();
+    liveBeat_.requestReset();
     audioBuffer_ = {};
     pitchAnalysis_ = {};
     clearRenderedOutput();
     lastWriteEndFrame_ = 0;
+    captureDirtyFrame_ = 0;
     prepared_ = false;
     analysisValid_ = false;
 }
@@ -388,22 +422,118 @@ TrackToolStatus TrackToolSession::analyze(const TrackAnalysisOptions& options, T
         return TrackToolStatus::NotPrepared;
     }
 
+    stopAnalysis();
     analysisOptions_ = sanitizeAnalysisOptions(options);
-    analysis_ = {};
-    analysis_.status = TrackToolStatus::Ok;
-    analysis_.isFixedTempo = analysisOptions_.assumeFixedTempo;
-    analysis_.bpm = analysisOptions_.useInitialBpm ? analysisOptions_.initialBpm : 0.0f;
-    analysis_.bpmConfidence = analysisOptions_.useInitialBpm ? 1.0f : 0.0f;
-    analysis_.gridStartFrame = 0;
-    analysis_.chroma.assign(12, 0.0f);
-
-    analysisValid_ = true;
+    TrackAnalysisResult analyzed;
+    // Тот же материал уже разбирали (другой экземпляр или прошлый проход DAW)
+    const TrackContentFingerprint content = computeContentFingerprint(audioBuffer_);
+    const std::uint64_t optionsKey = analysisOptionsKey(analysisOptions_);
+    const bool cached =
+        SharedAnalysisCache::findAnalysis(content, audioBuffer_.sampleRate, optionsKey, &analyzed);
+    if (!cached && !audioBuffer_.empty()
+        && analyzeTrackAudio(audioBuffer_, analysisOptions_, &analyzed) != TrackToolStatus::Unsupported) {
+        SharedAnalysisCache::storeAnalysis(content, audioBuffer_.sampleRate, optionsKey, analyzed);
+    } else if (!cached) {
+        // Анализировать нечего (или сборка без qm-dsp): известный темп и нулевая хрома
+        analyzed = {};
+        analyzed.status = TrackToolStatus::Ok;
+        analyzed.isFixedTempo = analysisOptions_.assumeFixedTempo;
+        analyzed.bpm = analysisOptions_.useInitialBpm ? analysisOptions_.initialBpm : 0.0f;
+        analyzed.bpmConfidence = analysisOptions_.useInitialBpm ? 1.0f : 0.0f;
+        analyzed.gridStartFrame = 0;
+        analyzed.chroma.assign(12, 0.0f);
+    }
     if (result) {
-        *result = analysis_;
+        *result = analyzed;
     }
+    if (analyzed.status != TrackToolStatus::Ok) {
+        return analyzed.status;
+    }
+    analysis_ = std::move(analyzed);
+    analysisValid_ = true;
     return TrackToolStatus::Ok;
 }
 
+TrackToolStatus TrackToolSession::startAnalysis(const TrackAnalysisOptions& options)
+{
+    stopAnalysis();
+    if (!prepared_) {
+        return TrackToolStatus::NotPrepared;
+    }
+    if (audioBuffer_.empty()) {
+        return TrackToolStatus::InvalidAudioInfo;
+    }
+
+    analysisOptions_ = sanitizeAnalysisOptions(options);
+    pendingAnalysis_ = {};
+    analysisCancel_.store(false, std::memory_order_relaxed);
+    analysisProgress_.store(0, std::memory_order_relaxed);
+    analysisDone_.store(false, std::memory_order_relaxed);
+
+    // Из кеша — сразу, без потока: takeAnalysisResult отдаст результат
+    const TrackContentFingerprint content = computeContentFingerprint(audioBuffer_);
+    const std::uint64_t optionsKey = analysisOptionsKey(analysisOptions_);
+    if (SharedAnalysisCache::findAnalysis(content, audioBuffer_.sampleRate, optionsKey, &pendingAnalysis_)) {
+        analysisProgress_.store(100, std::memory_order_relaxed);
+        analysisDone_.store(true, std::memory_order_release);
+        return TrackToolStatus::Ok;
+    }
+
+    // Поток трогает только audioBuffer_ (читает) и pending-поля; буфер не
+    // меняется, пока он жив, — об этом заботится stopAnalysis()
+    analysisThread_ = std::thread([this, content, optionsKey, options = analysisOptions_]() {
+        analyzeTrackAudio(audioBuffer_, options, &pendingAnalysis_, &analysisCancel_,
+                          [this](int percent) {
+                              analysisProgress_.store(percent, std::memory_order_relaxed);
+                          });
+        SharedAnalysisCache::storeAnalysis(content, audioBuffer_.sampleRate, optionsKey, pendingAnalysis_);
+        analysisDone_.store(true, std::memory_order_release);
+    });
+    return TrackToolStatus::Ok;
+}
+
+void TrackToolSession::cancelAnalysis()
+{
+    stopAnalysis();
+}
+
+bool TrackToolSession::isAnalysisRunning() const
+{
+    return analysisThread_.joinable() && !analysisDone_.load(std::memory_order_acquire);
+}
+
+bool TrackToolSession::takeAnalysisResult(TrackAnalysisResult* result)
+{
+    if (!analysisDone_.load(std::memory_order_acquire)) {
+        return false;
+    }
+    if (analysisThread_.joinable()) {
+        analysisThread_.join();
+    }
+    analysisDone_.store(false, std::memory_order_relaxed);
+    if (pendingAnalysis_.status == TrackToolStatus::Ok) {
+        analysis_ = pendingAnalysis_;
+        analysisValid_ = true;
+    }
+    if (result) {
+        *result = std::move(pendingAnalysis_);
+    }
+    pendingAnalysis_ = {};
+    return true;
+}
+
+void TrackToolSession::stopAnalysis()
+{
+    if (analysisThread_.joinable()) {
+        analysisCancel_.store(true, std::memory_order_relaxed);
+        analysisThread_.join();
+    }
+    analysisCancel_.store(false, std::memory_order_relaxed);
+    analysisDone_.store(false, std::memory_order_relaxed);
+    analysisProgress_.store(0, std::memory_order_relaxed);
+    pendingAnalysis_ = {};
+}
+
 TrackToolStatus TrackToolSession::render(const TrackRenderRequest& request, TrackRenderResult* result)
 {
     if (!prepared_) {
@@ -459,6 +589,7 @@ TrackAnalysisOptions sanitizeAnalysisOptions(const TrackAnalysisOptions& options
     if (out.useInitialBpm && out.initialBpm <= 0.0f) {
         out.useInitialBpm = false;
     }
+    out.beatsPerBar = std::clamp(out.beatsPerBar, 1, 32);
     return out;
 }
 
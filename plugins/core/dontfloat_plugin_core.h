@@ -4,8 +4,11 @@
 #include <atomic>
 #include <cstddef>
 #include <cstdint>
+#include <thread>
 #include <vector>
 
+#include "dontfloat_live_beat_tracker.h"
+
 namespace Dontfloat::PluginCore {
 
 enum class TrackToolStatus {
@@ -14,6 +17,7 @@ enum class TrackToolStatus {
     NotPrepared,
     InvalidRenderRequest,
     Unsupported,
+    Cancelled,
 };
 
 enum class TrackKey : int {
@@ -80,6 +84,8 @@ struct TrackAnalysisOptions {
     float maxBpm = 200.0f;
     float initialBpm = 0.0f;
     bool useInitialBpm = false;
+    /** Долей в такте: по нему ищется сильная доля (см. gridStartFrame). */
+    int beatsPerBar = 4;
 };
 
 struct TrackAnalysisResult {
@@ -89,6 +95,7 @@ struct TrackAnalysisResult {
     bool isFixedTempo = true;
     bool hasIrregularBeats = false;
     float averageBeatDeviationFrames = 0.0f;
+    /** Начало первого такта (сильная доля), как BPMAnalyzer::barStartSample. */
     std::int64_t gridStartFrame = 0;
 
     TrackKeyInfo primaryKey;
@@ -239,12 +246,41 @@ private:
 class TrackToolSession {
 public:
     TrackToolSession() = default;
+    ~TrackToolSession();
+    TrackToolSession(const TrackToolSession&) = delete;
+    TrackToolSession& operator=(const TrackToolSession&) = delete;
 
     void reset();
     TrackToolStatus prepare(const TrackAudioInfo& audioInfo);
     TrackToolStatus setAudioInfo(const TrackAudioInfo& audioInfo);
 
+    /**
+     * Анализ BPM, долей и тональности захваченного буфера (analyzeTrackAudio),
+     * синхронно. Без буфера или без qm-dsp — только известный темп
+     * (useInitialBpm) и нулевая хрома, как раньше. Результат по тому же
+     * материалу и настройкам берётся из SharedAnalysisCache.
+     */
     TrackToolStatus analyze(const TrackAnalysisOptions& options, TrackAnalysisResult* result);
+
+    /**
+     * Тот же анализ в фоновом потоке — для обёрток формата, которым нужен
+     * темп без открытого редактора. Поток читает audioBuffer() на месте, без
+     * копии; всё, что меняет буфер (захват, setAudioBuffer, reset), сначала
+     * отменяет анализ и дожидается потока. Повторный запуск отменяет прежний.
+     * Результат из кеша готов сразу, поток тогда не запускается.
+     * @return NotPrepared или InvalidAudioInfo (буфер пуст) — поток не запущен.
+     */
+    TrackToolStatus startAnalysis(const TrackAnalysisOptions& options);
+    /** Отменяет фоновый анализ и ждёт поток; результат не появится. */
+    void cancelAnalysis();
+    bool isAnalysisRunning() const;
+    /** Прогресс фонового анализа 0..100. */
+    int analysisProgress() const { return analysisProgress_.load(std::memory_order_relaxed); }
+    /**
+     * Забирает готовый результат фонового анализа: при Ok он становится
+     * analysis(). false — анализ ещё идёт или не запускался.
+     */
+    bool takeAnalysisResult(TrackAnalysisResult* result);
     TrackToolStatus render(const TrackRenderRequest& request, TrackRenderResult* result);
 
     TrackToolStatus setAudioBuffer(const TrackAudioBuffer& buffer);
@@ -258,6 +294,12 @@ public:
      */
     TrackToolStatus writeHostFrames(const float* const* inputs, int channelCount, int frameCount,
                                     std::int64_t timelineFrame);
+    /**
+     * Темп и доли того, что DAW играет прямо сейчас (LiveBeatTracker кормится
+     * из writeHostFrames). Любой поток; кадры — те же, что у audioBuffer().
+     * Готов после prepare() — до конца прохода и полного анализа.
+     */
+    LiveBeatState liveBeat() const { return liveBeat_.state(); }
     /**
      * Разбирает очередь захвата в общий буфер. **Только поток интерфейса.**
      * Всё, что раньше делал writeHostFrames (resize, склейка проходов,
@@ -268,6 +310,12 @@ public:
     /** Были ли потери блоков с прошлой проверки (интерфейс не успевал). */
     bool captureOverflowed();
     void clearHostCapture();
+    /**
+     * Самый ранний кадр audioBuffer(), изменённый с прошлого вызова: кадры до
+     * него те же, что видел интерфейс, и волну можно досчитать с этого места.
+     * -1 — ничего не менялось, 0 — буфер заменён целиком (новый проход и т.п.).
+     */
+    std::int64_t takeCaptureDirtyFrame();
 
     /**
      * Готовый результат работы плагина (коррекция высот, растяжение и т.п.).
@@ -308,6 +356,8 @@ public:
 private:
     /** Применяет один разобранный блок к общему буферу (поток интерфейса). */
     TrackToolStatus applyCaptureBlock(const HostCaptureQueue::Block& block);
+    /** Отменяет фоновый анализ и ждёт поток — перед любой правкой audioBuffer_. */
+    void stopAnalysis();
 
     TrackAudioInfo audioInfo_;
     TrackAnalysisOptions analysisOptions_;
@@ -320,6 +370,8 @@ private:
     HostCaptureQueue capture_;
     /** Переиспользуемый приёмник для pop() — чтобы не выделять на каждый блок. */
     HostCaptureQueue::Block captureBlock_;
+    /** Живой темп: process() — аудиопоток, prepare() — в prepare() сессии. */
+    LiveBeatTracker liveBeat_;
 
     TrackAudioBuffer audioBuffer_;
     /** Обработанный звук, который плагин отдаёт в выход (см. setRenderedOutput). */
@@ -329,10 +381,19 @@ private:
 
     /** Конец последней записи по таймлайну: по нему видно новый проход DAW. */
     std::int64_t lastWriteEndFrame_ = 0;
+    /** См. takeCaptureDirtyFrame(). */
+    std::int64_t captureDirtyFrame_ = -1;
     std::uint32_t version_ = 1;
     bool prepared_ = false;
     bool analysisValid_ = false;
     bool markersValid_ = false;
+
+    // Фоновый анализ (startAnalysis): поток пишет только pending-поля и флаги
+    std::thread analysisThread_;
+    std::atomic<bool> analysisCancel_ { false };
+    std::atomic<bool> analysisDone_ { false };
+    std::atomic<int> analysisProgress_ { 0 };
+    TrackAnalysisResult pendingAnalysis_;
 };
 
 bool isValidAudioInfo(const TrackAudioInfo& audioInfo);
@@ -0,0 +1,436 @@
+#include "dontfloat_track_analysis.h"
+
+#include "../../include/beatgridfit.h"
+#include "../../include/keyprofile.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#ifdef USE_MIXXX_QM_DSP
+#include <dsp/keydetection/GetKeyMode.h>
+#include <dsp/onsets/DetectionFunction.h>
+#include <dsp/rateconversion/Decimator.h>
+#include <dsp/tempotracking/TempoTrackV2.h>
+#endif
+
+namespace Dontfloat::PluginCore {
+namespace {
+
+// Параметры — те же, что у OnsetStream, BPMAnalyzer и KeyAnalyzer в приложении
+constexpr double kStepSecs = 0.01161;        // шаг onset-функции, ~12 мс
+constexpr int kMaximumBinSizeHz = 50;        // окно onset-функции: бин не шире 50 Гц
+constexpr int kOnsetStepsPerBlock = 256;     // между блоками — прогресс и отмена
+constexpr int kDownbeatDecimation = 16;      // как OnsetStream::kDownbeatDecimation
+constexpr int kDecimateBlock = 1024;
+constexpr float kTolerancePercent = 5.0f;    // BPMAnalyzer::AnalysisOptions::tolerancePercent
+constexpr float kTuningFrequency = 440.0f;
+constexpr float kKeyChangeThreshold = 0.3f;  // KeyAnalyzer::AnalysisOptions::keyChangeThreshold
+constexpr int kKeyFramesPerBlock = 64;
+constexpr int kKeyCount = KeyProfile::kKeyCount;
+
+#ifdef USE_MIXXX_QM_DSP
+
+bool isCancelled(const std::atomic<bool>* cancel)
+{
+    return cancel && cancel->load(std::memory_order_relaxed);
+}
+
+/** Прогресс без повторов; от \a from до \a to — доля этапа в общем анализе. */
+class ProgressRange {
+public:
+    ProgressRange(const TrackAnalysisProgress& callback, int from, int to)
+        : callback_(callback), from_(from), to_(to) {}
+
+    /** \a fraction — готовая часть этапа, 0..1. */
+    void report(double fraction) const
+    {
+        if (!callback_) {
+            return;
+        }
+        const int percent = from_ + int(std::lround((to_ - from_) * std::clamp(fraction, 0.0, 1.0)));
+        callback_(std::clamp(percent, 0, 100));
+    }
+
+private:
+    const TrackAnalysisProgress& callback_;
+    int from_;
+    int to_;
+};
+
+int nextPowerOfTwo(int value)
+{
+    int result = 1;
+    while (result < value) {
+        result *= 2;
+    }
+    return result;
+}
+
+/** Доли TempoTrackV2 и попутно прорежённый для DownBeat сигнал. */
+struct TrackedBeats {
+    std::vector<std::int64_t> positions;
+    std::vector<float> energy;
+    std::vector<float> decimated;
+};
+
+bool trackBeats(const std::vector<float>& mono, int sampleRate, TrackedBeats& out,
+                const std::atomic<bool>* cancel, const ProgressRange& onsetProgress,
+                const ProgressRange& trackerProgress)
+{
+    const std::size_t total = mono.size();
+    const int stepSize = std::max(1, int(sampleRate * kStepSecs));
+    const int windowSize = nextPowerOfTwo(sampleRate / kMaximumBinSizeHz);
+
+    DFConfig config;
+    config.DFType = DF_COMPLEXSD;
+    config.stepSize = stepSize;
+    config.frameLength = windowSize;
+    config.dbRise = 3;
+    config.adaptiveWhitening = false;
+    config.whiteningRelaxCoeff = -1;
+    config.whiteningFloor = -1;
+    DetectionFunction detection(config);
+
+    // ×16 — двумя ступенями, как в OnsetStream: фильтры Decimator есть до ×8
+    Decimator decimator8(kDecimateBlock, 8);
+    Decimator decimator2(kDecimateBlock / 8, kDownbeatDecimation / 8);
+    std::vector<float> stage(kDecimateBlock / 8);
+    const std::size_t decimateBlocks = total / kDecimateBlock;
+    out.decimated.assign(decimateBlocks * (kDecimateBlock / kDownbeatDecimation), 0.0f);
+    std::size_t decimatedBlocks = 0;
+    const auto decimateUpTo = [&](std::size_t sampleEnd) {
+        for (; decimatedBlocks < decimateBlocks && (decimatedBlocks + 1) * kDecimateBlock <= sampleEnd;
+             ++decimatedBlocks) {
+            decimator8.process(mono.data() + decimatedBlocks * kDecimateBlock, stage.data());
+            decimator2.process(stage.data(),
+                               out.decimated.data() + decimatedBlocks * (kDecimateBlock / kDownbeatDecimation));
+        }
+    };
+
+    // Окна с началом i, за которыми есть ещё сэмпл (i < size - windowSize), как в
+    // OnsetStream. Окно в double сдвигается на шаг: каждый сэмпл переводится один раз
+    const std::size_t window = std::size_t(windowSize);
+    const std::size_t step = std::size_t(stepSize);
+    const std::size_t frameCount = total > window ? (total - window + step - 1) / step : 0;
+    std::vector<double> frame(window);
+    std::vector<double> df;
+    df.reserve(frameCount);
+    for (std::size_t index = 0; index < frameCount; ++index) {
+        const std::size_t start = index * step;
+        std::size_t kept = 0;
+        if (index > 0 && step < window) {
+            kept = window - step;
+            std::memmove(frame.data(), frame.data() + step, kept * sizeof(double));
+        }
+        for (std::size_t j = kept; j < window; ++j) {
+            frame[j] = mono[start + j];
+        }
+        df.push_back(detection.processTimeDomain(frame.data()));
+
+        if ((index + 1) % kOnsetStepsPerBlock == 0) {
+            if (isCancelled(cancel)) {
+                return false;
+            }
+            decimateUpTo(start);
+            onsetProgress.report(double(index + 1) / double(frameCount));
+        }
+    }
+    decimateUpTo(total);
+    onsetProgress.report(1.0);
+
+    // TempoTrackV2 — как BPMAnalyzer::trackBeats: первые два значения пропускаются
+    if (df.size() < 5 || isCancelled(cancel)) {
+        return !isCancelled(cancel);
+    }
+    df.erase(df.begin(), df.begin() + 2);
+
+    TempoTrackV2 tracker(float(sampleRate), stepSize);
+    // Путь Viterbi бывает длиннее грубой оценки df/128 — буфер по длине df
+    std::vector<int> beatPeriod(df.size(), 0);
+    tracker.calculateBeatPeriod(df, beatPeriod);
+    if (isCancelled(cancel)) {
+        return false;
+    }
+    trackerProgress.report(0.75);
+
+    // Хвост после Viterbi остаётся нулём, а период 0 — деление на ноль в
+    // calculateBeats; слишком длинный период ломает индексацию
+    const int maxPeriod = std::max(1, int(df.size()) - 1);
+    int carry = 1;
+    for (int& period : beatPeriod) {
+        if (period > 0) {
+            carry = period;
+        } else {
+            period = carry;
+        }
+        period = std::clamp(period, 1, maxPeriod);
+    }
+
+    std::vector<double> beatFrames;
+    tracker.calculateBeats(df, beatPeriod, beatFrames);
+    if (isCancelled(cancel)) {
+        return false;
+    }
+    out.positions.reserve(beatFrames.size());
+    out.energy.reserve(beatFrames.size());
+    for (std::size_t i = 0; i < beatFrames.size(); ++i) {
+        out.positions.push_back(std::int64_t(beatFrames[i] * stepSize) + stepSize / 2);
+        out.energy.push_back(float(i < df.size() ? df[i] : df.back()));
+    }
+    trackerProgress.report(1.0);
+    return true;
+}
+
+/**
+ * Номер доли сетки у первой сильной доли (как BPMAnalyzer::findBarPhase, сетка
+ * постоянная): qm-dsp DownBeat по прорежённому сигналу.
+ */
+int findBarPhase(const TrackedBeats& tracked, int sampleRate, float bpm, std::int64_t gridStart,
+                 int beatsPerBar)
+{
+    const std::vector<std::int64_t>& beats = tracked.positions;
+    if (tracked.decimated.empty() || bpm <= 0.0f) {
+        return 0;
+    }
+    const double samplesPerBeat = 60.0 * sampleRate / bpm;
+    const int timesig =
+        BeatGridFit::trackerBeatsPerBar(beats.data(), beats.size(), samplesPerBeat, beatsPerBar);
+    const int downbeat = timesig == 0 ? -1
+        : BeatGridFit::firstDownbeat(tracked.decimated.data(), tracked.decimated.size(), beats.data(),
+                                     beats.size(), sampleRate, kDownbeatDecimation, timesig);
+    if (downbeat < 0) {
+        return 0;
+    }
+    const double gridBeat = (double(beats[std::size_t(downbeat)]) - double(gridStart)) / samplesPerBeat;
+    return BeatGridFit::barPhase(gridBeat, beatsPerBar);
+}
+
+/** BPM, сетка и доли — как BPMAnalyzer::analyzeDetectionFunction. */
+bool analyzeBeats(const std::vector<float>& mono, int sampleRate, const TrackAnalysisOptions& options,
+                  TrackAnalysisResult& result, const std::atomic<bool>* cancel,
+                  const ProgressRange& onsetProgress, const ProgressRange& trackerProgress)
+{
+    TrackedBeats tracked;
+    if (!trackBeats(mono, sampleRate, tracked, cancel, onsetProgress, trackerProgress)) {
+        return false;
+    }
+    const std::vector<std::int64_t>& beats = tracked.positions;
+    if (beats.size() < 2) {
+        return true;  // долей нет — BPM остаётся 0
+    }
+
+    // Гармоника BPM и фаза сетки — общие с BPMAnalyzer (beatgridfit.h); известный
+    // темп (useInitialBpm) не подбирается
+    const BeatGridFit::Fit fit =
+        BeatGridFit::fitGrid(beats.data(), beats.size(), sampleRate, options.minBpm, options.maxBpm,
+                             options.useInitialBpm ? options.initialBpm : 0.0f);
+    const float bpm = fit.bpm;
+    const std::int64_t gridStart = fit.gridStart;
+    const double samplesPerBeat = 60.0 * sampleRate / bpm;
+    result.bpm = bpm;
+    result.hasIrregularBeats = fit.deviation.maximum > kTolerancePercent / 100.0f;
+    result.isFixedTempo = !result.hasIrregularBeats && fit.deviation.average < kTolerancePercent / 200.0f;
+    result.bpmConfidence = 1.0f - std::min(1.0f, fit.deviation.average);
+
+    // Доли с ожидаемыми позициями на сетке
+    result.beats.resize(beats.size());
+    double totalDeviation = 0.0;
+    for (std::size_t i = 0; i < beats.size(); ++i) {
+        TrackBeat& beat = result.beats[i];
+        const double gridBeat = std::round((double(beats[i]) - double(gridStart)) / samplesPerBeat);
+        beat.positionFrames = beats[i];
+        beat.expectedPositionFrames = gridStart + std::llround(gridBeat * samplesPerBeat);
+        beat.deviationFrames = float(beat.positionFrames - beat.expectedPositionFrames);
+        beat.confidence = 0.9f;
+        beat.energy = tracked.energy[i];
+        totalDeviation += std::abs(double(beat.deviationFrames));
+    }
+    result.averageBeatDeviationFrames = float(totalDeviation / double(beats.size()));
+
+    // Сетка начинается с сильной доли — как BPMAnalyzer::barStartSample
+    if (!isCancelled(cancel)) {
+        const int barPhase = findBarPhase(tracked, sampleRate, bpm, gridStart, options.beatsPerBar);
+        result.gridStartFrame = gridStart + std::llround(barPhase * samplesPerBeat);
+    }
+    return !isCancelled(cancel);
+}
+
+/** Тональность — как KeyAnalyzer::analyzeKeyUsingQM, без копии сигнала. */
+bool analyzeKey(const std::vector<float>& mono, int sampleRate, const TrackAnalysisOptions& options,
+                TrackAnalysisResult& result, const std::atomic<bool>* cancel,
+                const ProgressRange& progress)
+{
+    GetKeyMode::Config config(sampleRate, kTuningFrequency);
+    // Быстрый анализ — кадры без перекрытия (по умолчанию GetKeyMode)
+    config.frameOverlapFactor = options.fastAnalysis ? 1 : 8;
+    config.decimationFactor = 8;
+    GetKeyMode keyMode(config);
+
+    const std::size_t total = mono.size();
+    const int blockSize = keyMode.getBlockSize();
+    const int hopSize = keyMode.getHopSize();
+    if (blockSize <= 0 || hopSize <= 0 || total < std::size_t(blockSize)) {
+        return true;  // слишком коротко — тональность не определяется
+    }
+
+    const std::size_t block = std::size_t(blockSize);
+    const std::size_t hop = std::size_t(hopSize);
+    const std::size_t frameCount = (total - block) / hop + 1;
+    std::vector<double> frame(block);
+    double chromaSum[12] = {};
+    float chroma[12];
+
+    // Покадровые тональности: гистограмма для второй тональности и смены
+    int counts[kKeyCount] = {};
+    float strengthSum[kKeyCount] = {};
+    float confidenceSum[kKeyCount] = {};
+    int voicedFrames = 0;
+    bool keyChanged = false;
+    TrackKeyInfo previous;
+
+    for (std::size_t index = 0; index < frameCount; ++index) {
+        const std::size_t start = index * hop;
+        std::size_t kept = 0;
+        if (index > 0 && hop < block) {
+            kept = block - hop;
+            std::memmove(frame.data(), frame.data() + hop, kept * sizeof(double));
+        }
+        for (std::size_t j = kept; j < block; ++j) {
+            frame[j] = mono[start + j];
+        }
+        keyMode.process(frame.data());
+
+        // Хрома кадра — силы 12 мажорных тональностей, как в приложении
+        const double* strengths = keyMode.getKeyStrengths();
+        if (!strengths) {
+            continue;
+        }
+        for (int j = 0; j < 12; ++j) {
+            chromaSum[j] += strengths[j];
+            chroma[j] = float(strengths[j]);
+        }
+        const TrackKeyInfo info = trackKeyFromChroma(chroma);
+        if (info.key != TrackKey::Unknown) {
+            const int k = int(info.key);
+            ++counts[k];
+            strengthSum[k] += info.strength;
+            confidenceSum[k] += info.confidence;
+            ++voicedFrames;
+        }
+        if (index > 0 && info.key != previous.key
+            && std::abs(info.strength - previous.strength) > kKeyChangeThreshold) {
+            keyChanged = true;
+        }
+        previous = info;
+
+        if ((index + 1) % kKeyFramesPerBlock == 0) {
+            if (isCancelled(cancel)) {
+                return false;
+            }
+            progress.report(double(index + 1) / double(frameCount));
+        }
+    }
+
+    for (int j = 0; j < 12; ++j) {
+        result.chroma[std::size_t(j)] = float(chromaSum[j] / double(frameCount));
+    }
+    result.primaryKey = trackKeyFromChroma(result.chroma.data());
+    result.keyConfidence = result.primaryKey.confidence;
+
+    // Вторая тональность — самая частая из остальных, если занимает заметную
+    // долю трека (KeyAnalyzer::pickSecondaryKey)
+    constexpr float kMinShare = 0.2f;
+    int best = -1;
+    for (int k = 0; k < kKeyCount; ++k) {
+        if (k != int(result.primaryKey.key) && (best < 0 || counts[k] > counts[best])) {
+            best = k;
+        }
+    }
+    if (voicedFrames >= 4 && best >= 0 && counts[best] >= 2
+        && float(counts[best]) / float(voicedFrames) >= kMinShare) {
+        TrackKeyInfo& secondary = result.secondaryKey;
+        secondary.key = static_cast<TrackKey>(best);
+        secondary.isMajor = KeyProfile::isMajor(best);
+        secondary.strength = strengthSum[best] / float(counts[best]);
+        secondary.confidence = confidenceSum[best] / float(counts[best]);
+    }
+    result.hasKeyChange = keyChanged || result.secondaryKey.key != TrackKey::Unknown;
+    progress.report(1.0);
+    return true;
+}
+
+#endif // USE_MIXXX_QM_DSP
+
+} // namespace
+
+TrackKeyInfo trackKeyFromChroma(const float* chroma)
+{
+    TrackKeyInfo info;
+    float correlation = 0.0f;
+    const int key = KeyProfile::bestKey(chroma, &correlation);
+    // Тишина (ни одной положительной корреляции) — тональности нет
+    if (key < 0) {
+        return info;
+    }
+    info.key = static_cast<TrackKey>(key);
+    info.isMajor = KeyProfile::isMajor(key);
+    info.strength = correlation;
+    info.confidence = correlation;
+    return info;
+}
+
+TrackToolStatus analyzeTrackAudio(const TrackAudioBuffer& buffer,
+                                  const TrackAnalysisOptions& options,
+                                  TrackAnalysisResult* result,
+                                  const std::atomic<bool>* cancel,
+                                  const TrackAnalysisProgress& onProgress)
+{
+    if (!result) {
+        return TrackToolStatus::InvalidAudioInfo;
+    }
+    *result = {};
+    result->chroma.assign(12, 0.0f);
+    if (buffer.empty() || buffer.sampleRate < 8000 || buffer.sampleRate > 384000) {
+        result->status = TrackToolStatus::InvalidAudioInfo;
+        return result->status;
+    }
+
+#ifdef USE_MIXXX_QM_DSP
+    const TrackAnalysisOptions sanitized = sanitizeAnalysisOptions(options);
+    // Отрезки прогресса: onset-функция, TempoTrackV2, тональность
+    const int beatsEnd = !sanitized.analyzeBpm ? 0 : (sanitized.analyzeKey ? 60 : 100);
+    const ProgressRange onsetProgress(onProgress, 0, beatsEnd / 2);
+    const ProgressRange trackerProgress(onProgress, beatsEnd / 2, beatsEnd);
+    const ProgressRange keyProgress(onProgress, beatsEnd, 100);
+
+    bool finished = true;
+    result->isFixedTempo = sanitized.assumeFixedTempo;
+    if (sanitized.analyzeBpm) {
+        finished = analyzeBeats(buffer.mono, buffer.sampleRate, sanitized, *result, cancel,
+                                onsetProgress, trackerProgress);
+    }
+    if (finished && sanitized.analyzeKey) {
+        finished = analyzeKey(buffer.mono, buffer.sampleRate, sanitized, *result, cancel, keyProgress);
+    }
+    if (!finished || isCancelled(cancel)) {
+        *result = {};
+        result->status = TrackToolStatus::Cancelled;
+        return result->status;
+    }
+    if (onProgress) {
+        onProgress(100);
+    }
+    result->status = TrackToolStatus::Ok;
+    return result->status;
+#else
+    (void)options;
+    (void)cancel;
+    (void)onProgress;
+    result->status = TrackToolStatus::Unsupported;
+    return result->status;
+#endif
+}
+
+} // namespace Dontfloat::PluginCore
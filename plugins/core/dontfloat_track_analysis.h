@@ -0,0 +1,65 @@
+#ifndef DONTFLOAT_TRACK_ANALYSIS_H
+#define DONTFLOAT_TRACK_ANALYSIS_H
+
+/**
+ * @brief Анализ BPM, сетки и тональности дорожки без Qt — прямо по буферам сессии.
+ *
+ * Раньше ядро плагина анализ не умело: `TrackToolSession::analyze` отдавал
+ * `initialBpm` и нулевую хрому, а настоящий анализ жил в Qt-редакторах —
+ * они копировали `audioBuffer().mono` в QVector и звали `BPMAnalyzer` и
+ * `KeyAnalyzer`. Обёртка формата без открытого редактора дорожку не
+ * анализировала вовсе, а с редактором держала в памяти вторую копию трека.
+ *
+ * Здесь те же алгоритмы на `std::vector<float>` без копий сигнала:
+ * - BPM и доли — как `BPMAnalyzer::analyzeBPMUsingMixxx`: onset-функция qm-dsp
+ *   (`DF_COMPLEXSD`, шаг ~11.6 мс), `TempoTrackV2`, гармоника BPM и фаза
+ *   сетки — `BeatGridFit::fitGrid` (include/beatgridfit.h), та же функция,
+ *   что у приложения;
+ * - сильная доля — qm-dsp `DownBeat` по сигналу, прорежённому в 16 раз
+ *   (`BeatGridFit::firstDownbeat`, как `BPMAnalyzer::findBarPhase`):
+ *   `gridStartFrame` — начало первого такта;
+ * - тональность — как `KeyAnalyzer::analyzeKeyUsingQM`: `GetKeyMode` по кадрам,
+ *   средняя хрома, профили `KeyProfile` (include/keyprofile.h) — те же, что у
+ *   `KeyAnalyzer::detectKeyFromChroma`, вторая тональность по гистограмме
+ *   покадровых тональностей.
+ *
+ * Сэмплы переводятся в double окном, которое сдвигается на шаг: каждый сэмпл —
+ * один раз на проход. Без qm-dsp (`USE_MIXXX_QM_DSP` не задан) анализ
+ * возвращает `TrackToolStatus::Unsupported`.
+ *
+ * Функция синхронная и годится для любого потока; фоновый запуск с прогрессом
+ * и отменой — `TrackToolSession::startAnalysis`.
+ */
+
+#include "dontfloat_plugin_core.h"
+
+#include <atomic>
+#include <functional>
+
+namespace Dontfloat::PluginCore {
+
+/** Прогресс анализа 0..100; вызывается из потока анализа. */
+using TrackAnalysisProgress = std::function<void(int percent)>;
+
+/**
+ * Тональность по 12 классам высоты \a chroma — как
+ * `KeyAnalyzer::detectKeyFromChroma`; тишина — `TrackKey::Unknown`.
+ */
+TrackKeyInfo trackKeyFromChroma(const float* chroma);
+
+/**
+ * Анализирует \a buffer (нужен только моно-канал) по \a options.
+ * @param cancel флаг отмены: проверяется между блоками onset-функции, этапами
+ *        TempoTrackV2 и кадрами тональности.
+ * @return Ok, Cancelled (результат не заполнен), InvalidAudioInfo для пустого
+ *         буфера или Unsupported без qm-dsp.
+ */
+TrackToolStatus analyzeTrackAudio(const TrackAudioBuffer& buffer,
+                                  const TrackAnalysisOptions& options,
+                                  TrackAnalysisResult* result,
+                                  const std::atomic<bool>* cancel = nullptr,
+                                  const TrackAnalysisProgress& onProgress = {});
+
+} // namespace Dontfloat::PluginCore
+
+#endif // DONTFLOAT_TRACK_ANALYSIS_H
@@ -1,14 +1,23 @@
+#include "../dontfloat_analysis_cache.h"
 #include "../dontfloat_plugin_core.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <iostream>
+#include <thread>
 
+using Dontfloat::PluginCore::SharedAnalysisCache;
 using Dontfloat::PluginCore::TrackAnalysisOptions;
 using Dontfloat::PluginCore::TrackAnalysisResult;
+using Dontfloat::PluginCore::TrackAudioBuffer;
 using Dontfloat::PluginCore::TrackAudioInfo;
 using Dontfloat::PluginCore::TrackRenderRequest;
 using Dontfloat::PluginCore::TrackRenderResult;
 using Dontfloat::PluginCore::TrackToolSession;
 using Dontfloat::PluginCore::TrackToolStatus;
+using Dontfloat::PluginCore::analysisOptionsKey;
+using Dontfloat::PluginCore::computeContentFingerprint;
 using Dontfloat::PluginCore::isValidAudioInfo;
 using Dontfloat::PluginCore::sanitizeAnalysisOptions;
 using Dontfloat::PluginCore::sanitizeAlignmentOptions;
@@ -91,6 +100,10 @@ bool testSanitizeHelpers()
     if (sanitizedAnalysis.minBpm != 30.0f || sanitizedAnalysis.maxBpm != 400.0f) {
         return false;
     }
+    analysis.beatsPerBar = 0;
+    if (sanitizeAnalysisOptions(analysis).beatsPerBar != 1) {
+        return false;
+    }
 
     auto alignment = sanitizeAlignmentOptions({});
     if (alignment.beatsPerBar != 4) {
@@ -109,6 +122,183 @@ bool testSanitizeHelpers()
     return sanitizeRenderOptions(render).pitchSemitones == 24.0f;
 }
 
+/** Бочка на каждую долю, 120 BPM; первая доля — через \a offset кадров. */
+TrackAudioBuffer makeClickTrack(double seconds, std::int64_t offset)
+{
+    constexpr int kSampleRate = 44100;
+    constexpr double kPi = 3.14159265358979323846;
+    const double interval = 60.0 * kSampleRate / 120.0;
+    TrackAudioBuffer buffer;
+    buffer.sampleRate = kSampleRate;
+    buffer.channelCount = 1;
+    buffer.mono.assign(static_cast<std::size_t>(seconds * kSampleRate), 0.0f);
+    for (double beat = double(offset); beat < double(buffer.mono.size()); beat += interval) {
+        const std::size_t start = static_cast<std::size_t>(beat);
+        for (std::size_t i = 0; i < 4000 && start + i < buffer.mono.size(); ++i) {
+            const double t = double(i) / kSampleRate;
+            buffer.mono[start + i] += float(0.8 * std::exp(-t * 30.0) * std::sin(2.0 * kPi * 60.0 * t));
+        }
+    }
+    return buffer;
+}
+
+// Живой трекер: темп и доли во время проигрывания, без полного анализа
+bool testLiveBeatTracker()
+{
+    TrackToolSession session;
+    if (session.liveBeat().bpm != 0.0f) {
+        return false;
+    }
+    if (session.prepare(TrackAudioInfo{44100, 1, 0}) != TrackToolStatus::Ok) {
+        return false;
+    }
+    const TrackAudioBuffer track = makeClickTrack(12.0, 5000);
+    constexpr int kBlock = 512;
+    for (std::size_t start = 0; start + kBlock <= track.mono.size(); start += kBlock) {
+        const float* inputs[1] = { track.mono.data() + start };
+        session.writeHostFrames(inputs, 1, kBlock, std::int64_t(start));
+    }
+    const auto live = session.liveBeat();
+    const double interval = 60.0 * 44100 / 120.0;
+    const double phase = std::fmod(double(live.lastBeatFrame - 5000), interval);
+    const double distance = std::min(std::abs(phase), interval - std::abs(phase));
+    if (std::abs(live.bpm - 120.0f) > 1.0f || live.confidence < 0.5f || distance > 1024.0) {
+        return false;
+    }
+
+    // Сброс захвата сбрасывает и трекер (на следующем блоке аудиопотока)
+    session.clearHostCapture();
+    const float* inputs[1] = { track.mono.data() };
+    session.writeHostFrames(inputs, 1, kBlock, 0);
+    return session.liveBeat().bpm == 0.0f;
+}
+
+// Общий кеш: тот же материал на новой позиции, другие настройки, вытеснение
+bool testAnalysisCache()
+{
+    SharedAnalysisCache::resetForTests();
+    const TrackAudioBuffer track = makeClickTrack(4.0, 5000);
+    TrackAudioBuffer moved = track;
+    moved.mono.insert(moved.mono.begin(), 1000, 0.0f);
+    const auto print = computeContentFingerprint(track);
+    const auto movedPrint = computeContentFingerprint(moved);
+
+    TrackAnalysisResult result;
+    result.status = TrackToolStatus::Ok;
+    result.bpm = 120.0f;
+    result.gridStartFrame = print.startFrame;
+    result.beats.resize(1);
+    result.beats[0].positionFrames = print.startFrame + 22050;
+    result.beats[0].expectedPositionFrames = print.startFrame + 22050;
+    const std::uint64_t key = analysisOptionsKey(TrackAnalysisOptions{});
+    SharedAnalysisCache::storeAnalysis(print, 44100, key, result);
+
+    // Клип сдвинут: позиции переносятся вслед за содержимым
+    TrackAnalysisResult found;
+    if (!SharedAnalysisCache::findAnalysis(movedPrint, 44100, key, &found)
+        || found.bpm != 120.0f || found.gridStartFrame != movedPrint.startFrame
+        || found.beats.size() != 1 || found.beats[0].positionFrames != movedPrint.startFrame + 22050) {
+        return false;
+    }
+    TrackAnalysisOptions other;
+    other.maxBpm = 150.0f;
+    if (analysisOptionsKey(other) == key
+        || SharedAnalysisCache::findAnalysis(print, 44100, analysisOptionsKey(other), &found)
+        || SharedAnalysisCache::findAnalysis(print, 48000, key, &found)) {
+        return false;
+    }
+    TrackAnalysisResult failed;
+    failed.status = TrackToolStatus::Unsupported;
+    SharedAnalysisCache::storeAnalysis(print, 44100, analysisOptionsKey(other), failed);
+    if (SharedAnalysisCache::size() != 1) {
+        return false;
+    }
+
+    // LRU: обращение к первой записи спасает её, вытесняется вторая
+    SharedAnalysisCache::setCapacity(2);
+    const auto shortPrint = computeContentFingerprint(makeClickTrack(2.0, 0));
+    SharedAnalysisCache::storeAnalysis(shortPrint, 44100, key, result);
+    SharedAnalysisCache::findAnalysis(print, 44100, key, &found);
+    SharedAnalysisCache::storeAnalysis(print, 44100, analysisOptionsKey(other), result);
+    const bool evicted = SharedAnalysisCache::size() == 2
+        && SharedAnalysisCache::findAnalysis(print, 44100, key, &found)
+        && !SharedAnalysisCache::findAnalysis(shortPrint, 44100, key, &found);
+    SharedAnalysisCache::resetForTests();
+    return evicted;
+}
+
+#ifdef USE_MIXXX_QM_DSP
+bool testAnalyzeClickTrack()
+{
+    TrackToolSession session;
+    if (session.setAudioBuffer(makeClickTrack(20.0, 5000)) != TrackToolStatus::Ok) {
+        return false;
+    }
+    TrackAnalysisOptions options;
+    options.analyzeKey = false;
+    TrackAnalysisResult result;
+    if (session.analyze(options, &result) != TrackToolStatus::Ok) {
+        return false;
+    }
+    // Сетка проходит через бочки: начало — на одной из них
+    const double interval = 60.0 * 44100 / 120.0;
+    const double phase = std::fmod(double(result.gridStartFrame - 5000), interval);
+    const double distance = std::min(std::abs(phase), interval - std::abs(phase));
+    return session.analysisValid()
+        && std::abs(result.bpm - 120.0f) < 0.5f
+        && result.beats.size() > 30
+        && distance < 0.03 * interval
+        && result.chroma.size() == 12;
+}
+
+// Фоновый анализ: прогресс, тот же результат, что у analyze(), и отмена
+bool testBackgroundAnalysis()
+{
+    TrackToolSession session;
+    if (session.setAudioBuffer(makeClickTrack(20.0, 5000)) != TrackToolStatus::Ok) {
+        return false;
+    }
+    TrackAnalysisResult direct;
+    session.analyze(TrackAnalysisOptions{}, &direct);
+
+    TrackAnalysisResult result;
+    if (session.takeAnalysisResult(&result)) {
+        return false;  // ничего не запускалось
+    }
+    if (session.startAnalysis(TrackAnalysisOptions{}) != TrackToolStatus::Ok) {
+        return false;
+    }
+    for (int i = 0; i < 3000 && !session.takeAnalysisResult(&result); ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    if (result.status != TrackToolStatus::Ok || session.isAnalysisRunning()
+        || result.bpm != direct.bpm || result.beats.size() != direct.beats.size()
+        || result.primaryKey.key != direct.primaryKey.key || session.analysis().bpm != direct.bpm) {
+        return false;
+    }
+
+    // Другой экземпляр с тем же материалом берёт результат из кеша сразу
+    TrackToolSession second;
+    second.setAudioBuffer(makeClickTrack(20.0, 5000));
+    if (second.startAnalysis(TrackAnalysisOptions{}) != TrackToolStatus::Ok
+        || !second.takeAnalysisResult(&result) || result.bpm != direct.bpm) {
+        return false;
+    }
+
+    // Новый буфер отменяет идущий анализ: результата не будет
+    if (session.startAnalysis(TrackAnalysisOptions{}) != TrackToolStatus::Ok) {
+        return false;
+    }
+    session.setAudioBuffer(makeClickTrack(4.0, 0));
+    if (session.isAnalysisRunning() || session.takeAnalysisResult(&result)) {
+        return false;
+    }
+    session.startAnalysis(TrackAnalysisOptions{});
+    session.cancelAnalysis();
+    return !session.isAnalysisRunning() && !session.takeAnalysisResult(&result);
+}
+#endif
+
 } // namespace
 
 int main()
@@ -129,5 +319,23 @@ int main()
         std::cerr << "testSanitizeHelpers failed\n";
         return 1;
     }
+    if (!testLiveBeatTracker()) {
+        std::cerr << "testLiveBeatTracker failed\n";
+        return 1;
+    }
+    if (!testAnalysisCache()) {
+        std::cerr << "testAnalysisCache failed\n";
+        return 1;
+    }
+#ifdef USE_MIXXX_QM_DSP
+    if (!testAnalyzeClickTrack()) {
+        std::cerr << "testAnalyzeClickTrack failed\n";
+        return 1;
+    }
+    if (!testBackgroundAnalysis()) {
+        std::cerr << "testBackgroundAnalysis failed\n";
+        return 1;
+    }
+#endif
     return 0;
 }
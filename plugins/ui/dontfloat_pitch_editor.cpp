@@ -1,5 +1,7 @@
 #include "dontfloat_pitch_editor.h"
 
+#include "../core/dontfloat_analysis_cache.h"
+
 #include "../../include/audiofileservice.h"
 #include "../../include/keyanalyzer.h"
 #include "../../include/keymodulationstrip.h"
@@ -39,6 +41,7 @@
 #include <algorithm>
 #include <cstdint>
 #include <cmath>
+#include <cstring>
 #include <vector>
 
 namespace Dontfloat::Plugins::Ui {
@@ -104,6 +107,72 @@ QString keyNameFromInfo(const KeyAnalyzer::KeyInfo& info)
     return info.keyName;
 }
 
+/** Порядок TrackKey совпадает с KeyAnalyzer::Key. */
+Dontfloat::PluginCore::TrackKeyInfo toCoreKey(const KeyAnalyzer::KeyInfo& info)
+{
+    Dontfloat::PluginCore::TrackKeyInfo out;
+    out.key = static_cast<Dontfloat::PluginCore::TrackKey>(int(info.key));
+    out.confidence = info.confidence;
+    out.strength = info.strength;
+    out.isMajor = info.isMajor;
+    return out;
+}
+
+QString keyNameFromCore(const Dontfloat::PluginCore::TrackKeyInfo& info)
+{
+    if (info.key == Dontfloat::PluginCore::TrackKey::Unknown) {
+        return QStringLiteral("C Major");  // как keyNameFromInfo
+    }
+    return KeyAnalyzer::keyToString(static_cast<KeyAnalyzer::Key>(int(info.key)));
+}
+
+/** Настройки анализа нот редактора (runPitchAnalysis): тональность и ноты. */
+struct PitchAnalysisSettings {
+    KeyAnalyzer::AnalysisOptions key;
+    PitchDetector::Options pitch;
+};
+
+std::uint64_t mixCacheKey(std::uint64_t hash, std::uint32_t value)
+{
+    constexpr std::uint64_t kFnvPrime = 1099511628211ULL;
+    for (int byte = 0; byte < 4; ++byte) {
+        hash = (hash ^ ((value >> (8 * byte)) & 0xFFu)) * kFnvPrime;
+    }
+    return hash;
+}
+
+std::uint64_t mixCacheKey(std::uint64_t hash, float value)
+{
+    std::uint32_t bits = 0;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return mixCacheKey(hash, bits);
+}
+
+/**
+ * Ключ записи нот в SharedAnalysisCache — FNV-1a по настройкам, от которых
+ * зависит результат, как analysisOptionsKey у долей: ноты другого строя или
+ * с другими порогами из кеша не берутся. maxThreads результат не меняет.
+ */
+std::uint64_t pitchAnalysisCacheKey(const PitchAnalysisSettings& settings)
+{
+    const KeyAnalyzer::AnalysisOptions& key = settings.key;
+    const PitchDetector::Options& pitch = settings.pitch;
+    std::uint64_t hash = 1469598103934665603ULL;
+    hash = mixCacheKey(hash, key.tuningFrequency);
+    hash = mixCacheKey(hash, std::uint32_t(key.frameSize));
+    hash = mixCacheKey(hash, std::uint32_t(key.hopSize));
+    hash = mixCacheKey(hash, std::uint32_t(key.detectKeyChanges));
+    hash = mixCacheKey(hash, key.keyChangeThreshold);
+    hash = mixCacheKey(hash, key.keyChangePenalty);
+    hash = mixCacheKey(hash, pitch.minFrequencyHz);
+    hash = mixCacheKey(hash, pitch.maxFrequencyHz);
+    hash = mixCacheKey(hash, pitch.minRms);
+    hash = mixCacheKey(hash, pitch.minCorrelation);
+    hash = mixCacheKey(hash, std::uint32_t(pitch.minNoteDurationMs));
+    hash = mixCacheKey(hash, pitch.referenceHz);
+    return hash;
+}
+
 QVector<float> toQVector(const std::vector<float>& samples)
 {
     QVector<float> out(static_cast<int>(samples.size()));
@@ -502,9 +571,12 @@ void DontfloatPitchEditor::startAutoAnalysis()
         return;
     }
 
-    // Содержимое дорожки изменилось — считаем ноты заново
+    // Содержимое дорожки изменилось — считаем ноты заново, если этот материал
+    // ещё не разбирал ни один экземпляр
     analyzedContent_ = print;
-    runPitchAnalysis();
+    if (!restoreCachedPitchAnalysis(print)) {
+        runPitchAnalysis();
+    }
 }
 
 void DontfloatPitchEditor::setHostBeatGrid(double bpm, int beatsPerBar, qint64 barStartSample)
@@ -957,10 +1029,15 @@ void DontfloatPitchEditor::runPitchAnalysis()
     // QFutureWatcher::result() падает в QResultStore/QList::at (MSVC Debug) —
     // та же грабля, что описана в MainWindow. Отдаём через shared_ptr.
     pendingOutcome_ = std::make_shared<PitchAnalysisOutcome>();
+    pendingOutcome_->content = Dontfloat::PluginCore::computeContentFingerprint(session_->audioBuffer());
+    pendingOutcome_->sampleRate = sampleRate;
+    const PitchAnalysisSettings settings;
+    pendingOutcome_->optionsKey = pitchAnalysisCacheKey(settings);
     analysisWatcher_->setFuture(QtConcurrent::run(
-        [mono, sampleRate, progress = analysisProgress_, outcome = pendingOutcome_]() {
+        [mono, sampleRate, settings, progress = analysisProgress_, outcome = pendingOutcome_]() {
             progress->store(2);
-            const KeyAnalyzer::AnalysisResult keyResult = KeyAnalyzer::analyzeKey(mono, sampleRate);
+            const KeyAnalyzer::AnalysisResult keyResult =
+                KeyAnalyzer::analyzeKey(mono, sampleRate, settings.key);
             outcome->primaryKeyName = keyNameFromInfo(keyResult.primaryKey);
             if (keyResult.hasKeyChange
                 && keyResult.secondaryKey.key != KeyAnalyzer::UNKNOWN_KEY
@@ -969,12 +1046,16 @@ void DontfloatPitchEditor::runPitchAnalysis()
             }
             progress->store(15);
             const QVector<PitchDetector::PitchNote> notes = PitchDetector::detectNotes(
-                mono, sampleRate, PitchDetector::Options(),
+                mono, sampleRate, settings.pitch,
                 [progress](int pct) { progress->store(15 + pct * 85 / 100); });
             progress->store(100);
 
             outcome->pitch.valid = true;
             outcome->pitch.notes = toCoreNotes(notes);
+            outcome->pitch.keys.primaryKey = toCoreKey(keyResult.primaryKey);
+            if (!outcome->secondaryKeyName.isEmpty()) {
+                outcome->pitch.keys.secondaryKey = toCoreKey(keyResult.secondaryKey);
+            }
             outcome->pitch.keys.hasKeyChange = keyResult.hasKeyChange;
         }));
 }
@@ -989,6 +1070,32 @@ void DontfloatPitchEditor::onPitchAnalysisFinished()
     }
     const PitchAnalysisOutcome outcome = *pendingOutcome_;
     pendingOutcome_.reset();
+    Dontfloat::PluginCore::SharedAnalysisCache::storePitch(outcome.content, outcome.sampleRate,
+                                                           outcome.optionsKey, outcome.pitch);
+    applyPitchOutcome(outcome);
+}
+
+bool DontfloatPitchEditor::restoreCachedPitchAnalysis(
+    const Dontfloat::PluginCore::TrackContentFingerprint& content)
+{
+    PitchAnalysisOutcome outcome;
+    if (!session_
+        || !Dontfloat::PluginCore::SharedAnalysisCache::findPitch(
+            content, session_->audioBuffer().sampleRate, pitchAnalysisCacheKey(PitchAnalysisSettings()),
+            &outcome.pitch)) {
+        return false;
+    }
+    outcome.primaryKeyName = keyNameFromCore(outcome.pitch.keys.primaryKey);
+    if (outcome.pitch.keys.hasKeyChange
+        && outcome.pitch.keys.secondaryKey.key != Dontfloat::PluginCore::TrackKey::Unknown) {
+        outcome.secondaryKeyName = keyNameFromCore(outcome.pitch.keys.secondaryKey);
+    }
+    applyPitchOutcome(outcome);
+    return true;
+}
+
+void DontfloatPitchEditor::applyPitchOutcome(const PitchAnalysisOutcome& outcome)
+{
     setPrimaryKey(outcome.primaryKeyName);
     if (!outcome.secondaryKeyName.isEmpty()) {
         setSecondaryKey(outcome.secondaryKeyName);
@@ -14,6 +14,7 @@
 #include <QWidget>
 #include <QVector>
 #include <atomic>
+#include <cstdint>
 #include <memory>
 
 class KeyModulationStrip;
@@ -33,6 +34,11 @@ struct PitchAnalysisOutcome {
     Dontfloat::PluginCore::TrackPitchAnalysis pitch;
     QString primaryKeyName;
     QString secondaryKeyName;
+    /** Что разбирали — ключ записи в SharedAnalysisCache. */
+    Dontfloat::PluginCore::TrackContentFingerprint content;
+    int sampleRate = 0;
+    /** Ключ настроек анализа (pitchAnalysisCacheKey) на момент запуска. */
+    std::uint64_t optionsKey = 0;
 };
 
 class DontfloatPitchEditor final : public QWidget, public DontfloatEditorContent {
@@ -100,6 +106,10 @@ private:
     /** Подгоняет диапазон высот пианоролла под найденные ноты. */
     void fitPitchRangeToNotes();
     void runPitchAnalysis();
+    /** Ноты и тональности того же материала из общего кеша; false — промах. */
+    bool restoreCachedPitchAnalysis(const Dontfloat::PluginCore::TrackContentFingerprint& content);
+    /** Готовый анализ (свой или из кеша) — в вид, сессию и на доску нот. */
+    void applyPitchOutcome(const PitchAnalysisOutcome& outcome);
     void syncNotesToSession();
     void setStatus(const QString& text);
     /** Сдвиг нот вслед за переехавшим клипом (см. detectContentShift). */
@@ -26,11 +26,50 @@ namespace {
 using Dontfloat::PluginCore::TrackAudioBuffer;
 using Dontfloat::PluginCore::TrackToolSession;
 
-QVector<float> toQVector(const std::vector<float>& samples)
+QVector<float> toQVector(const std::vector<float>& samples, std::int64_t fromFrame = 0)
 {
-    QVector<float> out(static_cast<int>(samples.size()));
-    if (!samples.empty()) {
-        std::copy(samples.begin(), samples.end(), out.begin());
+    const std::size_t from = std::min(samples.size(), static_cast<std::size_t>(fromFrame));
+    QVector<float> out(static_cast<int>(samples.size() - from));
+    if (!out.isEmpty()) {
+        std::copy(samples.begin() + static_cast<std::ptrdiff_t>(from), samples.end(), out.begin());
+    }
+    return out;
+}
+
+/** Анализ ядра — только BPM и доли: тональность Scratch не показывает. */
+Dontfloat::PluginCore::TrackAnalysisOptions bpmAnalysisOptions(int beatsPerBar)
+{
+    Dontfloat::PluginCore::TrackAnalysisOptions options;
+    options.analyzeKey = false;
+    options.beatsPerBar = beatsPerBar;
+    return options;
+}
+
+/**
+ * Результат ядра в BPMAnalyzer::AnalysisResult, с которым работают волна и
+ * выравнивание. gridStartFrame ядра — уже начало такта, поэтому barPhase 0.
+ * Отклонения долей (в долях интервала) досчитывает showBpmAnalysis.
+ */
+BPMAnalyzer::AnalysisResult fromCoreAnalysis(const Dontfloat::PluginCore::TrackAnalysisResult& result,
+                                             int sampleRate)
+{
+    BPMAnalyzer::AnalysisResult out;
+    out.bpm = result.bpm;
+    out.confidence = result.bpmConfidence;
+    out.isFixedTempo = result.isFixedTempo;
+    out.hasIrregularBeats = result.hasIrregularBeats;
+    out.gridStartSample = result.gridStartFrame;
+    if (result.bpm > 0.0f && sampleRate > 0) {
+        out.averageDeviation = result.averageBeatDeviationFrames / (60.0f * float(sampleRate) / result.bpm);
+    }
+    out.beats.reserve(int(result.beats.size()));
+    for (const Dontfloat::PluginCore::TrackBeat& coreBeat : result.beats) {
+        BPMAnalyzer::BeatInfo beat;
+        beat.position = coreBeat.positionFrames;
+        beat.expectedPosition = coreBeat.expectedPositionFrames;
+        beat.confidence = coreBeat.confidence;
+        beat.energy = coreBeat.energy;
+        out.beats.append(beat);
     }
     return out;
 }
@@ -40,16 +79,17 @@ std::vector<float> toStdVector(const QVector<float>& samples)
     return std::vector<float>(samples.begin(), samples.end());
 }
 
-QVector<QVector<float>> channelsFromBuffer(const TrackAudioBuffer& buffer)
+/** Каналы буфера с кадра \a fromFrame до конца (по умолчанию — целиком). */
+QVector<QVector<float>> channelsFromBuffer(const TrackAudioBuffer& buffer, std::int64_t fromFrame = 0)
 {
     QVector<QVector<float>> channels;
     if (!buffer.left.empty()) {
-        channels.append(toQVector(buffer.left));
+        channels.append(toQVector(buffer.left, fromFrame));
         if (!buffer.right.empty()) {
-            channels.append(toQVector(buffer.right));
+            channels.append(toQVector(buffer.right, fromFrame));
         }
     } else if (!buffer.mono.empty()) {
-        channels.append(toQVector(buffer.mono));
+        channels.append(toQVector(buffer.mono, fromFrame));
     }
     return channels;
 }
@@ -88,7 +128,6 @@ QVector<BPMAnalyzer::BeatInfo> createAlignedBeatGrid(float bpm,
 DontfloatScratchEditor::DontfloatScratchEditor(QWidget* parent, const QString& productName)
     : QWidget(parent)
     , productName_(productName)
-    , bpmWatcher_(new QFutureWatcher<void>(this))
     , alignWatcher_(new QFutureWatcher<void>(this))
 {
     setObjectName(QStringLiteral("dontfloatScratchEditor"));
@@ -145,10 +184,13 @@ DontfloatScratchEditor::DontfloatScratchEditor(QWidget* parent, const QString& p
     autoAnalysisTimer_->setInterval(kAutoAnalysisDelayMs);
     connect(autoAnalysisTimer_, &QTimer::timeout, this, &DontfloatScratchEditor::startAutoAnalysis);
 
+    // Анализ идёт в потоке сессии — забираем результат опросом
+    analysisPollTimer_ = new QTimer(this);
+    analysisPollTimer_->setInterval(kAnalysisPollIntervalMs);
+    connect(analysisPollTimer_, &QTimer::timeout, this, &DontfloatScratchEditor::pollBpmAnalysis);
+
     connect(alignButton_, &QPushButton::clicked, this, &DontfloatScratchEditor::onAlignBeatsClicked);
     connect(applyStretchButton_, &QPushButton::clicked, this, &DontfloatScratchEditor::onApplyStretchClicked);
-    connect(bpmWatcher_, &QFutureWatcher<void>::finished,
-            this, &DontfloatScratchEditor::onBpmAnalysisFinished);
     connect(alignWatcher_, &QFutureWatcher<void>::finished,
             this, &DontfloatScratchEditor::onAlignFinished);
     connect(waveform_, &WaveformView::markersChanged, this, &DontfloatScratchEditor::onMarkersChanged);
@@ -214,7 +256,8 @@ void DontfloatScratchEditor::notifyHostAudioAppended()
     if (!hostRefreshClock_.isValid()
         || hostRefreshClock_.elapsed() >= kHostRefreshIntervalMs) {
         hostRefreshClock_.restart();
-        refreshFromSession();
+        refreshCapturedWaveform();
+        updateActionButtons();
     }
     // Анализ дорожки стартует сам, как только DAW перестала слать блоки
     if (!analysisRunning_ && autoAnalysisTimer_ && session_ && !session_->audioBuffer().empty()) {
@@ -227,6 +270,8 @@ void DontfloatScratchEditor::refreshWaveform()
     if (!session_ || !waveform_) {
         return;
     }
+    // Волна строится целиком — накопленное место правки захвата уже не нужно
+    session_->takeCaptureDirtyFrame();
     const TrackAudioBuffer& buffer = session_->audioBuffer();
     if (buffer.empty()) {
         waveform_->setAudioData({});
@@ -239,7 +284,36 @@ void DontfloatScratchEditor::refreshWaveform()
     const QVector<QVector<float>> channels = channelsFromBuffer(buffer);
     waveform_->setAudioData(channels);
     waveform_->setSampleRate(buffer.sampleRate);
+    applyAnalysisToWaveform(buffer);
+}
+
+void DontfloatScratchEditor::refreshCapturedWaveform()
+{
+    if (!session_ || !waveform_) {
+        return;
+    }
+    const std::int64_t dirtyFrame = session_->takeCaptureDirtyFrame();
+    if (dirtyFrame < 0) {
+        return;  // с прошлой перерисовки захват ничего не поменял
+    }
+
+    // Кадры до места правки волна уже видела: копируем и досчитываем только
+    // хвост, а не всю дорожку на каждом обновлении. Новый проход DAW, другое
+    // число каналов или превью растяжения — полная перерисовка
+    const TrackAudioBuffer& buffer = session_->audioBuffer();
+    const QVector<QVector<float>>& shown = waveform_->getAudioData();
+    const std::int64_t fromFrame =
+        shown.isEmpty() ? 0 : std::min<std::int64_t>(dirtyFrame, shown[0].size());
+    if (fromFrame <= 0 || buffer.empty()
+        || !waveform_->updateAudioTail(fromFrame, channelsFromBuffer(buffer, fromFrame))) {
+        refreshWaveform();
+        return;
+    }
+    applyAnalysisToWaveform(buffer);
+}
 
+void DontfloatScratchEditor::applyAnalysisToWaveform(const TrackAudioBuffer& buffer)
+{
     if (lastAnalysis_.bpm > 0.0f) {
         waveform_->setBeatInfo(lastAnalysis_.beats);
         waveform_->setGridStartSample(lastAnalysis_.gridStartSample);
@@ -249,13 +323,34 @@ void DontfloatScratchEditor::refreshWaveform()
                       .arg(buffer.frameCount())
                       .arg(buffer.sampleRate)
                       .arg(double(lastAnalysis_.bpm), 0, 'f', 2));
-    } else {
+    } else if (!applyLiveBeatToWaveform(buffer)) {
         setStatus(tr("audio: %1 samples, %2 Hz — click “BPM analysis”")
                       .arg(buffer.frameCount())
                       .arg(buffer.sampleRate));
     }
 }
 
+bool DontfloatScratchEditor::applyLiveBeatToWaveform(const TrackAudioBuffer& buffer)
+{
+    const Dontfloat::PluginCore::LiveBeatState live = session_->liveBeat();
+    if (live.bpm <= 0.0f || live.confidence < kLiveGridMinConfidence || live.lastBeatFrame < 0
+        || buffer.sampleRate <= 0) {
+        return false;
+    }
+    if (!hostGridActive_) {
+        // Кадры трекера — те же, что у захвата: от последней доли назад к началу
+        const double beatSamples = 60.0 * buffer.sampleRate / live.bpm;
+        waveform_->setBPM(live.bpm);
+        waveform_->setBeatsPerBar(beatsPerBar_);
+        waveform_->setGridStartSample(qint64(std::fmod(double(live.lastBeatFrame), beatSamples)));
+    }
+    setStatus(tr("audio %1 samples @ %2 Hz · live BPM %3")
+                  .arg(buffer.frameCount())
+                  .arg(buffer.sampleRate)
+                  .arg(double(live.bpm), 0, 'f', 1));
+    return true;
+}
+
 void DontfloatScratchEditor::publishRenderedOutput(const QVector<QVector<float>>& channels,
                                                    int sampleRate)
 {
@@ -342,6 +437,7 @@ void DontfloatScratchEditor::setHostBeatGrid(double bpm, int beatsPerBar, qint64
         return;
     }
     // Сетка хоста главнее собственного анализа: в DAW доли считает она
+    hostGridActive_ = true;
     const bool changed = std::fabs(double(waveform_->getBPM()) - bpm) > 0.01
         || beatsPerBar_ != std::max(1, beatsPerBar)
         || waveform_->getGridStartSample() != barStartSample;
@@ -519,7 +615,8 @@ void DontfloatScratchEditor::startAutoAnalysis()
         return;
     }
 
-    // Содержимое дорожки изменилось — считаем заново
+    // Содержимое дорожки изменилось — считаем заново (разобранный другим
+    // экземпляром материал startAnalysis берёт из кеша)
     analyzedContent_ = print;
     runBpmAnalysis();
 }
@@ -572,9 +669,11 @@ void DontfloatScratchEditor::runBpmAnalysis()
     if (!session_ || session_->audioBuffer().empty() || analysisRunning_) {
         return;
     }
-    const QVector<float> mono = toQVector(session_->audioBuffer().mono);
-    const int sampleRate = session_->audioBuffer().sampleRate;
-    if (mono.isEmpty() || sampleRate <= 0) {
+    // Тот же анализ, что у обёрток формата: ядро читает буфер сессии на месте,
+    // без копии в QVector, и само смотрит в SharedAnalysisCache — тот же
+    // материал с теми же настройками готов сразу
+    if (session_->startAnalysis(bpmAnalysisOptions(beatsPerBar_))
+        != Dontfloat::PluginCore::TrackToolStatus::Ok) {
         setStatus(tr("no audio data for BPM analysis"));
         return;
     }
@@ -582,25 +681,38 @@ void DontfloatScratchEditor::runBpmAnalysis()
     analysisRunning_ = true;
     updateActionButtons();
     setStatus(tr("analyzing BPM…"));
-
-    // Результат мимо QFuture::result(): после длинного анализа он падает в
-    // QResultStore/QList::at (MSVC Debug) — как и в MainWindow / питч-редакторе
-    pendingBpm_ = std::make_shared<BPMAnalyzer::AnalysisResult>();
-    bpmWatcher_->setFuture(QtConcurrent::run([mono, sampleRate, result = pendingBpm_]() {
-        *result = BPMAnalyzer::analyzeBPM(mono, sampleRate);
-    }));
+    analysisPollTimer_->start();
+    pollBpmAnalysis();
 }
 
-void DontfloatScratchEditor::onBpmAnalysisFinished()
+void DontfloatScratchEditor::pollBpmAnalysis()
 {
+    Dontfloat::PluginCore::TrackAnalysisResult result;
+    if (session_ && !session_->takeAnalysisResult(&result)) {
+        if (session_->isAnalysisRunning()) {
+            setStatus(tr("analyzing BPM… %1%").arg(session_->analysisProgress()));
+            return;
+        }
+        // Буфер сменился посреди анализа (захват, выравнивание) — сессия его
+        // отменила; новое содержимое разберёт авто-анализ
+        result.status = Dontfloat::PluginCore::TrackToolStatus::Cancelled;
+    }
+    analysisPollTimer_->stop();
     analysisRunning_ = false;
-    if (!pendingBpm_) {
+    if (!session_ || result.status != Dontfloat::PluginCore::TrackToolStatus::Ok) {
+        analyzedContent_ = {};
+        if (session_ && !session_->audioBuffer().empty()) {
+            autoAnalysisTimer_->start();
+        }
         updateActionButtons();
         return;
     }
-    lastAnalysis_ = *pendingBpm_;
-    pendingBpm_.reset();
+    lastAnalysis_ = fromCoreAnalysis(result, session_->audioBuffer().sampleRate);
+    showBpmAnalysis();
+}
 
+void DontfloatScratchEditor::showBpmAnalysis()
+{
     if (lastAnalysis_.bpm <= 0.0f) {
         setStatus(tr("could not detect BPM"));
         updateActionButtons();
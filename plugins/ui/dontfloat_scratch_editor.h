@@ -61,13 +61,26 @@ private slots:
     void startAutoAnalysis();
     void onAlignBeatsClicked();
     void onApplyStretchClicked();
-    void onBpmAnalysisFinished();
+    /** Забирает результат фонового анализа сессии (startAnalysis). */
+    void pollBpmAnalysis();
     void onAlignFinished();
     void onMarkersChanged();
 
 private:
     void refreshWaveform();
+    /** Перерисовка по потоку блоков от хоста: волна дописывается с места правки. */
+    void refreshCapturedWaveform();
+    /** Сетка, BPM и строка статуса из последнего анализа поверх свежей волны. */
+    void applyAnalysisToWaveform(const Dontfloat::PluginCore::TrackAudioBuffer& buffer);
+    /**
+     * Пока полного анализа нет — сетка по живому трекеру сессии (темп того,
+     * что DAW играет сейчас). false — трекер ещё не уверен в темпе.
+     */
+    bool applyLiveBeatToWaveform(const Dontfloat::PluginCore::TrackAudioBuffer& buffer);
+    /** BPM и доли — TrackToolSession::startAnalysis, результат — pollBpmAnalysis. */
     void runBpmAnalysis();
+    /** Готовый lastAnalysis_ (свой или из кеша) — на волну и в статус. */
+    void showBpmAnalysis();
     void runBeatAlign();
     void setStatus(const QString& text);
     void updateActionButtons();
@@ -89,18 +102,19 @@ private:
     QPushButton* alignButton_ = nullptr;
     QPushButton* applyStretchButton_ = nullptr;
     QScrollBar* horizontalScrollBar_ = nullptr;
-    QFutureWatcher<void>* bpmWatcher_ = nullptr;
     QFutureWatcher<void>* alignWatcher_ = nullptr;
-    /** Результаты мимо QFuture::result() (см. runBpmAnalysis). */
-    std::shared_ptr<BPMAnalyzer::AnalysisResult> pendingBpm_;
+    /** Результат мимо QFuture::result() (см. runBeatAlign). */
     std::shared_ptr<QVector<QVector<float>>> pendingAligned_;
     BPMAnalyzer::AnalysisResult lastAnalysis_;
     QTimer* autoAnalysisTimer_ = nullptr;
+    QTimer* analysisPollTimer_ = nullptr;
     QElapsedTimer hostRefreshClock_;
     bool analysisRunning_ = false;
     bool alignRunning_ = false;
     /** Идёт применение каретки от DAW — обратно её не отправляем. */
     bool applyingHostPlayhead_ = false;
+    /** DAW прислала свою сетку — живая сетка её не перекрывает. */
+    bool hostGridActive_ = false;
     int beatsPerBar_ = 4;
     /** Точки цикла (мс) и его состояние — как A/B в главном окне. */
     qint64 loopStartMs_ = -1;
@@ -111,8 +125,12 @@ private:
 
     /** Пауза в потоке аудио от хоста, после которой стартует авто-анализ. */
     static constexpr int kAutoAnalysisDelayMs = 400;
+    /** Как часто спрашиваем сессию о готовности анализа (и обновляем прогресс). */
+    static constexpr int kAnalysisPollIntervalMs = 100;
     /** Минимальный интервал перерисовки волны при потоке блоков от хоста. */
     static constexpr int kHostRefreshIntervalMs = 200;
+    /** Уверенность живого трекера, с которой его сетка идёт на волну. */
+    static constexpr float kLiveGridMinConfidence = 0.5f;
 };
 
 } // namespace Dontfloat::Plugins::Ui
@@ -0,0 +1,549 @@
+#include "../include/analysiscache.h"
+
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QDateTime>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QPair>
+#include <QtCore/QSaveFile>
+#include <QtCore/QStandardPaths>
+
+#include <cstring>
+#include <type_traits>
+
+namespace {
+
+// Файл записи:
+//   FileHeader | SectionEntry × sectionCount | секции (каждая с границы 8 байт)
+// Числа пишутся в порядке байт машины: кеш локальный, а чужой порядок
+// отсекается по byteOrder в заголовке.
+
+constexpr char kMagic[4] = { 'D', 'F', 'A', 'C' };
+/** Меняется при любой смене раскладки секций или параметров анализа по умолчанию. */
+constexpr quint32 kFormatVersion = 3;
+constexpr quint32 kByteOrderMark = 0x01020304;
+constexpr qint64 kAlignment = 8;
+const QString kFileSuffix = QStringLiteral(".dfac");
+
+constexpr quint32 tag(char a, char b, char c, char d)
+{
+    return quint32(quint8(a)) | (quint32(quint8(b)) << 8) | (quint32(quint8(c)) << 16)
+         | (quint32(quint8(d)) << 24);
+}
+
+constexpr quint32 kInfoTag = tag('I', 'N', 'F', 'O');
+constexpr quint32 kPeaksTag = tag('P', 'E', 'A', 'K');
+constexpr quint32 kBeatsTag = tag('B', 'E', 'A', 'T');
+constexpr quint32 kPitchTag = tag('P', 'T', 'C', 'H');
+
+struct FileHeader {
+    char magic[4];
+    quint32 version;
+    quint32 byteOrder;
+    quint32 sectionCount;
+};
+
+struct SectionEntry {
+    quint32 tag;
+    quint32 reserved;
+    qint64 offset;
+    qint64 size;
+};
+
+struct StoredInfo {
+    qint32 sampleRate;
+    qint32 channelCount;
+    qint64 sampleCount;
+};
+
+struct StoredBeatsHeader {
+    float bpm;
+    float confidence;
+    float averageDeviation;
+    float preliminaryBPM;
+    qint64 gridStartSample;
+    quint32 flags;
+    qint32 beatCount;
+    qint32 barPhase;
+    qint32 reserved;
+    quint64 optionsKey;  // AnalysisCacheEntry::beatsOptionsKey
+};
+
+enum BeatsFlag : quint32 {
+    kIrregularBeats = 1u << 0,
+    kFixedTempo = 1u << 1,
+    kHasPreliminaryBPM = 1u << 2,
+};
+
+struct StoredBeat {
+    qint64 position;
+    qint64 expectedPosition;
+    float confidence;
+    float deviation;
+    float energy;
+    float reserved;
+};
+
+struct StoredKey {
+    qint32 key;
+    float confidence;
+    float strength;
+    qint32 isMajor;
+    char name[32];  // UTF-8, с нулём в конце
+};
+
+struct StoredPitchHeader {
+    float gridBpm;
+    qint32 gridBeatsPerBar;
+    qint64 gridStartSample;
+    StoredKey primaryKey;
+    qint32 hasModulation;
+    qint32 barCount;
+    qint32 regionCount;
+    qint32 noteCount;
+};
+
+struct StoredBar {
+    qint32 barIndex;
+    qint32 reserved;
+    qint64 startSample;
+    qint64 endSample;
+    StoredKey key;
+};
+
+struct StoredRegion {
+    qint32 startBar;
+    qint32 endBar;
+    qint64 startSample;
+    qint64 endSample;
+    StoredKey key;
+};
+
+struct StoredNote {
+    qint64 startSample;
+    qint64 endSample;
+    qint64 sourceStartSample;
+    qint64 sourceEndSample;
+    float midiPitch;
+    float detectedPitch;
+    float confidence;
+    float reserved;
+};
+
+static_assert(sizeof(StoredBeat) % kAlignment == 0, "записи секций выровнены по 8 байт");
+static_assert(sizeof(StoredBar) % kAlignment == 0, "записи секций выровнены по 8 байт");
+static_assert(sizeof(StoredRegion) % kAlignment == 0, "записи секций выровнены по 8 байт");
+static_assert(sizeof(StoredNote) % kAlignment == 0, "записи секций выровнены по 8 байт");
+
+template <typename T>
+void appendPod(QByteArray& out, const T& value)
+{
+    static_assert(std::is_trivially_copyable_v<T>, "в файл пишутся только POD-записи");
+    out.append(reinterpret_cast<const char*>(&value), qsizetype(sizeof(T)));
+}
+
+/** Последовательное чтение POD-записей из секции с проверкой границ. */
+class SectionReader
+{
+public:
+    SectionReader(const char* data, qint64 size) : data_(data), left_(size) {}
+
+    template <typename T>
+    bool read(T& value)
+    {
+        if (left_ < qint64(sizeof(T))) {
+            return false;
+        }
+        std::memcpy(&value, data_, sizeof(T));
+        data_ += sizeof(T);
+        left_ -= qint64(sizeof(T));
+        return true;
+    }
+
+    bool atEnd() const { return left_ == 0; }
+
+private:
+    const char* data_;
+    qint64 left_;
+};
+
+StoredKey storeKey(const KeyAnalyzer::KeyInfo& info)
+{
+    StoredKey stored {};
+    stored.key = qint32(info.key);
+    stored.confidence = info.confidence;
+    stored.strength = info.strength;
+    stored.isMajor = info.isMajor ? 1 : 0;
+    const QByteArray name = info.keyName.toUtf8().left(qsizetype(sizeof(stored.name)) - 1);
+    std::memcpy(stored.name, name.constData(), size_t(name.size()));
+    return stored;
+}
+
+bool restoreKey(const StoredKey& stored, KeyAnalyzer::KeyInfo& info)
+{
+    if (stored.key < 0 || stored.key > qint32(KeyAnalyzer::UNKNOWN_KEY)) {
+        return false;
+    }
+    info.key = KeyAnalyzer::Key(stored.key);
+    info.confidence = stored.confidence;
+    info.strength = stored.strength;
+    info.isMajor = stored.isMajor != 0;
+    info.keyName = QString::fromUtf8(stored.name, qsizetype(qstrnlen(stored.name, sizeof(stored.name))));
+    return true;
+}
+
+QByteArray encodeBeats(const BPMAnalyzer::AnalysisResult& beats, quint64 optionsKey)
+{
+    QByteArray out;
+    StoredBeatsHeader header {};
+    header.bpm = beats.bpm;
+    header.confidence = beats.confidence;
+    header.averageDeviation = beats.averageDeviation;
+    header.preliminaryBPM = beats.preliminaryBPM;
+    header.gridStartSample = beats.gridStartSample;
+    header.flags = (beats.hasIrregularBeats ? kIrregularBeats : 0u)
+                 | (beats.isFixedTempo ? kFixedTempo : 0u)
+                 | (beats.hasPreliminaryBPM ? kHasPreliminaryBPM : 0u);
+    header.beatCount = qint32(beats.beats.size());
+    header.barPhase = beats.barPhase;
+    header.optionsKey = optionsKey;
+    appendPod(out, header);
+    for (const BPMAnalyzer::BeatInfo& beat : beats.beats) {
+        appendPod(out, StoredBeat { beat.position, beat.expectedPosition, beat.confidence,
+                                    beat.deviation, beat.energy, 0.0f });
+    }
+    return out;
+}
+
+bool decodeBeats(const char* data, qint64 size, BPMAnalyzer::AnalysisResult& beats, quint64& optionsKey)
+{
+    SectionReader reader(data, size);
+    StoredBeatsHeader header {};
+    if (!reader.read(header) || header.beatCount < 0
+        || size != qint64(sizeof(header)) + qint64(header.beatCount) * qint64(sizeof(StoredBeat))) {
+        return false;
+    }
+    beats = BPMAnalyzer::AnalysisResult();
+    optionsKey = header.optionsKey;
+    beats.bpm = header.bpm;
+    beats.confidence = header.confidence;
+    beats.averageDeviation = header.averageDeviation;
+    beats.preliminaryBPM = header.preliminaryBPM;
+    beats.gridStartSample = header.gridStartSample;
+    beats.barPhase = header.barPhase;
+    beats.hasIrregularBeats = (header.flags & kIrregularBeats) != 0;
+    beats.isFixedTempo = (header.flags & kFixedTempo) != 0;
+    beats.hasPreliminaryBPM = (header.flags & kHasPreliminaryBPM) != 0;
+    beats.beats.resize(header.beatCount);
+    for (BPMAnalyzer::BeatInfo& beat : beats.beats) {
+        StoredBeat stored {};
+        reader.read(stored);
+        beat.position = stored.position;
+        beat.expectedPosition = stored.expectedPosition;
+        beat.confidence = stored.confidence;
+        beat.deviation = stored.deviation;
+        beat.energy = stored.energy;
+    }
+    return true;
+}
+
+QByteArray encodePitch(const AnalysisCacheEntry& entry)
+{
+    QByteArray out;
+    StoredPitchHeader header {};
+    header.gridBpm = entry.keyGrid.bpm;
+    header.gridBeatsPerBar = entry.keyGrid.beatsPerBar;
+    header.gridStartSample = entry.keyGrid.gridStartSample;
+    header.primaryKey = storeKey(entry.perBarKey.primaryKey);
+    header.hasModulation = entry.perBarKey.hasModulation ? 1 : 0;
+    header.barCount = qint32(entry.perBarKey.bars.size());
+    header.regionCount = qint32(entry.perBarKey.regions.size());
+    header.noteCount = qint32(entry.notes.size());
+    appendPod(out, header);
+    for (const KeyAnalyzer::BarKey& bar : entry.perBarKey.bars) {
+        appendPod(out, StoredBar { bar.barIndex, 0, bar.startSample, bar.endSample, storeKey(bar.key) });
+    }
+    for (const KeyAnalyzer::KeyRegion& region : entry.perBarKey.regions) {
+        appendPod(out, StoredRegion { region.startBar, region.endBar, region.startSample,
+                                      region.endSample, storeKey(region.key) });
+    }
+    for (const PitchDetector::PitchNote& note : entry.notes) {
+        appendPod(out, StoredNote { note.startSample, note.endSample, note.sourceStartSample,
+                                    note.sourceEndSample, note.midiPitch, note.detectedPitch,
+                                    note.confidence, 0.0f });
+    }
+    return out;
+}
+
+bool decodePitch(const char* data, qint64 size, AnalysisCacheEntry& entry)
+{
+    SectionReader reader(data, size);
+    StoredPitchHeader header {};
+    if (!reader.read(header) || header.barCount < 0 || header.regionCount < 0 || header.noteCount < 0
+        || size != qint64(sizeof(header)) + qint64(header.barCount) * qint64(sizeof(StoredBar))
+                   + qint64(header.regionCount) * qint64(sizeof(StoredRegion))
+                   + qint64(header.noteCount) * qint64(sizeof(StoredNote))) {
+        return false;
+    }
+    entry.keyGrid.bpm = header.gridBpm;
+    entry.keyGrid.beatsPerBar = header.gridBeatsPerBar;
+    entry.keyGrid.gridStartSample = header.gridStartSample;
+    entry.perBarKey = KeyAnalyzer::PerBarKeyResult();
+    entry.perBarKey.hasModulation = header.hasModulation != 0;
+    bool ok = restoreKey(header.primaryKey, entry.perBarKey.primaryKey);
+
+    entry.perBarKey.bars.resize(header.barCount);
+    for (KeyAnalyzer::BarKey& bar : entry.perBarKey.bars) {
+        StoredBar stored {};
+        reader.read(stored);
+        bar.barIndex = stored.barIndex;
+        bar.startSample = stored.startSample;
+        bar.endSample = stored.endSample;
+        ok = restoreKey(stored.key, bar.key) && ok;
+    }
+    entry.perBarKey.regions.resize(header.regionCount);
+    for (KeyAnalyzer::KeyRegion& region : entry.perBarKey.regions) {
+        StoredRegion stored {};
+        reader.read(stored);
+        region.startBar = stored.startBar;
+        region.endBar = stored.endBar;
+        region.startSample = stored.startSample;
+        region.endSample = stored.endSample;
+        ok = restoreKey(stored.key, region.key) && ok;
+    }
+    entry.notes.resize(header.noteCount);
+    for (PitchDetector::PitchNote& note : entry.notes) {
+        StoredNote stored {};
+        reader.read(stored);
+        note.startSample = stored.startSample;
+        note.endSample = stored.endSample;
+        note.sourceStartSample = stored.sourceStartSample;
+        note.sourceEndSample = stored.sourceEndSample;
+        note.midiPitch = stored.midiPitch;
+        note.detectedPitch = stored.detectedPitch;
+        note.confidence = stored.confidence;
+    }
+    return ok;
+}
+
+} // namespace
+
+AnalysisCache::AnalysisCache(const QString& directory)
+    : directory_(directory)
+{
+}
+
+QString AnalysisCache::defaultDirectory()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation)
+         + QStringLiteral("/analysis");
+}
+
+QByteArray AnalysisCache::contentHash(const QString& filePath)
+{
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return {};
+    }
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    if (!hash.addData(&file)) {
+        return {};
+    }
+    return hash.result().toHex();
+}
+
+quint64 AnalysisCache::optionsKey(const BPMAnalyzer::AnalysisOptions& options)
+{
+    // FNV-1a по полям: флаги, затем числа (BPM из настроек — только если включён)
+    quint64 hash = 1469598103934665603ULL;
+    const auto mix = [&hash](quint32 value) {
+        for (int byte = 0; byte < 4; ++byte) {
+            hash = (hash ^ ((value >> (8 * byte)) & 0xFFu)) * 1099511628211ULL;
+        }
+    };
+    const auto mixFloat = [&mix](float value) {
+        quint32 bits = 0;
+        std::memcpy(&bits, &value, sizeof(bits));
+        mix(bits);
+    };
+    mix(quint32(options.assumeFixedTempo) | quint32(options.fastAnalysis) << 1
+        | quint32(options.useMixxxAlgorithm) << 2 | quint32(options.useInitialBPM) << 3
+        | quint32(options.trustFileBPM) << 4);
+    mixFloat(options.minBPM);
+    mixFloat(options.maxBPM);
+    mixFloat(options.tolerancePercent);
+    mixFloat(options.useInitialBPM ? options.initialBPM : 0.0f);
+    mixFloat(options.trustFileBPM ? options.fileBPM : 0.0f);
+    mix(quint32(options.beatsPerBar));
+    return hash;
+}
+
+QString AnalysisCache::pathFor(const QByteArray& hash) const
+{
+    return directory_ + QLatin1Char('/') + QString::fromLatin1(hash) + kFileSuffix;
+}
+
+QByteArray AnalysisCache::encode(const AnalysisCacheEntry& entry)
+{
+    QVector<QPair<quint32, QByteArray>> sections;
+    QByteArray info;
+    appendPod(info, StoredInfo { entry.sampleRate, entry.channelCount, entry.sampleCount });
+    sections.append({ kInfoTag, info });
+    if (entry.peaks.isValid()) {
+        sections.append({ kPeaksTag, entry.peaks.serialize() });
+    }
+    if (entry.hasBeats) {
+        sections.append({ kBeatsTag, encodeBeats(entry.beats, entry.beatsOptionsKey) });
+    }
+    if (entry.hasPitchAnalysis) {
+        sections.append({ kPitchTag, encodePitch(entry) });
+    }
+
+    FileHeader header {};
+    std::memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kFormatVersion;
+    header.byteOrder = kByteOrderMark;
+    header.sectionCount = quint32(sections.size());
+
+    // Секции с границы 8 байт: отображённые в память корзины пиков и записи
+    // читаются без невыровненного доступа
+    auto aligned = [](qint64 offset) { return (offset + kAlignment - 1) / kAlignment * kAlignment; };
+    qint64 offset = aligned(qint64(sizeof(FileHeader)) + qint64(sections.size()) * qint64(sizeof(SectionEntry)));
+    QByteArray out;
+    appendPod(out, header);
+    for (const auto& section : sections) {
+        appendPod(out, SectionEntry { section.first, 0, offset, qint64(section.second.size()) });
+        offset = aligned(offset + section.second.size());
+    }
+    for (const auto& section : sections) {
+        out.append(QByteArray(aligned(out.size()) - out.size(), '\0'));
+        out.append(section.second);
+    }
+    return out;
+}
+
+bool AnalysisCache::decode(const char* data, qint64 size, AnalysisCacheEntry& entry)
+{
+    entry = AnalysisCacheEntry();
+    SectionReader reader(data, size);
+    FileHeader header {};
+    if (!reader.read(header) || std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0
+        || header.version != kFormatVersion || header.byteOrder != kByteOrderMark) {
+        return false;
+    }
+
+    bool hasInfo = false;
+    for (quint32 i = 0; i < header.sectionCount; ++i) {
+        SectionEntry section {};
+        if (!reader.read(section) || section.offset < 0 || section.size < 0
+            || section.offset % kAlignment != 0 || section.offset > size
+            || section.size > size - section.offset) {
+            return false;
+        }
+        const char* begin = data + section.offset;
+        bool ok = true;
+        switch (section.tag) {
+        case kInfoTag: {
+            StoredInfo info {};
+            SectionReader infoReader(begin, section.size);
+            ok = infoReader.read(info) && infoReader.atEnd();
+            entry.sampleRate = info.sampleRate;
+            entry.channelCount = info.channelCount;
+            entry.sampleCount = info.sampleCount;
+            hasInfo = ok;
+            break;
+        }
+        case kPeaksTag:
+            ok = entry.peaks.deserialize(begin, section.size);
+            break;
+        case kBeatsTag:
+            ok = entry.hasBeats = decodeBeats(begin, section.size, entry.beats, entry.beatsOptionsKey);
+            break;
+        case kPitchTag:
+            ok = entry.hasPitchAnalysis = decodePitch(begin, section.size, entry);
+            break;
+        default:
+            break;  // незнакомые секции пропускаем
+        }
+        if (!ok) {
+            return false;
+        }
+    }
+    // Пики от другого аудио хуже, чем их отсутствие
+    if (!hasInfo || (entry.peaks.isValid()
+                     && (entry.peaks.sampleCount() != entry.sampleCount
+                         || entry.peaks.channelCount() != entry.channelCount))) {
+        return false;
+    }
+    return true;
+}
+
+bool AnalysisCache::load(const QByteArray& hash, AnalysisCacheEntry& entry) const
+{
+    if (hash.isEmpty()) {
+        return false;
+    }
+    QFile file(pathFor(hash));
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    const qint64 size = file.size();
+    const uchar* mapped = size > 0 ? file.map(0, size) : nullptr;
+    bool ok = false;
+    if (mapped) {
+        ok = decode(reinterpret_cast<const char*>(mapped), size, entry);
+        file.unmap(const_cast<uchar*>(mapped));
+    } else {
+        const QByteArray bytes = file.readAll();
+        ok = decode(bytes.constData(), bytes.size(), entry);
+    }
+    file.close();
+
+    if (!ok) {
+        QFile::remove(pathFor(hash));  // чужая версия или обрывок — пересчитаем и перепишем
+        return false;
+    }
+    // Время изменения — метка «недавно нужен» для вытеснения (см. prune)
+    if (file.open(QIODevice::ReadWrite)) {
+        file.setFileTime(QDateTime::currentDateTimeUtc(), QFileDevice::FileModificationTime);
+    }
+    return true;
+}
+
+bool AnalysisCache::store(const QByteArray& hash, const AnalysisCacheEntry& entry)
+{
+    if (hash.isEmpty() || !QDir().mkpath(directory_)) {
+        return false;
+    }
+    QSaveFile file(pathFor(hash));
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+    const QByteArray bytes = encode(entry);
+    if (file.write(bytes) != bytes.size() || !file.commit()) {
+        return false;
+    }
+    prune();
+    return true;
+}
+
+void AnalysisCache::remove(const QByteArray& hash)
+{
+    if (!hash.isEmpty()) {
+        QFile::remove(pathFor(hash));
+    }
+}
+
+void AnalysisCache::prune() const
+{
+    const QFileInfoList files = QDir(directory_).entryInfoList(
+        { QStringLiteral("*") + kFileSuffix }, QDir::Files, QDir::Time);  // свежие первыми
+    qint64 total = 0;
+    for (const QFileInfo& info : files) {
+        total += info.size();
+        if (total > budgetBytes_) {
+            QFile::remove(info.absoluteFilePath());
+        }
+    }
+}
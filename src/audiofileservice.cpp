@@ -80,9 +80,19 @@ QString decoderErrorText(QAudioDecoder::Error error)
 
 namespace AudioFileService {
 
-DecodeResult decode(const QString& filePath, const std::function<void(int)>& onProgress)
+DecodeResult decode(const QString& filePath,
+                    const std::function<void(int)>& onProgress,
+                    const BlockCallback& onBlock,
+                    const std::atomic<bool>* cancel)
 {
     DecodeResult result;
+    const auto isCancelled = [cancel]() {
+        return cancel && cancel->load(std::memory_order_relaxed);
+    };
+    if (isCancelled()) {
+        result.cancelled = true;
+        return result;
+    }
 
     QAudioDecoder decoder;
     decoder.setSource(QUrl::fromLocalFile(filePath));
@@ -91,6 +101,7 @@ DecodeResult decode(const QString& filePath, const std::function<void(int)>& onP
     QVector<float> leftChannel;
     QVector<float> rightChannel;
     bool decodeError = false;
+    bool cancelled = false;
     QString errorMsg;
     int detectedSampleRate = 0;
     bool reserved = false;
@@ -112,6 +123,14 @@ DecodeResult decode(const QString& filePath, const std::function<void(int)>& onP
         });
 
     QObject::connect(&decoder, &QAudioDecoder::bufferReady, [&]() {
+        if (cancelled) {
+            return;
+        }
+        if (isCancelled()) {
+            cancelled = true;
+            loop.quit();
+            return;
+        }
         const QAudioBuffer buffer = decoder.read();
         if (!buffer.isValid() || buffer.frameCount() == 0)
             return;
@@ -134,7 +153,16 @@ DecodeResult decode(const QString& filePath, const std::function<void(int)>& onP
             }
         }
 
+        const int firstFrame = leftChannel.size();
         appendAudioBuffer(buffer, leftChannel, rightChannel);
+        const int blockFrames = leftChannel.size() - firstFrame;
+        if (onBlock && blockFrames > 0) {
+            onBlock(detectedSampleRate,
+                    leftChannel.constData() + firstFrame,
+                    rightChannel.size() == leftChannel.size() ? rightChannel.constData() + firstFrame
+                                                              : nullptr,
+                    blockFrames);
+        }
 
         if (onProgress && detectedSampleRate > 0) {
             const qint64 durMs = decoder.duration();
@@ -155,6 +183,10 @@ DecodeResult decode(const QString& filePath, const std::function<void(int)>& onP
     loop.exec();
     decoder.stop();
 
+    if (cancelled) {
+        result.cancelled = true;
+        return result;
+    }
     if (decodeError) {
         result.error = errorMsg;
         return result;
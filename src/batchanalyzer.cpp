@@ -0,0 +1,430 @@
+#include "../include/batchanalyzer.h"
+
+#include "../include/audiofileservice.h"
+#include "../include/markersfile.h"
+#include "../include/onsetstream.h"
+
+#include <QtConcurrent/QtConcurrent>
+#include <QtCore/QDir>
+#include <QtCore/QDirIterator>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QFileInfo>
+#include <QtCore/QJsonArray>
+#include <QtCore/QJsonDocument>
+#include <QtCore/QMutex>
+#include <QtCore/QSaveFile>
+#include <QtCore/QSet>
+#include <QtCore/QThread>
+#include <QtCore/QThreadPool>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+namespace BatchAnalyzer {
+
+namespace {
+
+const QString kJsonSuffix = QStringLiteral(".dontfloat.json");
+const QString kMarkersSuffix = QStringLiteral("_markers.txt");
+
+bool wantsJson(const Options& options)
+{
+    return options.format != OutputFormat::Markers;
+}
+
+bool wantsMarkers(const Options& options)
+{
+    return options.format != OutputFormat::Json;
+}
+
+bool outputsExist(const QString& path, const Options& options)
+{
+    if (wantsJson(options) && !QFileInfo::exists(outputPathFor(path, options, kJsonSuffix))) {
+        return false;
+    }
+    if (wantsMarkers(options) && !QFileInfo::exists(outputPathFor(path, options, kMarkersSuffix))) {
+        return false;
+    }
+    return true;
+}
+
+QJsonObject keyToJson(const KeyAnalyzer::KeyInfo& key)
+{
+    QJsonObject object;
+    object.insert(QStringLiteral("name"), key.keyName.isEmpty()
+                                              ? KeyAnalyzer::keyToString(key.key)
+                                              : key.keyName);
+    object.insert(QStringLiteral("confidence"), double(key.confidence));
+    return object;
+}
+
+bool writeJson(const QString& path, const QJsonObject& object, QString* error)
+{
+    QDir().mkpath(QFileInfo(path).absolutePath());
+    // QSaveFile: прерванный ночной прогон не оставит обрезанный JSON
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        *error = QStringLiteral("cannot write %1").arg(path);
+        return false;
+    }
+    file.write(QJsonDocument(object).toJson(QJsonDocument::Indented));
+    if (!file.commit()) {
+        *error = QStringLiteral("cannot write %1").arg(path);
+        return false;
+    }
+    return true;
+}
+
+bool writeMarkers(const QString& path, const FileResult& result, const Options& options, QString* error)
+{
+    QDir().mkpath(QFileInfo(path).absolutePath());
+
+    MarkersFileMeta meta;
+    meta.bpm = result.beats.bpm;
+    meta.beatsPerBar = options.beatsPerBar;
+    meta.sampleRate = result.sampleRate;
+    meta.gridStartSample = BPMAnalyzer::barStartSample(result.beats, result.sampleRate);
+
+    QVector<Marker> markers;
+    markers.reserve(result.beats.beats.size());
+    for (const BPMAnalyzer::BeatInfo& beat : result.beats.beats) {
+        Marker marker(beat.position, result.sampleRate);
+        marker.originalPosition = beat.position;
+        markers.append(marker);
+    }
+    return MarkersFile::writeFile(path, meta, markers, result.sampleRate, error);
+}
+
+} // namespace
+
+QStringList audioSuffixes()
+{
+    return { QStringLiteral("wav"), QStringLiteral("mp3"), QStringLiteral("flac"),
+             QStringLiteral("ogg"), QStringLiteral("aif"), QStringLiteral("aiff"),
+             QStringLiteral("m4a") };
+}
+
+QStringList collectAudioFiles(const QStringList& paths, bool recursive)
+{
+    const QStringList suffixes = audioSuffixes();
+    QSet<QString> seen;
+    QVector<QFileInfo> found;
+
+    const auto add = [&](const QFileInfo& info) {
+        const QString path = info.absoluteFilePath();
+        if (!seen.contains(path)) {
+            seen.insert(path);
+            found.append(info);
+        }
+    };
+
+    for (const QString& path : paths) {
+        const QFileInfo info(path);
+        if (info.isFile()) {
+            add(info);
+            continue;
+        }
+        if (!info.isDir()) {
+            continue;
+        }
+        QDirIterator it(info.absoluteFilePath(), QDir::Files | QDir::Readable,
+                        recursive ? QDirIterator::Subdirectories : QDirIterator::NoIteratorFlags);
+        while (it.hasNext()) {
+            const QFileInfo file(it.next());
+            if (suffixes.contains(file.suffix().toLower())) {
+                add(file);
+            }
+        }
+    }
+
+    // Большие файлы — в начало очереди: к концу пакета остаются короткие, и
+    // потоки заканчивают почти одновременно
+    std::stable_sort(found.begin(), found.end(), [](const QFileInfo& a, const QFileInfo& b) {
+        if (a.size() != b.size()) {
+            return a.size() > b.size();
+        }
+        return a.absoluteFilePath() < b.absoluteFilePath();
+    });
+
+    QStringList files;
+    files.reserve(found.size());
+    for (const QFileInfo& info : found) {
+        files.append(info.absoluteFilePath());
+    }
+    return files;
+}
+
+QString outputPathFor(const QString& audioPath, const Options& options, const QString& suffix)
+{
+    const QFileInfo info(audioPath);
+    const QString baseName = info.completeBaseName() + suffix;
+    if (options.outputDir.isEmpty()) {
+        return info.absoluteDir().filePath(baseName);
+    }
+
+    QString relativeDir;
+    if (!options.inputRoot.isEmpty()) {
+        relativeDir = QDir(options.inputRoot).relativeFilePath(info.absolutePath());
+        // Файл вне корня — кладём прямо в outputDir, наружу не выходим
+        if (relativeDir == QStringLiteral(".") || relativeDir.startsWith(QStringLiteral(".."))
+            || QDir::isAbsolutePath(relativeDir)) {
+            relativeDir.clear();
+        }
+    }
+    const QDir outputDir(options.outputDir);
+    return relativeDir.isEmpty() ? outputDir.filePath(baseName)
+                                 : outputDir.filePath(relativeDir + QLatin1Char('/') + baseName);
+}
+
+FileResult analyzeFile(const QString& path, const Options& options, int threadBudget)
+{
+    return analyzeFile(path, options, [threadBudget]() { return threadBudget; });
+}
+
+FileResult analyzeFile(const QString& path,
+                       const Options& options,
+                       const std::function<int()>& threadBudget)
+{
+    FileResult result;
+    result.path = path;
+    QElapsedTimer timer;
+    timer.start();
+
+    if (options.skipExisting && outputsExist(path, options)) {
+        result.ok = true;
+        result.skipped = true;
+        return result;
+    }
+
+    // Onset-функция набирается из блоков декодера по среднему каналов, как при
+    // загрузке в окне (LoadPipeline)
+    std::unique_ptr<OnsetStream> onsets;
+    AudioFileService::BlockCallback onBlock;
+    if (options.bpmOptions.useMixxxAlgorithm) {
+        onBlock = [&onsets](int sampleRate, const float* left, const float* right, int frames) {
+            if (!onsets && sampleRate > 0) {
+                onsets = std::make_unique<OnsetStream>(sampleRate);
+            }
+            if (onsets) {
+                onsets->push(left, right, frames);
+            }
+        };
+    }
+
+    const AudioFileService::DecodeResult decoded = AudioFileService::decode(path, {}, onBlock);
+    if (!decoded.ok || decoded.channels.isEmpty() || decoded.channels[0].isEmpty()) {
+        result.error = decoded.error.isEmpty() ? QStringLiteral("no audio") : decoded.error;
+        result.elapsedMs = timer.elapsed();
+        return result;
+    }
+
+    result.sampleRate = decoded.sampleRate;
+    result.channelCount = decoded.channels.size();
+    result.sampleCount = decoded.channels[0].size();
+
+    // Сильная доля ищется в том же размере, в каком считаются такты
+    BPMAnalyzer::AnalysisOptions bpmOptions = options.bpmOptions;
+    bpmOptions.beatsPerBar = options.beatsPerBar;
+    bpmOptions.maxThreads = threadBudget();
+    const QVector<float> mono = AudioFileService::toMono(decoded.channels);
+    if (onsets && onsets->sampleCount() == result.sampleCount) {
+        result.beats = BPMAnalyzer::analyzeOnsetStream(*onsets, bpmOptions);
+    } else {
+        result.beats = BPMAnalyzer::analyzeBPM(mono, decoded.sampleRate, bpmOptions);
+    }
+    onsets.reset();
+
+    if (options.analyzeKeys || options.detectNotes) {
+
+        KeyAnalyzer::BarGrid barGrid;
+        barGrid.bpm = result.beats.bpm;
+        barGrid.beatsPerBar = options.beatsPerBar;
+        barGrid.gridStartSample = BPMAnalyzer::barStartSample(result.beats, result.sampleRate);
+        const bool analyzeKeys = options.analyzeKeys && barGrid.bpm > 0.0f;
+        // Бюджет берётся заново: пока шёл BPM, другие файлы могли закончиться
+        const int stageBudget = threadBudget();
+        KeyAnalyzer::AnalysisOptions keyOptions;
+        keyOptions.maxThreads = stageBudget;
+        PitchDetector::Options pitchOptions;
+        pitchOptions.maxThreads = stageBudget;
+
+        if (stageBudget >= 2 && analyzeKeys && options.detectNotes) {
+            // Свободные ядра есть: ноты — в отдельном потоке, тональность — в этом,
+            // бюджет пополам. Пул свой: потоки общего заняты рабочими пакета
+            pitchOptions.maxThreads = stageBudget / 2;
+            keyOptions.maxThreads = stageBudget - pitchOptions.maxThreads;
+            QThreadPool stagePool;
+            stagePool.setMaxThreadCount(1);
+            QFuture<QVector<PitchDetector::PitchNote>> notes = QtConcurrent::run(
+                &stagePool, [&mono, &decoded, &pitchOptions]() {
+                    return PitchDetector::detectNotes(mono, decoded.sampleRate, pitchOptions);
+                });
+            result.keys = KeyAnalyzer::analyzeKeyPerBar(mono, decoded.sampleRate, barGrid, keyOptions);
+            result.notes = notes.result();
+        } else {
+            if (analyzeKeys) {
+                result.keys = KeyAnalyzer::analyzeKeyPerBar(mono, decoded.sampleRate, barGrid, keyOptions);
+            }
+            if (options.detectNotes) {
+                result.notes = PitchDetector::detectNotes(mono, decoded.sampleRate, pitchOptions);
+            }
+        }
+    }
+
+    result.ok = true;
+    QString error;
+    if (wantsJson(options)) {
+        const QString jsonPath = outputPathFor(path, options, kJsonSuffix);
+        if (writeJson(jsonPath, toJson(result), &error)) {
+            result.outputs.append(jsonPath);
+        } else {
+            result.ok = false;
+            result.error = error;
+        }
+    }
+    if (result.ok && wantsMarkers(options)) {
+        const QString markersPath = outputPathFor(path, options, kMarkersSuffix);
+        if (writeMarkers(markersPath, result, options, &error)) {
+            result.outputs.append(markersPath);
+        } else {
+            result.ok = false;
+            result.error = error;
+        }
+    }
+
+    result.elapsedMs = timer.elapsed();
+    return result;
+}
+
+QJsonObject toJson(const FileResult& result)
+{
+    QJsonObject root;
+    root.insert(QStringLiteral("file"), result.path);
+    root.insert(QStringLiteral("sampleRate"), result.sampleRate);
+    root.insert(QStringLiteral("channels"), result.channelCount);
+    root.insert(QStringLiteral("samples"), double(result.sampleCount));
+
+    const BPMAnalyzer::AnalysisResult& beats = result.beats;
+    root.insert(QStringLiteral("bpm"), double(beats.bpm));
+    root.insert(QStringLiteral("confidence"), double(beats.confidence));
+    root.insert(QStringLiteral("gridStartSample"), double(beats.gridStartSample));
+    root.insert(QStringLiteral("barPhase"), beats.barPhase);
+    root.insert(QStringLiteral("fixedTempo"), beats.isFixedTempo);
+    root.insert(QStringLiteral("irregularBeats"), beats.hasIrregularBeats);
+
+    QJsonArray beatPositions;
+    for (const BPMAnalyzer::BeatInfo& beat : beats.beats) {
+        beatPositions.append(double(beat.position));
+    }
+    root.insert(QStringLiteral("beats"), beatPositions);
+
+    if (beats.tempoMap.isVariable()) {
+        QJsonArray segments;
+        for (const TempoMap::Segment& segment : beats.tempoMap.segments()) {
+            QJsonObject object;
+            object.insert(QStringLiteral("startSample"), segment.startSample);
+            object.insert(QStringLiteral("startBeat"), segment.startBeat);
+            object.insert(QStringLiteral("bpm"), 60.0 * result.sampleRate / segment.samplesPerBeat);
+            segments.append(object);
+        }
+        root.insert(QStringLiteral("tempoMap"), segments);
+    }
+
+    const KeyAnalyzer::PerBarKeyResult& keys = result.keys;
+    if (!keys.bars.isEmpty()) {
+        root.insert(QStringLiteral("key"), keyToJson(keys.primaryKey));
+        QJsonArray regions;
+        for (const KeyAnalyzer::KeyRegion& region : keys.regions) {
+            QJsonObject object = keyToJson(region.key);
+            object.insert(QStringLiteral("startBar"), region.startBar);
+            object.insert(QStringLiteral("endBar"), region.endBar);
+            object.insert(QStringLiteral("startSample"), double(region.startSample));
+            object.insert(QStringLiteral("endSample"), double(region.endSample));
+            regions.append(object);
+        }
+        root.insert(QStringLiteral("keyRegions"), regions);
+    }
+
+    if (!result.notes.isEmpty()) {
+        QJsonArray notes;
+        for (const PitchDetector::PitchNote& note : result.notes) {
+            QJsonObject object;
+            object.insert(QStringLiteral("startSample"), double(note.startSample));
+            object.insert(QStringLiteral("endSample"), double(note.endSample));
+            object.insert(QStringLiteral("pitch"), double(note.detectedPitch));
+            object.insert(QStringLiteral("confidence"), double(note.confidence));
+            notes.append(object);
+        }
+        root.insert(QStringLiteral("notes"), notes);
+    }
+    return root;
+}
+
+Summary run(const QStringList& files,
+            const Options& options,
+            const std::function<void(const FileResult&, int done, int total)>& onFinished)
+{
+    Summary summary;
+    const int total = files.size();
+    if (total == 0) {
+        return summary;
+    }
+
+    const int jobs = qBound(1, options.jobs > 0 ? options.jobs : QThread::idealThreadCount(), total);
+    std::atomic<int> next { 0 };
+    std::atomic<int> active { jobs };
+    QMutex reportMutex;
+    int done = 0;
+
+    const auto worker = [&]() {
+        for (;;) {
+            const int index = next.fetch_add(1);
+            if (index >= total) {
+                active.fetch_sub(1);
+                return;
+            }
+            // Пока очередь не пуста, ядра заняты файлами: каждый анализируется в
+            // один поток. Очередь кончилась — свободные ядра делятся между
+            // файлами, которые ещё считаются. Бюджет считается перед каждым
+            // этапом, так что хвост пакета подбирает ядра закончивших файлов
+            const auto threadBudget = [&]() {
+                if (jobs == 1) {
+                    return 0;
+                }
+                if (next.load() < total) {
+                    return 1;
+                }
+                return qMax(1, QThread::idealThreadCount() / qMax(1, active.load()));
+            };
+            const FileResult result = analyzeFile(files[index], options, threadBudget);
+
+            QMutexLocker locker(&reportMutex);
+            ++done;
+            if (result.skipped) {
+                ++summary.skipped;
+            } else if (result.ok) {
+                ++summary.analyzed;
+            } else {
+                ++summary.failed;
+            }
+            if (onFinished) {
+                onFinished(result, done, total);
+            }
+        }
+    };
+
+    if (jobs == 1) {
+        worker();
+        return summary;
+    }
+
+    QThreadPool pool;
+    pool.setMaxThreadCount(jobs);
+    for (int i = 0; i < jobs; ++i) {
+        pool.start(worker);
+    }
+    pool.waitForDone();
+    return summary;
+}
+
+} // namespace BatchAnalyzer
@@ -1,5 +1,6 @@
 #include "../include/beatvisualizer.h"
 #include "../include/bpmanalyzer.h"
+#include "../include/fft_engine.h"
 #include <QDebug>
 #include <QtMath>
 #include <QPainter>
@@ -7,6 +8,7 @@
 #include <QBrush>
 #include <QPainterPath>
 #include <QPolygonF>
+#include <algorithm>
 #include <cmath>
 
 namespace {
@@ -267,19 +269,16 @@ QPixmap BeatVisualizer::createDiagonalPattern(float stripeWidth,
 }
 
 void BeatVisualizer::drawBeatDeviations(QPainter& painter,
-                                       const QVector<BPMAnalyzer::BeatInfo>& beats,
+                                       const DeviationModel& deviations,
                                        const QRectF& rect,
-                                       float bpm,
-                                       int sampleRate,
                                        float samplesPerPixel,
                                        int startSample,
                                        const VisualizationSettings& settings,
                                        const BeatDeviationColors& colors)
 {
-    Q_UNUSED(sampleRate);  // интервал сетки больше не пересчитывается здесь
-
     // Быстрый выход если нечего рисовать
-    if (beats.isEmpty() || !settings.showBeatDeviations || bpm <= 0.0f) {
+    if (!deviations.isEvaluated() || deviations.size() < 2 || !settings.showBeatDeviations
+        || samplesPerPixel <= 0.0f) {
         return;
     }
 
@@ -293,24 +292,30 @@ void BeatVisualizer::drawBeatDeviations(QPainter& painter,
     const qreal topY = rect.top() + verticalMargin;
     const qreal botY = rect.bottom() - verticalMargin;
 
+    // Доли идут по времени: видимые — непрерывный отрезок, начало — двоичным поиском.
+    // Координаты в double: на 192 kHz позиции длинного трека уже не влезают
+    // в точные целые float, и треугольник уезжал от бита.
+    const double* positions = deviations.positions();
+    const double* expected = deviations.expectedPositions();
+    const double* deviation = deviations.deviations();
+    const int count = deviations.size();
+    const double endSample = double(startSample) + rectWidth * double(samplesPerPixel);
+    const int first = qMax(1, int(std::lower_bound(positions, positions + count,
+                                                   double(startSample)) - positions));
+
     // Включаем антиалиасинг один раз для всех треугольников
     painter.save();
     painter.setRenderHint(QPainter::Antialiasing, true);
 
     // Рисуем метки отклонений для каждого бита
-    for (int i = 1; i < beats.size(); ++i) {
-        const auto& beat = beats[i];
-
+    for (int i = first; i < count && positions[i] <= endSample; ++i) {
         // Проверяем, есть ли значимое отклонение (больше порога)
-        if (qAbs(beat.deviation) < deviationThreshold) {
+        if (qAbs(deviation[i]) < double(deviationThreshold)) {
             continue;
         }
 
-        // Ожидаемая позиция приходит из BPMAnalyzer::calculateDeviations вместе с deviation.
-        // Координаты считаем в double: на 192 kHz позиции длинного трека уже не влезают
-        // в точные целые float, и треугольник уезжает от бита.
-        const double expectedPosition = double(beat.expectedPosition);
-        const double actualPosition = double(beat.position);
+        const double expectedPosition = expected[i];
+        const double actualPosition = positions[i];
 
         // Вычисляем координаты для отрисовки
         const float expectedX = float((expectedPosition - startSample) / samplesPerPixel);
@@ -322,7 +327,7 @@ void BeatVisualizer::drawBeatDeviations(QPainter& painter,
         }
 
         // Определяем, растянута ли доля (положительное отклонение) или сжата (отрицательное)
-        const bool isStretched = beat.deviation > 0;
+        const bool isStretched = deviation[i] > 0.0;
 
         // Выбираем цвет в зависимости от типа отклонения и состояния выравнивания
         QColor baseColor = deviationBaseColor(isStretched, settings.beatsAligned, colors);
@@ -413,3 +418,44 @@ void BeatVisualizer::drawBeatWaveform(QPainter& painter,
     painter.setPen(Qt::NoPen);
     painter.drawPolygon(silhouette);
 }
+
+QVector<float> BeatVisualizer::calculateFrequencySpectrum(const QVector<float>& samples,
+                                                        int sampleRate,
+                                                        int windowSize)
+{
+    Q_UNUSED(sampleRate)
+
+    const unsigned fftSize = DFEngine::nextPow2(unsigned(qMax(2, windowSize)));
+    const DFEngine::FFTPlan& plan = DFEngine::FFTPlan::forSize(fftSize);
+    QVector<float> spectrum(int(plan.binCount()), 0.0f);
+    if (samples.isEmpty()) {
+        return spectrum;
+    }
+
+    std::vector<float> window;
+    DFEngine::precomputeWindow(window, fftSize, DFEngine::WindowFunction::Hanning);
+
+    // Средний амплитудный спектр по кадрам с перекрытием 50% (метод Уэлча);
+    // буферы кадра переиспользуются, план общий для всех вызовов этого размера
+    std::vector<float> magnitudes;
+    std::vector<DFEngine::Complex> scratch;
+    const int hop = int(fftSize / 2);
+    int frames = 0;
+    for (int start = 0; start < samples.size(); start += hop) {
+        const unsigned count = unsigned(qMin<qsizetype>(fftSize, samples.size() - start));
+        plan.magnitudes(samples.constData() + start, count, window.data(), magnitudes, scratch);
+        for (int k = 0; k < spectrum.size(); ++k) {
+            spectrum[k] += magnitudes[size_t(k)];
+        }
+        ++frames;
+        if (start + int(fftSize) >= samples.size()) {
+            break;
+        }
+    }
+
+    const float norm = 1.0f / float(qMax(1, frames));
+    for (float& value : spectrum) {
+        value *= norm;
+    }
+    return spectrum;
+}
@@ -1,31 +1,82 @@
 #include "../include/bpmanalyzer.h"
+#include "../include/beatgridfit.h"
+#include "../include/deviationmodel.h"
+#include "../include/onsetstream.h"
 #include <QtCore/QDebug>
+#include <QtCore/QRunnable>
+#include <QtCore/QSemaphore>
+#include <QtCore/QThread>
+#include <QtCore/QThreadPool>
 #include <cmath>
+#include <functional>
 #include <algorithm>
 #include <numeric>
 
 #ifdef USE_MIXXX_QM_DSP
-#include <dsp/onsets/DetectionFunction.h>
 #include <dsp/tempotracking/TempoTrackV2.h>
 #endif
 
 // Константы из Mixxx
 namespace {
-    constexpr float kStepSecs = 0.01161f; // ~12ms разрешение для BeatMap
-    constexpr int kMaximumBinSizeHz = 50; // Hz
-
     constexpr float kPeakThresholdMin = 0.05f;
     constexpr float kPeakThresholdMax = 0.3f;
     constexpr float kPeakThresholdStep = 0.05f;
     constexpr int kMinPeaksForAnalysis = 10;
 
-    // Вспомогательная функция для вычисления следующей степени двойки
-    int nextPowerOfTwo(int value) {
-        int result = 1;
-        while (result < value) {
-            result *= 2;
+    // Окно огибающей энергии для поиска пиков и долей (сэмплы)
+    constexpr int kBeatEnergyWindow = 1024;
+    // Короче этого огибающая считается в одном потоке
+    constexpr int kParallelMinSamples = 1 << 18;
+    // Onset-функция по целому сигналу считается блоками по столько шагов:
+    // между блоками — прогресс и проверка отмены (~3 с звука при 44.1 кГц)
+    constexpr int kOnsetStepsPerBlock = 256;
+
+    bool isCancelled(const BPMAnalyzer::AnalysisOptions& options) {
+        return options.cancel && options.cancel->load(std::memory_order_relaxed);
+    }
+
+    void reportProgress(const BPMAnalyzer::AnalysisOptions& options, int percent) {
+        if (options.onProgress) {
+            options.onProgress(qBound(0, percent, 100));
         }
-        return result;
+    }
+
+    // Потоков на анализ: maxThreads из AnalysisOptions, 0 — по числу ядер
+    int analysisThreadCount(int maxThreads) {
+        return qBound(1, maxThreads > 0 ? maxThreads : QThread::idealThreadCount(), 16);
+    }
+
+    // Выполняет task(0 … taskCount-1) не более чем на maxThreads потоках и ждёт
+    // завершения. Пул свой, как в PitchDetector: анализ и сам обычно запущен из
+    // задачи глобального пула
+    void parallelFor(int maxThreads, int taskCount, const std::function<void(int)>& task) {
+        const int threadCount = analysisThreadCount(maxThreads);
+        if (threadCount <= 1 || taskCount <= 1) {
+            for (int i = 0; i < taskCount; ++i) {
+                task(i);
+            }
+            return;
+        }
+        QThreadPool pool;
+        pool.setMaxThreadCount(std::min(threadCount, taskCount));
+        QSemaphore finished;
+        for (int i = 0; i < taskCount; ++i) {
+            pool.start(QRunnable::create([&task, &finished, i]() {
+                task(i);
+                finished.release();
+            }));
+        }
+        finished.acquire(taskCount);
+    }
+
+    // Позиции долей для BeatGridFit
+    std::vector<std::int64_t> beatPositions(const QVector<BPMAnalyzer::BeatInfo>& beats) {
+        std::vector<std::int64_t> positions;
+        positions.reserve(size_t(beats.size()));
+        for (const BPMAnalyzer::BeatInfo& beat : beats) {
+            positions.push_back(beat.position);
+        }
+        return positions;
     }
 
     bool sanitizeBeatPeriods(std::vector<int>& beatPeriod, size_t dfSize) {
@@ -97,50 +148,84 @@ BPMAnalyzer::AnalysisResult BPMAnalyzer::analyzeBPM(const QVector<float>& sample
 
     qDebug() << "Starting BPM analysis with" << samples.size() << "samples at" << sampleRate << "Hz";
 
-    // Множественный анализ с разными параметрами
-    QVector<AnalysisResult> candidates;
+    // Огибающая энергии считается один раз: по ней идут и поиск пиков на всех
+    // порогах, и поиск долей, и анализ по окнам (окна — участки огибающей, без копий)
+    const QVector<float> energy = beatEnergyEnvelope(samples, options.maxThreads);
+    const float* envelope = energy.constData();
+    const int sampleCount = static_cast<int>(samples.size());
+    if (isCancelled(options)) {
+        return result;
+    }
+    reportProgress(options, 30);
+
+    // Задача кандидата: пики участка огибающей → интервал → BPM → доли
+    struct CandidateTask {
+        int first = 0;
+        int count = 0;
+        float minEnergy = 0.0f;
+        int minPeaks = 0;
+        bool assumeFixedTempo = true;
+        bool valid = false;
+        AnalysisResult result;
+    };
+    QVector<CandidateTask> tasks;
 
     // Анализ 1: Обнаружение пиков с разными порогами
     for (float threshold = kPeakThresholdMin; threshold <= kPeakThresholdMax; threshold += kPeakThresholdStep) {
-        auto peaks = detectPeaks(samples, threshold);
-        if (peaks.size() < kMinPeaksForAnalysis) continue;
+        CandidateTask task;
+        task.count = sampleCount;
+        task.minEnergy = threshold;
+        task.minPeaks = kMinPeaksForAnalysis;
+        task.assumeFixedTempo = options.assumeFixedTempo;
+        tasks.append(task);
+    }
+
+    // Анализ 2: Анализ по окнам (для треков с переменным темпом)
+    if (!options.assumeFixedTempo) {
+        int windowSize = sampleRate * 10; // 10 секунд
+        for (int start = 0; start < sampleCount - windowSize; start += windowSize / 2) {
+            CandidateTask task;
+            task.first = start;
+            task.count = windowSize;
+            task.minEnergy = 0.1f;
+            task.minPeaks = 5;
+            task.assumeFixedTempo = false;
+            tasks.append(task);
+        }
+    }
+
+    // Задачи независимы — считаем параллельно, каждая пишет только в свой элемент
+    parallelFor(options.maxThreads, int(tasks.size()), [&](int index) {
+        if (isCancelled(options)) return;
+        CandidateTask& task = tasks[index];
+        const float* span = envelope + task.first;
+        auto peaks = detectPeaks(span, task.count, task.minEnergy);
+        if (peaks.size() < task.minPeaks) return;
 
         float confidence;
-        float avgInterval = calculateAverageInterval(peaks, options.assumeFixedTempo, &confidence);
+        float avgInterval = calculateAverageInterval(peaks, task.assumeFixedTempo, &confidence);
         float bpm = estimateBPM(avgInterval, sampleRate, options);
 
         if (isValidBPM(bpm, options)) {
-            AnalysisResult candidate;
-            candidate.bpm = bpm;
-            candidate.confidence = confidence;
-            candidate.beats = findBeats(samples, bpm, sampleRate, options);
-            candidate.preliminaryBPM = 0.0f;
-            candidate.hasPreliminaryBPM = false;
-            candidates.append(candidate);
-
-            qDebug() << "BPM candidate:" << bpm << "confidence:" << confidence << "threshold:" << threshold;
+            task.result.bpm = bpm;
+            task.result.confidence = confidence;
+            task.result.beats = findBeats(span, task.count, bpm, sampleRate, options);
+            task.valid = true;
+
+            qDebug() << "BPM candidate:" << bpm << "confidence:" << confidence << "threshold:" << task.minEnergy;
         }
+    });
+
+    if (isCancelled(options)) {
+        return result;
     }
+    reportProgress(options, 90);
 
-    // Анализ 2: Анализ по окнам (для треков с переменным темпом)
-    if (!options.assumeFixedTempo) {
-        int windowSize = sampleRate * 10; // 10 секунд
-        for (int start = 0; start < static_cast<int>(samples.size()) - windowSize; start += windowSize / 2) {
-            QVector<float> window(samples.begin() + start, samples.begin() + start + windowSize);
-            auto peaks = detectPeaks(window, 0.1f);
-            if (peaks.size() < 5) continue;
-
-            float confidence;
-            float avgInterval = calculateAverageInterval(peaks, false, &confidence);
-            float bpm = estimateBPM(avgInterval, sampleRate, options);
-
-            if (isValidBPM(bpm, options)) {
-                AnalysisResult candidate;
-                candidate.bpm = bpm;
-                candidate.confidence = confidence;
-                candidate.beats = findBeats(window, bpm, sampleRate, options);
-                candidates.append(candidate);
-            }
+    // Порядок кандидатов прежний: сначала пороги, затем окна
+    QVector<AnalysisResult> candidates;
+    for (const CandidateTask& task : tasks) {
+        if (task.valid) {
+            candidates.append(task.result);
         }
     }
 
@@ -166,7 +251,7 @@ BPMAnalyzer::AnalysisResult BPMAnalyzer::analyzeBPM(const QVector<float>& sample
     if (std::abs(correctedMainBPM - result.bpm) < 10.0f) {
         qDebug() << "Corrected main BPM from" << result.bpm << "to" << correctedMainBPM;
         result.bpm = correctedMainBPM;
-        result.beats = findBeats(samples, result.bpm, sampleRate, options);
+        result.beats = findBeats(envelope, sampleCount, result.bpm, sampleRate, options);
     }
 
     // Дополнительная проверка: ищем близкие BPM и выбираем наиболее частый
@@ -205,7 +290,7 @@ BPMAnalyzer::AnalysisResult BPMAnalyzer::analyzeBPM(const QVector<float>& sample
         // Если наиболее частый BPM отличается от лучшего по уверенности, используем его
         if (std::abs(mostFrequentBPM - result.bpm) > 10.0f && bpmCounts.first().second > 1) {
             result.bpm = mostFrequentBPM;
-            result.beats = findBeats(samples, result.bpm, sampleRate, options);
+            result.beats = findBeats(envelope, sampleCount, result.bpm, sampleRate, options);
             qDebug() << "Using most frequent BPM:" << result.bpm;
         }
     }
@@ -266,27 +351,23 @@ BPMAnalyzer::AnalysisResult BPMAnalyzer::analyzeBPM(const QVector<float>& sample
     qDebug() << "Final BPM result:" << result.bpm << "confidence:" << result.confidence
              << "irregular beats:" << result.hasIrregularBeats;
 
+    reportProgress(options, 100);
     return result;
 }
 
-QVector<QPair<int, float>> BPMAnalyzer::detectPeaks(const QVector<float>& samples,
+QVector<QPair<int, float>> BPMAnalyzer::detectPeaks(const float* energy,
+                                                   int count,
                                                    float minEnergy) {
     QVector<QPair<int, float>> peaks;
-    const int windowSize = 1024; // Размер окна анализа
+    const int windowSize = kBeatEnergyWindow; // Размер окна анализа
     const int minPeakDistance = 4410; // Минимальное расстояние между пиками (~0.1 сек при 44.1 кГц)
 
-    if (samples.size() < windowSize * 3) {
+    if (count < windowSize * 3) {
         return peaks;
     }
 
-    // Скользящее среднее для энергии
-    QVector<float> energy(samples.size());
-    for (int i = windowSize; i < static_cast<int>(samples.size()) - windowSize; ++i) {
-        energy[i] = calculateBeatEnergy(samples, i, windowSize);
-    }
-
     // Поиск локальных максимумов с улучшенной логикой
-    for (int i = windowSize; i < static_cast<int>(samples.size()) - windowSize; ++i) {
+    for (int i = windowSize; i < count - windowSize; ++i) {
         if (energy[i] < minEnergy) {
             continue;
         }
@@ -408,12 +489,13 @@ float BPMAnalyzer::estimateBPM(float averageInterval,
     return bpm;
 }
 
-QVector<BPMAnalyzer::BeatInfo> BPMAnalyzer::findBeats(const QVector<float>& samples,
+QVector<BPMAnalyzer::BeatInfo> BPMAnalyzer::findBeats(const float* energy,
+                                                     int count,
                                                      float bpm,
                                                      int sampleRate,
                                                      const AnalysisOptions& options) {
     QVector<BeatInfo> beats;
-    if (samples.isEmpty() || bpm <= 0 || sampleRate <= 0) {
+    if (count <= 0 || bpm <= 0 || sampleRate <= 0) {
         return beats;
     }
 
@@ -426,36 +508,29 @@ QVector<BPMAnalyzer::BeatInfo> BPMAnalyzer::findBeats(const QVector<float>& samp
     // Поиск первой доли только в первом интервале (0 … 1 beat), чтобы сетка строилась от первой доли, а не от второй
     int firstBeat = -1;
     float maxEnergy = 0.0f;
-    int searchLimit = qMin(static_cast<int>(samples.size()), qRound(beatInterval));
+    int searchLimit = qMin(count, qRound(beatInterval));
     for (int i = 0; i < searchLimit; ++i) {
-        float energy = calculateBeatEnergy(samples, i, 1024);
-        if (energy > maxEnergy) {
-            maxEnergy = energy;
+        if (energy[i] > maxEnergy) {
+            maxEnergy = energy[i];
             firstBeat = i;
         }
     }
-    if (firstBeat < 0 && !samples.isEmpty()) {
-        firstBeat = 0;
-    }
     if (firstBeat < 0) {
-        return beats;
+        firstBeat = 0;
     }
 
     // Добавляем биты с учетом отклонений
     float expectedPos = firstBeat;
-    while (expectedPos < samples.size()) {
+    while (expectedPos < count) {
         int actualPos = expectedPos;
-        float maxEnergy = calculateBeatEnergy(samples, actualPos, 1024);
+        float maxEnergy = energy[actualPos];
 
         // Ищем локальный максимум энергии
         for (int offset = -searchWindow; offset <= searchWindow; ++offset) {
             int pos = qRound(expectedPos + offset);
-            if (pos >= 0 && pos < samples.size()) {
-                float energy = calculateBeatEnergy(samples, pos, 1024);
-                if (energy > maxEnergy) {
-                    maxEnergy = energy;
-                    actualPos = pos;
-                }
+            if (pos >= 0 && pos < count && energy[pos] > maxEnergy) {
+                maxEnergy = energy[pos];
+                actualPos = pos;
             }
         }
 
@@ -477,20 +552,50 @@ QVector<BPMAnalyzer::BeatInfo> BPMAnalyzer::findBeats(const QVector<float>& samp
     return beats;
 }
 
-float BPMAnalyzer::calculateBeatEnergy(const QVector<float>& samples,
-                                     int position,
-                                     int windowSize) {
-    float energy = 0.0f;
-    int start = std::max(0, position - windowSize/2);
-    int end = std::min<int>(samples.size(), position + windowSize/2);
-
-    // Используем RMS (Root Mean Square) для более точного расчета энергии
-    for (int i = start; i < end; ++i) {
-        energy += samples[i] * samples[i];
-    }
+QVector<float> BPMAnalyzer::beatEnergyEnvelope(const QVector<float>& samples, int maxThreads) {
+    const int count = static_cast<int>(samples.size());
+    QVector<float> energy(count);
+    const float* in = samples.constData();
+    float* out = energy.data();
+    const int half = kBeatEnergyWindow / 2;
+
+    // RMS в окне [i - half, i + half), обрезанном краями сигнала. Сумма квадратов
+    // скользит вместе с окном: O(N) вместо O(N × окно)
+    auto fill = [&](int first, int last) {
+        int start = std::max(0, first - half);
+        int end = std::min(count, first + half);
+        double sum = 0.0;
+        for (int k = start; k < end; ++k) {
+            sum += double(in[k]) * in[k];
+        }
+        for (int i = first; i < last; ++i) {
+            out[i] = float(std::sqrt(std::max(0.0, sum) / (end - start)));
+            const int nextStart = std::max(0, i + 1 - half);
+            const int nextEnd = std::min(count, i + 1 + half);
+            for (; end < nextEnd; ++end) {
+                sum += double(in[end]) * in[end];
+            }
+            for (; start < nextStart; ++start) {
+                sum -= double(in[start]) * in[start];
+            }
+        }
+    };
 
-    // Возвращаем RMS энергию
-    return std::sqrt(energy / (end - start));
+    // Куски сигнала независимы: каждый начинает свою сумму заново
+    const int chunkCount = analysisThreadCount(maxThreads);
+    if (chunkCount <= 1 || count < kParallelMinSamples) {
+        fill(0, count);
+        return energy;
+    }
+    const int chunkSize = (count + chunkCount - 1) / chunkCount;
+    parallelFor(chunkCount, chunkCount, [&](int chunk) {
+        const int first = chunk * chunkSize;
+        const int last = std::min(count, first + chunkSize);
+        if (first < last) {
+            fill(first, last);
+        }
+    });
+    return energy;
 }
 
 bool BPMAnalyzer::isValidBPM(float bpm, const AnalysisOptions& options) {
@@ -538,9 +643,35 @@ BPMAnalyzer::AnalysisResult BPMAnalyzer::analyzeBPMUsingMixxx(const QVector<floa
         return result;
     }
 
-    // Обнаружение onset'ов с использованием алгоритма из Mixxx
+    // Обнаружение onset'ов с использованием алгоритма из Mixxx: половина прогресса,
+    // вторая — TempoTrackV2
     int stepSize, windowSize;
-    QVector<double> detectionFunction = detectOnsets(samples, sampleRate, stepSize, windowSize);
+    QVector<float> decimated;
+    const QVector<double> detectionFunction =
+        detectOnsets(samples, sampleRate, stepSize, windowSize, options, 50, &decimated);
+    if (isCancelled(options)) {
+        return result;
+    }
+    return analyzeDetectionFunction(detectionFunction, sampleRate, stepSize, options, 50, decimated);
+}
+
+BPMAnalyzer::AnalysisResult BPMAnalyzer::analyzeOnsetStream(const OnsetStream& stream,
+                                                            const AnalysisOptions& options) {
+    if (stream.sampleCount() == 0) {
+        qDebug() << "Invalid input for Mixxx BPM analysis";
+        return AnalysisResult();
+    }
+    return analyzeDetectionFunction(stream.values(), stream.sampleRate(), stream.stepSize(), options,
+                                    0, stream.decimated());
+}
+
+BPMAnalyzer::AnalysisResult BPMAnalyzer::analyzeDetectionFunction(const QVector<double>& detectionFunction,
+                                                                  int sampleRate,
+                                                                  int stepSize,
+                                                                  const AnalysisOptions& options,
+                                                                  int progressFrom,
+                                                                  const QVector<float>& decimated) {
+    AnalysisResult result;
 
     if (detectionFunction.isEmpty()) {
         qDebug() << "No onsets detected using Mixxx algorithm";
@@ -548,7 +679,11 @@ BPMAnalyzer::AnalysisResult BPMAnalyzer::analyzeBPMUsingMixxx(const QVector<floa
     }
 
     // Отслеживание битов через алгоритм TempoTrackV2 из Mixxx
-    QVector<BeatInfo> beats = trackBeats(detectionFunction, sampleRate, stepSize);
+    QVector<BeatInfo> beats =
+        trackBeats(detectionFunction, sampleRate, stepSize, options, progressFrom, 95);
+    if (isCancelled(options)) {
+        return result;
+    }
 
     if (beats.isEmpty()) {
         qDebug() << "No beats detected using Mixxx algorithm";
@@ -556,114 +691,19 @@ BPMAnalyzer::AnalysisResult BPMAnalyzer::analyzeBPMUsingMixxx(const QVector<floa
     }
 
     result.beats = beats;
-    qint64 detectedStart = beats.first().position;
-    const qint64 maxGridStartSamples = qint64(2.0 * sampleRate);
-    result.gridStartSample = (detectedStart <= maxGridStartSamples) ? detectedStart : 0;
-
-    // Вычисляем BPM на основе обнаруженных битов
-    if (beats.size() >= 2) {
-        QVector<float> intervals;
-        intervals.reserve(beats.size() - 1);
-        for (int i = 1; i < static_cast<int>(beats.size()); ++i) {
-            intervals.append(float(beats[i].position - beats[i-1].position));
-        }
 
-        // Базовый BPM из среднего интервала
-        const float avgInterval = std::accumulate(intervals.begin(), intervals.end(), 0.0f) / intervals.size();
-        const float baseBpm = 60.0f * sampleRate / avgInterval;
-        // Сохраняем базовый BPM как предварительный (до выбора гармоники)
-        result.preliminaryBPM = baseBpm;
+    // Гармоника BPM и фаза сетки — общие с ядром плагина (beatgridfit.h)
+    const std::vector<std::int64_t> positions = beatPositions(beats);
+    const BeatGridFit::Fit fit = BeatGridFit::fitGrid(positions.data(), positions.size(), sampleRate,
+                                                      options.minBPM, options.maxBPM);
+    result.gridStartSample = fit.gridStart;
+    if (fit.bpm > 0.0f) {
+        // Базовый BPM по среднему интервалу — предварительный (до выбора гармоники)
+        result.preliminaryBPM = fit.baseBpm;
         result.hasPreliminaryBPM = true;
-
-        // Подбор гармоники BPM (x0.5, x1, x2, x4), минимизирующей разброс долей
-        auto calcDeviationForBpm = [&](float candidateBpm) -> float {
-            if (candidateBpm <= 0.0f) return std::numeric_limits<float>::infinity();
-            const float beatInterval = 60.0f * sampleRate / candidateBpm; // в сэмплах
-            if (beatInterval <= 0.0f) return std::numeric_limits<float>::infinity();
-
-            // Считаем отклонение каждой фактической доли от ближайшей идеальной позиции
-            float totalDeviationAbs = 0.0f;
-            float maxDeviationAbs = 0.0f;
-            const float gridStart = float(result.gridStartSample);
-            const int considerCount = std::min<int>(int(beats.size()), 512); // ограничим, чтобы не тратить много времени
-            for (int i = 0; i < considerCount; ++i) {
-                const float pos = float(beats[i].position);
-                const float phase = (pos - gridStart) / beatInterval; // в долях
-                const float nearest = std::round(phase);
-                const float deviationBeats = std::abs(phase - nearest); // |отклонение| в долях
-                totalDeviationAbs += deviationBeats;
-                if (deviationBeats > maxDeviationAbs) maxDeviationAbs = deviationBeats;
-            }
-            // Взвешиваем среднее и максимум, чтобы штрафовать большие скачки
-            const float avgDev = totalDeviationAbs / std::max(1, considerCount);
-            return avgDev * 0.7f + maxDeviationAbs * 0.3f;
-        };
-
-        // Кандидаты BPM (учитывая попадание в допустимый диапазон)
-        QVector<float> candidates;
-        candidates.reserve(8);
-        auto addIfInRange = [&](float v) {
-            if (v > 0.0f) {
-                float x = v;
-                while (x < options.minBPM) x *= 2.0f;
-                while (x > options.maxBPM) x *= 0.5f;
-                candidates.append(x);
-            }
-        };
-        addIfInRange(baseBpm);
-        addIfInRange(baseBpm * 2.0f);
-        addIfInRange(baseBpm * 4.0f);
-        addIfInRange(baseBpm * 0.5f);
-        addIfInRange(baseBpm * 0.25f);
-
-        // Выбираем BPM с минимальным отклонением сетки
-        float bestBpm = baseBpm;
-        float bestScore = std::numeric_limits<float>::infinity();
-        for (float c : candidates) {
-            const float score = calcDeviationForBpm(c);
-            if (score < bestScore) {
-                bestScore = score;
-                bestBpm = c;
-            }
-        }
-
-        result.bpm = bestBpm;
-
-        // Подбор начала сетки по минимальному отклонению (фаза)
-        const float beatIntervalForBest = 60.0f * sampleRate / result.bpm;
-        const qint64 maxGridStartSamples = qint64(2.0 * sampleRate);
-        auto deviationForGridStart = [&](qint64 gridStart) -> float {
-            float sum = 0.0f;
-            const int n = qMin(int(beats.size()), 256);
-            for (int i = 0; i < n; ++i) {
-                float phase = (float(beats[i].position) - float(gridStart)) / beatIntervalForBest;
-                sum += std::abs(phase - std::round(phase));
-            }
-            return (n > 0) ? sum / n : 1.0f;
-        };
-        qint64 bestStart = result.gridStartSample;
-        float bestDev = deviationForGridStart(bestStart);
-        for (int phase = 0; phase < qMin(5, int(beats.size())); ++phase) {
-            qint64 cand = beats[phase].position - qint64(phase * beatIntervalForBest);
-            if (cand >= 0 && cand <= maxGridStartSamples) {
-                float d = deviationForGridStart(cand);
-                if (d < bestDev) { bestDev = d; bestStart = cand; }
-            }
-        }
-        result.gridStartSample = bestStart;
-
-        // Пересчитываем метрики регулярности для выбранного BPM
-        float totalDeviation = 0.0f;
-        float maxDeviation = 0.0f;
-        const int considerCount2 = std::min<int>(int(beats.size()), 512);
-        for (int i = 0; i < considerCount2; ++i) {
-            const float expBeats = (float(beats[i].position) - float(result.gridStartSample)) / beatIntervalForBest;
-            const float dev = std::abs(expBeats - std::round(expBeats)); // отклонение в долях
-            totalDeviation += dev;
-            if (dev > maxDeviation) maxDeviation = dev;
-        }
-        result.averageDeviation = totalDeviation / std::max(1, considerCount2);
-        result.hasIrregularBeats = (maxDeviation > options.tolerancePercent / 100.0f);
+        result.bpm = fit.bpm;
+        result.averageDeviation = fit.deviation.average;
+        result.hasIrregularBeats = (fit.deviation.maximum > options.tolerancePercent / 100.0f);
         result.isFixedTempo = !result.hasIrregularBeats && (result.averageDeviation < options.tolerancePercent / 200.0f);
         result.confidence = 1.0f - std::min(1.0f, result.averageDeviation);
     }
@@ -676,74 +716,150 @@ BPMAnalyzer::AnalysisResult BPMAnalyzer::analyzeBPMUsingMixxx(const QVector<floa
         result.bpm *= 0.5f;
     }
 
+    result.tempoMap = buildTempoMap(result, sampleRate);
+
+    // Сильная доля — по уже прорежённому при onset-проходе сигналу и найденным
+    // долям: одно БПФ на долю, по сравнению с анализом это единицы процентов
+    if (!decimated.isEmpty() && !isCancelled(options)) {
+        result.barPhase = findBarPhase(decimated, sampleRate, result, options.beatsPerBar);
+    }
+
     qDebug() << "Mixxx algorithm detected BPM:" << result.bpm
-             << "with" << beats.size() << "beats";
+             << "with" << beats.size() << "beats"
+             << "tempo segments:" << result.tempoMap.segments().size()
+             << "bar phase:" << result.barPhase;
 
+    reportProgress(options, 100);
     return result;
 }
 
-QVector<double> BPMAnalyzer::detectOnsets(const QVector<float>& samples,
-                                         int sampleRate,
-                                         int& stepSize,
-                                         int& windowSize) {
-    QVector<double> detectionResults;
+TempoMap BPMAnalyzer::buildTempoMap(const AnalysisResult& result, int sampleRate)
+{
+    if (result.bpm <= 0.0f || sampleRate <= 0) {
+        return TempoMap();
+    }
+    const double samplesPerBeat = 60.0 * sampleRate / result.bpm;
+    const TempoMap fixedMap = TempoMap::constant(samplesPerBeat, result.gridStartSample);
+    if (result.beats.size() < 3) {
+        return fixedMap;
+    }
 
-    // Вычисляем параметры окна как в Mixxx
-    stepSize = static_cast<int>(sampleRate * kStepSecs);
-    windowSize = nextPowerOfTwo(sampleRate / kMaximumBinSizeHz);
+    QVector<qint64> positions;
+    positions.reserve(result.beats.size());
+    for (const BeatInfo& beat : result.beats) {
+        positions.append(beat.position);
+    }
 
-    qDebug() << "Mixxx onset detection: sampleRate =" << sampleRate
-             << ", stepSize =" << stepSize
-             << ", windowSize =" << windowSize;
+    // Доли трекера могут идти через одну или вдвое чаще выбранного BPM:
+    // масштаб — ближайшая к отношению степень двойки
+    if (positions.last() <= positions.first()) {
+        return fixedMap;
+    }
+    const std::vector<std::int64_t> trackerBeats = beatPositions(result.beats);
+    const double beatScale =
+        BeatGridFit::trackerBeatScale(trackerBeats.data(), trackerBeats.size(), samplesPerBeat);
 
-#ifdef USE_MIXXX_QM_DSP
-    // Если есть библиотека qm-dsp, используем её
-    DFConfig config;
-    config.DFType = DF_COMPLEXSD;
-    config.stepSize = stepSize;
-    config.frameLength = windowSize;
-    config.dbRise = 3;
-    config.adaptiveWhitening = false;
-    config.whiteningRelaxCoeff = -1;
-    config.whiteningFloor = -1;
-
-    DetectionFunction df(config);
-
-    // Обрабатываем сигнал окнами
-    QVector<double> window(windowSize);
-    for (int i = 0; i < static_cast<int>(samples.size()) - windowSize; i += stepSize) {
-        // Копируем окно данных
-        for (int j = 0; j < windowSize; ++j) {
-            window[j] = samples[i + j];
-        }
-        // Вычисляем detection function
-        double value = df.processTimeDomain(window.data());
-        detectionResults.append(value);
+    TempoMap map = TempoMap::fromBeats(positions, beatScale);
+    if (!map.isVariable()) {
+        return fixedMap;
     }
+    map.rebase(result.gridStartSample);
+    return map;
+}
+
+qint64 BPMAnalyzer::barStartSample(const AnalysisResult& result, int sampleRate)
+{
+    if (result.barPhase == 0) {
+        return result.gridStartSample;
+    }
+    if (!result.tempoMap.isEmpty()) {
+        return qint64(std::llround(result.tempoMap.sampleAtBeat(result.barPhase)));
+    }
+    if (result.bpm <= 0.0f || sampleRate <= 0) {
+        return result.gridStartSample;
+    }
+    return result.gridStartSample
+        + qint64(std::llround(result.barPhase * 60.0 * sampleRate / result.bpm));
+}
+
+int BPMAnalyzer::findBarPhase(const QVector<float>& decimated,
+                              int sampleRate,
+                              const AnalysisResult& result,
+                              int beatsPerBar)
+{
+#ifdef USE_MIXXX_QM_DSP
+    if (decimated.isEmpty() || result.bpm <= 0.0f || sampleRate <= 0 || beatsPerBar < 2) {
+        return 0;
+    }
+    const std::vector<std::int64_t> beats = beatPositions(result.beats);
+    const double samplesPerBeat = 60.0 * sampleRate / result.bpm;
+    // DownBeat считает такт в долях трекера (см. buildTempoMap)
+    const int timesig =
+        BeatGridFit::trackerBeatsPerBar(beats.data(), beats.size(), samplesPerBeat, beatsPerBar);
+    if (timesig == 0) {
+        return 0;
+    }
+    const int downbeat = BeatGridFit::firstDownbeat(decimated.constData(), size_t(decimated.size()),
+                                                    beats.data(), beats.size(), sampleRate,
+                                                    OnsetStream::kDownbeatDecimation, timesig);
+    if (downbeat < 0) {
+        return 0;
+    }
+
+    // Номер доли сетки у первой сильной доли, по модулю длины такта
+    const double position = double(beats[size_t(downbeat)]);
+    const double gridBeat = result.tempoMap.isEmpty()
+        ? (position - double(result.gridStartSample)) / samplesPerBeat
+        : result.tempoMap.beatAtSample(position);
+    return BeatGridFit::barPhase(gridBeat, beatsPerBar);
 #else
-    // Упрощённый алгоритм обнаружения onset'ов
-    for (int i = 0; i < static_cast<int>(samples.size()) - windowSize; i += stepSize) {
-        double energy = 0.0;
-        for (int j = 0; j < windowSize; ++j) {
-            energy += samples[i + j] * samples[i + j];
+    Q_UNUSED(decimated);
+    Q_UNUSED(sampleRate);
+    Q_UNUSED(result);
+    Q_UNUSED(beatsPerBar);
+    return 0;
+#endif
+}
+
+QVector<double> BPMAnalyzer::detectOnsets(const QVector<float>& samples,
+                                         int sampleRate,
+                                         int& stepSize,
+                                         int& windowSize,
+                                         const AnalysisOptions& options,
+                                         int progressTo,
+                                         QVector<float>* decimated) {
+    // Тот же поток, что получает блоки при декодировании. Значения не зависят
+    // от разбиения на блоки — между блоками отчитываемся и проверяем отмену
+    OnsetStream stream(sampleRate);
+    stepSize = stream.stepSize();
+    windowSize = stream.windowSize();
+    const qint64 total = samples.size();
+    const int block = stepSize * kOnsetStepsPerBlock;
+    for (qint64 first = 0; first < total; first += block) {
+        if (isCancelled(options)) {
+            return {};
         }
-        detectionResults.append(std::sqrt(energy / windowSize));
+        const int count = int(qMin<qint64>(block, total - first));
+        stream.push(samples.constData() + first, count);
+        reportProgress(options, int((first + count) * progressTo / total));
     }
 
-    // Применяем spectral flux для улучшения обнаружения
-    for (int i = 1; i < static_cast<int>(detectionResults.size()); ++i) {
-        double flux = detectionResults[i] - detectionResults[i-1];
-        if (flux < 0) flux = 0;
-        detectionResults[i] = flux;
-    }
-#endif
+    qDebug() << "Mixxx onset detection: sampleRate =" << sampleRate
+             << ", stepSize =" << stepSize
+             << ", windowSize =" << windowSize;
 
-    return detectionResults;
+    if (decimated) {
+        *decimated = stream.decimated();
+    }
+    return stream.values();
 }
 
 QVector<BPMAnalyzer::BeatInfo> BPMAnalyzer::trackBeats(const QVector<double>& detectionFunction,
                                                       int sampleRate,
-                                                      int stepSize) {
+                                                      int stepSize,
+                                                      const AnalysisOptions& options,
+                                                      int progressFrom,
+                                                      int progressTo) {
     QVector<BeatInfo> beats;
 
     if (detectionFunction.size() < 3) {
@@ -772,8 +888,14 @@ QVector<BPMAnalyzer::BeatInfo> BPMAnalyzer::trackBeats(const QVector<double>& de
     // Выделяем буфер с запасом по длине df, чтобы исключить выход за границы.
     beatPeriod.assign(df.size(), 0);
 
-    // Вычисляем период битов
+    // Вычисляем период битов. Внутрь TempoTrackV2 (вендорный qm-dsp) не заглядываем:
+    // прогресс и отмена — на границах его этапов. Период (Viterbi по всему df) —
+    // самый долгий из них, ему три четверти отрезка
     tt.calculateBeatPeriod(df, beatPeriod);
+    if (isCancelled(options)) {
+        return beats;
+    }
+    reportProgress(options, progressFrom + (progressTo - progressFrom) * 3 / 4);
 
     stabilizeBeatPeriodTail(beatPeriod);
 
@@ -786,6 +908,9 @@ QVector<BPMAnalyzer::BeatInfo> BPMAnalyzer::trackBeats(const QVector<double>& de
     // Вычисляем позиции битов
     std::vector<double> beatPositions;
     tt.calculateBeats(df, beatPeriod, beatPositions);
+    if (isCancelled(options)) {
+        return beats;
+    }
     beats.reserve(static_cast<int>(beatPositions.size()));
 
     // Преобразуем в BeatInfo
@@ -847,6 +972,7 @@ QVector<BPMAnalyzer::BeatInfo> BPMAnalyzer::trackBeats(const QVector<double>& de
 
     beats = filteredBeats;
 #endif
+    reportProgress(options, progressTo);
 
     // Вычисляем отклонения от среднего интервала
     if (beats.size() > 2) {
@@ -927,175 +1053,37 @@ BPMAnalyzer::AnalysisResult BPMAnalyzer::createBeatGridFromBPM(const QVector<flo
 // ПОИСК НЕРОВНЫХ ДОЛЕЙ
 // ============================================================================
 
-namespace {
-
-// Медиана in-place (порядок элементов не сохраняется).
-double medianInPlace(std::vector<double>& values)
-{
-    if (values.empty()) {
-        return 0.0;
-    }
-    const size_t mid = values.size() / 2;
-    std::nth_element(values.begin(), values.begin() + mid, values.end());
-    const double upper = values[mid];
-    if (values.size() % 2 != 0) {
-        return upper;
-    }
-    const double lower = *std::max_element(values.begin(), values.begin() + mid);
-    return 0.5 * (lower + upper);
-}
-
-} // namespace
-
 void BPMAnalyzer::calculateDeviations(QVector<BeatInfo>& beats, float bpm, int sampleRate)
 {
     calculateDeviations(beats, bpm, sampleRate, DeviationOptions());
 }
 
+// Раскладка, статистика и SIMD-ядра — в DeviationModel; окну, которое двигает
+// сетку, модель нужна и дальше (shiftGrid), здесь она живёт один вызов.
 BPMAnalyzer::DeviationStats BPMAnalyzer::calculateDeviations(QVector<BeatInfo>& beats,
                                                             float bpm,
                                                             int sampleRate,
                                                             const DeviationOptions& options)
 {
-    DeviationStats stats;
-    if (beats.isEmpty() || bpm <= 0.0f || sampleRate <= 0) {
-        return stats;
-    }
-
-    // Всё считаем в double: на 192 kHz позиции длинного трека выходят за диапазон
-    // целых, представимых во float точно (2^24), и сетка «уезжает» на десятки сэмплов.
-    const double nominalInterval = (60.0 * double(sampleRate)) / double(bpm);
-    if (nominalInterval < 1.0) {
-        return stats;
-    }
-
-    const int beatCount = int(beats.size());
-    std::vector<double> gridIndex(size_t(beatCount), 0.0);
-    double interval = nominalInterval;
-    double origin = (options.gridStartSample >= 0) ? double(options.gridStartSample)
-                                                   : double(beats.first().position);
-
-    // Каждая доля сопоставляется ближайшей линии сетки, а не своему порядковому
-    // номеру: пропуск или лишнее срабатывание детектора тогда портит одну долю,
-    // а не весь хвост трека (раньше отклонение уходило в ±1 интервал до конца).
-    auto assignGridIndices = [&]() {
-        for (int i = 0; i < beatCount; ++i) {
-            gridIndex[size_t(i)] = options.snapToNearestGrid
-                ? std::round((double(beats[i].position) - origin) / interval)
-                : double(i);
-        }
-    };
-
-    auto residuals = [&]() {
-        std::vector<double> values(size_t(beatCount), 0.0);
-        for (int i = 0; i < beatCount; ++i) {
-            values[size_t(i)] = double(beats[i].position) - (origin + gridIndex[size_t(i)] * interval);
-        }
-        return values;
-    };
-
-    assignGridIndices();
-
-    // Фаза сетки — медиана остатков, а не позиция первой доли. Иначе сдвинутая
-    // первая доля (затакт, шум, ложный onset) объявляет неровным весь трек.
-    if (options.gridStartSample < 0) {
-        for (int pass = 0; pass < 3; ++pass) {
-            std::vector<double> values = residuals();
-            const double shift = medianInPlace(values);
-            origin += shift;
-            assignGridIndices();
-            if (std::abs(shift) < 0.5) {  // сошлось до долей сэмпла
-                break;
-            }
-        }
-    }
-
-    // Уточнение интервала: если реальный темп чуть отличается от номинального,
-    // отклонения растут линейно и «неровным» становится весь конец трека.
-    // Регрессия по инлаерам отделяет такой дрейф от настоящего джиттера.
-    if (options.refineTempo && beatCount >= 3) {
-        std::vector<double> values = residuals();
-        std::vector<double> magnitudes(values.size());
-        for (size_t i = 0; i < values.size(); ++i) {
-            magnitudes[i] = std::abs(values[i]);
-        }
-        // Порог инлаера: не уже четверти интервала, чтобы выборка не выродилась.
-        const double inlierLimit = std::max(3.0 * medianInPlace(magnitudes), 0.25 * interval);
-
-        double sumX = 0.0, sumY = 0.0;
-        int inliers = 0;
-        for (int i = 0; i < beatCount; ++i) {
-            const double predicted = origin + gridIndex[size_t(i)] * interval;
-            if (std::abs(double(beats[i].position) - predicted) > inlierLimit) {
-                continue;
-            }
-            sumX += gridIndex[size_t(i)];
-            sumY += double(beats[i].position);
-            ++inliers;
-        }
-
-        if (inliers >= 3) {
-            const double meanX = sumX / inliers;
-            const double meanY = sumY / inliers;
-            double covXY = 0.0, varX = 0.0;
-            for (int i = 0; i < beatCount; ++i) {
-                const double predicted = origin + gridIndex[size_t(i)] * interval;
-                if (std::abs(double(beats[i].position) - predicted) > inlierLimit) {
-                    continue;
-                }
-                const double dx = gridIndex[size_t(i)] - meanX;
-                covXY += dx * (double(beats[i].position) - meanY);
-                varX += dx * dx;
-            }
-
-            if (varX > 0.0) {
-                const double limit = double(std::max(0.0f, options.maxTempoCorrection));
-                const double refined = std::min(std::max(covXY / varX, nominalInterval * (1.0 - limit)),
-                                                nominalInterval * (1.0 + limit));
-                if (refined > 1.0) {
-                    interval = refined;
-                    origin = meanY - interval * meanX;
-                    assignGridIndices();
-                }
-            }
-        }
+    DeviationModel model;
+    model.setBeats(beats);
+    const DeviationStats stats = model.evaluate(bpm, sampleRate, options);
+    if (model.isEvaluated()) {
+        model.writeTo(beats);
     }
+    return stats;
+}
 
-    stats.beatCount = beatCount;
-    stats.gridStartSample = qint64(std::llround(origin));
-    stats.gridBPM = float((60.0 * double(sampleRate)) / interval);
-
-    double sumAbs = 0.0;
-    double sumSquares = 0.0;
-    std::vector<double> absDeviations(size_t(beatCount), 0.0);
-
-    for (int i = 0; i < beatCount; ++i) {
-        const double expected = origin + gridIndex[size_t(i)] * interval;
-        const double deviation = (double(beats[i].position) - expected) / interval;
-
-        beats[i].expectedPosition = qint64(std::llround(expected));
-        beats[i].deviation = float(deviation);
-
-        const double magnitude = std::abs(deviation);
-        absDeviations[size_t(i)] = magnitude;
-        sumAbs += magnitude;
-        sumSquares += deviation * deviation;
-        stats.maxAbsDeviation = std::max(stats.maxAbsDeviation, float(magnitude));
-
-        if (i > 0) {
-            const double step = gridIndex[size_t(i)] - gridIndex[size_t(i - 1)];
-            if (step > 1.0) {
-                stats.gapCount += int(step) - 1;  // детектор пропустил доли
-            } else if (step <= 0.0) {
-                ++stats.duplicateCount;           // две доли на одной линии сетки
-            }
-        }
+BPMAnalyzer::DeviationStats BPMAnalyzer::calculateDeviations(QVector<BeatInfo>& beats,
+                                                            const TempoMap& tempoMap,
+                                                            int sampleRate)
+{
+    DeviationModel model;
+    model.setBeats(beats);
+    const DeviationStats stats = model.evaluate(tempoMap, sampleRate);
+    if (model.isEvaluated()) {
+        model.writeTo(beats);
     }
-
-    stats.meanAbsDeviation = float(sumAbs / beatCount);
-    stats.rmsDeviation = float(std::sqrt(sumSquares / beatCount));
-    stats.medianAbsDeviation = float(medianInPlace(absDeviations));
-
     return stats;
 }
 
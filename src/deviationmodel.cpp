@@ -0,0 +1,471 @@
+#include "../include/deviationmodel.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// double-векторы NEON есть только в AArch64; на ARMv7 остаётся скалярное ядро
+#if defined(DFENGINE_HAS_NEON) && (defined(__aarch64__) || defined(_M_ARM64))
+#define DEVIATIONMODEL_HAS_NEON64 1
+#endif
+
+// Ожидаемые позиции — без FMA: origin + index·interval, слитое в одну операцию,
+// округляется иначе, и на границе .5 сэмпла expectedPosition уходит на 1 от
+// скалярного ядра. Остальное AVX2-ядро пользуется FMA как обычно
+#if defined(DFENGINE_HAS_X86_SIMD) && (defined(__GNUC__) || defined(__clang__))
+#define DEVIATIONMODEL_TARGET_AVX2_NO_FMA __attribute__((target("avx2")))
+#else
+#define DEVIATIONMODEL_TARGET_AVX2_NO_FMA
+#endif
+
+void residualsScalar(const double* position, const double* gridIndex, qint64 count,
+                     double origin, double interval, double* expected, double* deviation)
+{
+    for (qint64 i = 0; i < count; ++i) {
+        const double e = origin + gridIndex[i] * interval;
+        expected[i] = e;
+        deviation[i] = (position[i] - e) / interval;
+    }
+}
+
+void reduceScalar(const double* deviation, qint64 count,
+                  double& sumAbs, double& sumSquares, double& maxAbs)
+{
+    for (qint64 i = 0; i < count; ++i) {
+        const double magnitude = std::abs(deviation[i]);
+        sumAbs += magnitude;
+        sumSquares += deviation[i] * deviation[i];
+        maxAbs = std::max(maxAbs, magnitude);
+    }
+}
+
+/** Свёртка векторных аккумуляторов; хвост, не кратный ширине вектора, — скалярно. */
+void finishReduce(const double* lanesAbs, const double* lanesSquares, const double* lanesMax,
+                  int lanes, const double* tail, qint64 tailCount,
+                  double& sumAbs, double& sumSquares, double& maxAbs)
+{
+    for (int i = 0; i < lanes; ++i) {
+        sumAbs += lanesAbs[i];
+        sumSquares += lanesSquares[i];
+        maxAbs = std::max(maxAbs, lanesMax[i]);
+    }
+    reduceScalar(tail, tailCount, sumAbs, sumSquares, maxAbs);
+}
+
+#if defined(DFENGINE_HAS_X86_SIMD)
+void residualsSse2(const double* position, const double* gridIndex, qint64 count,
+                   double origin, double interval, double* expected, double* deviation)
+{
+    const __m128d o = _mm_set1_pd(origin);
+    const __m128d step = _mm_set1_pd(interval);
+    qint64 i = 0;
+    for (; i + 2 <= count; i += 2) {
+        const __m128d e = _mm_add_pd(o, _mm_mul_pd(_mm_loadu_pd(gridIndex + i), step));
+        _mm_storeu_pd(expected + i, e);
+        _mm_storeu_pd(deviation + i, _mm_div_pd(_mm_sub_pd(_mm_loadu_pd(position + i), e), step));
+    }
+    residualsScalar(position + i, gridIndex + i, count - i, origin, interval,
+                    expected + i, deviation + i);
+}
+
+void reduceSse2(const double* deviation, qint64 count,
+                double& sumAbs, double& sumSquares, double& maxAbs)
+{
+    const __m128d signMask = _mm_set1_pd(-0.0);
+    __m128d accAbs = _mm_setzero_pd();
+    __m128d accSquares = _mm_setzero_pd();
+    __m128d accMax = _mm_setzero_pd();
+    qint64 i = 0;
+    for (; i + 2 <= count; i += 2) {
+        const __m128d v = _mm_loadu_pd(deviation + i);
+        const __m128d magnitude = _mm_andnot_pd(signMask, v);
+        accAbs = _mm_add_pd(accAbs, magnitude);
+        accSquares = _mm_add_pd(accSquares, _mm_mul_pd(v, v));
+        accMax = _mm_max_pd(accMax, magnitude);
+    }
+    alignas(16) double lanesAbs[2];
+    alignas(16) double lanesSquares[2];
+    alignas(16) double lanesMax[2];
+    _mm_store_pd(lanesAbs, accAbs);
+    _mm_store_pd(lanesSquares, accSquares);
+    _mm_store_pd(lanesMax, accMax);
+    finishReduce(lanesAbs, lanesSquares, lanesMax, 2, deviation + i, count - i,
+                 sumAbs, sumSquares, maxAbs);
+}
+
+DEVIATIONMODEL_TARGET_AVX2_NO_FMA
+void residualsAvx2(const double* position, const double* gridIndex, qint64 count,
+                   double origin, double interval, double* expected, double* deviation)
+{
+    const __m256d o = _mm256_set1_pd(origin);
+    const __m256d step = _mm256_set1_pd(interval);
+    qint64 i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const __m256d e = _mm256_add_pd(o, _mm256_mul_pd(_mm256_loadu_pd(gridIndex + i), step));
+        _mm256_storeu_pd(expected + i, e);
+        _mm256_storeu_pd(deviation + i,
+                         _mm256_div_pd(_mm256_sub_pd(_mm256_loadu_pd(position + i), e), step));
+    }
+    residualsScalar(position + i, gridIndex + i, count - i, origin, interval,
+                    expected + i, deviation + i);
+}
+
+DFENGINE_TARGET_AVX2
+void reduceAvx2(const double* deviation, qint64 count,
+                double& sumAbs, double& sumSquares, double& maxAbs)
+{
+    const __m256d signMask = _mm256_set1_pd(-0.0);
+    __m256d accAbs = _mm256_setzero_pd();
+    __m256d accSquares = _mm256_setzero_pd();
+    __m256d accMax = _mm256_setzero_pd();
+    qint64 i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const __m256d v = _mm256_loadu_pd(deviation + i);
+        const __m256d magnitude = _mm256_andnot_pd(signMask, v);
+        accAbs = _mm256_add_pd(accAbs, magnitude);
+        accSquares = _mm256_fmadd_pd(v, v, accSquares);
+        accMax = _mm256_max_pd(accMax, magnitude);
+    }
+    alignas(32) double lanesAbs[4];
+    alignas(32) double lanesSquares[4];
+    alignas(32) double lanesMax[4];
+    _mm256_store_pd(lanesAbs, accAbs);
+    _mm256_store_pd(lanesSquares, accSquares);
+    _mm256_store_pd(lanesMax, accMax);
+    finishReduce(lanesAbs, lanesSquares, lanesMax, 4, deviation + i, count - i,
+                 sumAbs, sumSquares, maxAbs);
+}
+#endif
+
+#if defined(DEVIATIONMODEL_HAS_NEON64)
+void residualsNeon(const double* position, const double* gridIndex, qint64 count,
+                   double origin, double interval, double* expected, double* deviation)
+{
+    const float64x2_t o = vdupq_n_f64(origin);
+    const float64x2_t step = vdupq_n_f64(interval);
+    qint64 i = 0;
+    for (; i + 2 <= count; i += 2) {
+        const float64x2_t e = vaddq_f64(o, vmulq_f64(vld1q_f64(gridIndex + i), step));
+        vst1q_f64(expected + i, e);
+        vst1q_f64(deviation + i, vdivq_f64(vsubq_f64(vld1q_f64(position + i), e), step));
+    }
+    residualsScalar(position + i, gridIndex + i, count - i, origin, interval,
+                    expected + i, deviation + i);
+}
+
+void reduceNeon(const double* deviation, qint64 count,
+                double& sumAbs, double& sumSquares, double& maxAbs)
+{
+    float64x2_t accAbs = vdupq_n_f64(0.0);
+    float64x2_t accSquares = vdupq_n_f64(0.0);
+    float64x2_t accMax = vdupq_n_f64(0.0);
+    qint64 i = 0;
+    for (; i + 2 <= count; i += 2) {
+        const float64x2_t v = vld1q_f64(deviation + i);
+        const float64x2_t magnitude = vabsq_f64(v);
+        accAbs = vaddq_f64(accAbs, magnitude);
+        accSquares = vfmaq_f64(accSquares, v, v);
+        accMax = vmaxq_f64(accMax, magnitude);
+    }
+    double lanesAbs[2];
+    double lanesSquares[2];
+    double lanesMax[2];
+    vst1q_f64(lanesAbs, accAbs);
+    vst1q_f64(lanesSquares, accSquares);
+    vst1q_f64(lanesMax, accMax);
+    finishReduce(lanesAbs, lanesSquares, lanesMax, 2, deviation + i, count - i,
+                 sumAbs, sumSquares, maxAbs);
+}
+#endif
+
+} // namespace
+
+DeviationModel::DeviationModel(DFEngine::SimdKernel kernel)
+    : residualsKernel_(residualsScalar)
+    , reduceKernel_(reduceScalar)
+{
+    if (!DFEngine::isSimdKernelSupported(kernel)) {
+        return;
+    }
+    switch (kernel) {
+    case DFEngine::SimdKernel::Scalar:
+        break;
+    case DFEngine::SimdKernel::Sse2:
+#if defined(DFENGINE_HAS_X86_SIMD)
+        residualsKernel_ = residualsSse2;
+        reduceKernel_ = reduceSse2;
+#endif
+        break;
+    case DFEngine::SimdKernel::Avx2:
+#if defined(DFENGINE_HAS_X86_SIMD)
+        residualsKernel_ = residualsAvx2;
+        reduceKernel_ = reduceAvx2;
+#endif
+        break;
+    case DFEngine::SimdKernel::Neon:
+#if defined(DEVIATIONMODEL_HAS_NEON64)
+        residualsKernel_ = residualsNeon;
+        reduceKernel_ = reduceNeon;
+#endif
+        break;
+    }
+}
+
+void DeviationModel::setBeats(const QVector<BPMAnalyzer::BeatInfo>& beats)
+{
+    const size_t count = size_t(beats.size());
+    position_.resize(count);
+    gridIndex_.resize(count);
+    expected_.resize(count);
+    deviation_.resize(count);
+    scratch_.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        position_[i] = double(beats[int(i)].position);
+    }
+    evaluated_ = false;
+    stats_ = BPMAnalyzer::DeviationStats();
+}
+
+void DeviationModel::clear()
+{
+    setBeats({});
+}
+
+// Каждая доля сопоставляется ближайшей линии сетки, а не своему порядковому
+// номеру: пропуск или лишнее срабатывание детектора тогда портит одну долю,
+// а не весь хвост трека.
+void DeviationModel::assignGridIndices()
+{
+    const size_t count = position_.size();
+    for (size_t i = 0; i < count; ++i) {
+        gridIndex_[i] = snapToNearestGrid_
+            ? std::round((position_[i] - origin_) / interval_)
+            : double(i);
+    }
+}
+
+/** Остатки в сэмплах (позиция минус линия сетки) — в scratch_. */
+void DeviationModel::fillResiduals()
+{
+    const size_t count = position_.size();
+    for (size_t i = 0; i < count; ++i) {
+        scratch_[i] = position_[i] - (origin_ + gridIndex_[i] * interval_);
+    }
+}
+
+/** Медиана scratch_ (порядок элементов не сохраняется). */
+double DeviationModel::medianOfScratch()
+{
+    if (scratch_.empty()) {
+        return 0.0;
+    }
+    const size_t mid = scratch_.size() / 2;
+    std::nth_element(scratch_.begin(), scratch_.begin() + mid, scratch_.end());
+    const double upper = scratch_[mid];
+    if (scratch_.size() % 2 != 0) {
+        return upper;
+    }
+    const double lower = *std::max_element(scratch_.begin(), scratch_.begin() + mid);
+    return 0.5 * (lower + upper);
+}
+
+// Уточнение интервала: если реальный темп чуть отличается от номинального,
+// отклонения растут линейно и «неровным» становится весь конец трека.
+// Регрессия по инлаерам отделяет такой дрейф от настоящего джиттера.
+void DeviationModel::refineInterval(double nominalInterval, float maxTempoCorrection)
+{
+    const size_t count = position_.size();
+    fillResiduals();
+    for (size_t i = 0; i < count; ++i) {
+        scratch_[i] = std::abs(scratch_[i]);
+    }
+    // Порог инлаера: не уже четверти интервала, чтобы выборка не выродилась.
+    const double inlierLimit = std::max(3.0 * medianOfScratch(), 0.25 * interval_);
+
+    const auto isInlier = [&](size_t i) {
+        return std::abs(position_[i] - (origin_ + gridIndex_[i] * interval_)) <= inlierLimit;
+    };
+
+    double sumX = 0.0, sumY = 0.0;
+    int inliers = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (isInlier(i)) {
+            sumX += gridIndex_[i];
+            sumY += position_[i];
+            ++inliers;
+        }
+    }
+    if (inliers < 3) {
+        return;
+    }
+
+    // Второй проход по центрированным значениям: позиции длинного трека велики,
+    // и сумма x·y «в лоб» теряет точность
+    const double meanX = sumX / inliers;
+    const double meanY = sumY / inliers;
+    double covXY = 0.0, varX = 0.0;
+    for (size_t i = 0; i < count; ++i) {
+        if (isInlier(i)) {
+            const double dx = gridIndex_[i] - meanX;
+            covXY += dx * (position_[i] - meanY);
+            varX += dx * dx;
+        }
+    }
+    if (varX <= 0.0) {
+        return;
+    }
+
+    const double limit = double(std::max(0.0f, maxTempoCorrection));
+    const double refined = std::min(std::max(covXY / varX, nominalInterval * (1.0 - limit)),
+                                    nominalInterval * (1.0 + limit));
+    if (refined > 1.0) {
+        interval_ = refined;
+        origin_ = meanY - interval_ * meanX;
+        assignGridIndices();
+    }
+}
+
+const BPMAnalyzer::DeviationStats& DeviationModel::evaluate(
+    float bpm, int sampleRate, const BPMAnalyzer::DeviationOptions& options)
+{
+    evaluated_ = false;
+    stats_ = BPMAnalyzer::DeviationStats();
+    if (position_.empty() || bpm <= 0.0f || sampleRate <= 0) {
+        return stats_;
+    }
+
+    // Всё в double: на 192 kHz позиции длинного трека выходят за диапазон
+    // целых, представимых во float точно (2^24).
+    const double nominalInterval = (60.0 * double(sampleRate)) / double(bpm);
+    if (nominalInterval < 1.0) {
+        return stats_;
+    }
+
+    useTempoMap_ = false;
+    tempoMap_ = TempoMap();
+    sampleRate_ = sampleRate;
+    snapToNearestGrid_ = options.snapToNearestGrid;
+    interval_ = nominalInterval;
+    origin_ = options.gridStartSample >= 0 ? double(options.gridStartSample) : position_.front();
+    assignGridIndices();
+
+    // Фаза сетки — медиана остатков, а не позиция первой доли. Иначе сдвинутая
+    // первая доля (затакт, шум, ложный onset) объявляет неровным весь трек.
+    if (options.gridStartSample < 0) {
+        for (int pass = 0; pass < 3; ++pass) {
+            fillResiduals();
+            const double shift = medianOfScratch();
+            origin_ += shift;
+            assignGridIndices();
+            if (std::abs(shift) < 0.5) {  // сошлось до долей сэмпла
+                break;
+            }
+        }
+    }
+
+    if (options.refineTempo && position_.size() >= 3) {
+        refineInterval(nominalInterval, options.maxTempoCorrection);
+    }
+
+    finish();
+    return stats_;
+}
+
+const BPMAnalyzer::DeviationStats& DeviationModel::evaluate(const TempoMap& tempoMap, int sampleRate)
+{
+    evaluated_ = false;
+    stats_ = BPMAnalyzer::DeviationStats();
+    if (position_.empty() || tempoMap.isEmpty() || sampleRate <= 0) {
+        return stats_;
+    }
+
+    useTempoMap_ = true;
+    tempoMap_ = tempoMap;
+    sampleRate_ = sampleRate;
+    evaluateTempoMap();
+    finish();
+    return stats_;
+}
+
+// Карта: каждая доля — к ближайшей целой доле карты, отклонение в долях
+// интервала своего сегмента. Поиск сегмента двоичный, поэтому без SIMD
+void DeviationModel::evaluateTempoMap()
+{
+    const size_t count = position_.size();
+    for (size_t i = 0; i < count; ++i) {
+        const double index = std::round(tempoMap_.beatAtSample(position_[i]));
+        const double expected = tempoMap_.sampleAtBeat(index);
+        const double interval = tempoMap_.samplesPerBeatAt(expected);
+        gridIndex_[i] = index;
+        expected_[i] = expected;
+        deviation_[i] = interval > 0.0 ? (position_[i] - expected) / interval : 0.0;
+    }
+    origin_ = tempoMap_.sampleAtBeat(0.0);
+}
+
+const BPMAnalyzer::DeviationStats& DeviationModel::shiftGrid(double sampleDelta)
+{
+    if (!evaluated_ || sampleDelta == 0.0) {
+        return stats_;
+    }
+    if (useTempoMap_) {
+        tempoMap_.shift(sampleDelta);
+        evaluateTempoMap();
+    } else {
+        origin_ += sampleDelta;
+        assignGridIndices();
+    }
+    finish();
+    return stats_;
+}
+
+/** Ожидаемые позиции, отклонения и статистика по уже разложенным долям. */
+void DeviationModel::finish()
+{
+    const qint64 count = qint64(position_.size());
+    if (!useTempoMap_) {
+        residualsKernel_(position_.data(), gridIndex_.data(), count, origin_, interval_,
+                         expected_.data(), deviation_.data());
+    }
+
+    BPMAnalyzer::DeviationStats stats;
+    stats.beatCount = int(count);
+    stats.gridStartSample = qint64(std::llround(origin_));
+    stats.gridBPM = useTempoMap_ ? float(tempoMap_.bpmAt(origin_, sampleRate_))
+                                 : float((60.0 * double(sampleRate_)) / interval_);
+
+    double sumAbs = 0.0;
+    double sumSquares = 0.0;
+    double maxAbs = 0.0;
+    reduceKernel_(deviation_.data(), count, sumAbs, sumSquares, maxAbs);
+
+    for (qint64 i = 1; i < count; ++i) {
+        const double step = gridIndex_[size_t(i)] - gridIndex_[size_t(i - 1)];
+        if (step > 1.0) {
+            stats.gapCount += int(step) - 1;  // детектор пропустил доли
+        } else if (step <= 0.0) {
+            ++stats.duplicateCount;           // две доли на одной линии сетки
+        }
+    }
+
+    for (qint64 i = 0; i < count; ++i) {
+        scratch_[size_t(i)] = std::abs(deviation_[size_t(i)]);
+    }
+    stats.maxAbsDeviation = float(maxAbs);
+    stats.meanAbsDeviation = float(sumAbs / double(count));
+    stats.rmsDeviation = float(std::sqrt(sumSquares / double(count)));
+    stats.medianAbsDeviation = float(medianOfScratch());
+
+    stats_ = stats;
+    evaluated_ = true;
+}
+
+void DeviationModel::writeTo(QVector<BPMAnalyzer::BeatInfo>& beats) const
+{
+    const int count = qMin(int(beats.size()), size());
+    for (int i = 0; i < count; ++i) {
+        beats[i].expectedPosition = qint64(std::llround(expected_[size_t(i)]));
+        beats[i].deviation = float(deviation_[size_t(i)]);
+    }
+}
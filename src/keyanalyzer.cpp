@@ -1,8 +1,17 @@
 #include "../include/keyanalyzer.h"
+#include "../include/keyprofile.h"
 #include <QtCore/QDebug>
+#include <QtCore/QRunnable>
+#include <QtCore/QSemaphore>
 #include <QtCore/QSet>
+#include <QtCore/QThread>
+#include <QtCore/QThreadPool>
 #include <cmath>
 #include <algorithm>
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <vector>
 
 // Заглушки для qm-dsp библиотек
 #ifdef USE_MIXXX_QM_DSP
@@ -11,15 +20,6 @@
 #endif
 
 namespace {
-    // Хроматические профили для мажорных и минорных тональностей
-    const QVector<float> MAJOR_PROFILES = {
-        1.0f, 0.0f, 1.0f, 0.0f, 1.0f, 1.0f, 0.0f, 1.0f, 0.0f, 1.0f, 0.0f, 1.0f  // C, D, E, F, G, A, B
-    };
-    
-    const QVector<float> MINOR_PROFILES = {
-        1.0f, 0.0f, 1.0f, 1.0f, 0.0f, 1.0f, 0.0f, 1.0f, 1.0f, 0.0f, 1.0f, 0.0f  // C, D, Eb, F, G, Ab, Bb
-    };
-    
     const QVector<QString> KEY_NAMES = {
         "C Major", "C Minor",
         "C# Major", "C# Minor", 
@@ -40,62 +40,13 @@ namespace {
 KeyAnalyzer::AnalysisResult KeyAnalyzer::analyzeKey(const QVector<float>& samples, 
                                                    int sampleRate,
                                                    const AnalysisOptions& options) {
-    // Если доступна qm-dsp библиотека, используем её
-    #ifdef USE_MIXXX_QM_DSP
-    return analyzeKeyUsingQM(samples, sampleRate, options);
-    #else
-    // Иначе используем упрощенный алгоритм
-    AnalysisResult result;
-    result.overallConfidence = 0.0f;
-    result.hasKeyChange = false;
-    
     if (samples.isEmpty()) {
         qDebug() << "No samples provided for key analysis";
-        return result;
-    }
-    
-    // Извлекаем хроматические признаки
-    QVector<float> chromaVector = extractChromaFeatures(samples, sampleRate, 
-                                                       options.frameSize, options.hopSize);
-    
-    if (chromaVector.isEmpty()) {
-        qDebug() << "Failed to extract chroma features";
-        return result;
+        return AnalysisResult();
     }
-    
-    // Определяем тональность
-    result.primaryKey = detectKeyFromChroma(chromaVector);
-    result.chromaVector = chromaVector;
-    result.overallConfidence = result.primaryKey.confidence;
-    
-    // Если нужно, определяем смены тональности
-    if (options.detectKeyChanges) {
-        // Разбиваем на кадры для анализа смены тональности
-        QVector<QVector<float>> chromaFrames;
-        int frameCount = samples.size() / options.hopSize;
-        
-        for (int i = 0; i < frameCount; ++i) {
-            int start = i * options.hopSize;
-            int end = std::min(start + options.frameSize, static_cast<int>(samples.size()));
-            
-            if (end - start >= options.frameSize) {
-                QVector<float> frame(samples.begin() + start, samples.begin() + end);
-                QVector<float> frameChroma = extractChromaFeatures(frame, sampleRate, 
-                                                                  options.frameSize, options.hopSize);
-                if (!frameChroma.isEmpty()) {
-                    chromaFrames.append(frameChroma);
-                }
-            }
-        }
-        
-        result.keyChanges = detectKeyChanges(chromaFrames, options.keyChangeThreshold);
-        result.secondaryKey = pickSecondaryKey(chromaFrames, result.primaryKey.key);
-        result.hasKeyChange = !result.keyChanges.isEmpty()
-            || result.secondaryKey.key != UNKNOWN_KEY;
-    }
-    
-    return result;
-    #endif
+    // Звук читается один раз и без копии в double: дальше всё по кадрам хромы
+    return analyzeKey(
+        computeChromaFrames(samples, sampleRate, DFEngine::bestSimdKernel(), options.maxThreads), options);
 }
 
 #ifdef USE_MIXXX_QM_DSP
@@ -114,22 +65,20 @@ KeyAnalyzer::AnalysisResult KeyAnalyzer::analyzeKeyUsingQM(const QVector<float>&
         
         GetKeyMode keyDetector(config);
         
-        // Конвертируем float в double для qm-dsp
-        QVector<double> doubleSamples = convertToDouble(samples);
-        
         // Обрабатываем аудио по кадрам
         const int frameSize = keyDetector.getBlockSize();
         const int hopSize = keyDetector.getHopSize();
-        if (frameSize <= 0 || hopSize <= 0 || doubleSamples.size() < frameSize) {
+        if (frameSize <= 0 || hopSize <= 0 || samples.size() < frameSize) {
             qDebug() << "GetKeyMode: invalid frame/hop size or too short audio";
             return result;
         }
         
         QVector<QVector<double>> chromaFrames;
+        // В double переводится только текущий кадр, а не весь трек
+        std::vector<double> frame(std::size_t(frameSize), 0.0);
         
-        for (int i = 0; i <= doubleSamples.size() - frameSize; i += hopSize) {
-            QVector<double> frame(doubleSamples.begin() + i, 
-                                 doubleSamples.begin() + i + frameSize);
+        for (qsizetype i = 0; i <= samples.size() - frameSize; i += hopSize) {
+            std::copy(samples.cbegin() + i, samples.cbegin() + i + frameSize, frame.begin());
             
             // Обрабатываем кадр (возвращает индекс тональности)
             Q_UNUSED(keyDetector.process(frame.data())); // Результат пока не используется
@@ -190,56 +139,6 @@ KeyAnalyzer::AnalysisResult KeyAnalyzer::analyzeKeyUsingQM(const QVector<float>&
 }
 #endif
 
-QVector<float> KeyAnalyzer::extractChromaFeatures(const QVector<float>& samples, 
-                                                 int sampleRate,
-                                                 int frameSize, 
-                                                 int hopSize) {
-    (void)sampleRate; // Подавляем предупреждение о неиспользуемом параметре
-    QVector<float> chromaVector(12, 0.0f);
-    
-    if (samples.isEmpty()) {
-        return chromaVector;
-    }
-    
-    // Простое извлечение хроматических признаков через FFT
-    // В реальной реализации здесь должен быть более сложный алгоритм
-    
-    // Разбиваем на кадры
-    QVector<QVector<float>> frames;
-    for (int i = 0; i < samples.size() - frameSize; i += hopSize) {
-        QVector<float> frame(samples.begin() + i, samples.begin() + i + frameSize);
-        frames.append(frame);
-    }
-    
-    if (frames.isEmpty()) {
-        return chromaVector;
-    }
-    
-    // Простое усреднение по кадрам (заглушка)
-    // В реальности здесь должен быть FFT и группировка по хроматическим классам
-    for (int i = 0; i < 12; ++i) {
-        float sum = 0.0f;
-        for (const auto& frame : frames) {
-            // Простая заглушка - используем энергию в разных частотных диапазонах
-            int bin = (i * frameSize) / 12;
-            if (bin < frame.size()) {
-                sum += std::abs(frame[bin]);
-            }
-        }
-        chromaVector[i] = sum / frames.size();
-    }
-    
-    // Нормализация
-    float maxVal = *std::max_element(chromaVector.begin(), chromaVector.end());
-    if (maxVal > 0.0f) {
-        for (int i = 0; i < 12; ++i) {
-            chromaVector[i] /= maxVal;
-        }
-    }
-    
-    return chromaVector;
-}
-
 KeyAnalyzer::KeyInfo KeyAnalyzer::detectKeyFromChroma(const QVector<float>& chromaVector) {
     KeyInfo result;
     result.key = UNKNOWN_KEY;
@@ -252,45 +151,16 @@ KeyAnalyzer::KeyInfo KeyAnalyzer::detectKeyFromChroma(const QVector<float>& chro
         return result;
     }
     
+    // Все 24 тональности по профилям Крумхансла–Кесслера (KeyProfile)
     float bestCorrelation = 0.0f;
-    int bestKey = 0;
-    bool bestIsMajor = false;
-    
-    // Проверяем все 24 тональности (12 мажорных + 12 минорных)
-    for (int key = 0; key < 12; ++key) {
-        // Мажорная тональность
-        float majorCorr = 0.0f;
-        for (int i = 0; i < 12; ++i) {
-            int shiftedIndex = (i + key) % 12;
-            majorCorr += chromaVector[i] * MAJOR_PROFILES[shiftedIndex];
-        }
-        
-        // Минорная тональность
-        float minorCorr = 0.0f;
-        for (int i = 0; i < 12; ++i) {
-            int shiftedIndex = (i + key) % 12;
-            minorCorr += chromaVector[i] * MINOR_PROFILES[shiftedIndex];
-        }
-        
-        if (majorCorr > bestCorrelation) {
-            bestCorrelation = majorCorr;
-            bestKey = key;
-            bestIsMajor = true;
-        }
-        
-        if (minorCorr > bestCorrelation) {
-            bestCorrelation = minorCorr;
-            bestKey = key;
-            bestIsMajor = false;
-        }
-    }
+    const int bestKey = KeyProfile::bestKey(chromaVector.constData(), &bestCorrelation);
     
-    // Устанавливаем результат
-    result.key = static_cast<Key>(bestKey * 2 + (bestIsMajor ? 0 : 1));
+    // Устанавливаем результат; тишина — прежний C Minor с нулевой уверенностью
+    result.key = bestKey < 0 ? C_MINOR : static_cast<Key>(bestKey);
     result.confidence = std::min(bestCorrelation, 1.0f);
     result.keyName = keyToString(result.key);
     result.strength = bestCorrelation;
-    result.isMajor = bestIsMajor;
+    result.isMajor = isMajorKey(result.key);
     
     return result;
 }
@@ -415,38 +285,523 @@ double KeyAnalyzer::samplesPerBar(const BarGrid& grid, int sampleRate) {
     return barLengthInQuarters * samplesPerBeat;
 }
 
-QVector<float> KeyAnalyzer::computeChromaGoertzel(const QVector<float>& samples, int sampleRate) {
+namespace {
+
+// ─── Банк резонаторов Гёрцеля для хромы ─────────────────────────────────────
+// 60 резонаторов (MIDI 36..95) считаются не 60 проходами по сигналу, а по
+// октавным уровням: сигнал прореживается полуполосным фильтром вдвое за
+// уровень, и каждый резонатор работает на самом редком уровне, где его частота
+// ещё в полосе пропускания. Разрешение по частоте задаёт длительность куска,
+// а не частота дискретизации, поэтому на нижних октавах оно то же, а сэмплов
+// в 2^уровень меньше. На уровне все его резонаторы идут одним проходом:
+// состояния лежат в SIMD-регистрах по kBankLanes штук.
+
+constexpr int kChromaMidiLow = 36;   // C2
+constexpr int kChromaMidiHigh = 95;  // B6
+constexpr int kChromaBinCount = kChromaMidiHigh - kChromaMidiLow + 1;
+constexpr int kBankLanes = 16;
+constexpr int kMaxChromaLevel = 6;
+// Резонатор остаётся на уровне, пока его частота не выше этой доли частоты
+// дискретизации уровня: дальше начинаются переходная полоса фильтра и
+// отражения от неё
+constexpr double kMaxBinFraction = 0.3;
+// Меньше сэмплов на уровне не прореживаем: Гёрцелю нужен хоть какой-то отрезок
+constexpr qint64 kMinLevelSamples = 64;
+// Полуполосный КИХ 2·15+1 отводов с окном Блэкмана: пульсации в полосе
+// пропускания ~1e-4, подавление за переходной полосой ~70 дБ
+constexpr int kHalfbandHalfLength = 15;
+
+/** Ненулевые нечётные отводы полуполосного фильтра: taps[j] — отвод ±(2j+1). */
+const std::array<double, (kHalfbandHalfLength + 1) / 2>& halfbandTaps()
+{
+    static const std::array<double, (kHalfbandHalfLength + 1) / 2> taps = []() {
+        constexpr double kPi = 3.14159265358979323846;
+        constexpr double span = double(kHalfbandHalfLength + 1);
+        std::array<double, (kHalfbandHalfLength + 1) / 2> t {};
+        double sum = 0.0;
+        for (int j = 0; j < int(t.size()); ++j) {
+            const int k = 2 * j + 1;
+            const double sinc = std::sin(kPi * k / 2.0) / (kPi * k);
+            const double window = 0.42 + 0.5 * std::cos(kPi * k / span)
+                                + 0.08 * std::cos(2.0 * kPi * k / span);
+            t[j] = sinc * window;
+            sum += 2.0 * t[j];
+        }
+        // Усиление на нуле — ровно 1: центральный отвод 0.5, остальное — нечётные
+        for (double& tap : t) {
+            tap *= 0.5 / sum;
+        }
+        return t;
+    }();
+    return taps;
+}
+
+/** Прореживание вдвое: out[m] — отфильтрованный in[2m], без задержки. */
+void decimateByTwo(const std::vector<double>& in, std::vector<double>& out)
+{
+    const std::array<double, (kHalfbandHalfLength + 1) / 2>& taps = halfbandTaps();
+    const qint64 n = qint64(in.size());
+    out.resize(std::size_t((n + 1) / 2));
+    for (qint64 m = 0; m < qint64(out.size()); ++m) {
+        const qint64 centre = 2 * m;
+        double acc = 0.5 * in[std::size_t(centre)];
+        if (centre >= kHalfbandHalfLength && centre + kHalfbandHalfLength < n) {
+            for (int j = 0; j < int(taps.size()); ++j) {
+                const qint64 k = 2 * j + 1;
+                acc += taps[j] * (in[std::size_t(centre - k)] + in[std::size_t(centre + k)]);
+            }
+        } else {
+            // Края: за пределами куска — тишина
+            for (int j = 0; j < int(taps.size()); ++j) {
+                const qint64 k = 2 * j + 1;
+                const double left = centre - k >= 0 ? in[std::size_t(centre - k)] : 0.0;
+                const double right = centre + k < n ? in[std::size_t(centre + k)] : 0.0;
+                acc += taps[j] * (left + right);
+            }
+        }
+        out[std::size_t(m)] = acc;
+    }
+}
+
+/**
+ * kBankLanes резонаторов за один проход по x: s0 = x + coeff·s1 − s2.
+ * s1/s2 — состояния на входе и на выходе.
+ */
+using GoertzelBankKernel = void (*)(const double* x, qint64 count, const double* coeff,
+                                    double* s1, double* s2);
+
+void goertzelBankScalar(const double* x, qint64 count, const double* coeff, double* s1, double* s2)
+{
+    double a1[kBankLanes];
+    double a2[kBankLanes];
+    std::copy(s1, s1 + kBankLanes, a1);
+    std::copy(s2, s2 + kBankLanes, a2);
+    for (qint64 i = 0; i < count; ++i) {
+        for (int b = 0; b < kBankLanes; ++b) {
+            const double s0 = x[i] + coeff[b] * a1[b] - a2[b];
+            a2[b] = a1[b];
+            a1[b] = s0;
+        }
+    }
+    std::copy(a1, a1 + kBankLanes, s1);
+    std::copy(a2, a2 + kBankLanes, s2);
+}
+
+// double-векторы NEON есть только в AArch64; на ARMv7 остаётся скалярное ядро
+#if defined(DFENGINE_HAS_NEON) && (defined(__aarch64__) || defined(_M_ARM64))
+#define KEYANALYZER_HAS_NEON64 1
+#endif
+
+#if defined(DFENGINE_HAS_X86_SIMD)
+void goertzelBankSse2(const double* x, qint64 count, const double* coeff, double* s1, double* s2)
+{
+    constexpr int kVectors = kBankLanes / 2;
+    __m128d c[kVectors];
+    __m128d a1[kVectors];
+    __m128d a2[kVectors];
+    for (int v = 0; v < kVectors; ++v) {
+        c[v] = _mm_loadu_pd(coeff + 2 * v);
+        a1[v] = _mm_loadu_pd(s1 + 2 * v);
+        a2[v] = _mm_loadu_pd(s2 + 2 * v);
+    }
+    for (qint64 i = 0; i < count; ++i) {
+        const __m128d xv = _mm_set1_pd(x[i]);
+        for (int v = 0; v < kVectors; ++v) {
+            const __m128d s0 = _mm_sub_pd(_mm_add_pd(xv, _mm_mul_pd(c[v], a1[v])), a2[v]);
+            a2[v] = a1[v];
+            a1[v] = s0;
+        }
+    }
+    for (int v = 0; v < kVectors; ++v) {
+        _mm_storeu_pd(s1 + 2 * v, a1[v]);
+        _mm_storeu_pd(s2 + 2 * v, a2[v]);
+    }
+}
+
+DFENGINE_TARGET_AVX2
+void goertzelBankAvx2(const double* x, qint64 count, const double* coeff, double* s1, double* s2)
+{
+    constexpr int kVectors = kBankLanes / 4;
+    __m256d c[kVectors];
+    __m256d a1[kVectors];
+    __m256d a2[kVectors];
+    for (int v = 0; v < kVectors; ++v) {
+        c[v] = _mm256_loadu_pd(coeff + 4 * v);
+        a1[v] = _mm256_loadu_pd(s1 + 4 * v);
+        a2[v] = _mm256_loadu_pd(s2 + 4 * v);
+    }
+    for (qint64 i = 0; i < count; ++i) {
+        const __m256d xv = _mm256_set1_pd(x[i]);
+        for (int v = 0; v < kVectors; ++v) {
+            // x − s2 не зависит от предыдущего шага: на цепочке остаётся одна FMA
+            const __m256d s0 = _mm256_fmadd_pd(c[v], a1[v], _mm256_sub_pd(xv, a2[v]));
+            a2[v] = a1[v];
+            a1[v] = s0;
+        }
+    }
+    for (int v = 0; v < kVectors; ++v) {
+        _mm256_storeu_pd(s1 + 4 * v, a1[v]);
+        _mm256_storeu_pd(s2 + 4 * v, a2[v]);
+    }
+}
+#endif
+
+#if defined(KEYANALYZER_HAS_NEON64)
+void goertzelBankNeon(const double* x, qint64 count, const double* coeff, double* s1, double* s2)
+{
+    constexpr int kVectors = kBankLanes / 2;
+    float64x2_t c[kVectors];
+    float64x2_t a1[kVectors];
+    float64x2_t a2[kVectors];
+    for (int v = 0; v < kVectors; ++v) {
+        c[v] = vld1q_f64(coeff + 2 * v);
+        a1[v] = vld1q_f64(s1 + 2 * v);
+        a2[v] = vld1q_f64(s2 + 2 * v);
+    }
+    for (qint64 i = 0; i < count; ++i) {
+        const float64x2_t xv = vdupq_n_f64(x[i]);
+        for (int v = 0; v < kVectors; ++v) {
+            const float64x2_t s0 = vfmaq_f64(vsubq_f64(xv, a2[v]), c[v], a1[v]);
+            a2[v] = a1[v];
+            a1[v] = s0;
+        }
+    }
+    for (int v = 0; v < kVectors; ++v) {
+        vst1q_f64(s1 + 2 * v, a1[v]);
+        vst1q_f64(s2 + 2 * v, a2[v]);
+    }
+}
+#endif
+
+double chromaBinFrequency(int bin)
+{
+    return 440.0 * std::pow(2.0, (double(kChromaMidiLow + bin) - 69.0) / 12.0);
+}
+
+/**
+ * Уровень резонатора: самый редкий, где частота ещё в полосе и сэмплов уровня
+ * хватает; −1 — частота выше Найквиста, резонатор не считается.
+ */
+int chromaBinLevel(double freq, int sampleRate, qint64 sampleCount)
+{
+    if (freq >= 0.5 * double(sampleRate)) {
+        return -1;
+    }
+    int level = 0;
+    while (level < kMaxChromaLevel && (sampleCount >> (level + 1)) >= kMinLevelSamples
+           && freq <= kMaxBinFraction * double(sampleRate) / double(qint64(1) << (level + 1))) {
+        ++level;
+    }
+    return level;
+}
+
+GoertzelBankKernel goertzelBankKernelFor(DFEngine::SimdKernel kernel)
+{
+    if (!DFEngine::isSimdKernelSupported(kernel)) {
+        return goertzelBankScalar;
+    }
+    switch (kernel) {
+    case DFEngine::SimdKernel::Scalar:
+        return goertzelBankScalar;
+    case DFEngine::SimdKernel::Sse2:
+#if defined(DFENGINE_HAS_X86_SIMD)
+        return goertzelBankSse2;
+#else
+        return goertzelBankScalar;
+#endif
+    case DFEngine::SimdKernel::Avx2:
+#if defined(DFENGINE_HAS_X86_SIMD)
+        return goertzelBankAvx2;
+#else
+        return goertzelBankScalar;
+#endif
+    case DFEngine::SimdKernel::Neon:
+#if defined(KEYANALYZER_HAS_NEON64)
+        return goertzelBankNeon;
+#else
+        return goertzelBankScalar;
+#endif
+    }
+    return goertzelBankScalar;
+}
+
+// ─── Кадры хромы для потактового анализа ─────────────────────────────────────
+// Отклик Гёрцеля линеен по сэмплам: отклик такта — сумма откликов его кадров,
+// если все они в одной фазе (от начала трека). Поэтому трек проходится один
+// раз, а такты любой сетки собираются из префиксных сумм.
+
+// Шаг кадра: целое число сэмплов на каждом уровне прореживания
+constexpr int kChromaHop = 1024;
+static_assert(kChromaHop % (1 << kMaxChromaLevel) == 0, "кадр должен делиться на каждом уровне");
+// Запас по краям куска: опора каскада прореживания до верхнего уровня —
+// 15·(2^6 − 1) = 945 сэмплов, так что прореженный кусок совпадает с
+// прореживанием целого трека
+constexpr qint64 kChromaChunkPad = kChromaHop;
+// Кадров на задачу пула (~6 с звука при 44.1 кГц)
+constexpr int kChromaChunkFrames = 256;
+
+// Выполняет task(0 … taskCount-1) не более чем на maxThreads потоках (0 — по
+// числу ядер) и ждёт завершения. Пул свой, как в BPMAnalyzer: анализ и сам
+// обычно запущен из задачи глобального пула
+void parallelFor(int maxThreads, int taskCount, const std::function<void(int)>& task)
+{
+    const int threadCount = qBound(1, maxThreads > 0 ? maxThreads : QThread::idealThreadCount(), 16);
+    if (threadCount <= 1 || taskCount <= 1) {
+        for (int i = 0; i < taskCount; ++i) {
+            task(i);
+        }
+        return;
+    }
+    QThreadPool pool;
+    pool.setMaxThreadCount(std::min(threadCount, taskCount));
+    QSemaphore finished;
+    for (int i = 0; i < taskCount; ++i) {
+        pool.start(QRunnable::create([&task, &finished, i]() {
+            task(i);
+            finished.release();
+        }));
+    }
+    finished.acquire(taskCount);
+}
+
+struct ChromaFramePlan {
+    int sampleRate = 0;
+    qint64 sampleCount = 0;
+    int topLevel = 0;
+    std::array<double, kChromaBinCount> freqs {};
+    std::array<int, kChromaBinCount> levels {};
+};
+
+/**
+ * Отклики резонаторов кадров [frameBegin, frameEnd) в фазе от начала трека,
+ * умноженные на 2^уровень (величина тона не зависит от прореживания):
+ * out[f · kChromaBinCount + b].
+ */
+void computeFrameResponses(const float* samples, const ChromaFramePlan& plan, int frameBegin,
+                           int frameEnd, GoertzelBankKernel bank, std::complex<double>* out)
+{
+    constexpr double kTwoPi = 6.28318530717958647692;
+    const qint64 n = plan.sampleCount;
+    const qint64 segmentStart = std::max<qint64>(0, qint64(frameBegin) * kChromaHop - kChromaChunkPad);
+    const qint64 segmentEnd = std::min<qint64>(n, qint64(frameEnd) * kChromaHop + kChromaChunkPad);
+    std::vector<double> signal(samples + segmentStart, samples + segmentEnd);
+    std::vector<double> decimated;
+
+    for (int level = 0; level <= plan.topLevel; ++level) {
+        const double levelRate = double(plan.sampleRate) / double(qint64(1) << level);
+        const double scale = double(qint64(1) << level);
+        const qint64 offset = segmentStart >> level;  // индекс signal[0] на уровне трека
+        const qint64 levelCount = (n + (qint64(1) << level) - 1) >> level;
+        const qint64 levelHop = kChromaHop >> level;
+
+        for (int first = 0; first < kChromaBinCount; ) {
+            std::array<int, kBankLanes> bins {};
+            std::array<double, kBankLanes> coeff {};
+            std::array<double, kBankLanes> omega {};
+            std::array<double, kBankLanes> cosOmega {};
+            std::array<double, kBankLanes> sinOmega {};
+            int used = 0;
+            for (; first < kChromaBinCount && used < kBankLanes; ++first) {
+                if (plan.levels[first] == level) {
+                    bins[used] = first;
+                    omega[used] = kTwoPi * plan.freqs[first] / levelRate;
+                    cosOmega[used] = std::cos(omega[used]);
+                    sinOmega[used] = std::sin(omega[used]);
+                    coeff[used] = 2.0 * cosOmega[used];
+                    ++used;
+                }
+            }
+            if (used == 0) {
+                break;
+            }
+            for (int f = frameBegin; f < frameEnd; ++f) {
+                const qint64 start = qint64(f) * levelHop;
+                const qint64 end = std::min(levelCount, start + levelHop);
+                if (end <= start) {
+                    continue;
+                }
+                std::array<double, kBankLanes> s1 {};
+                std::array<double, kBankLanes> s2 {};
+                bank(signal.data() + (start - offset), end - start, coeff.data(), s1.data(), s2.data());
+                for (int lane = 0; lane < used; ++lane) {
+                    // Σ x[k]·e^(−jωk) по кадру, k — индекс уровня от начала трека:
+                    // e^(−jω·last)·(s1 − e^(−jω)·s2)
+                    const double re = s1[lane] - cosOmega[lane] * s2[lane];
+                    const double im = sinOmega[lane] * s2[lane];
+                    const double phase = omega[lane] * double(end - 1);
+                    const double c = std::cos(phase);
+                    const double sn = std::sin(phase);
+                    out[std::size_t(f) * kChromaBinCount + std::size_t(bins[lane])] =
+                        std::complex<double>((re * c + im * sn) * scale, (im * c - re * sn) * scale);
+                }
+            }
+        }
+        if (level < plan.topLevel) {
+            decimateByTwo(signal, decimated);
+            signal.swap(decimated);
+        }
+    }
+}
+
+/// Нормированная к пику хрома кадров [firstFrame, endFrame): по резонатору —
+/// модуль разности префиксов, то есть отклик на всём отрезке целиком.
+void frameRangeChroma(const KeyAnalyzer::ChromaFrames& frames, int firstFrame, int endFrame,
+                      QVector<float>& chroma, QVector<float>* unnormalized = nullptr)
+{
+    const std::complex<double>* from = frames.prefix.constData()
+        + qsizetype(firstFrame) * KeyAnalyzer::ChromaFrames::kBinCount;
+    const std::complex<double>* to = frames.prefix.constData()
+        + qsizetype(endFrame) * KeyAnalyzer::ChromaFrames::kBinCount;
+    chroma.fill(0.0f);
+    for (int bin = 0; bin < KeyAnalyzer::ChromaFrames::kBinCount; ++bin) {
+        const int pitchClass = frames.binPitchClass[bin];
+        if (pitchClass >= 0) {
+            chroma[pitchClass] += float(std::abs(to[bin] - from[bin]));
+        }
+    }
+    if (unnormalized) {
+        for (int i = 0; i < 12; ++i) {
+            (*unnormalized)[i] += chroma[i];
+        }
+    }
+    const float maxVal = *std::max_element(chroma.cbegin(), chroma.cend());
+    if (maxVal > 0.0f) {
+        for (float& v : chroma) {
+            v /= maxVal;
+        }
+    }
+}
+
+/// Корреляция хромы шага с профилем каждой из 24 тональностей (−1..1); тишина — нули.
+void keyEmissions(const QVector<float>& chroma, std::array<float, KeyAnalyzer::UNKNOWN_KEY>& emission)
+{
+    for (int key = 0; key < int(KeyAnalyzer::UNKNOWN_KEY); ++key) {
+        emission[key] = KeyProfile::correlation(chroma.constData(), key);
+    }
+}
+
+/// Тональность шага после сглаживания: сила — корреляция с профилем, как у
+/// detectKeyFromChroma, уверенность — она же, не меньше нуля.
+KeyAnalyzer::KeyInfo keyInfoFor(KeyAnalyzer::Key key, const QVector<float>& chroma)
+{
+    KeyAnalyzer::KeyInfo info;
+    info.key = key;
+    info.keyName = KeyAnalyzer::keyToString(key);
+    info.isMajor = KeyAnalyzer::isMajorKey(key);
+    if (key == KeyAnalyzer::UNKNOWN_KEY) {
+        return info;
+    }
+    info.strength = KeyProfile::correlation(chroma.constData(), int(key));
+    info.confidence = qMax(0.0f, info.strength);
+    return info;
+}
+
+} // namespace
+
+QVector<KeyAnalyzer::Key> KeyAnalyzer::decodeKeyPath(const QVector<QVector<float>>& chroma,
+                                                     float changePenalty) {
+    constexpr int kStates = int(UNKNOWN_KEY);
+    const int steps = chroma.size();
+    QVector<Key> path(steps, UNKNOWN_KEY);
+    if (steps == 0) {
+        return path;
+    }
+    const float penalty = qMax(0.0f, changePenalty);
+
+    // score[k] — лучшая сумма корреляций с профилем по пути, который кончается в k, за
+    // вычетом лучшей суммы прошлого шага (так числа не растут с длиной трека).
+    // Смена стоит одинаково для любой пары тональностей, поэтому лучший
+    // предшественник k — либо сам k, либо лучший на прошлом шаге: вместо
+    // перебора 24 × 24 хватает 24 сравнений на шаг.
+    std::array<float, kStates> score {};
+    std::array<float, kStates> emission {};
+    std::vector<std::uint8_t> from(std::size_t(steps) * kStates);
+    // Лучшая тональность; при ничьей — первая по порядку, как у KeyProfile::bestKey
+    const auto bestState = [&score]() {
+        int best = 0;
+        for (int k = 1; k < kStates; ++k) {
+            if (score[k] > score[best]) {
+                best = k;
+            }
+        }
+        return best;
+    };
+    for (int t = 0; t < steps; ++t) {
+        keyEmissions(chroma[t], emission);
+        const int best = bestState();
+        const float top = score[best];
+        std::uint8_t* back = from.data() + std::size_t(t) * kStates;
+        for (int k = 0; k < kStates; ++k) {
+            // При равенстве остаёмся: без выигрыша тональность не меняется
+            const bool stay = score[k] - top >= -penalty;
+            back[k] = std::uint8_t(stay ? k : best);
+            score[k] = (stay ? score[k] - top : -penalty) + emission[k];
+        }
+    }
+
+    int state = bestState();
+    for (int t = steps - 1; t >= 0; --t) {
+        path[t] = static_cast<Key>(state);
+        state = from[std::size_t(t) * kStates + std::size_t(state)];
+    }
+    return path;
+}
+
+QVector<float> KeyAnalyzer::computeChromaGoertzel(const QVector<float>& samples, int sampleRate,
+                                                  DFEngine::SimdKernel kernel) {
     QVector<float> chroma(12, 0.0f);
-    const int n = samples.size();
+    const qint64 n = samples.size();
     if (n < 32 || sampleRate <= 0) {
         return chroma;
     }
 
     constexpr double kTwoPi = 6.28318530717958647692;
-    // Диапазон нот C2 (MIDI 36) .. B6 (MIDI 95) покрывает основные регистры.
-    const int midiLow = 36;
-    const int midiHigh = 95;
-    const double nyquist = 0.5 * double(sampleRate);
-
-    for (int midi = midiLow; midi <= midiHigh; ++midi) {
-        const double freq = 440.0 * std::pow(2.0, (double(midi) - 69.0) / 12.0);
-        if (freq <= 0.0 || freq >= nyquist) {
-            continue;
-        }
 
-        // Алгоритм Гёрцеля: величина спектра на частоте freq за один проход.
-        const double w = kTwoPi * freq / double(sampleRate);
-        const double coeff = 2.0 * std::cos(w);
-        double s1 = 0.0, s2 = 0.0;
-        for (int i = 0; i < n; ++i) {
-            const double s0 = double(samples[i]) + coeff * s1 - s2;
-            s2 = s1;
-            s1 = s0;
-        }
-        const double power = s1 * s1 + s2 * s2 - coeff * s1 * s2;
-        const double magnitude = std::sqrt(std::max(0.0, power)) / double(n);
+    std::array<double, kChromaBinCount> freqs {};
+    std::array<int, kChromaBinCount> levels {};
+    int topLevel = 0;
+    for (int bin = 0; bin < kChromaBinCount; ++bin) {
+        freqs[bin] = chromaBinFrequency(bin);
+        levels[bin] = chromaBinLevel(freqs[bin], sampleRate, n);
+        topLevel = std::max(topLevel, levels[bin]);
+    }
 
-        chroma[midi % 12] += float(magnitude);
+    const GoertzelBankKernel bank = goertzelBankKernelFor(kernel);
+    std::vector<double> signal(samples.begin(), samples.end());
+    std::vector<double> decimated;
+    for (int level = 0; level <= topLevel; ++level) {
+        const double levelRate = double(sampleRate) / double(qint64(1) << level);
+        const qint64 count = qint64(signal.size());
+        for (int first = 0; first < kChromaBinCount; ) {
+            // Очередные kBankLanes резонаторов этого уровня; пустые дорожки — coeff 0
+            std::array<int, kBankLanes> bins {};
+            std::array<double, kBankLanes> coeff {};
+            std::array<double, kBankLanes> s1 {};
+            std::array<double, kBankLanes> s2 {};
+            int used = 0;
+            for (; first < kChromaBinCount && used < kBankLanes; ++first) {
+                if (levels[first] == level) {
+                    bins[used] = first;
+                    coeff[used] = 2.0 * std::cos(kTwoPi * freqs[first] / levelRate);
+                    ++used;
+                }
+            }
+            if (used == 0) {
+                break;
+            }
+            bank(signal.data(), count, coeff.data(), s1.data(), s2.data());
+            for (int lane = 0; lane < used; ++lane) {
+                const double power = s1[lane] * s1[lane] + s2[lane] * s2[lane]
+                                   - coeff[lane] * s1[lane] * s2[lane];
+                // На сэмпл своего уровня: величина тона не зависит от прореживания
+                const double magnitude = std::sqrt(std::max(0.0, power)) / double(count);
+                chroma[(kChromaMidiLow + bins[lane]) % 12] += float(magnitude);
+            }
+        }
+        if (level < topLevel) {
+            decimateByTwo(signal, decimated);
+            signal.swap(decimated);
+        }
     }
 
     float maxVal = 0.0f;
@@ -532,23 +887,91 @@ KeyAnalyzer::KeyInfo KeyAnalyzer::dominantModulationKey(const PerBarKeyResult& p
     return result;
 }
 
+KeyAnalyzer::ChromaFrames KeyAnalyzer::computeChromaFrames(const QVector<float>& samples,
+                                                          int sampleRate,
+                                                          DFEngine::SimdKernel kernel,
+                                                          int maxThreads) {
+    ChromaFrames frames;
+    const qint64 n = samples.size();
+    if (n < 32 || sampleRate <= 0) {
+        return frames;
+    }
+
+    ChromaFramePlan plan;
+    plan.sampleRate = sampleRate;
+    plan.sampleCount = n;
+    frames.binPitchClass.resize(ChromaFrames::kBinCount);
+    for (int bin = 0; bin < kChromaBinCount; ++bin) {
+        plan.freqs[bin] = chromaBinFrequency(bin);
+        plan.levels[bin] = chromaBinLevel(plan.freqs[bin], sampleRate, n);
+        plan.topLevel = std::max(plan.topLevel, plan.levels[bin]);
+        frames.binPitchClass[bin] = plan.levels[bin] < 0 ? -1 : (kChromaMidiLow + bin) % 12;
+    }
+
+    frames.sampleRate = sampleRate;
+    frames.sampleCount = n;
+    frames.hopSamples = kChromaHop;
+    frames.frameCount = int((n + kChromaHop - 1) / kChromaHop);
+    frames.prefix.resize(qsizetype(frames.frameCount + 1) * kChromaBinCount);
+
+    // Отклики кадра f — в строке f + 1: ниже они же превращаются в префиксы
+    std::complex<double>* responses = frames.prefix.data() + kChromaBinCount;
+    const GoertzelBankKernel bank = goertzelBankKernelFor(kernel);
+    const float* data = samples.constData();
+    const int chunkCount = (frames.frameCount + kChromaChunkFrames - 1) / kChromaChunkFrames;
+    parallelFor(maxThreads, chunkCount, [&](int chunk) {
+        const int frameBegin = chunk * kChromaChunkFrames;
+        const int frameEnd = std::min(frames.frameCount, frameBegin + kChromaChunkFrames);
+        computeFrameResponses(data, plan, frameBegin, frameEnd, bank, responses);
+    });
+
+    // Префиксы — в double: отклик такта — разность двух сумм по всему треку,
+    // и во float тихий класс к концу длинного трека тонул бы в её округлении
+    for (int f = 1; f < frames.frameCount; ++f) {
+        const std::complex<double>* previous = responses + std::size_t(f - 1) * kChromaBinCount;
+        std::complex<double>* row = responses + std::size_t(f) * kChromaBinCount;
+        for (int bin = 0; bin < kChromaBinCount; ++bin) {
+            row[bin] += previous[bin];
+        }
+    }
+    return frames;
+}
+
 KeyAnalyzer::PerBarKeyResult KeyAnalyzer::analyzeKeyPerBar(const QVector<float>& samples,
                                                           int sampleRate,
                                                           const BarGrid& grid,
                                                           const AnalysisOptions& options) {
-    Q_UNUSED(options);
-    PerBarKeyResult result;
+    if (samples.isEmpty() || samplesPerBar(grid, sampleRate) < 1.0) {
+        return PerBarKeyResult();
+    }
+    return analyzeKeyPerBar(
+        computeChromaFrames(samples, sampleRate, DFEngine::bestSimdKernel(), options.maxThreads), grid,
+        options);
+}
 
-    const qint64 n = samples.size();
-    const double spb = samplesPerBar(grid, sampleRate);
-    if (n <= 0 || spb < 1.0) {
-        return result;
+KeyAnalyzer::PerBarKeyResult KeyAnalyzer::analyzeKeyPerBar(const ChromaFrames& frames,
+                                                          const BarGrid& grid,
+                                                          const AnalysisOptions& options) {
+    const qint64 n = frames.sampleCount;
+    const double spb = samplesPerBar(grid, frames.sampleRate);
+    if (frames.isEmpty() || spb < 1.0) {
+        return PerBarKeyResult();
     }
 
     // Минимальная длина такта для устойчивого анализа (~50 мс).
-    const qint64 minBarSamples = qMax<qint64>(32, qint64(sampleRate) / 20);
+    const qint64 minBarSamples = qMax<qint64>(32, qint64(frames.sampleRate) / 20);
     const qint64 gridStart = qMax<qint64>(0, grid.gridStartSample);
+    // Граница такта — ближайшая граница кадра
+    const auto frameAt = [&frames](qint64 sample) {
+        return int(qBound<qint64>(0, (sample + frames.hopSamples / 2) / frames.hopSamples,
+                                  frames.frameCount));
+    };
 
+    QVector<BarKey> bars;
+    QVector<QVector<float>> barChroma;
+    bars.reserve(int(double(n - gridStart) / spb) + 1);
+    barChroma.reserve(bars.capacity());
+    QVector<float> chroma(12, 0.0f);
     for (int barIndex = 0; ; ++barIndex) {
         const qint64 barStart = gridStart + qint64(std::llround(double(barIndex) * spb));
         if (barStart >= n) {
@@ -561,18 +984,112 @@ KeyAnalyzer::PerBarKeyResult KeyAnalyzer::analyzeKeyPerBar(const QVector<float>&
             break;
         }
 
-        QVector<float> slice(samples.begin() + barStart, samples.begin() + sliceEnd);
-        const QVector<float> chroma = computeChromaGoertzel(slice, sampleRate);
+        const int firstFrame = frameAt(barStart);
+        const int endFrame = std::max(frameAt(sliceEnd), std::min(frames.frameCount, firstFrame + 1));
+        frameRangeChroma(frames, firstFrame, endFrame, chroma);
 
         BarKey bk;
         bk.barIndex = barIndex;
         bk.startSample = barStart;
         bk.endSample = barEnd;
-        bk.key = detectKeyFromChroma(chroma);
-        result.bars.append(bk);
+        bars.append(bk);
+        barChroma.append(chroma);
+    }
+
+    // Тональности тактов — сглаженный путь, а не argmax каждого такта:
+    // одиночный такт с соседней гаммой не рвёт регион
+    const QVector<Key> path = decodeKeyPath(barChroma, options.keyChangePenalty);
+    for (int i = 0; i < bars.size(); ++i) {
+        bars[i].key = keyInfoFor(path[i], barChroma[i]);
+    }
+    return summarizeBarKeys(bars);
+}
+
+KeyAnalyzer::AnalysisResult KeyAnalyzer::analyzeKey(const ChromaFrames& frames,
+                                                   const AnalysisOptions& options) {
+    AnalysisResult result;
+    if (frames.isEmpty()) {
+        qDebug() << "Failed to extract chroma features";
+        return result;
+    }
+
+    // Окна — целые кадры хромы; трек короче окна — одно окно на весь трек
+    const int windowFrames = qBound(
+        1, int(std::lround(double(options.frameSize) / double(frames.hopSamples))), frames.frameCount);
+    const int windowHop = qMax(1, int(std::lround(double(options.hopSize) / double(frames.hopSamples))));
+
+    // Хрома трека — сумма величин окон, а не один отклик на весь трек:
+    // слегка плавающий строй за минуты гасил бы сам себя по фазе
+    QVector<float> trackChroma(12, 0.0f);
+    QVector<QVector<float>> windowChroma;
+    windowChroma.reserve((frames.frameCount - windowFrames) / windowHop + 1);
+    QVector<float> chroma(12, 0.0f);
+    for (int first = 0; first + windowFrames <= frames.frameCount; first += windowHop) {
+        frameRangeChroma(frames, first, first + windowFrames, chroma, &trackChroma);
+        windowChroma.append(chroma);
+    }
+    const float maxVal = *std::max_element(trackChroma.cbegin(), trackChroma.cend());
+    if (maxVal > 0.0f) {
+        for (float& v : trackChroma) {
+            v /= maxVal;
+        }
     }
 
-    return summarizeBarKeys(result.bars);
+    result.chromaVector = trackChroma;
+
+    // Основная тональность — самая долгая на сглаженном пути окон, как у
+    // тактов (summarizeBarKeys): по сумме хромы двух гамм профиль может выбрать
+    // третью, соседнюю обеим. Смены — границы пути, вторая тональность — самая
+    // долгая после основной
+    const QVector<Key> path = decodeKeyPath(windowChroma, options.keyChangePenalty);
+    QVector<int> counts(int(UNKNOWN_KEY), 0);
+    QVector<float> strengthSum(int(UNKNOWN_KEY), 0.0f);
+    QVector<float> confidenceSum(int(UNKNOWN_KEY), 0.0f);
+    QVector<KeyInfo> changes;
+    for (int t = 0; t < path.size(); ++t) {
+        const KeyInfo info = keyInfoFor(path[t], windowChroma[t]);
+        if (t > 0 && path[t] != path[t - 1]) {
+            changes.append(info);
+        }
+        ++counts[int(path[t])];
+        strengthSum[int(path[t])] += info.strength;
+        confidenceSum[int(path[t])] += info.confidence;
+    }
+    const auto pathKey = [&](int idx) {
+        KeyInfo info;
+        info.key = static_cast<Key>(idx);
+        info.keyName = keyToString(info.key);
+        info.isMajor = isMajorKey(info.key);
+        info.strength = strengthSum[idx] / counts[idx];
+        info.confidence = confidenceSum[idx] / counts[idx];
+        return info;
+    };
+
+    const int primaryIdx = int(std::max_element(counts.cbegin(), counts.cend()) - counts.cbegin());
+    // Тишина: путь стоит на первой тональности без единого довода — как раньше, по хроме трека
+    result.primaryKey = maxVal > 0.0f ? pathKey(primaryIdx) : detectKeyFromChroma(trackChroma);
+    result.overallConfidence = result.primaryKey.confidence;
+
+    if (options.detectKeyChanges) {
+        result.keyChanges = changes;
+
+        // Модуляция считается значимой, если вторая тональность
+        // занимает заметную долю трека
+        constexpr float kMinShare = 0.2f;
+        int bestIdx = -1;
+        for (int i = 0; i < counts.size(); ++i) {
+            if (i != int(result.primaryKey.key) && counts[i] >= 2
+                && (bestIdx < 0 || counts[i] > counts[bestIdx])) {
+                bestIdx = i;
+            }
+        }
+        if (bestIdx >= 0 && float(counts[bestIdx]) / float(path.size()) >= kMinShare) {
+            result.secondaryKey = pathKey(bestIdx);
+        }
+        result.hasKeyChange = !result.keyChanges.isEmpty()
+            || result.secondaryKey.key != UNKNOWN_KEY;
+    }
+    return result;
 }
 
 KeyAnalyzer::PerBarKeyResult KeyAnalyzer::summarizeBarKeys(const QVector<BarKey>& bars) {
@@ -618,15 +1135,6 @@ KeyAnalyzer::PerBarKeyResult KeyAnalyzer::summarizeBarKeys(const QVector<BarKey>
     return result;
 }
 
-QVector<double> KeyAnalyzer::convertToDouble(const QVector<float>& samples) {
-    QVector<double> result;
-    result.reserve(samples.size());
-    for (float sample : samples) {
-        result.append(static_cast<double>(sample));
-    }
-    return result;
-}
-
 QVector<float> KeyAnalyzer::convertToFloat(const QVector<double>& samples) {
     QVector<float> result;
     result.reserve(samples.size());
@@ -1,7 +1,6 @@
 #include "../include/loadfiledialog.h"
 #include "../ui_loadfiledialog.h"
 #include <QStyle>
-#include <QApplication>
 #include <QTimer>
 
 LoadFileDialog::LoadFileDialog(QWidget *parent, const BPMAnalyzer::AnalysisResult& analysisResult)
@@ -46,7 +45,6 @@ void LoadFileDialog::updateProgress(const QString& status, int progress)
     ui->statusLabel->setText(status);
     ui->statusLabel->setStyleSheet("font-size: 14px; font-weight: bold; color: white;");
     ui->progressBar->setValue(progress);
-    QApplication::processEvents();
 }
 
 void LoadFileDialog::showResult(const BPMAnalyzer::AnalysisResult& analysis)
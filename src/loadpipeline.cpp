@@ -0,0 +1,192 @@
+#include "../include/loadpipeline.h"
+
+#include "../include/audiofileservice.h"
+#include "../include/onsetstream.h"
+
+#include <QtConcurrent/QtConcurrent>
+#include <memory>
+
+namespace LoadPipeline {
+
+namespace {
+
+bool isCancelled(const std::atomic<bool>* cancel)
+{
+    return cancel && cancel->load(std::memory_order_relaxed);
+}
+
+} // namespace
+
+Result run(const QString& filePath,
+           const BPMAnalyzer::AnalysisOptions& options,
+           const AnalysisCache* cache,
+           const std::atomic<bool>* cancel,
+           const Callbacks& callbacks)
+{
+    Result result;
+
+    // Прогресс не откатывается назад: этапы отчитываются каждый в своём отрезке
+    Stage lastStage = Stage::Decoding;
+    int lastPercent = -1;
+    const auto report = [&](Stage stage, int percent) {
+        percent = qBound(lastPercent, percent, 100);
+        if (!callbacks.onProgress || (stage == lastStage && percent == lastPercent)) {
+            return;
+        }
+        lastStage = stage;
+        lastPercent = percent;
+        callbacks.onProgress(stage, percent);
+    };
+
+    // Хеш содержимого — ключ кеша анализа — и чтение записи по нему идут
+    // параллельно с декодированием: файл читают оба, и второй раз он уже в
+    // кеше ОС. Копия кеша и shared_ptr — задача может пережить отменённый run()
+    struct CacheLookup {
+        QByteArray hash;
+        bool found = false;
+        AnalysisCacheEntry entry;
+        std::atomic<bool> ready { false };
+    };
+    const auto lookup = std::make_shared<CacheLookup>();
+    QFuture<void> hashing;
+    if (cache) {
+        // Доли, посчитанные с другими настройками (размер такта, алгоритм,
+        // диапазон BPM), — промах: иначе тихо вернулась бы старая сетка
+        const quint64 optionsKey = AnalysisCache::optionsKey(options);
+        hashing = QtConcurrent::run([filePath, cacheCopy = *cache, lookup, optionsKey]() {
+            lookup->hash = AnalysisCache::contentHash(filePath);
+            lookup->found = !lookup->hash.isEmpty() && cacheCopy.load(lookup->hash, lookup->entry)
+                && lookup->entry.hasBeats && lookup->entry.beatsOptionsKey == optionsKey;
+            lookup->ready.store(true, std::memory_order_release);
+        });
+    }
+
+    // Запись подходит, если совпали частота и каналы; длину сверяем, когда
+    // декодирование закончено. При попадании onset-функция больше не нужна,
+    // прореживание для сильной доли продолжается
+    std::unique_ptr<OnsetStream> onsets;
+    bool lookupChecked = false;
+    const auto checkLookup = [&](int sampleRate, int channelCount) {
+        lookupChecked = true;
+        result.contentHash = lookup->hash;
+        result.cacheHit = lookup->found && lookup->entry.sampleRate == sampleRate
+            && lookup->entry.channelCount == channelCount;
+        if (!result.cacheHit) {
+            return;
+        }
+        result.cached = std::move(lookup->entry);
+        if (onsets) {
+            onsets->stopDetection();
+        }
+        if (callbacks.onCached) {
+            callbacks.onCached(result.cached);
+        }
+    };
+
+    // Onset-функция набирается прямо из блоков декодера по среднему каналов:
+    // к концу декодирования остаётся TempoTrackV2. Между блоками — проверка,
+    // готов ли хеш: запись кеша находится ещё во время декодирования
+    AudioFileService::BlockCallback onBlock;
+    if (options.useMixxxAlgorithm || cache) {
+        onBlock = [&](int sampleRate, const float* left, const float* right, int frames) {
+            if (cache && !lookupChecked && lookup->ready.load(std::memory_order_acquire)) {
+                checkLookup(sampleRate, right ? 2 : 1);
+            }
+            if (!options.useMixxxAlgorithm) {
+                return;
+            }
+            if (!onsets && sampleRate > 0) {
+                onsets = std::make_unique<OnsetStream>(sampleRate);
+                if (result.cacheHit) {
+                    onsets->stopDetection();
+                }
+            }
+            if (onsets) {
+                onsets->push(left, right, frames);
+            }
+        };
+    }
+
+    report(Stage::Decoding, 0);
+    AudioFileService::DecodeResult decoded = AudioFileService::decode(
+        filePath,
+        [&report](int percent) { report(Stage::Decoding, percent * kDecodedPercent / 100); },
+        onBlock,
+        cancel);
+    // Хеш, если ещё считается, дочитает файл сам: shared_ptr держит его результат
+    if (decoded.cancelled || isCancelled(cancel)) {
+        result.cancelled = true;
+        return result;
+    }
+    if (!decoded.ok || decoded.channels.isEmpty() || decoded.channels[0].isEmpty()) {
+        result.error = decoded.error;
+        return result;
+    }
+
+    result.channels = std::move(decoded.channels);
+    result.sampleRate = decoded.sampleRate;
+    report(Stage::Decoding, kDecodedPercent);
+    if (cache && !lookupChecked) {
+        // Хеш не успел за декодированием — дожидаемся его здесь, до анализа
+        hashing.waitForFinished();
+        checkLookup(result.sampleRate, result.channels.size());
+    }
+    if (result.cacheHit && result.cached.sampleCount != result.channels[0].size()) {
+        // Длина разошлась — запись не про этот файл: анализируем по сигналу
+        result.cacheHit = false;
+        result.cached = AnalysisCacheEntry();
+    }
+    if (callbacks.onDecoded) {
+        callbacks.onDecoded(result.channels, result.sampleRate);
+    }
+
+    const bool onsetsComplete = onsets && onsets->sampleCount() == result.channels[0].size();
+    if (onsetsComplete) {
+        result.downbeatSignal = onsets->decimated();
+    }
+    if (result.cacheHit) {
+        result.analysis = result.cached.beats;
+        // Карта темпа в кеше не хранится — она целиком выводится из долей
+        result.analysis.tempoMap = BPMAnalyzer::buildTempoMap(result.analysis, result.sampleRate);
+    } else {
+        BPMAnalyzer::AnalysisOptions analysisOptions = options;
+        analysisOptions.cancel = cancel;
+        analysisOptions.onProgress = [&report](int percent) {
+            report(Stage::Analyzing,
+                   kDecodedPercent + percent * (kAnalyzedPercent - kDecodedPercent) / 100);
+        };
+        // Запись кеша отброшена по длине — onset-функция уже оборвана
+        if (onsetsComplete && onsets->isDetecting()) {
+            result.analysis = BPMAnalyzer::analyzeOnsetStream(*onsets, analysisOptions);
+        } else {
+            result.analysis = BPMAnalyzer::analyzeBPM(AudioFileService::toMono(result.channels),
+                                                      result.sampleRate, analysisOptions);
+        }
+    }
+    onsets.reset();
+    if (isCancelled(cancel)) {
+        result.cancelled = true;
+        return result;
+    }
+
+    // Отклонения — по той же сетке, что получит волна: при плавающем темпе по карте
+    report(Stage::Deviations, kAnalyzedPercent);
+    BPMAnalyzer::AnalysisResult& analysis = result.analysis;
+    if (analysis.bpm > 0.0f && !analysis.beats.isEmpty()) {
+        if (analysis.tempoMap.isVariable()) {
+            result.deviations =
+                BPMAnalyzer::calculateDeviations(analysis.beats, analysis.tempoMap, result.sampleRate);
+        } else {
+            BPMAnalyzer::DeviationOptions deviationOptions;
+            deviationOptions.gridStartSample = analysis.gridStartSample;
+            result.deviations = BPMAnalyzer::calculateDeviations(analysis.beats, analysis.bpm,
+                                                                 result.sampleRate, deviationOptions);
+        }
+    }
+    report(Stage::Deviations, 100);
+
+    result.ok = true;
+    return result;
+}
+
+} // namespace LoadPipeline
@@ -10,9 +10,11 @@
 #include <QLoggingCategory>
 #include <QFileInfo>
 #include <iostream>
+#include <memory>
 #include "../include/mainwindow.h"
 #include "../include/bpmanalyzer.h"
 #include "../include/audiofileservice.h"
+#include "../include/onsetstream.h"
 #include <QStyleFactory>
 
 Q_LOGGING_CATEGORY(lcStartup, "dontfloat.startup")
@@ -60,9 +62,11 @@ void configureStartupLogging(bool verbose)
 }
 
 // Декодирует аудиофайл в моно-сигнал для анализа BPM (консольный режим).
-bool loadAudioFile(const QString& filePath, QVector<float>& samples, int& sampleRate)
+// \a onBlock получает блоки по ходу декодирования (см. AudioFileService::decode).
+bool loadAudioFile(const QString& filePath, QVector<float>& samples, int& sampleRate,
+                   const AudioFileService::BlockCallback& onBlock = {})
 {
-    const AudioFileService::DecodeResult res = AudioFileService::decode(filePath);
+    const AudioFileService::DecodeResult res = AudioFileService::decode(filePath, {}, onBlock);
     if (!res.ok) {
         if (!res.error.isEmpty())
             std::cout << "ОШИБКА декодирования: " << res.error.toStdString() << std::endl;
@@ -89,7 +93,21 @@ int runConsoleMode(const QString& filePath, const BPMAnalyzer::AnalysisOptions&
     QVector<float> samples;
     int sampleRate = 0;
 
-    if (!loadAudioFile(filePath, samples, sampleRate)) {
+    // Onset-функция Mixxx набирается по ходу декодирования из того же моно-сведения
+    std::unique_ptr<OnsetStream> onsets;
+    AudioFileService::BlockCallback onBlock;
+    if (options.useMixxxAlgorithm) {
+        onBlock = [&onsets](int rate, const float* left, const float* right, int frames) {
+            if (!onsets && rate > 0) {
+                onsets = std::make_unique<OnsetStream>(rate);
+            }
+            if (onsets) {
+                onsets->push(left, right, frames);
+            }
+        };
+    }
+
+    if (!loadAudioFile(filePath, samples, sampleRate, onBlock)) {
         std::cout << "ОШИБКА: Не удалось загрузить аудиофайл" << std::endl;
         return 1;
     }
@@ -108,7 +126,9 @@ int runConsoleMode(const QString& filePath, const BPMAnalyzer::AnalysisOptions&
 
     std::cout << std::endl << "Начинаем анализ BPM..." << std::endl;
 
-    const BPMAnalyzer::AnalysisResult result = BPMAnalyzer::analyzeBPM(samples, sampleRate, options);
+    const BPMAnalyzer::AnalysisResult result = (onsets && onsets->sampleCount() == samples.size())
+        ? BPMAnalyzer::analyzeOnsetStream(*onsets, options)
+        : BPMAnalyzer::analyzeBPM(samples, sampleRate, options);
 
     std::cout << std::endl << "=== РЕЗУЛЬТАТЫ АНАЛИЗА ===" << std::endl;
     std::cout << "Определенный BPM: " << result.bpm << std::endl;
@@ -31,6 +31,7 @@
 #include <QtGui/QDropEvent>
 #include <QtCore/QMimeData>
 #include <QtWidgets/QScrollBar>
+#include <QtWidgets/QSlider>
 #include <QtWidgets/QCheckBox>
 #include <QtWidgets/QComboBox>
 #include <QtWidgets/QProgressBar>
@@ -59,6 +60,7 @@
 #include "../include/timeutils.h"
 #include "../include/wavwriter.h"
 #include "../include/audiofileservice.h"
+#include "../include/loadpipeline.h"
 #include <QUndoStack>
 #include <QtGui/QShortcut>
 #include <QtWidgets/QDialogButtonBox>
@@ -98,6 +100,32 @@ static bool loadTranslation(QTranslator *translator, const QString &name)
 
 namespace {
 
+/**
+ * Настройки анализа при загрузке файла: по умолчанию BPMAnalyzer (Mixxx,
+ * 60–200 BPM, δ 5 %), сильная доля — в размере \a beatsPerBar. По ним же
+ * ключ записи в кеше (AnalysisCache::optionsKey).
+ */
+BPMAnalyzer::AnalysisOptions loadAnalysisOptions(int beatsPerBar)
+{
+    BPMAnalyzer::AnalysisOptions options;
+    options.beatsPerBar = beatsPerBar;
+    return options;
+}
+
+/** Подпись этапа загрузки файла в диалоге (см. LoadPipeline). */
+QString loadStageText(LoadPipeline::Stage stage)
+{
+    switch (stage) {
+    case LoadPipeline::Stage::Decoding:
+        return MainWindow::tr("Loading audio...");
+    case LoadPipeline::Stage::Analyzing:
+        return MainWindow::tr("Audio analysis...");
+    case LoadPipeline::Stage::Deviations:
+        return MainWindow::tr("Checking beats...");
+    }
+    return QString();
+}
+
 void alignWaveformViewToBarGrid(WaveformView *waveformView, float bpm, int beatsPerBar, qint64 gridStartSample)
 {
     if (!waveformView || bpm <= 0.f)
@@ -173,6 +201,19 @@ qint64 mapSampleFromTimeline(qint64 sample, QVector<Marker> markers)
     return sample + (markers.last().originalPosition - markers.last().position);
 }
 
+/** Тональность трека по итогам потактового анализа (основная + модуляция). */
+KeyAnalyzer::AnalysisResult trackKeyFromPerBar(const KeyAnalyzer::PerBarKeyResult& perBar)
+{
+    KeyAnalyzer::AnalysisResult key;
+    key.primaryKey = perBar.primaryKey;
+    key.overallConfidence = perBar.primaryKey.confidence;
+    key.hasKeyChange = perBar.hasModulation;
+    if (perBar.hasModulation) {
+        key.secondaryKey = KeyAnalyzer::dominantModulationKey(perBar, perBar.primaryKey.key);
+    }
+    return key;
+}
+
 /** Warp координат нот через метки: ноты остаются в порядке исходного вектора. */
 QVector<PitchDetector::PitchNote> warpNotesThroughMarkers(
     const QVector<PitchDetector::PitchNote>& notes, QVector<Marker> markers)
@@ -550,6 +591,9 @@ void MainWindow::prepareShutdown()
         notePreviewPlayer->stop();
     }
 
+    // Загрузка файла в фоне: рабочий поток остановится на ближайшей проверке флага
+    cancelAudioLoad();
+
     // Инвалидируем фоновый preview; не ждём пул (может быть длинный PitchCorrection).
     ++markerPreviewEpoch;
     if (markerPreviewRunning) {
@@ -868,6 +912,7 @@ void MainWindow::setupConnections()
             pitchGridWidget->setBeatsPerBar(bpb);
             pitchGridWidget->update();
         }
+        rebinKeyBars();
         updateTimeLabel(mediaPlayer ? mediaPlayer->position() : currentPosition);
         QString text = ui->barsCombo->currentText();
         statusBar()->showMessage(tr("Time signature set to %1").arg(text), 2000);
@@ -948,6 +993,7 @@ void MainWindow::setupConnections()
             if (pitchGridWidget) {
                 pitchGridWidget->setGridStartSample(sample);
             }
+            rebinKeyBars();
             updateTimeLabel(mediaPlayer ? mediaPlayer->position() : currentPosition);
         });
 
@@ -1221,10 +1267,19 @@ void MainWindow::updateBPM()
     bool ok;
     float bpm = ui->bpmEdit->text().toFloat(&ok);
     if (ok && bpm > 0.0f && bpm <= 9999.99f) {
+        // Введённый вручную BPM — ровная сетка: найденная карта темпа сбрасывается,
+        // если пользователь его действительно поменял (в поле BPM — два знака)
+        const bool tempoChanged = std::abs(bpm - waveformView->getBPM()) >= 0.005f;
         waveformView->setBPM(bpm);
+        if (tempoChanged) {
+            waveformView->setTempoMap(TempoMap());
+        }
         // Синхронизируем BPM с PitchGridWidget
         if (pitchGridWidget) {
             pitchGridWidget->setBPM(bpm);
+            if (tempoChanged) {
+                pitchGridWidget->setTempoMap(TempoMap());
+            }
         }
         // Обновляем BPM в метрономе
         if (metronomeController) {
@@ -1235,6 +1290,9 @@ void MainWindow::updateBPM()
         if (pitchGridWidget) {
             pitchGridWidget->update();
         }
+        if (tempoChanged) {
+            rebinKeyBars();
+        }
         statusBar()->showMessage(tr("BPM set to: %1").arg(bpm), 2000);
     } else {
         ui->bpmEdit->setText("120.00");
@@ -1819,6 +1877,7 @@ void MainWindow::resetAudioState()
     // Сброс второй тональности — поле модуляции покажется только после анализа
     setKey2(QString());
     lastPerBarKey = KeyAnalyzer::PerBarKeyResult();
+    keyChromaFrames.reset();
     if (keyModulationStrip) {
         keyModulationStrip->clearRegions();
     }
@@ -1856,62 +1915,280 @@ void MainWindow::openAudioFile()
 
 void MainWindow::processAudioFile(const QString& filePath)
 {
-    setEnabled(false);
-    QApplication::processEvents();
-
-    LoadFileDialog dialog(this, BPMAnalyzer::AnalysisResult());
-    dialog.setWindowTitle(tr("Analysis and Beat Alignment"));
-    dialog.setWindowModality(Qt::ApplicationModal);
-    dialog.updateProgress(tr("Loading audio..."), 10);
-    dialog.show();
-    dialog.raise();
-    dialog.activateWindow();
-    QApplication::processEvents();
-
-    bool loadOk = false;
-    const QVector<QVector<float>> audioData = loadAudioFile(filePath, &loadOk,
-        [this, &dialog](int percent) {
-            // Декодирование занимает «нижнюю» часть прогресс-бара (10..45 %).
-            dialog.updateProgress(tr("Loading audio..."), 10 + (percent * 35) / 100);
-        });
-    if (!loadOk || audioData.isEmpty()) {
-        dialog.close();
-        setEnabled(true);
-        statusBar()->showMessage(tr("File load error"), 3000);
+    // Прежняя загрузка, если ещё идёт, больше не нужна
+    cancelAudioLoad();
+    const qint64 epoch = loadEpoch;
+    auto cancel = std::make_shared<std::atomic<bool>>(false);
+    loadCancel = cancel;
+
+    // Окно не блокируется: пока файл декодируется и анализируется, диалог только
+    // показывает ход загрузки, а решение «выровнять/пропустить» спросит по готовности
+    loadDialog = new LoadFileDialog(this, BPMAnalyzer::AnalysisResult());
+    loadDialog->setWindowTitle(tr("Analysis and Beat Alignment"));
+    loadDialog->updateProgress(tr("Loading audio..."), 0);
+    loadDialog->show();
+
+    // Сильная доля ищется в размере, выбранном сейчас в окне
+    loadBeatsPerBar = waveformView ? qMax(1, waveformView->getBeatsPerBar()) : 4;
+    const BPMAnalyzer::AnalysisOptions analysisOptions = loadAnalysisOptions(loadBeatsPerBar);
+    const AnalysisCache cache = analysisCache;
+    // QPointer: окно могли закрыть, пока идёт загрузка.
+    const QPointer<MainWindow> self(this);
+
+    (void)QtConcurrent::run([self, epoch, filePath, analysisOptions, cache, cancel]() {
+        LoadPipeline::Callbacks callbacks;
+        callbacks.onProgress = [self, epoch](LoadPipeline::Stage stage, int percent) {
+            if (!self) {
+                return;
+            }
+            QMetaObject::invokeMethod(self, [self, epoch, stage, percent]() {
+                if (self && epoch == self->loadEpoch && self->loadDialog) {
+                    self->loadDialog->updateProgress(loadStageText(stage), percent);
+                }
+            }, Qt::QueuedConnection);
+        };
+        callbacks.onDecoded = [self, epoch](const QVector<QVector<float>>& channels, int sampleRate) {
+            if (!self) {
+                return;
+            }
+            QMetaObject::invokeMethod(self, [self, epoch, channels, sampleRate]() {
+                if (self && epoch == self->loadEpoch) {
+                    self->showDecodedAudio(channels, sampleRate);
+                }
+            }, Qt::QueuedConnection);
+        };
+
+        callbacks.onCached = [self, epoch](const AnalysisCacheEntry& entry) {
+            if (!self) {
+                return;
+            }
+            // Карта темпа в кеше не хранится — строится здесь, не в UI-потоке
+            auto cached = std::make_shared<AnalysisCacheEntry>(entry);
+            cached->beats.tempoMap = BPMAnalyzer::buildTempoMap(cached->beats, cached->sampleRate);
+            QMetaObject::invokeMethod(self, [self, epoch, cached]() {
+                if (self && epoch == self->loadEpoch) {
+                    self->loadCachedEntry = cached;
+                }
+            }, Qt::QueuedConnection);
+        };
+
+        auto result = std::make_shared<LoadPipeline::Result>(
+            LoadPipeline::run(filePath, analysisOptions, &cache, cancel.get(), callbacks));
+
+        if (!self) {
+            return;
+        }
+        // Без QFutureWatcher::result() — только QueuedConnection в UI-поток.
+        QMetaObject::invokeMethod(self, [self, epoch, result]() {
+            if (self) {
+                self->finishAudioLoad(epoch, result);
+            }
+        }, Qt::QueuedConnection);
+    });
+}
+
+void MainWindow::cancelAudioLoad()
+{
+    ++loadEpoch;
+    loadCachedEntry.reset();
+    if (loadCancel) {
+        loadCancel->store(true);
+        loadCancel.reset();
+    }
+    if (loadDialog) {
+        disconnect(loadDialog.data(), nullptr, this, nullptr);
+        loadDialog->close();
+        loadDialog->deleteLater();
+        loadDialog = nullptr;
+    }
+}
+
+void MainWindow::showDecodedAudio(const QVector<QVector<float>>& channels, int sampleRate)
+{
+    if (!waveformView || channels.isEmpty()) {
+        return;
+    }
+
+    // Сохраняем нативную частоту дискретизации для всего пайплайна.
+    if (sampleRate > 0) {
+        waveformView->setSampleRate(sampleRate);
+    }
+    waveformView->setAudioData(channels);
+    // Доли прошлого файла к новой волне не относятся — свои придут с анализом
+    waveformView->setBeatInfo(QVector<BPMAnalyzer::BeatInfo>());
+    waveformView->setTempoMap(TempoMap());
+    waveformView->update();
+
+    if (pitchGridWidget) {
+        pitchGridWidget->setAudioData(channels);
+        pitchGridWidget->setSampleRate(waveformView->getSampleRate());
+        pitchGridWidget->setTempoMap(TempoMap());
+        pitchGridWidget->update();
+    }
+
+    // Анализ уже нашёлся в кеше — доли и пики встают вместе с волной. Длина та
+    // же, что сверяет LoadPipeline: чужая запись сюда не попадает
+    if (loadCachedEntry && loadCachedEntry->sampleRate == sampleRate
+        && loadCachedEntry->sampleCount == channels[0].size()) {
+        updateUIAfterAnalysis(loadCachedEntry->beats, loadBeatsPerBar);
+        waveformView->adoptSourcePeaks(loadCachedEntry->peaks);
+    }
+
+    updateTimeLabel(0);
+    updateHorizontalScrollBar(waveformView->getZoomLevel());
+}
+
+void MainWindow::finishAudioLoad(qint64 epoch, const std::shared_ptr<LoadPipeline::Result>& result)
+{
+    if (epoch != loadEpoch || !result) {
+        return;
+    }
+    loadCancel.reset();
+    loadCachedEntry.reset();
+
+    const QPointer<LoadFileDialog> dialog = loadDialog;
+    if (!result->ok) {
+        if (dialog) {
+            dialog->close();
+            dialog->deleteLater();
+        }
+        loadDialog = nullptr;
+        if (!result->cancelled) {
+            statusBar()->showMessage(result->error.isEmpty()
+                                         ? tr("File load error")
+                                         : tr("Decode error: %1").arg(result->error),
+                                     3000);
+        }
         return;
     }
 
-    // Параметры совпадают с BPMAnalyzer::AnalysisOptions по умолчанию (Mixxx, 60–200 BPM, δ 5 %)
-    const BPMAnalyzer::AnalysisOptions analysisOptions;
+    currentContentHash = result->contentHash;
 
-    dialog.updateProgress(tr("Audio analysis..."), 50);
-    const BPMAnalyzer::AnalysisResult analysis =
-        BPMAnalyzer::analyzeBPM(audioData[0], waveformView->getSampleRate(), analysisOptions);
+    // Доли на волне сразу, ещё до решения в диалоге. Пики сбросил setAudioData
+    // в showDecodedAudio — готовая пирамида из кеша ставится поверх
+    updateUIAfterAnalysis(result->analysis, loadBeatsPerBar);
+    if (result->cacheHit) {
+        waveformView->adoptSourcePeaks(result->cached.peaks);
+    }
 
-    dialog.updateProgress(tr("Analysis completed."), 100);
-    dialog.showResult(analysis);
-    dialog.setBeatsPerBar(4);
+    if (!dialog) {
+        completeAudioLoad(*result, false, false, loadBeatsPerBar);
+        return;
+    }
 
-    updateUIAfterAnalysis(audioData, analysis, dialog.getBeatsPerBar());
+    dialog->updateProgress(tr("Analysis completed."), 100);
+    dialog->showResult(result->analysis);
+    dialog->setBeatsPerBar(loadBeatsPerBar);
 
-    const bool accepted = (dialog.exec() == QDialog::Accepted);
-    const int beatsPerBar = dialog.getBeatsPerBar();
+    connect(dialog.data(), &QDialog::finished, this, [this, epoch, result, dialog](int code) {
+        if (!dialog) {
+            return;
+        }
+        const bool fixBeats = (code == QDialog::Accepted) && dialog->shouldFixBeats();
+        const bool keepMarkers = dialog->keepMarkersOnSkip();
+        const int beatsPerBar = dialog->getBeatsPerBar();
+        dialog->deleteLater();
+        if (loadDialog.data() == dialog.data()) {
+            loadDialog = nullptr;
+        }
+        if (epoch == loadEpoch) {
+            completeAudioLoad(*result, fixBeats, keepMarkers, beatsPerBar);
+        }
+    });
 
-    updateUIAfterAnalysis(audioData, analysis, beatsPerBar);
+    // Ответ нужен до правок: диалог становится модальным для окна, но только
+    // теперь — пока шла загрузка, окно оставалось доступным
+    dialog->hide();
+    dialog->setWindowModality(Qt::WindowModal);
+    dialog->open();
+}
+
+void MainWindow::completeAudioLoad(const LoadPipeline::Result& result,
+                                   bool fixBeats,
+                                   bool keepMarkers,
+                                   int beatsPerBar)
+{
+    BPMAnalyzer::AnalysisResult analysis = result.analysis;
+    if (beatsPerBar != loadBeatsPerBar) {
+        // Сильная доля искалась в размере loadBeatsPerBar, в диалоге выбран
+        // другой: ищем её заново по тем же долям и прорежённому сигналу
+        analysis.barPhase = BPMAnalyzer::findBarPhase(result.downbeatSignal, result.sampleRate,
+                                                      analysis, beatsPerBar);
+    }
+    updateUIAfterAnalysis(analysis, beatsPerBar);
+
+    const QVector<QVector<float>>& source = waveformView->getSourceAudioData();
+    currentContentSource = source.isEmpty() ? nullptr : source[0].constData();
+    // Запись кеша — с ключом того размера, в котором найдена сильная доля
+    if (!result.cacheHit || beatsPerBar != loadBeatsPerBar) {
+        storeLoadedAnalysis(analysis, beatsPerBar);
+    }
 
-    if (accepted && dialog.shouldFixBeats()) {
-        createDeviationMarkers(analysisOptions.tolerancePercent);
-    } else if (dialog.keepMarkersOnSkip()) {
-        createDeviationMarkers(analysisOptions.tolerancePercent, true);
+    const float tolerancePercent = BPMAnalyzer::AnalysisOptions().tolerancePercent;
+    if (fixBeats) {
+        createDeviationMarkers(tolerancePercent);
+    } else if (keepMarkers) {
+        createDeviationMarkers(tolerancePercent, true);
     }
 
-    alignWaveformViewToBarGrid(waveformView, analysis.bpm, beatsPerBar, analysis.gridStartSample);
+    alignWaveformViewToBarGrid(waveformView, analysis.bpm, beatsPerBar,
+                               BPMAnalyzer::barStartSample(analysis, waveformView->getSampleRate()));
 
     updateTimeLabel(0);
     updateHorizontalScrollBar(waveformView->getZoomLevel());
     resetLoopStateAfterNewFile();
-    setEnabled(true);
-    showPitchGridAnalyzeOverlay();
+    if (!result.cacheHit || !result.cached.hasPitchAnalysis || !restoreCachedPitchAnalysis(result.cached)) {
+        showPitchGridAnalyzeOverlay();
+    }
+}
+
+bool MainWindow::isSourceAudioFromFile() const
+{
+    // Правки (выравнивание долей и т.п.) заменяют буфер исходного аудио целиком
+    const QVector<QVector<float>>& source = waveformView->getSourceAudioData();
+    return !currentContentHash.isEmpty() && !source.isEmpty()
+        && source[0].constData() == currentContentSource;
+}
+
+void MainWindow::storeLoadedAnalysis(const BPMAnalyzer::AnalysisResult& analysis, int beatsPerBar)
+{
+    if (!isSourceAudioFromFile()) {
+        return;
+    }
+    const QVector<QVector<float>>& source = waveformView->getSourceAudioData();
+    AnalysisCacheEntry entry;
+    entry.sampleRate = waveformView->getSampleRate();
+    entry.channelCount = source.size();
+    entry.sampleCount = source[0].size();
+    // Пирамида всё равно нужна для первой отрисовки — в кеш идёт копия
+    if (const WaveformPeaks* peaks = waveformView->sourcePeaks()) {
+        entry.peaks = *peaks;
+    }
+    entry.hasBeats = true;
+    entry.beats = analysis;
+    entry.beatsOptionsKey = AnalysisCache::optionsKey(loadAnalysisOptions(beatsPerBar));
+
+    AnalysisCache cache = analysisCache;
+    (void)QtConcurrent::run([cache, hash = currentContentHash, entry]() mutable {
+        cache.store(hash, entry);
+    });
+}
+
+bool MainWindow::restoreCachedPitchAnalysis(const AnalysisCacheEntry& cached)
+{
+    // Такты режутся по сетке: другая сетка — другие тональности тактов
+    if (cached.keyGrid.bpm != waveformView->getBPM()
+        || cached.keyGrid.beatsPerBar != waveformView->getBeatsPerBar()
+        || cached.keyGrid.gridStartSample != waveformView->getGridStartSample()) {
+        return false;
+    }
+    applyPerBarKeyResult(cached.perBarKey, trackKeyFromPerBar(cached.perBarKey));
+    // Кадров хромы в кеше нет: сменится сетка — такты пересчитает новый анализ
+    keyChromaFrames.reset();
+    basePitchNotes = cached.notes;
+    refreshPitchGridNotes();
+    hidePitchGridAnalyzeOverlay();
+    return true;
 }
 
 void MainWindow::resetLoopStateAfterNewFile()
@@ -1925,31 +2202,6 @@ void MainWindow::resetLoopStateAfterNewFile()
     ui->loopButton->setChecked(false);
 }
 
-QVector<QVector<float>> MainWindow::loadAudioFile(const QString& filePath,
-                                                  bool* ok,
-                                                  const std::function<void(int)>& onProgress)
-{
-    if (ok)
-        *ok = false;
-
-    // Декодирование вынесено в AudioFileService (нативный формат, без ресемплинга).
-    const AudioFileService::DecodeResult res = AudioFileService::decode(filePath, onProgress);
-
-    if (!res.ok) {
-        if (!res.error.isEmpty())
-            statusBar()->showMessage(tr("Decode error: %1").arg(res.error), 3000);
-        return {};
-    }
-
-    // Сохраняем нативную частоту дискретизации для всего пайплайна.
-    if (waveformView && res.sampleRate > 0)
-        waveformView->setSampleRate(res.sampleRate);
-
-    if (ok)
-        *ok = true;
-    return res.channels;
-}
-
 void MainWindow::saveAudioFile()
 {
     doSaveAudioFile();
@@ -2536,11 +2788,30 @@ void MainWindow::createDeviationMarkers(float tolerancePercent, bool neutralMark
         return;
     }
 
-    // Вычисляем отклонения относительно той же сетки, что нарисована на волне:
-    // иначе ожидаемые позиции меток разойдутся с видимыми линиями тактов.
-    BPMAnalyzer::DeviationOptions deviationOptions;
-    deviationOptions.gridStartSample = waveformView->getGridStartSample();
-    BPMAnalyzer::calculateDeviations(beats, bpm, sampleRate, deviationOptions);
+    // Отклонения — относительно той же сетки, что нарисована на волне: иначе
+    // ожидаемые позиции меток разойдутся с видимыми линиями тактов. Волна держит
+    // их посчитанными (при переменном темпе — по карте) и сдвигает вместе с сеткой.
+    const DeviationModel& deviationModel = waveformView->getDeviationModel();
+    if (deviationModel.isEvaluated() && deviationModel.size() == beats.size()) {
+        deviationModel.writeTo(beats);
+    } else {
+        // Модель не посчитана под эти доли — считаем здесь по той же сетке,
+        // что и WaveformView::refreshDeviations
+        const TempoMap& tempoMap = waveformView->getTempoMap();
+        BPMAnalyzer::DeviationStats stats;
+        if (tempoMap.isVariable()) {
+            stats = BPMAnalyzer::calculateDeviations(beats, tempoMap, sampleRate);
+        } else {
+            BPMAnalyzer::DeviationOptions deviationOptions;
+            deviationOptions.gridStartSample = waveformView->getGridStartSample();
+            stats = BPMAnalyzer::calculateDeviations(beats, bpm, sampleRate, deviationOptions);
+        }
+        if (stats.beatCount != beats.size()) {
+            // Сетка мельче сэмпла (BPM вне разумного) — отклонения не измерить
+            statusBar()->showMessage(tr("Cannot measure beat deviations on this grid"), 3000);
+            return;
+        }
+    }
 
     // Находим неровные доли
     float deviationThreshold = tolerancePercent / 100.0f; // Преобразуем проценты в доли
@@ -2729,26 +3000,37 @@ void MainWindow::startPitchAnalysis()
     // QPointer: окно могли закрыть, пока крутится пул потоков.
     const QPointer<MainWindow> self(this);
 
-    (void)QtConcurrent::run([self, epoch, mono, sampleRate, progress, barGrid, pending]() {
+    // Результат ляжет в кеш анализа, только если анализировался сам файл, а не правка
+    const QByteArray cacheHash = isSourceAudioFromFile() ? currentContentHash : QByteArray();
+    AnalysisCache cache = analysisCache;
+
+    const KeyAnalyzer::AnalysisOptions keyOptions = keyAnalysisOptions;
+    (void)QtConcurrent::run([self, epoch, mono, sampleRate, progress, barGrid, keyOptions, pending,
+                             cacheHash, cache]() mutable {
         bool ok = false;
         try {
             progress->store(2);
-            pending->perBarKey = KeyAnalyzer::analyzeKeyPerBar(mono, sampleRate, barGrid);
+            pending->chromaFrames = std::make_shared<const KeyAnalyzer::ChromaFrames>(
+                KeyAnalyzer::computeChromaFrames(mono, sampleRate));
+            pending->perBarKey =
+                KeyAnalyzer::analyzeKeyPerBar(*pending->chromaFrames, barGrid, keyOptions);
             progress->store(12);
-            pending->key.primaryKey = pending->perBarKey.primaryKey;
-            pending->key.overallConfidence = pending->perBarKey.primaryKey.confidence;
-            pending->key.hasKeyChange = pending->perBarKey.hasModulation;
-            if (pending->perBarKey.hasModulation) {
-                pending->key.secondaryKey =
-                    KeyAnalyzer::dominantModulationKey(
-                        pending->perBarKey, pending->perBarKey.primaryKey.key);
-            }
+            pending->key = trackKeyFromPerBar(pending->perBarKey);
             progress->store(15);
             pending->notes = PitchDetector::detectNotes(
                 mono, sampleRate, PitchDetector::Options(),
                 [progress](int pct) { progress->store(15 + pct * 85 / 100); });
             progress->store(100);
             ok = true;
+
+            AnalysisCacheEntry entry;
+            if (!cacheHash.isEmpty() && cache.load(cacheHash, entry)) {
+                entry.hasPitchAnalysis = true;
+                entry.keyGrid = barGrid;
+                entry.perBarKey = pending->perBarKey;
+                entry.notes = pending->notes;
+                cache.store(cacheHash, entry);
+            }
         } catch (const std::exception& e) {
             qWarning() << "Pitch analysis failed:" << e.what();
         } catch (...) {
@@ -2786,6 +3068,7 @@ void MainWindow::finishPitchAnalysis(qint64 epoch, bool ok,
         return;
     }
 
+    keyChromaFrames = pending->chromaFrames;
     applyPerBarKeyResult(pending->perBarKey, pending->key);
 
     QString keysText = currentKey;
@@ -2995,6 +3278,10 @@ void MainWindow::applyPitchCorrection()
     const int sampleRate = waveformView->getSampleRate();
     const QVector<PitchDetector::PitchNote> notes =
         warpNotesThroughMarkers(basePitchNotes, waveformView->getMarkers());
+    // Вне нот аудио остаётся прежним — пирамида пиков правится только на них
+    const QPair<qint64, qint64> edited = PitchCorrection::editedRange(notes, baseData[0].size());
+    const WaveformView::SourceEdit sourceEdit { edited.first, edited.second,
+                                                waveformView->sourceGeneration() };
 
     statusBar()->showMessage(tr("Applying note pitch correction..."), 0);
     setEnabled(false);
@@ -3003,12 +3290,12 @@ void MainWindow::applyPitchCorrection()
     auto newDataBox = std::make_shared<QVector<QVector<float>>>();
     const QPointer<MainWindow> self(this);
 
-    (void)QtConcurrent::run([self, baseData, notes, sampleRate, newDataBox, oldData]() {
+    (void)QtConcurrent::run([self, baseData, notes, sampleRate, newDataBox, oldData, sourceEdit]() {
         *newDataBox = PitchCorrection::apply(baseData, notes, sampleRate);
         if (!self) {
             return;
         }
-        QMetaObject::invokeMethod(self, [self, newDataBox, oldData]() {
+        QMetaObject::invokeMethod(self, [self, newDataBox, oldData, sourceEdit]() {
             if (!self) {
                 return;
             }
@@ -3021,9 +3308,11 @@ void MainWindow::applyPitchCorrection()
             }
 
             const QVector<Marker> markers = self->waveformView->getMarkers();
-            self->undoStack->push(new TimeStretchCommand(
+            auto* command = new TimeStretchCommand(
                 self->waveformView, oldData, newData, markers, markers,
-                self->tr("Apply note pitch correction")));
+                self->tr("Apply note pitch correction"));
+            command->setSourceEdit(sourceEdit);
+            self->undoStack->push(command);
 
             for (PitchDetector::PitchNote& note : self->basePitchNotes) {
                 note.detectedPitch = note.midiPitch;
@@ -3061,14 +3350,17 @@ void MainWindow::analyzeKey()
     setEnabled(false);
 
     using KeyOutcome = QPair<KeyAnalyzer::AnalysisResult, KeyAnalyzer::PerBarKeyResult>;
+    // Кадры хромы остаются окну: по ним такты пересчитываются при смене сетки
+    auto frames = std::make_shared<KeyAnalyzer::ChromaFrames>();
     auto* watcher = new QFutureWatcher<KeyOutcome>(this);
     connect(watcher, &QFutureWatcher<KeyOutcome>::finished, this,
-            [this, watcher]() {
+            [this, watcher, frames]() {
         const KeyOutcome outcome = watcher->result();
         const KeyAnalyzer::AnalysisResult result = outcome.first;
         const KeyAnalyzer::PerBarKeyResult perBar = outcome.second;
         setEnabled(true);
 
+        keyChromaFrames = frames;
         applyPerBarKeyResult(perBar, result);
 
         QString keysText = currentKey;
@@ -3080,12 +3372,31 @@ void MainWindow::analyzeKey()
         watcher->deleteLater();
     });
 
-    watcher->setFuture(QtConcurrent::run([samples, sampleRate, barGrid]() {
-        return qMakePair(KeyAnalyzer::analyzeKey(samples, sampleRate),
-                         KeyAnalyzer::analyzeKeyPerBar(samples, sampleRate, barGrid));
+    const KeyAnalyzer::AnalysisOptions options = keyAnalysisOptions;
+    watcher->setFuture(QtConcurrent::run([samples, sampleRate, barGrid, options, frames]() {
+        // Один проход по звуку: тональность трека и такты — из одних кадров
+        *frames = KeyAnalyzer::computeChromaFrames(samples, sampleRate);
+        return qMakePair(KeyAnalyzer::analyzeKey(*frames, options),
+                         KeyAnalyzer::analyzeKeyPerBar(*frames, barGrid, options));
     }));
 }
 
+void MainWindow::rebinKeyBars()
+{
+    if (!keyChromaFrames || !waveformView || lastPerBarKey.bars.isEmpty()) {
+        return;
+    }
+    KeyAnalyzer::BarGrid barGrid;
+    barGrid.bpm = waveformView->getBPM();
+    barGrid.beatsPerBar = waveformView->getBeatsPerBar();
+    barGrid.gridStartSample = waveformView->getGridStartSample();
+    // Только суммы по готовым кадрам и Витерби по тактам — доли миллисекунды,
+    // можно прямо в UI-потоке, в том числе на каждый шаг ползунка сглаживания
+    const KeyAnalyzer::PerBarKeyResult perBar =
+        KeyAnalyzer::analyzeKeyPerBar(*keyChromaFrames, barGrid, keyAnalysisOptions);
+    applyPerBarKeyResult(perBar, trackKeyFromPerBar(perBar));
+}
+
 void MainWindow::showKeyContextMenu(const QPoint& pos)
 {
     if (keyMenu)
@@ -3129,6 +3440,22 @@ void MainWindow::setupKeyModulationStrip()
         connect(keyModulationStrip, &KeyModulationStrip::fieldMenuRequested,
                 this, &MainWindow::onKeyModulationFieldMenu);
     }
+
+    // Сглаживание смен тональности: цена смены в decodeKeyPath. Такты
+    // пересобираются из кадров хромы на каждом шаге ползунка
+    if (!keyChangePenaltySlider && ui->keyInputLayout) {
+        keyChangePenaltySlider = new QSlider(Qt::Horizontal, ui->keyInputContainer);
+        keyChangePenaltySlider->setRange(0, 200);
+        keyChangePenaltySlider->setValue(qRound(keyAnalysisOptions.keyChangePenalty * 100.0f));
+        keyChangePenaltySlider->setFixedWidth(72);
+        keyChangePenaltySlider->setToolTip(
+            tr("Key change smoothing: higher values merge short modulations into the surrounding key"));
+        ui->keyInputLayout->addWidget(keyChangePenaltySlider);
+        connect(keyChangePenaltySlider, &QSlider::valueChanged, this, [this](int value) {
+            keyAnalysisOptions.keyChangePenalty = float(value) / 100.0f;
+            rebinKeyBars();
+        });
+    }
     syncKeyModulationStripFromWaveform();
 }
 
@@ -3585,6 +3912,9 @@ void MainWindow::exportNotesToMidi()
     // Ноты живут в координатах исходного аудио — нулём файла делаем начало
     // тактовой сетки, чтобы доли в DAW совпали с сеткой DONTFLOAT
     options.startSample = waveformView ? waveformView->getGridStartSample() : 0;
+    if (waveformView) {
+        options.tempoMap = waveformView->getTempoMap();
+    }
 
     QString error;
     if (!MidiExporter::writeFile(path, basePitchNotes, options, &error)) {
@@ -4359,16 +4689,20 @@ void MainWindow::setBPMAndBeatsPerBar(float bpm, int beatsPerBar)
     }
 }
 
-void MainWindow::updateUIAfterAnalysis(const QVector<QVector<float>>& audioData,
-                                       const BPMAnalyzer::AnalysisResult& analysis,
+void MainWindow::updateUIAfterAnalysis(const BPMAnalyzer::AnalysisResult& analysis,
                                        int beatsPerBar)
 {
     if (!waveformView) return;
 
-    waveformView->setAudioData(audioData);
+    // Аудио уже на волне (showDecodedAudio) — здесь только доли и сетка.
+    // Сетка начинается с сильной доли: такты на волне и в питч-сетке — от неё
+    const qint64 barStart = BPMAnalyzer::barStartSample(analysis, waveformView->getSampleRate());
+    TempoMap tempoMap = analysis.tempoMap;
+    tempoMap.rebase(barStart);
     waveformView->setBeatInfo(analysis.beats);
-    waveformView->setGridStartSample(analysis.gridStartSample);
+    waveformView->setGridStartSample(barStart);
     waveformView->setBPM(analysis.bpm);
+    waveformView->setTempoMap(tempoMap);
     waveformView->setBeatsAligned(false);
     waveformView->setBeatsPerBar(beatsPerBar);
     waveformView->update();
@@ -4376,11 +4710,10 @@ void MainWindow::updateUIAfterAnalysis(const QVector<QVector<float>>& audioData,
     setBPMAndBeatsPerBar(analysis.bpm, beatsPerBar);
 
     if (pitchGridWidget) {
-        pitchGridWidget->setAudioData(audioData);
-        pitchGridWidget->setSampleRate(waveformView->getSampleRate());
         pitchGridWidget->setBPM(analysis.bpm);
         pitchGridWidget->setBeatsPerBar(beatsPerBar);
-        pitchGridWidget->setGridStartSample(analysis.gridStartSample);
+        pitchGridWidget->setGridStartSample(barStart);
+        pitchGridWidget->setTempoMap(tempoMap);
         pitchGridWidget->update();
     }
 
@@ -4388,6 +4721,7 @@ void MainWindow::updateUIAfterAnalysis(const QVector<QVector<float>>& audioData,
         metronomeController->setBPM(analysis.bpm);
     }
 
+    rebinKeyBars();
     updateHorizontalScrollBar(waveformView->getZoomLevel());
 }
 
@@ -4397,9 +4731,13 @@ void MainWindow::updateUIAfterBeatFix(const QVector<QVector<float>>& fixedData,
 {
     if (!waveformView) return;
 
+    // Доли ровные: начало такта — через barPhase долей bpm от начала сетки
+    const qint64 barStart = BPMAnalyzer::barStartSample(analysis, waveformView->getSampleRate());
     waveformView->setAudioData(fixedData);
-    waveformView->setGridStartSample(analysis.gridStartSample);
+    waveformView->setGridStartSample(barStart);
     waveformView->setBPM(analysis.bpm);
+    // Доли поставлены на ровную сетку bpm — карта переменного темпа больше не нужна
+    waveformView->setTempoMap(TempoMap());
     waveformView->setBeatsAligned(true);
     waveformView->setBeatsPerBar(beatsPerBar);
     waveformView->update();
@@ -4411,7 +4749,8 @@ void MainWindow::updateUIAfterBeatFix(const QVector<QVector<float>>& fixedData,
         pitchGridWidget->setSampleRate(waveformView->getSampleRate());
         pitchGridWidget->setBPM(analysis.bpm);
         pitchGridWidget->setBeatsPerBar(beatsPerBar);
-        pitchGridWidget->setGridStartSample(analysis.gridStartSample);
+        pitchGridWidget->setGridStartSample(barStart);
+        pitchGridWidget->setTempoMap(TempoMap());
         pitchGridWidget->update();
     }
 
@@ -4425,7 +4764,7 @@ void MainWindow::updateUIAfterBeatFix(const QVector<QVector<float>>& fixedData,
     float samplesPerBeat = (60.0f * sampleRate) / analysis.bpm;
     float barLengthInQuarters = (beatsPerBar == 6) ? 3.f : (beatsPerBar == 12) ? 6.f : float(qMax(1, beatsPerBar));
     float samplesPerBar = barLengthInQuarters * samplesPerBeat;
-    float offset = float(analysis.gridStartSample) / samplesPerBar;
+    float offset = float(barStart) / samplesPerBar;
     offset = offset - floor(offset);
     waveformView->setHorizontalOffset(offset);
     updateHorizontalScrollBar(waveformView->getZoomLevel());
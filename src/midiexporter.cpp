@@ -48,8 +48,16 @@ struct MidiEvent {
     bool noteOn = false;
     int pitch = 60;
     int velocity = 96;
+    /** Мета-событие темпа (pitch/velocity не используются). */
+    bool tempo = false;
+    quint32 microsecondsPerQuarter = 0;
 };
 
+quint32 microsecondsPerQuarter(double samplesPerQuarter, int sampleRate)
+{
+    return quint32(std::llround(samplesPerQuarter * 1000000.0 / double(sampleRate)));
+}
+
 int clampPitch(float midiPitch)
 {
     const int rounded = int(std::lround(midiPitch));
@@ -67,14 +75,43 @@ QByteArray buildFile(const QVector<PitchDetector::PitchNote>& notes, const Optio
 
     // Сэмплы → тики: сколько сэмплов в четверти, столько же и в kTicksPerQuarter
     const double samplesPerQuarter = (60.0 / double(bpm)) * double(sampleRate);
+    const TempoMap& tempoMap = options.tempoMap;
+    const bool variableTempo = tempoMap.isVariable();
+    const double startBeat = variableTempo ? tempoMap.beatAtSample(double(options.startSample)) : 0.0;
+    const auto beatsToTicks = [](double beats) {
+        return quint32(std::max<long long>(0, std::llround(beats * double(kTicksPerQuarter))));
+    };
     const auto toTicks = [&](qint64 sample) {
+        if (variableTempo) {
+            return beatsToTicks(tempoMap.beatAtSample(double(sample)) - startBeat);
+        }
         const double relative = double(sample - options.startSample);
-        const double ticks = (relative / samplesPerQuarter) * double(kTicksPerQuarter);
-        return quint32(std::max<long long>(0, std::llround(ticks)));
+        return beatsToTicks(relative / samplesPerQuarter);
     };
 
     QVector<MidiEvent> events;
-    events.reserve(notes.size() * 2);
+    events.reserve(notes.size() * 2 + 1);
+
+    // Темп: микросекунды на четверть. Переменный — с начала файла темп
+    // сегмента под startSample, дальше — на начале каждого следующего
+    MidiEvent initialTempo;
+    initialTempo.tempo = true;
+    initialTempo.microsecondsPerQuarter = variableTempo
+        ? microsecondsPerQuarter(tempoMap.samplesPerBeatAt(double(options.startSample)), sampleRate)
+        : quint32(std::llround(60000000.0 / double(bpm)));
+    events.append(initialTempo);
+    if (variableTempo) {
+        for (const TempoMap::Segment& segment : tempoMap.segments()) {
+            if (segment.startSample <= double(options.startSample)) {
+                continue;
+            }
+            MidiEvent change;
+            change.tempo = true;
+            change.tick = beatsToTicks(segment.startBeat - startBeat);
+            change.microsecondsPerQuarter = microsecondsPerQuarter(segment.samplesPerBeat, sampleRate);
+            events.append(change);
+        }
+    }
     for (const PitchDetector::PitchNote& note : notes) {
         if (note.endSample <= note.startSample) {
             continue;
@@ -87,30 +124,32 @@ QByteArray buildFile(const QVector<PitchDetector::PitchNote>& notes, const Optio
         events.append({ endTick, false, pitch, 0 });
     }
 
-    // Порядок: по тику, при равенстве сначала note-off (иначе повтор той же
-    // высоты гасится собственным выключением)
+    // Порядок: по тику, при равенстве сначала темп, затем note-off (иначе
+    // повтор той же высоты гасится собственным выключением)
     std::stable_sort(events.begin(), events.end(), [](const MidiEvent& a, const MidiEvent& b) {
         if (a.tick != b.tick) {
             return a.tick < b.tick;
         }
+        if (a.tempo != b.tempo) {
+            return a.tempo;
+        }
         return int(a.noteOn) < int(b.noteOn);
     });
 
     QByteArray track;
-    // Темп: микросекунды на четверть
-    const quint32 microsecondsPerQuarter = quint32(std::llround(60000000.0 / double(bpm)));
-    appendVlq(track, 0);
-    track.append(char(0xFF));
-    track.append(char(0x51));
-    track.append(char(0x03));
-    track.append(char((microsecondsPerQuarter >> 16) & 0xFF));
-    track.append(char((microsecondsPerQuarter >> 8) & 0xFF));
-    track.append(char(microsecondsPerQuarter & 0xFF));
-
     quint32 previousTick = 0;
     for (const MidiEvent& event : events) {
         appendVlq(track, event.tick - previousTick);
         previousTick = event.tick;
+        if (event.tempo) {
+            track.append(char(0xFF));
+            track.append(char(0x51));
+            track.append(char(0x03));
+            track.append(char((event.microsecondsPerQuarter >> 16) & 0xFF));
+            track.append(char((event.microsecondsPerQuarter >> 8) & 0xFF));
+            track.append(char(event.microsecondsPerQuarter & 0xFF));
+            continue;
+        }
         track.append(char((event.noteOn ? 0x90 : 0x80) | channel));
         track.append(char(event.pitch & 0x7F));
         track.append(char(event.velocity & 0x7F));
@@ -0,0 +1,184 @@
+#include "../include/onsetstream.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#ifdef USE_MIXXX_QM_DSP
+#include <dsp/onsets/DetectionFunction.h>
+#include <dsp/rateconversion/Decimator.h>
+#endif
+
+namespace {
+    // Константы из Mixxx
+    constexpr float kStepSecs = 0.01161f; // ~12ms разрешение для BeatMap
+    constexpr int kMaximumBinSizeHz = 50; // Hz
+    // Блок прореживания: кратен kDownbeatDecimation, Decimator работает блоками
+    constexpr int kDecimateBlock = 1024;
+
+    int nextPowerOfTwo(int value) {
+        int result = 1;
+        while (result < value) {
+            result *= 2;
+        }
+        return result;
+    }
+}
+
+OnsetStream::OnsetStream(int sampleRate)
+    : sampleRate_(qMax(1, sampleRate))
+    , stepSize_(stepSizeFor(sampleRate_))
+    , windowSize_(windowSizeFor(sampleRate_))
+{
+    window_.resize(windowSize_);
+
+#ifdef USE_MIXXX_QM_DSP
+    DFConfig config;
+    config.DFType = DF_COMPLEXSD;
+    config.stepSize = stepSize_;
+    config.frameLength = windowSize_;
+    config.dbRise = 3;
+    config.adaptiveWhitening = false;
+    config.whiteningRelaxCoeff = -1;
+    config.whiteningFloor = -1;
+    detection_ = std::make_unique<DetectionFunction>(config);
+
+    // ×16 — двумя ступенями, как в DownBeat: фильтры Decimator есть до ×8
+    decimateBlock_.resize(kDecimateBlock);
+    decimateStage_.resize(kDecimateBlock / 8);
+    decimator8_ = std::make_unique<Decimator>(kDecimateBlock, 8);
+    decimator2_ = std::make_unique<Decimator>(kDecimateBlock / 8, kDownbeatDecimation / 8);
+#endif
+}
+
+OnsetStream::~OnsetStream() = default;
+
+int OnsetStream::stepSizeFor(int sampleRate)
+{
+    return qMax(1, static_cast<int>(sampleRate * kStepSecs));
+}
+
+int OnsetStream::windowSizeFor(int sampleRate)
+{
+    return nextPowerOfTwo(sampleRate / kMaximumBinSizeHz);
+}
+
+void OnsetStream::push(const float* samples, int count)
+{
+    if (samples && count > 0) {
+        pushConverted(samples, count, nullptr);
+    }
+}
+
+void OnsetStream::push(const float* left, const float* right, int frames)
+{
+    if (left && frames > 0) {
+        pushConverted(left, frames, right);
+    }
+}
+
+// Каждый сэмпл переводится в double один раз — при записи в окно
+void OnsetStream::pushConverted(const float* samples, int count, const float* right)
+{
+    sampleCount_ += count;
+    decimate(samples, count, right);
+    if (!detecting_) {
+        return;
+    }
+    while (count > 0) {
+        if (skip_ > 0) {
+            const int n = qMin(skip_, count);
+            skip_ -= n;
+            samples += n;
+            if (right) {
+                right += n;
+            }
+            count -= n;
+            continue;
+        }
+        // Полное окно считается, только когда за ним есть ещё сэмпл —
+        // так же, как прежний цикл по целому сигналу
+        if (filled_ == windowSize_) {
+            emitWindow();
+            continue;
+        }
+        const int n = qMin(windowSize_ - filled_, count);
+        double* out = window_.data() + filled_;
+        if (right) {
+            for (int i = 0; i < n; ++i) {
+                out[i] = 0.5f * (samples[i] + right[i]);
+            }
+            right += n;
+        } else {
+            for (int i = 0; i < n; ++i) {
+                out[i] = samples[i];
+            }
+        }
+        filled_ += n;
+        samples += n;
+        count -= n;
+    }
+}
+
+void OnsetStream::emitWindow()
+{
+#ifdef USE_MIXXX_QM_DSP
+    values_.append(detection_->processTimeDomain(window_.data()));
+#else
+    // Упрощённая функция: RMS окна и его прирост (spectral flux)
+    double energy = 0.0;
+    for (int j = 0; j < windowSize_; ++j) {
+        const float s = float(window_[j]);
+        energy += s * s;
+    }
+    double value = std::sqrt(energy / windowSize_);
+    if (!values_.isEmpty()) {
+        // Прирост считается от предыдущего значения функции, как и прежде
+        value = std::max(0.0, value - values_.last());
+    }
+    values_.append(value);
+#endif
+
+    if (stepSize_ < windowSize_) {
+        const int kept = windowSize_ - stepSize_;
+        std::memmove(window_.data(), window_.constData() + stepSize_, size_t(kept) * sizeof(double));
+        filled_ = kept;
+    } else {
+        filled_ = 0;
+        skip_ = stepSize_ - windowSize_;
+    }
+}
+
+// Прореживается каждый сэмпл, в том числе пропущенные окнами при шаге длиннее окна
+void OnsetStream::decimate(const float* samples, int count, const float* right)
+{
+#ifdef USE_MIXXX_QM_DSP
+    while (count > 0) {
+        const int n = qMin(kDecimateBlock - decimateFilled_, count);
+        float* out = decimateBlock_.data() + decimateFilled_;
+        if (right) {
+            for (int i = 0; i < n; ++i) {
+                out[i] = 0.5f * (samples[i] + right[i]);
+            }
+            right += n;
+        } else {
+            std::memcpy(out, samples, size_t(n) * sizeof(float));
+        }
+        decimateFilled_ += n;
+        samples += n;
+        count -= n;
+
+        if (decimateFilled_ == kDecimateBlock) {
+            decimator8_->process(decimateBlock_.constData(), decimateStage_.data());
+            const qsizetype at = decimated_.size();
+            decimated_.resize(at + kDecimateBlock / kDownbeatDecimation);
+            decimator2_->process(decimateStage_.constData(), decimated_.data() + at);
+            decimateFilled_ = 0;
+        }
+    }
+#else
+    Q_UNUSED(samples);
+    Q_UNUSED(count);
+    Q_UNUSED(right);
+#endif
+}
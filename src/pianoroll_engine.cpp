@@ -54,53 +54,82 @@ BeatGridMetrics computeBeatGridMetrics(float bpm, int beatsPerBar, int sampleRat
     return metrics;
 }
 
-WaveformEnvelope buildWaveformEnvelope(const QVector<QVector<float>>& channels,
-                                       int pixelWidth,
-                                       int widgetHeight)
+bool EnvelopePyramid::ensureBuilt(const QVector<QVector<float>>& channels)
 {
-    WaveformEnvelope envelope;
-    if (channels.isEmpty() || channels[0].isEmpty() || pixelWidth <= 0 || widgetHeight <= 2) {
-        return envelope;
+    QVector<const float*> sources;
+    sources.reserve(channels.size());
+    for (const QVector<float>& channel : channels) {
+        sources.append(channel.constData());
+    }
+    const qint64 size = channels.isEmpty() ? 0 : channels[0].size();
+    if (sources == sources_ && size == sourceSize_) {
+        return false;
     }
 
-    const int totalFrames = channels[0].size();
+    clear();
+    sources_ = sources;
+    sourceSize_ = size;
+    if (size <= 0) {
+        return true;
+    }
+
+    // Сведение по каналам целиком (непрерывные проходы по памяти); сложение
+    // идёт в том же порядке, что и прежнее сведение по кадрам
     const int numChannels = channels.size();
+    mix_.fill(0.0f, int(size));
+    float* mix = mix_.data();
+    for (const QVector<float>& channel : channels) {
+        const float* samples = channel.constData();
+        const qint64 count = qMin<qint64>(size, channel.size());
+        for (qint64 frame = 0; frame < count; ++frame) {
+            mix[frame] += samples[frame];
+        }
+    }
+    const float divisor = float(qMax(1, numChannels));
+    for (qint64 frame = 0; frame < size; ++frame) {
+        mix[frame] /= divisor;
+    }
+    peaks_.build(mix_);
+    return true;
+}
 
-    envelope.pixelWidth = pixelWidth;
-    envelope.samplesPerPixel = float(totalFrames) / float(pixelWidth);
-    if (envelope.samplesPerPixel < 1.0f) {
-        envelope.pixelWidth = totalFrames;
-        envelope.samplesPerPixel = 1.0f;
+void EnvelopePyramid::clear()
+{
+    sources_.clear();
+    sourceSize_ = 0;
+    mix_.clear();
+    peaks_.clear();
+}
+
+WaveformEnvelope EnvelopePyramid::envelope(qint64 startSample, float samplesPerPixel,
+                                           int pixelWidth, int widgetHeight) const
+{
+    WaveformEnvelope envelope;
+    if (mix_.isEmpty() || pixelWidth <= 0 || widgetHeight <= 2 || samplesPerPixel <= 0.0f) {
+        return envelope;
     }
 
-    envelope.upper.resize(envelope.pixelWidth);
-    envelope.lower.resize(envelope.pixelWidth);
+    envelope.pixelWidth = pixelWidth;
+    envelope.samplesPerPixel = samplesPerPixel;
+    envelope.upper.resize(pixelWidth);
+    envelope.lower.resize(pixelWidth);
 
+    const qint64 totalFrames = mix_.size();
     const int centerY = widgetHeight / 2;
     const int amplitude = qMax(1, centerY - 1);
 
-    for (int column = 0; column < envelope.pixelWidth; ++column) {
-        const int sampleStart = int(column * envelope.samplesPerPixel);
-        const int sampleEnd = int((column + 1) * envelope.samplesPerPixel);
+    for (int column = 0; column < pixelWidth; ++column) {
+        const qint64 sampleStart = qMax<qint64>(0, startSample + qint64(column * samplesPerPixel));
+        const qint64 sampleEnd =
+            qMin(totalFrames, qMax(sampleStart + 1, startSample + qint64((column + 1) * samplesPerPixel)));
 
         float maxSample = 0.0f;
         float minSample = 0.0f;
-
-        for (int frame = sampleStart; frame < sampleEnd; ++frame) {
-            if (frame >= totalFrames) {
-                break;
-            }
-
-            float mixed = 0.0f;
-            for (int channel = 0; channel < numChannels; ++channel) {
-                if (frame < channels[channel].size()) {
-                    mixed += channels[channel][frame];
-                }
-            }
-            mixed /= qMax(1, numChannels);
-
-            maxSample = qMax(maxSample, mixed);
-            minSample = qMin(minSample, mixed);
+        float peakMin = 0.0f;
+        float peakMax = 0.0f;
+        if (sampleStart < sampleEnd && peaks_.range(mix_, sampleStart, sampleEnd, peakMin, peakMax)) {
+            maxSample = qMax(maxSample, peakMax);
+            minSample = qMin(minSample, peakMin);
         }
 
         envelope.upper[column] = qBound(0, centerY - int(maxSample * amplitude), widgetHeight - 1);
@@ -110,6 +139,34 @@ WaveformEnvelope buildWaveformEnvelope(const QVector<QVector<float>>& channels,
     return envelope;
 }
 
+WaveformEnvelope buildWaveformEnvelope(const QVector<QVector<float>>& channels,
+                                       int pixelWidth,
+                                       int widgetHeight)
+{
+    if (channels.isEmpty() || channels[0].isEmpty() || pixelWidth <= 0 || widgetHeight <= 2) {
+        return WaveformEnvelope();
+    }
+
+    const int totalFrames = channels[0].size();
+    float samplesPerPixel = float(totalFrames) / float(pixelWidth);
+    if (samplesPerPixel < 1.0f) {
+        pixelWidth = totalFrames;
+        samplesPerPixel = 1.0f;
+    }
+
+    EnvelopePyramid pyramid;
+    pyramid.ensureBuilt(channels);
+    return pyramid.envelope(0, samplesPerPixel, pixelWidth, widgetHeight);
+}
+
+WaveformEnvelope buildWaveformEnvelope(const EnvelopePyramid& pyramid,
+                                       const Viewport& viewport,
+                                       int pixelWidth,
+                                       int widgetHeight)
+{
+    return pyramid.envelope(viewport.startSample, viewport.samplesPerPixel, pixelWidth, widgetHeight);
+}
+
 QVector<GridLine> visibleGridLines(const Viewport& viewport,
                                      const BeatGridMetrics& metrics,
                                      qint64 gridStartSample,
@@ -192,6 +249,66 @@ qint64 snapToGrid(qint64 sample,
                       enabled);
 }
 
+// Деление такта в четвертях — как у computeBeatGridMetrics
+static double beatsPerSubdivision(int beatsPerBar, int* subdivisionsPerBar)
+{
+    const double barLengthInQuarters =
+        (beatsPerBar == 6) ? 3.0 : (beatsPerBar == 12) ? 6.0 : double(qMax(1, beatsPerBar));
+    *subdivisionsPerBar = (beatsPerBar == 6 || beatsPerBar == 12) ? 8 : 4;
+    return barLengthInQuarters / *subdivisionsPerBar;
+}
+
+QVector<GridLine> visibleGridLines(const Viewport& viewport,
+                                   const TempoMap& tempoMap,
+                                   int beatsPerBar,
+                                   int widthPx)
+{
+    QVector<GridLine> lines;
+    if (tempoMap.isEmpty() || widthPx <= 0) {
+        return lines;
+    }
+
+    int subdivisionsPerBar = 4;
+    const double subBeats = beatsPerSubdivision(beatsPerBar, &subdivisionsPerBar);
+    const int firstSubdivision =
+        int(std::floor(tempoMap.beatAtSample(double(viewport.startSample)) / subBeats));
+
+    for (int subdivision = firstSubdivision; ; ++subdivision) {
+        const qint64 samplePos = qint64(tempoMap.sampleAtBeat(subdivision * subBeats));
+        if (samplePos < viewport.startSample) {
+            continue;
+        }
+
+        const float x = viewport.sampleToPixelX(samplePos);
+        if (x >= widthPx) {
+            break;
+        }
+
+        GridLine line;
+        line.x = x;
+        line.isBarLine = (subdivision % subdivisionsPerBar) == 0;
+        lines.append(line);
+    }
+
+    return lines;
+}
+
+qint64 snapToGrid(qint64 sample,
+                  const TempoMap& tempoMap,
+                  int beatsPerBar,
+                  bool enabled)
+{
+    if (!enabled || tempoMap.isEmpty()) {
+        return sample;
+    }
+
+    int subdivisionsPerBar = 4;
+    const double subBeats = beatsPerSubdivision(beatsPerBar, &subdivisionsPerBar);
+    const double subdivision = std::round(tempoMap.beatAtSample(double(sample)) / subBeats);
+    const qint64 snapped = qint64(std::llround(tempoMap.sampleAtBeat(subdivision * subBeats)));
+    return qMax(qint64(0), snapped);
+}
+
 bool canSplitNoteAt(qint64 startSample,
                     qint64 endSample,
                     qint64 cutSample,
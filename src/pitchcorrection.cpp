@@ -85,6 +85,34 @@ void silenceRange(QVector<float>& channel, qint64 from, qint64 to)
 
 } // namespace
 
+QPair<qint64, qint64> editedRange(const QVector<PitchDetector::PitchNote>& notes,
+                                  qint64 totalSamples)
+{
+    // Те же границы, что у apply(): гашение места ушедшей ноты и вписывание
+    // на новое место не выходят за отрезки нот
+    qint64 first = totalSamples;
+    qint64 last = 0;
+    const auto include = [&](qint64 from, qint64 to) {
+        from = qBound<qint64>(0, from, totalSamples);
+        to = qBound<qint64>(from, to, totalSamples);
+        if (to > from) {
+            first = qMin(first, from);
+            last = qMax(last, to);
+        }
+    };
+    for (const PitchDetector::PitchNote& note : notes) {
+        const bool pitchChanged = std::abs(note.midiPitch - note.detectedPitch) >= 0.01f;
+        const bool moved = note.isMovedInTime();
+        if (!pitchChanged && !moved) {
+            continue;
+        }
+        include(note.sourceStart(), note.sourceEnd());
+        const qint64 targetStart = qBound<qint64>(0, note.startSample, totalSamples);
+        include(targetStart, targetStart + (note.sourceEnd() - note.sourceStart()));
+    }
+    return last > first ? qMakePair(first, last) : qMakePair(qint64(0), qint64(0));
+}
+
 bool hasPendingEdits(const QVector<PitchDetector::PitchNote>& notes)
 {
     for (const PitchDetector::PitchNote& note : notes) {
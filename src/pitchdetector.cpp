@@ -1,4 +1,5 @@
 #include "../include/pitchdetector.h"
+#include "../include/fft_engine.h"
 
 #include <QtCore/QRunnable>
 #include <QtCore/QSemaphore>
@@ -32,6 +33,10 @@ constexpr int kMedianWindow = 5;
 // первый, а не глобальный — иначе выигрывают кратные периоды (октава вниз).
 constexpr float kYinThreshold = 0.15f;
 
+// До этого лага разностную функцию дешевле считать напрямую: на коротком кадре
+// SIMD-цикл по лагам быстрее двух FFT блока «кадр + лаг».
+constexpr int kDirectMaxLag = 64;
+
 struct FrameEstimate {
     float midi = -1.0f;       // < 0 — кадр невокализованный/тишина
     float confidence = 0.0f;
@@ -123,17 +128,104 @@ float refineLag(const std::vector<float>& cmnd, int tau)
     return float(tau) + shift;
 }
 
+/// Буферы одного потока анализа: кадры идут подряд без выделений памяти.
+struct FrameScratch {
+    explicit FrameScratch(const Layout& layout)
+        // Автокорреляция через FFT циклическая: блок должен вместить кадр и
+        // максимальный лаг, чтобы хвост не заворачивался на начало.
+        : plan(DFEngine::FFTPlan::forSize(unsigned(layout.frameSize + layout.maxLag)))
+    {
+        spectrum.resize(plan.binCount());
+        power.resize(plan.size());
+        energy.resize(layout.frameSize + 1);
+        diff.reserve(layout.maxLag + 1);
+        cmnd.reserve(layout.maxLag + 1);
+    }
+
+    const DFEngine::FFTPlan& plan;
+    std::vector<DFEngine::Complex> spectrum;
+    std::vector<float> power;     ///< |X|² по всему блоку (чётная последовательность)
+    std::vector<double> energy;   ///< energy[i] — сумма квадратов samples[0..i)
+    std::vector<float> diff;
+    std::vector<float> cmnd;
+};
+
+/// Разностная функция YIN напрямую, как в определении: O(length · maxLag).
+void directDifference(const float* samples, int length, int maxLag, std::vector<float>& diff)
+{
+    for (int tau = 1; tau <= maxLag; ++tau) {
+        const int n = length - tau;
+        // Восемь независимых сумм: без зависимости по сумматору компилятор
+        // разворачивает цикл в SIMD (SSE/AVX/NEON) и без -ffast-math.
+        float acc[8] = {};
+        int i = 0;
+        for (; i + 8 <= n; i += 8) {
+            for (int k = 0; k < 8; ++k) {
+                const float d = samples[i + k] - samples[i + k + tau];
+                acc[k] += d * d;
+            }
+        }
+        for (; i < n; ++i) {
+            const float d = samples[i] - samples[i + tau];
+            acc[0] += d * d;
+        }
+        const float sum = ((acc[0] + acc[4]) + (acc[1] + acc[5]))
+                        + ((acc[2] + acc[6]) + (acc[3] + acc[7]));
+        diff[tau] = sum / float(n);
+    }
+}
+
+/**
+ * Разностная функция YIN через автокорреляцию:
+ *   d(tau) = sum (x[i] - x[i+tau])² = E[0, n) + E[tau, tau+n) - 2·r(tau),
+ * n = length - tau. Энергии — из префиксных сумм scratch.energy, r — обратным
+ * FFT от |X|²: два FFT на кадр вместо O(length · maxLag).
+ */
+void fftDifference(const float* samples, int length, int maxLag, FrameScratch& scratch)
+{
+    const DFEngine::FFTPlan& plan = scratch.plan;
+    const unsigned blockSize = plan.size();
+    DFEngine::Complex* spectrum = scratch.spectrum.data();
+    float* power = scratch.power.data();
+
+    plan.forward(samples, unsigned(length), nullptr, spectrum);
+    const unsigned half = blockSize / 2;
+    for (unsigned k = 0; k <= half; ++k) {
+        const float re = spectrum[k].real();
+        const float im = spectrum[k].imag();
+        power[k] = re * re + im * im;
+    }
+    for (unsigned k = half + 1; k < blockSize; ++k) {
+        power[k] = power[blockSize - k];
+    }
+    // |X|² вещественна и чётна, поэтому обратное преобразование совпадает с
+    // прямым с точностью до множителя 1/blockSize.
+    plan.forward(power, blockSize, nullptr, spectrum);
+    const double autoScale = 2.0 / double(blockSize);
+
+    const std::vector<double>& energy = scratch.energy;
+    std::vector<float>& diff = scratch.diff;
+    for (int tau = 1; tau <= maxLag; ++tau) {
+        const int n = length - tau;
+        const double sum = energy[n] + (energy[length] - energy[tau])
+                         - autoScale * spectrum[tau].real();
+        // Округление float-спектра может увести почти нулевую сумму в минус
+        diff[tau] = float(qMax(0.0, sum) / n);
+    }
+}
+
 FrameEstimate estimateFrame(const float* samples, const Layout& layout, const Options& opt,
-                            std::vector<float>& diff, std::vector<float>& cmnd)
+                            FrameScratch& scratch)
 {
     FrameEstimate est;
     const int length = layout.frameSize;
 
-    double energy = 0.0;
+    std::vector<double>& energy = scratch.energy;
+    energy[0] = 0.0;
     for (int i = 0; i < length; ++i) {
-        energy += double(samples[i]) * samples[i];
+        energy[i + 1] = energy[i] + double(samples[i]) * samples[i];
     }
-    const float rms = std::sqrt(float(energy / qMax(1, length)));
+    const float rms = std::sqrt(float(energy[length] / qMax(1, length)));
     if (rms < opt.minRms) {
         return est;
     }
@@ -145,22 +237,16 @@ FrameEstimate estimateFrame(const float* samples, const Layout& layout, const Op
 
     // Разностная функция YIN. Нормируем на число слагаемых: иначе большие лаги
     // выигрывают просто потому, что суммируют меньше точек.
+    std::vector<float>& diff = scratch.diff;
     diff.assign(maxLag + 1, 0.0f);
-    for (int tau = 1; tau <= maxLag; ++tau) {
-        const int n = length - tau;
-        if (n <= 0) {
-            diff[tau] = diff[tau - 1];
-            continue;
-        }
-        double sum = 0.0;
-        for (int i = 0; i < n; ++i) {
-            const double d = double(samples[i]) - samples[i + tau];
-            sum += d * d;
-        }
-        diff[tau] = float(sum / n);
+    if (maxLag <= kDirectMaxLag) {
+        directDifference(samples, length, maxLag, diff);
+    } else {
+        fftDifference(samples, length, maxLag, scratch);
     }
 
     // Кумулятивная нормировка (CMNDF) — она и подавляет кратные периоды.
+    std::vector<float>& cmnd = scratch.cmnd;
     cmnd.assign(maxLag + 1, 1.0f);
     double running = 0.0;
     for (int tau = 1; tau <= maxLag; ++tau) {
@@ -296,23 +382,20 @@ QVector<PitchNote> detectNotes(const QVector<float>& mono,
     const int frameCount = (work.size() - layout.frameSize) / layout.hopSize + 1;
     QVector<FrameEstimate> frames(frameCount);
 
-    std::vector<float> diff;
-    std::vector<float> cmnd;
-    diff.reserve(layout.maxLag + 1);
-    cmnd.reserve(layout.maxLag + 1);
-
     // Кадры считаются независимо друг от друга, поэтому раскладываем их по
     // ядрам. Пул свой, а не глобальный: анализ и сам обычно запущен из
     // QtConcurrent на глобальном пуле, и на одноядерной машине задачи ждали бы
     // поток, который занят ими же.
-    const int threadCount = qBound(1, QThread::idealThreadCount(), 16);
+    const int threadCount =
+        qBound(1, options.maxThreads > 0 ? options.maxThreads : QThread::idealThreadCount(), 16);
     constexpr int kMinFramesForThreads = 64;
 
     if (threadCount <= 1 || frameCount < kMinFramesForThreads) {
+        FrameScratch scratch(layout);
         int lastReported = -1;
         for (int f = 0; f < frameCount; ++f) {
             frames[f] = estimateFrame(work.constData() + qint64(f) * layout.hopSize,
-                                      layout, options, diff, cmnd);
+                                      layout, options, scratch);
             if (onProgress) {
                 const int pct = int(qint64(f + 1) * 100 / frameCount);
                 if (pct != lastReported) {
@@ -337,14 +420,11 @@ QVector<PitchNote> detectNotes(const QVector<float>& mono,
                 continue;
             }
             pool.start(QRunnable::create([&, from, to]() {
-                // Буферы разностной функции — свои у каждого потока
-                std::vector<float> localDiff;
-                std::vector<float> localCmnd;
-                localDiff.reserve(layout.maxLag + 1);
-                localCmnd.reserve(layout.maxLag + 1);
+                // Буферы FFT и разностной функции — свои у каждого потока
+                FrameScratch scratch(layout);
                 for (int f = from; f < to; ++f) {
                     frames[f] = estimateFrame(work.constData() + qint64(f) * layout.hopSize,
-                                              layout, options, localDiff, localCmnd);
+                                              layout, options, scratch);
                     processed.fetch_add(1, std::memory_order_relaxed);
                 }
                 finished.release();
@@ -262,10 +262,26 @@ void PitchGridWidget::setBeatsPerBar(int beats)
 
 void PitchGridWidget::setGridStartSample(qint64 sample)
 {
+    tempoMap.shift(double(sample - gridStartSample));
     gridStartSample = sample;
     update();
 }
 
+void PitchGridWidget::setTempoMap(const TempoMap& map)
+{
+    tempoMap = map;
+    update();
+}
+
+qint64 PitchGridWidget::snapSampleToGrid(qint64 sample, bool enabled) const
+{
+    if (tempoMap.isVariable()) {
+        return PianoRollEngine::snapToGrid(sample, tempoMap, beatsPerBar, enabled);
+    }
+    return PianoRollEngine::snapToGrid(sample, bpm, beatsPerBar, sampleRate, gridStartSample,
+                                       enabled);
+}
+
 void PitchGridWidget::setPitchRange(int min, int max)
 {
     minPitch = min;
@@ -439,9 +455,8 @@ bool PitchGridWidget::requestNoteSplit(int noteIndex, qint64 rawSample)
     }
 
     const PitchDetector::PitchNote& note = pitchNotes[noteIndex];
-    const qint64 cutSample = PianoRollEngine::snapToGrid(
-        rawSample, bpm, beatsPerBar, sampleRate, gridStartSample,
-        noteCutMode == CutMode::SnapToGrid);
+    const qint64 cutSample =
+        snapSampleToGrid(rawSample, noteCutMode == CutMode::SnapToGrid);
 
     if (!PianoRollEngine::canSplitNoteAt(note.startSample, note.endSample, cutSample)) {
         emit noteSplitRejected(SplitRejection::CutOutsideNote);
@@ -467,9 +482,8 @@ void PitchGridWidget::updateSplitPreview(const QPoint& pos)
 
     const int noteIndex = noteIndexAt(pos);
     const qint64 rawSample = cutSampleFromX(pos.x());
-    const qint64 cutSample = PianoRollEngine::snapToGrid(
-        rawSample, bpm, beatsPerBar, sampleRate, gridStartSample,
-        noteCutMode == CutMode::SnapToGrid);
+    const qint64 cutSample =
+        snapSampleToGrid(rawSample, noteCutMode == CutMode::SnapToGrid);
     const bool valid = noteIndex >= 0
         && PianoRollEngine::canSplitNoteAt(pitchNotes[noteIndex].startSample,
                                            pitchNotes[noteIndex].endSample, cutSample);
@@ -649,9 +663,10 @@ void PitchGridWidget::drawBeatGrid(QPainter& painter, const QRect& rect) const
 
     const auto viewport = currentViewport();
     const int refWidth = timelineReferenceWidth();
-    const QVector<PianoRollEngine::GridLine> lines =
-        PianoRollEngine::visibleGridLines(viewport, bpm, beatsPerBar, sampleRate,
-                                          gridStartSample, refWidth);
+    const QVector<PianoRollEngine::GridLine> lines = tempoMap.isVariable()
+        ? PianoRollEngine::visibleGridLines(viewport, tempoMap, beatsPerBar, refWidth)
+        : PianoRollEngine::visibleGridLines(viewport, bpm, beatsPerBar, sampleRate,
+                                            gridStartSample, refWidth);
 
     for (const PianoRollEngine::GridLine& line : lines) {
         const float x = rect.left() + timelineToContentX(line.x);
@@ -863,8 +878,7 @@ qint64 PitchGridWidget::getPositionFromX(int x) const
 
     const auto viewport = currentViewport();
     qint64 sample = viewport.pixelToSample(int(contentToTimelineX(float(x))));
-    sample = PianoRollEngine::snapToGrid(sample, bpm, beatsPerBar, sampleRate,
-                                         gridStartSample, beatGridSnap);
+    sample = snapSampleToGrid(sample, beatGridSnap);
     const qint64 maxSample = qMax<qint64>(0, effectiveTimelineSamples() - 1);
     sample = qBound(qint64(0), sample, maxSample);
     return (sample * 1000) / sampleRate;
@@ -955,10 +969,7 @@ void PitchGridWidget::mouseMoveEvent(QMouseEvent *event)
                 const qint64 cursorSample = cutSampleFromX(event->pos().x());
                 qint64 targetStart = noteDragStartSample + (cursorSample - noteDragGrabSample);
                 if (noteCutMode == CutMode::SnapToGrid) {
-                    const auto metrics = PianoRollEngine::computeBeatGridMetrics(
-                        bpm, beatsPerBar, sampleRate);
-                    targetStart = PianoRollEngine::snapToGrid(targetStart, metrics,
-                                                              gridStartSample, true);
+                    targetStart = snapSampleToGrid(targetStart, true);
                 }
                 targetStart = qMax<qint64>(0, targetStart);
                 PitchDetector::PitchNote& note = pitchNotes[selectedNoteIndex];
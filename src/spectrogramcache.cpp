@@ -0,0 +1,64 @@
+#include "../include/spectrogramcache.h"
+
+#include <QtCore/QMutexLocker>
+
+#include <cmath>
+
+SpectrogramCache::SpectrogramCache()
+{
+    setBudgetBytes(kDefaultBudgetBytes);
+}
+
+int SpectrogramCache::levelForSamplesPerColumn(double samplesPerColumn)
+{
+    int level = 0;
+    while (level < kMaxLevel && double(hopForLevel(level + 1)) <= samplesPerColumn) {
+        ++level;
+    }
+    return level;
+}
+
+qint64 SpectrogramCache::frameCount(qint64 sampleCount, int windowSize, int level)
+{
+    if (windowSize <= 0 || sampleCount < windowSize) {
+        return 0;
+    }
+    return (sampleCount - windowSize) / hopForLevel(level) + 1;
+}
+
+qint64 SpectrogramCache::tileCount(qint64 sampleCount, int windowSize, int level)
+{
+    return (frameCount(sampleCount, windowSize, level) + kTileColumns - 1) / kTileColumns;
+}
+
+const QImage* SpectrogramCache::find(const SpectrogramTileKey& key)
+{
+    // QCache::object поднимает запись в начало LRU-очереди
+    return tiles_.object(key);
+}
+
+void SpectrogramCache::insert(const SpectrogramTileKey& key, const QImage& image)
+{
+    if (image.isNull()) {
+        return;
+    }
+    const qsizetype cost = qMax<qsizetype>(1, qsizetype(image.sizeInBytes() / 1024));
+    tiles_.insert(key, new QImage(image), cost);
+}
+
+void SpectrogramCache::setBudgetBytes(qint64 bytes)
+{
+    tiles_.setMaxCost(qMax<qsizetype>(1, qsizetype(bytes / 1024)));
+}
+
+void SpectrogramWantedTiles::assign(const QSet<SpectrogramTileKey>& keys)
+{
+    QMutexLocker lock(&mutex_);
+    keys_ = keys;
+}
+
+bool SpectrogramWantedTiles::contains(const SpectrogramTileKey& key) const
+{
+    QMutexLocker lock(&mutex_);
+    return keys_.contains(key);
+}
@@ -0,0 +1,228 @@
+#include "../include/tempomap.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+/** Прямая «номер доли → сэмпл» по методу наименьших квадратов (накопительно). */
+struct LineFit {
+    double sx = 0.0;
+    double sy = 0.0;
+    double sxx = 0.0;
+    double sxy = 0.0;
+    int count = 0;
+
+    void add(double x, double y)
+    {
+        sx += x;
+        sy += y;
+        sxx += x * x;
+        sxy += x * y;
+        ++count;
+    }
+
+    double slope() const
+    {
+        const double denominator = count * sxx - sx * sx;
+        return denominator != 0.0 ? (count * sxy - sx * sy) / denominator : 0.0;
+    }
+
+    double intercept() const { return count > 0 ? (sy - slope() * sx) / count : 0.0; }
+};
+
+} // namespace
+
+TempoMap TempoMap::constant(double samplesPerBeat, qint64 gridStartSample)
+{
+    TempoMap map;
+    if (samplesPerBeat > 0.0) {
+        map.segments_.append(Segment { double(gridStartSample), 0.0, samplesPerBeat });
+    }
+    return map;
+}
+
+TempoMap TempoMap::fromBeats(const QVector<qint64>& beatPositions,
+                             double beatScale,
+                             double maxResidualBeats)
+{
+    TempoMap map;
+    const int n = beatPositions.size();
+    if (n < 2 || beatScale <= 0.0) {
+        return map;
+    }
+    const qint64* beats = beatPositions.constData();
+
+    // Сегмент: доли [first, last] на одной прямой; соседние сегменты делят
+    // граничную долю, чтобы стык был общим
+    struct Fit {
+        int first = 0;
+        int last = 0;
+        double intercept = 0.0;  // сэмпл доли first (относительно beats[first])
+        double slope = 0.0;      // сэмплов на интервал между найденными долями
+
+        double sampleAt(const qint64* positions, int index) const
+        {
+            return double(positions[first]) + intercept + slope * (index - first);
+        }
+    };
+    QVector<Fit> fits;
+
+    QVector<int> members;
+    int first = 0;
+    while (first < n - 1) {
+        LineFit line;
+        members.clear();
+        const auto addBeat = [&](int index) {
+            line.add(index - first, double(beats[index] - beats[first]));
+            members.append(index);
+        };
+        // Проверка без добавления: все доли сегмента вместе с index — на прямой
+        const auto fitsWith = [&](int index) {
+            LineFit candidate = line;
+            candidate.add(index - first, double(beats[index] - beats[first]));
+            const double slope = candidate.slope();
+            if (slope <= 0.0) {
+                return false;
+            }
+            const double intercept = candidate.intercept();
+            const double limit = maxResidualBeats * slope;
+            const auto residual = [&](int k) {
+                return std::abs(double(beats[k] - beats[first]) - (intercept + slope * (k - first)));
+            };
+            if (residual(index) > limit) {
+                return false;
+            }
+            for (int k : members) {
+                if (residual(k) > limit) {
+                    return false;
+                }
+            }
+            return true;
+        };
+
+        addBeat(first);
+        addBeat(first + 1);
+        int last = first + 1;
+        int next = first + 2;
+        while (next < n) {
+            if (fitsWith(next)) {
+                addBeat(next);
+                last = next++;
+            } else if (next + 1 < n && fitsWith(next + 1)) {
+                // Одиночный выброс детектора: следующая доля снова на прямой
+                addBeat(next + 1);
+                last = next + 1;
+                next += 2;
+            } else {
+                break;
+            }
+        }
+
+        Fit fit;
+        fit.first = first;
+        fit.last = last;
+        fit.slope = line.slope();
+        fit.intercept = line.intercept();
+        if (fit.slope > 0.0) {
+            fits.append(fit);
+        }
+        first = last;
+    }
+    if (fits.isEmpty()) {
+        return map;
+    }
+
+    // Опорные точки — на стыках; там берём среднее двух прямых
+    QVector<double> anchorIndex;
+    QVector<double> anchorSample;
+    const auto addAnchor = [&](int index, double sample) {
+        if (!anchorSample.isEmpty() && (sample <= anchorSample.last() || index <= anchorIndex.last())) {
+            return;
+        }
+        anchorIndex.append(index);
+        anchorSample.append(sample);
+    };
+    addAnchor(fits.first().first, fits.first().sampleAt(beats, fits.first().first));
+    for (int i = 1; i < fits.size(); ++i) {
+        const int boundary = fits[i].first;
+        addAnchor(boundary, 0.5 * (fits[i - 1].sampleAt(beats, boundary) + fits[i].sampleAt(beats, boundary)));
+    }
+    addAnchor(fits.last().last, fits.last().sampleAt(beats, fits.last().last));
+
+    if (anchorSample.size() < 2) {
+        return constant(fits.first().slope / beatScale, qint64(std::llround(anchorSample.first())));
+    }
+    for (int i = 0; i + 1 < anchorSample.size(); ++i) {
+        const double beatSpan = (anchorIndex[i + 1] - anchorIndex[i]) * beatScale;
+        map.segments_.append(Segment { anchorSample[i],
+                                       anchorIndex[i] * beatScale,
+                                       (anchorSample[i + 1] - anchorSample[i]) / beatSpan });
+    }
+    return map;
+}
+
+int TempoMap::segmentAtSample(double sample) const
+{
+    const auto it = std::upper_bound(segments_.cbegin(), segments_.cend(), sample,
+                                     [](double value, const Segment& segment) {
+                                         return value < segment.startSample;
+                                     });
+    return qMax(0, int(it - segments_.cbegin()) - 1);
+}
+
+int TempoMap::segmentAtBeat(double beat) const
+{
+    const auto it = std::upper_bound(segments_.cbegin(), segments_.cend(), beat,
+                                     [](double value, const Segment& segment) {
+                                         return value < segment.startBeat;
+                                     });
+    return qMax(0, int(it - segments_.cbegin()) - 1);
+}
+
+double TempoMap::beatAtSample(double sample) const
+{
+    if (segments_.isEmpty()) {
+        return 0.0;
+    }
+    const Segment& segment = segments_[segmentAtSample(sample)];
+    return segment.startBeat + (sample - segment.startSample) / segment.samplesPerBeat;
+}
+
+double TempoMap::sampleAtBeat(double beat) const
+{
+    if (segments_.isEmpty()) {
+        return 0.0;
+    }
+    const Segment& segment = segments_[segmentAtBeat(beat)];
+    return segment.startSample + (beat - segment.startBeat) * segment.samplesPerBeat;
+}
+
+double TempoMap::samplesPerBeatAt(double sample) const
+{
+    return segments_.isEmpty() ? 0.0 : segments_[segmentAtSample(sample)].samplesPerBeat;
+}
+
+double TempoMap::bpmAt(double sample, int sampleRate) const
+{
+    const double samplesPerBeat = samplesPerBeatAt(sample);
+    return samplesPerBeat > 0.0 ? 60.0 * sampleRate / samplesPerBeat : 0.0;
+}
+
+void TempoMap::shift(double sampleDelta)
+{
+    for (Segment& segment : segments_) {
+        segment.startSample += sampleDelta;
+    }
+}
+
+void TempoMap::rebase(qint64 gridStartSample)
+{
+    if (segments_.isEmpty()) {
+        return;
+    }
+    const double origin = std::round(beatAtSample(double(gridStartSample)));
+    for (Segment& segment : segments_) {
+        segment.startBeat -= origin;
+    }
+}
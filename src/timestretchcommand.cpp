@@ -17,6 +17,12 @@ TimeStretchCommand::TimeStretchCommand(WaveformView* view,
     setText(text);
 }
 
+void TimeStretchCommand::setSourceEdit(const WaveformView::SourceEdit& edit)
+{
+    sourceEdit = edit;
+    hasSourceEdit = true;
+}
+
 void TimeStretchCommand::undo()
 {
     if (!waveformView) {
@@ -43,7 +49,11 @@ void TimeStretchCommand::redo()
     }
 
     // Применяем новые аудиоданные
-    waveformView->setAudioData(newAudioData);
+    if (hasSourceEdit) {
+        waveformView->setAudioData(newAudioData, sourceEdit);
+    } else {
+        waveformView->setAudioData(newAudioData);
+    }
 
     // Применяем новые метки
     waveformView->setMarkers(newMarkerData);
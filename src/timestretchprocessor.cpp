@@ -320,9 +320,23 @@ QVector<MarkerData> TimeStretchProcessor::buildBeatAlignmentMarkers(
     qint64 gridStartSample,
     qint64 totalSamples,
     int sampleRate)
+{
+    if (beatIntervalSamples < 1.0) {
+        return {};
+    }
+    return buildBeatAlignmentMarkers(beatPositions,
+                                     TempoMap::constant(beatIntervalSamples, gridStartSample),
+                                     totalSamples, sampleRate);
+}
+
+QVector<MarkerData> TimeStretchProcessor::buildBeatAlignmentMarkers(
+    const QVector<qint64>& beatPositions,
+    const TempoMap& tempoMap,
+    qint64 totalSamples,
+    int sampleRate)
 {
     QVector<MarkerData> markers;
-    if (beatPositions.isEmpty() || beatIntervalSamples < 1.0 || totalSamples <= 1
+    if (beatPositions.isEmpty() || tempoMap.isEmpty() || totalSamples <= 1
         || sampleRate <= 0) {
         return markers;
     }
@@ -348,10 +362,8 @@ QVector<MarkerData> TimeStretchProcessor::buildBeatAlignmentMarkers(
         if (beat <= 0 || beat >= totalSamples) {
             continue;  // края закрепляются отдельно
         }
-        const qint64 gridIndex =
-            qint64(std::llround((double(beat) - double(gridStartSample)) / beatIntervalSamples));
-        const qint64 target =
-            gridStartSample + qint64(std::llround(double(gridIndex) * beatIntervalSamples));
+        const qint64 gridIndex = qint64(std::llround(tempoMap.beatAtSample(double(beat))));
+        const qint64 target = qint64(std::llround(tempoMap.sampleAtBeat(double(gridIndex))));
         if (target <= 0 || target >= totalSamples) {
             continue;
         }
@@ -433,6 +445,31 @@ TimeStretchProcessor::StretchResult TimeStretchProcessor::alignBeatsToGrid(
     return result;
 }
 
+TimeStretchProcessor::StretchResult TimeStretchProcessor::alignBeatsToGrid(
+    const QVector<QVector<float>>& audioData,
+    const QVector<qint64>& beatPositions,
+    const TempoMap& tempoMap,
+    int sampleRate,
+    bool preservePitch)
+{
+    StretchResult result;
+    result.audioData = audioData;
+
+    if (audioData.isEmpty() || audioData[0].isEmpty() || tempoMap.isEmpty() || sampleRate <= 0) {
+        return result;
+    }
+
+    const QVector<MarkerData> markers = buildBeatAlignmentMarkers(
+        beatPositions, tempoMap, audioData[0].size(), sampleRate);
+    if (markers.size() < 2) {
+        qDebug() << "alignBeatsToGrid: нечего выравнивать";
+        return result;
+    }
+
+    result = applyMarkerStretch(audioData, markers, sampleRate, preservePitch);
+    return result;
+}
+
 QVector<TimeStretchProcessor::StretchSegment> TimeStretchProcessor::calculateSegments(
     const QVector<MarkerData>& markers,
     qint64 audioSize,
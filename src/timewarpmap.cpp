@@ -0,0 +1,159 @@
+#include "../include/timewarpmap.h"
+
+#include <algorithm>
+
+TimeWarpMap::TimeWarpMap(const QVector<Marker>& markers, qint64 originalSize)
+    : originalSize_(originalSize)
+    , displaySize_(qMax(originalSize, qint64(1)))
+{
+    source_.reserve(markers.size());
+    for (const Marker& marker : markers) {
+        source_.append(Anchor { marker.originalPosition, marker.position });
+        changesTimeline_ = changesTimeline_ || marker.position != marker.originalPosition;
+    }
+    // Метки на своих местах — карта тождественная (и без ошибок округления)
+    if (markers.size() < 2 || originalSize <= 0 || !changesTimeline_) {
+        displaySize_ = originalSize;
+        return;
+    }
+
+    anchors_ = source_;
+    std::stable_sort(anchors_.begin(), anchors_.end(), [](const Anchor& a, const Anchor& b) {
+        return a.original < b.original;
+    });
+    for (int i = 1; i < anchors_.size(); ++i) {
+        displayMonotonic_ = displayMonotonic_ && anchors_[i - 1].display <= anchors_[i].display;
+    }
+
+    // Хвост после последней метки тянется с коэффициентом последнего отрезка
+    const Anchor& m0 = anchors_[anchors_.size() - 2];
+    const Anchor& m1 = anchors_.last();
+    qint64 displayLen = m1.display;
+    const qint64 origTail = originalSize - m1.original;
+    if (origTail > 0) {
+        const qint64 origSeg = m1.original - m0.original;
+        const qint64 dispSeg = m1.display - m0.display;
+        if (origSeg > 0 && dispSeg > 0) {
+            const float tailFactor = qMax(0.1f, float(dispSeg) / float(origSeg));
+            displayLen += qint64(origTail * tailFactor);
+        } else {
+            displayLen += origTail;
+        }
+    }
+    displaySize_ = qMax(displayLen, qint64(1));
+}
+
+bool TimeWarpMap::isBuiltFor(const QVector<Marker>& markers, qint64 originalSize) const
+{
+    if (originalSize != originalSize_ || markers.size() != source_.size()) {
+        return false;
+    }
+    for (int i = 0; i < markers.size(); ++i) {
+        if (markers[i].originalPosition != source_[i].original
+            || markers[i].position != source_[i].display) {
+            return false;
+        }
+    }
+    return true;
+}
+
+qint64 TimeWarpMap::clampOriginal(qint64 pos) const
+{
+    return qBound(qint64(0), pos, originalSize_ - 1);
+}
+
+qint64 TimeWarpMap::toDisplay(qint64 originalPos) const
+{
+    if (anchors_.size() < 2) {
+        return originalPos;
+    }
+
+    // До первой метки — масштаб от нуля до первой метки
+    const Anchor& first = anchors_.first();
+    if (originalPos <= first.original) {
+        if (first.original <= 0) {
+            return originalPos;
+        }
+        const double t = double(originalPos) / double(first.original);
+        return qint64(t * first.display);
+    }
+
+    // После последней метки — продолжение последнего отрезка
+    const Anchor& last = anchors_.last();
+    if (originalPos >= last.original) {
+        const Anchor& m0 = anchors_[anchors_.size() - 2];
+        const qint64 origLen = last.original - m0.original;
+        if (origLen <= 0) {
+            return originalPos;
+        }
+        const double t = double(originalPos - last.original) / double(origLen);
+        return last.display + qint64(t * (last.display - m0.display));
+    }
+
+    // Отрезок [m0, m1), в который попадает позиция: первая опора правее неё — m1
+    const auto next = std::upper_bound(anchors_.cbegin(), anchors_.cend(), originalPos,
+                                       [](qint64 pos, const Anchor& a) { return pos < a.original; });
+    const Anchor& m1 = *next;
+    const Anchor& m0 = *(next - 1);
+    const double t = double(originalPos - m0.original) / double(m1.original - m0.original);
+    return m0.display + qint64(t * (m1.display - m0.display));
+}
+
+qint64 TimeWarpMap::toOriginal(qint64 displayPos) const
+{
+    if (anchors_.size() < 2) {
+        return clampOriginal(displayPos);
+    }
+
+    const Anchor& first = anchors_.first();
+    if (displayPos <= first.display) {
+        if (first.display <= 0) {
+            return clampOriginal(displayPos);
+        }
+        const double t = double(displayPos) / double(first.display);
+        return clampOriginal(qint64(t * first.original));
+    }
+
+    const Anchor& last = anchors_.last();
+    if (displayPos >= last.display) {
+        const Anchor& m0 = anchors_[anchors_.size() - 2];
+        const qint64 origLen = last.original - m0.original;
+        const qint64 dispLen = last.display - m0.display;
+        const qint64 origTail = originalSize_ - last.original;
+        const qint64 dispTail = qMax<qint64>(1, displaySize_ - last.display);
+        if (origLen > 0 && dispLen > 0 && origTail > 0) {
+            const double t = double(displayPos - last.display) / double(dispTail);
+            return clampOriginal(last.original + qint64(t * origTail));
+        }
+        return clampOriginal(last.original);
+    }
+
+    // Отрезок, в который попадает позиция таймлайна. Метки обычно не
+    // перекрещиваются — тогда поиск двоичный; иначе берётся первый подходящий
+    int segment = -1;
+    if (displayMonotonic_) {
+        const auto next = std::upper_bound(anchors_.cbegin(), anchors_.cend(), displayPos,
+                                           [](qint64 pos, const Anchor& a) { return pos < a.display; });
+        segment = int(next - anchors_.cbegin()) - 1;
+    } else {
+        for (int i = 0; i + 1 < anchors_.size(); ++i) {
+            if (displayPos >= anchors_[i].display && displayPos < anchors_[i + 1].display) {
+                segment = i;
+                break;
+            }
+        }
+    }
+    if (segment < 0 || segment + 1 >= anchors_.size()) {
+        return clampOriginal(displayPos);
+    }
+
+    const Anchor& m0 = anchors_[segment];
+    const Anchor& m1 = anchors_[segment + 1];
+    const qint64 origLen = m1.original - m0.original;
+    const qint64 dispLen = m1.display - m0.display;
+    if (origLen <= 0 || dispLen <= 0) {
+        return clampOriginal(displayPos);
+    }
+    const double t = double(displayPos - m0.display) / double(dispLen);
+    return clampOriginal(m0.original + qint64(t * origLen));
+}
@@ -1,4 +1,5 @@
 #include "../include/waveformanalyzer.h"
+#include "../include/fft_engine.h"
 #include <QtCore/QDebug>
 #include <QtCore/QtMath>
 #include <cmath>
@@ -374,19 +375,30 @@ QVector<float> WaveformAnalyzer::calculateFFT(const QVector<float>& samples, int
         return result;
     }
     
-    // Простая реализация FFT (заглушка)
-    // В реальной реализации здесь должен быть эффективный FFT алгоритм
-    for (int i = 0; i < std::min(static_cast<int>(samples.size()), fftSize); ++i) {
-        result[i * 2] = samples[i]; // Real part
-        result[i * 2 + 1] = 0.0f;   // Imaginary part
+    const int count = std::min(static_cast<int>(samples.size()), fftSize);
+    
+    // Степень двойки — через общий план DFEngine (O(N log N), таблицы готовы)
+    if (DFEngine::nextPow2(unsigned(fftSize)) == unsigned(fftSize) && fftSize >= 2) {
+        const DFEngine::FFTPlan& plan = DFEngine::FFTPlan::forSize(unsigned(fftSize));
+        std::vector<DFEngine::Complex> spectrum(plan.binCount());
+        plan.forward(samples.constData(), unsigned(count), nullptr, spectrum.data());
+        
+        // Вторая половина спектра вещественного сигнала — сопряжённое зеркало первой
+        for (int k = 0; k < fftSize; ++k) {
+            const DFEngine::Complex bin = (k <= fftSize / 2) ? spectrum[k]
+                                                             : std::conj(spectrum[fftSize - k]);
+            result[k * 2] = bin.real();
+            result[k * 2 + 1] = bin.imag();
+        }
+        return result;
     }
     
-    // Простое преобразование Фурье (неэффективное, только для демонстрации)
+    // Прямое преобразование Фурье для размеров не степени двойки (редкий путь)
     for (int k = 0; k < fftSize; ++k) {
         float real = 0.0f;
         float imag = 0.0f;
         
-        for (int n = 0; n < fftSize; ++n) {
+        for (int n = 0; n < count; ++n) {
             float angle = -2.0f * M_PI * k * n / fftSize;
             real += samples[n] * std::cos(angle);
             imag += samples[n] * std::sin(angle);
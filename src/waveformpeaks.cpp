@@ -1,83 +1,429 @@
 #include "../include/waveformpeaks.h"
 
+#include <QtCore/QRunnable>
+#include <QtCore/QSemaphore>
+#include <QtCore/QThread>
+#include <QtCore/QThreadPool>
+
 #include <algorithm>
+#include <cstring>
+
+namespace {
+
+// Меньше этого (сэмплов всех каналов) потоки не окупают свой запуск
+constexpr qint64 kParallelMinSamples = qint64(1) << 20;
+
+using MinMaxKernel = void (*)(const float* data, qint64 count, float& minValue, float& maxValue);
+
+void minMaxScalar(const float* data, qint64 count, float& minValue, float& maxValue)
+{
+    float lo = data[0];
+    float hi = lo;
+    for (qint64 i = 1; i < count; ++i) {
+        lo = std::min(lo, data[i]);
+        hi = std::max(hi, data[i]);
+    }
+    minValue = lo;
+    maxValue = hi;
+}
+
+/** Свёртка векторных аккумуляторов и хвоста, не кратного ширине вектора. */
+void finishMinMax(const float* lanesMin, const float* lanesMax, int lanes,
+                  const float* tail, qint64 tailCount, float& minValue, float& maxValue)
+{
+    float lo = lanesMin[0];
+    float hi = lanesMax[0];
+    for (int i = 1; i < lanes; ++i) {
+        lo = std::min(lo, lanesMin[i]);
+        hi = std::max(hi, lanesMax[i]);
+    }
+    for (qint64 i = 0; i < tailCount; ++i) {
+        lo = std::min(lo, tail[i]);
+        hi = std::max(hi, tail[i]);
+    }
+    minValue = lo;
+    maxValue = hi;
+}
+
+#if defined(DFENGINE_HAS_X86_SIMD)
+void minMaxSse2(const float* data, qint64 count, float& minValue, float& maxValue)
+{
+    if (count < 4) {
+        minMaxScalar(data, count, minValue, maxValue);
+        return;
+    }
+    __m128 lo = _mm_loadu_ps(data);
+    __m128 hi = lo;
+    qint64 i = 4;
+    for (; i + 4 <= count; i += 4) {
+        const __m128 v = _mm_loadu_ps(data + i);
+        lo = _mm_min_ps(lo, v);
+        hi = _mm_max_ps(hi, v);
+    }
+    alignas(16) float lanesMin[4];
+    alignas(16) float lanesMax[4];
+    _mm_store_ps(lanesMin, lo);
+    _mm_store_ps(lanesMax, hi);
+    finishMinMax(lanesMin, lanesMax, 4, data + i, count - i, minValue, maxValue);
+}
+
+DFENGINE_TARGET_AVX2
+void minMaxAvx2(const float* data, qint64 count, float& minValue, float& maxValue)
+{
+    if (count < 16) {
+        minMaxScalar(data, count, minValue, maxValue);
+        return;
+    }
+    // Два аккумулятора: min/max с задержкой в несколько тактов не ждут друг друга
+    __m256 lo0 = _mm256_loadu_ps(data);
+    __m256 hi0 = lo0;
+    __m256 lo1 = _mm256_loadu_ps(data + 8);
+    __m256 hi1 = lo1;
+    qint64 i = 16;
+    for (; i + 16 <= count; i += 16) {
+        const __m256 a = _mm256_loadu_ps(data + i);
+        const __m256 b = _mm256_loadu_ps(data + i + 8);
+        lo0 = _mm256_min_ps(lo0, a);
+        hi0 = _mm256_max_ps(hi0, a);
+        lo1 = _mm256_min_ps(lo1, b);
+        hi1 = _mm256_max_ps(hi1, b);
+    }
+    alignas(32) float lanesMin[8];
+    alignas(32) float lanesMax[8];
+    _mm256_store_ps(lanesMin, _mm256_min_ps(lo0, lo1));
+    _mm256_store_ps(lanesMax, _mm256_max_ps(hi0, hi1));
+    finishMinMax(lanesMin, lanesMax, 8, data + i, count - i, minValue, maxValue);
+}
+#endif
+
+#if defined(DFENGINE_HAS_NEON)
+void minMaxNeon(const float* data, qint64 count, float& minValue, float& maxValue)
+{
+    if (count < 4) {
+        minMaxScalar(data, count, minValue, maxValue);
+        return;
+    }
+    float32x4_t lo = vld1q_f32(data);
+    float32x4_t hi = lo;
+    qint64 i = 4;
+    for (; i + 4 <= count; i += 4) {
+        const float32x4_t v = vld1q_f32(data + i);
+        lo = vminq_f32(lo, v);
+        hi = vmaxq_f32(hi, v);
+    }
+    float lanesMin[4];
+    float lanesMax[4];
+    vst1q_f32(lanesMin, lo);
+    vst1q_f32(lanesMax, hi);
+    finishMinMax(lanesMin, lanesMax, 4, data + i, count - i, minValue, maxValue);
+}
+#endif
+
+MinMaxKernel minMaxKernelFor(DFEngine::SimdKernel kernel)
+{
+    if (!DFEngine::isSimdKernelSupported(kernel)) {
+        return minMaxScalar;
+    }
+    switch (kernel) {
+    case DFEngine::SimdKernel::Scalar:
+        return minMaxScalar;
+    case DFEngine::SimdKernel::Sse2:
+#if defined(DFENGINE_HAS_X86_SIMD)
+        return minMaxSse2;
+#else
+        return minMaxScalar;
+#endif
+    case DFEngine::SimdKernel::Avx2:
+#if defined(DFENGINE_HAS_X86_SIMD)
+        return minMaxAvx2;
+#else
+        return minMaxScalar;
+#endif
+    case DFEngine::SimdKernel::Neon:
+#if defined(DFENGINE_HAS_NEON)
+        return minMaxNeon;
+#else
+        return minMaxScalar;
+#endif
+    }
+    return minMaxScalar;
+}
+
+/** Ядро для чтения отрезков при отрисовке; выбирается один раз за процесс. */
+MinMaxKernel bestMinMaxKernel()
+{
+    static const MinMaxKernel best = minMaxKernelFor(DFEngine::bestSimdKernel());
+    return best;
+}
+
+/** Заголовок блока serialize(): за ним корзины нижнего уровня как есть. */
+struct SerializedHeader {
+    quint32 magic;
+    qint32 channelCount;
+    qint64 sampleCount;
+    qint64 bucketSamples;
+};
+
+constexpr quint32 kSerializedMagic = 0x4B504644;  // "DFPK"
+
+} // namespace
 
 void WaveformPeaks::clear()
 {
     levels_.clear();
     sampleCount_ = 0;
+    channelCount_ = 0;
 }
 
-void WaveformPeaks::build(const QVector<float>& samples)
+void WaveformPeaks::build(const QVector<float>& samples, DFEngine::SimdKernel kernel)
 {
-    clear();
     if (samples.isEmpty()) {
+        clear();
         return;
     }
-    sampleCount_ = samples.size();
+    buildChannels(QVector<QVector<float>> { samples }, kernel);
+}
+
+void WaveformPeaks::buildChannels(const QVector<QVector<float>>& channels, DFEngine::SimdKernel kernel)
+{
+    clear();
+    if (!matchesChannels(channels, channels.isEmpty() ? 0 : channels[0].size())
+        || channels[0].isEmpty()) {
+        return;  // у каналов разная длина — одна сетка корзин им не подходит
+    }
+    sampleCount_ = channels[0].size();
+    channelCount_ = channels.size();
 
-    // Нижний уровень: min/max по корзинам сырых сэмплов
+    // Нижний уровень: min/max по корзинам сырых сэмплов, каналы вперемешку
     Level base;
     base.bucketSamples = kBaseBucketSamples;
-    const qint64 baseCount = (sampleCount_ + kBaseBucketSamples - 1) / kBaseBucketSamples;
-    base.buckets.resize(int(baseCount));
-    for (qint64 bucket = 0; bucket < baseCount; ++bucket) {
-        const qint64 from = bucket * kBaseBucketSamples;
-        const qint64 to = std::min<qint64>(from + kBaseBucketSamples, sampleCount_);
-        float minValue = samples[int(from)];
-        float maxValue = minValue;
-        for (qint64 i = from + 1; i < to; ++i) {
-            const float value = samples[int(i)];
-            minValue = std::min(minValue, value);
-            maxValue = std::max(maxValue, value);
-        }
-        base.buckets[int(bucket)] = Bucket { minValue, maxValue };
-    }
+    base.bucketCount = (sampleCount_ + kBaseBucketSamples - 1) / kBaseBucketSamples;
+    base.buckets.resize(base.bucketCount * channelCount_);
     levels_.append(std::move(base));
 
-    // Каждый следующий уровень вдвое грубее предыдущего
-    while (levels_.last().buckets.size() > 1) {
-        const Level& previous = levels_.last();
-        Level next;
-        next.bucketSamples = previous.bucketSamples * 2;
-        next.buckets.resize((previous.buckets.size() + 1) / 2);
-        for (int i = 0; i < next.buckets.size(); ++i) {
-            const Bucket& left = previous.buckets[i * 2];
-            const bool hasRight = i * 2 + 1 < previous.buckets.size();
-            const Bucket& right = hasRight ? previous.buckets[i * 2 + 1] : left;
-            next.buckets[i] = Bucket { std::min(left.min, right.min),
-                                       std::max(left.max, right.max) };
-        }
-        levels_.append(std::move(next));
+    computeBaseBuckets(channels, 0, levels_[0].bucketCount, kernel);
+    updateUpperLevels(0, levels_[0].bucketCount);
+}
+
+QByteArray WaveformPeaks::serialize() const
+{
+    if (!isValid()) {
+        return {};
     }
+    const Level& base = levels_[0];
+    const SerializedHeader header { kSerializedMagic, channelCount_, sampleCount_, base.bucketSamples };
+    const qsizetype bucketBytes = base.buckets.size() * qsizetype(sizeof(Bucket));
+
+    QByteArray out(qsizetype(sizeof(header)) + bucketBytes, Qt::Uninitialized);
+    std::memcpy(out.data(), &header, sizeof(header));
+    std::memcpy(out.data() + sizeof(header), base.buckets.constData(), size_t(bucketBytes));
+    return out;
 }
 
-bool WaveformPeaks::range(const QVector<float>& samples, qint64 from, qint64 to,
-                          float& minValue, float& maxValue) const
+bool WaveformPeaks::deserialize(const char* data, qint64 size)
 {
-    if (samples.size() != sampleCount_ || sampleCount_ <= 0) {
-        return false;  // пирамида не от этих сэмплов — пусть считает вызывающий
+    clear();
+    SerializedHeader header {};
+    if (!data || size < qint64(sizeof(header))) {
+        return false;
+    }
+    std::memcpy(&header, data, sizeof(header));
+    if (header.magic != kSerializedMagic || header.channelCount <= 0 || header.sampleCount <= 0
+        || header.bucketSamples != kBaseBucketSamples) {
+        return false;
+    }
+    // Числа из файла сверяются с его размером до умножения: испорченный или
+    // чужой заголовок не должен переполнить счёт и задать размер выделения
+    const qint64 bucketCount = header.sampleCount / kBaseBucketSamples
+        + (header.sampleCount % kBaseBucketSamples != 0 ? 1 : 0);
+    const qint64 bytesPerBucket = qint64(header.channelCount) * qint64(sizeof(Bucket));
+    const qint64 payload = size - qint64(sizeof(header));
+    if (bucketCount > payload / bytesPerBucket) {
+        return false;
+    }
+    const qint64 bucketBytes = bucketCount * bytesPerBucket;
+    if (payload != bucketBytes) {
+        return false;
+    }
+
+    Level base;
+    base.bucketCount = bucketCount;
+    base.buckets.resize(bucketCount * header.channelCount);
+    std::memcpy(base.buckets.data(), data + sizeof(header), size_t(bucketBytes));
+    levels_.append(std::move(base));
+    sampleCount_ = header.sampleCount;
+    channelCount_ = header.channelCount;
+    updateUpperLevels(0, bucketCount);
+    return true;
+}
+
+void WaveformPeaks::update(const QVector<QVector<float>>& channels, qint64 from, qint64 to)
+{
+    if (!isValid() || channels.size() != channelCount_ || !matchesChannels(channels, sampleCount_)) {
+        buildChannels(channels);
+        return;
     }
     from = std::max<qint64>(0, from);
     to = std::min<qint64>(to, sampleCount_);
     if (to <= from) {
+        return;
+    }
+    const qint64 firstBucket = from / kBaseBucketSamples;
+    const qint64 lastBucket = (to + kBaseBucketSamples - 1) / kBaseBucketSamples;
+    computeBaseBuckets(channels, firstBucket, lastBucket, DFEngine::bestSimdKernel());
+    updateUpperLevels(firstBucket, lastBucket);
+}
+
+void WaveformPeaks::splice(const QVector<QVector<float>>& channels, qint64 at, qint64 removed,
+                           qint64 inserted)
+{
+    const bool consistent = isValid() && channels.size() == channelCount_
+        && at >= 0 && at <= sampleCount_ && removed >= 0 && removed <= sampleCount_ - at
+        && inserted >= 0 && matchesChannels(channels, sampleCount_ - removed + inserted);
+    if (!consistent || sampleCount_ - removed + inserted == 0) {
+        buildChannels(channels);
+        return;
+    }
+
+    const qint64 newSampleCount = sampleCount_ - removed + inserted;
+    const qint64 delta = inserted - removed;
+    Level& base = levels_[0];
+    const qint64 oldCount = base.bucketCount;
+    const qint64 newCount = (newSampleCount + kBaseBucketSamples - 1) / kBaseBucketSamples;
+
+    // Корзина с точкой правки меняется в любом случае; всё, что левее, — нет
+    const qint64 firstBucket = at / kBaseBucketSamples;
+    qint64 lastBucket = newCount;
+
+    // Если длина изменилась на целое число корзин, хвост после правки — те же
+    // корзины со сдвигом: переносим их, а не считаем заново. Иначе границы
+    // корзин хвоста сместились, и его придётся пересчитать
+    if (delta % kBaseBucketSamples == 0) {
+        const qint64 shift = delta / kBaseBucketSamples;
+        const qint64 tailBucket = (at + removed + kBaseBucketSamples - 1) / kBaseBucketSamples;
+        const qint64 tailCount = oldCount - tailBucket;
+        if (shift > 0) {
+            base.buckets.resize(newCount * channelCount_);
+        }
+        if (tailCount > 0 && shift != 0) {
+            Bucket* data = base.buckets.data();
+            std::memmove(data + (tailBucket + shift) * channelCount_,
+                         data + tailBucket * channelCount_,
+                         size_t(tailCount * channelCount_) * sizeof(Bucket));
+        }
+        lastBucket = tailBucket + shift;
+    }
+    base.buckets.resize(newCount * channelCount_);
+    base.bucketCount = newCount;
+    sampleCount_ = newSampleCount;
+
+    computeBaseBuckets(channels, firstBucket, lastBucket, DFEngine::bestSimdKernel());
+    // Выше корзины склеиваются парами, и сдвиг на нечётное число корзин их
+    // перемешивает: верхние уровни пересчитываем от точки правки до конца
+    updateUpperLevels(firstBucket, newCount);
+}
+
+bool WaveformPeaks::matchesChannels(const QVector<QVector<float>>& channels, qint64 sampleCount)
+{
+    if (channels.isEmpty()) {
         return false;
     }
+    for (const QVector<float>& channel : channels) {
+        if (channel.size() != sampleCount) {
+            return false;
+        }
+    }
+    return true;
+}
 
-    const qint64 span = to - from;
-    minValue = samples[int(from)];
-    maxValue = minValue;
+void WaveformPeaks::computeBaseBuckets(const QVector<QVector<float>>& channels, qint64 firstBucket,
+                                       qint64 lastBucket, DFEngine::SimdKernel kernel)
+{
+    if (lastBucket <= firstBucket) {
+        return;
+    }
+    const MinMaxKernel minMax = minMaxKernelFor(kernel);
+    Bucket* out = levels_[0].buckets.data();
+    const int channelCount = channelCount_;
+    const qint64 sampleCount = sampleCount_;
+    auto buildBuckets = [&](qint64 first, qint64 last) {
+        for (int ch = 0; ch < channelCount; ++ch) {
+            const float* samples = channels[ch].constData();
+            for (qint64 bucket = first; bucket < last; ++bucket) {
+                const qint64 from = bucket * kBaseBucketSamples;
+                const qint64 to = std::min<qint64>(from + kBaseBucketSamples, sampleCount);
+                Bucket& value = out[bucket * channelCount + ch];
+                minMax(samples + from, to - from, value.min, value.max);
+            }
+        }
+    };
 
-    // Вблизи (несколько сэмплов на пиксель) дешевле и точнее прочитать напрямую
-    if (span <= kBaseBucketSamples * 2 || levels_.isEmpty()) {
-        for (qint64 i = from + 1; i < to; ++i) {
-            const float value = samples[int(i)];
-            minValue = std::min(minValue, value);
-            maxValue = std::max(maxValue, value);
+    // Куски дорожки независимы — раскладываем по ядрам. Пул свой, как в
+    // PitchDetector: сборка может идти из задачи глобального пула
+    const qint64 bucketCount = lastBucket - firstBucket;
+    const int threadCount = qBound(1, QThread::idealThreadCount(), 16);
+    if (threadCount <= 1 || bucketCount * kBaseBucketSamples * channelCount < kParallelMinSamples) {
+        buildBuckets(firstBucket, lastBucket);
+        return;
+    }
+
+    QThreadPool pool;
+    pool.setMaxThreadCount(threadCount);
+    QSemaphore finished;
+    const qint64 chunkBuckets = (bucketCount + threadCount - 1) / threadCount;
+    for (int chunk = 0; chunk < threadCount; ++chunk) {
+        const qint64 first = firstBucket + chunk * chunkBuckets;
+        const qint64 last = std::min(lastBucket, first + chunkBuckets);
+        if (first >= last) {
+            finished.release();
+            continue;
         }
-        return true;
+        pool.start(QRunnable::create([&, first, last]() {
+            buildBuckets(first, last);
+            finished.release();
+        }));
     }
+    finished.acquire(threadCount);
+}
+
+void WaveformPeaks::updateUpperLevels(qint64 firstBucket, qint64 lastBucket)
+{
+    // Каждый следующий уровень вдвое грубее предыдущего; пересчитываются только
+    // предки корзин [firstBucket, lastBucket) нижнего уровня
+    const int channelCount = channelCount_;
+    int levelIndex = 1;
+    while (levels_[levelIndex - 1].bucketCount > 1) {
+        if (levelIndex == levels_.size()) {
+            Level next;
+            next.bucketSamples = levels_[levelIndex - 1].bucketSamples * 2;
+            levels_.append(std::move(next));
+        }
+        const Level& previous = levels_[levelIndex - 1];
+        Level& next = levels_[levelIndex];
+        next.bucketCount = (previous.bucketCount + 1) / 2;
+        next.buckets.resize(next.bucketCount * channelCount);
+
+        firstBucket /= 2;
+        lastBucket = std::min(next.bucketCount, (lastBucket + 1) / 2);
+        const Bucket* in = previous.buckets.constData();
+        Bucket* out = next.buckets.data();
+        for (qint64 i = firstBucket; i < lastBucket; ++i) {
+            const bool hasRight = i * 2 + 1 < previous.bucketCount;
+            const Bucket* left = in + i * 2 * channelCount;
+            const Bucket* right = hasRight ? left + channelCount : left;
+            for (int ch = 0; ch < channelCount; ++ch) {
+                out[i * channelCount + ch] = Bucket { std::min(left[ch].min, right[ch].min),
+                                                      std::max(left[ch].max, right[ch].max) };
+            }
+        }
+        ++levelIndex;
+    }
+    // Дорожка укоротилась — лишние верхние уровни больше не нужны
+    levels_.resize(levelIndex);
+}
 
+int WaveformPeaks::levelForSpan(qint64 span) const
+{
     // Самый мелкий уровень, у которого в отрезок помещается хотя бы
     // kMinBucketsPerRange корзин: тогда захват соседних сэмплов по краям не
     // больше доли отрезка, а чтений — десятки вместо тысяч
@@ -88,19 +434,95 @@ bool WaveformPeaks::range(const QVector<float>& samples, qint64 from, qint64 to,
         }
         levelIndex = i;
     }
-    const Level& level = levels_[levelIndex];
+    return levelIndex;
+}
+
+bool WaveformPeaks::range(const QVector<float>& samples, qint64 from, qint64 to,
+                          float& minValue, float& maxValue) const
+{
+    return range(0, samples, from, to, minValue, maxValue);
+}
+
+bool WaveformPeaks::range(int channel, const QVector<float>& samples, qint64 from, qint64 to,
+                          float& minValue, float& maxValue) const
+{
+    if (samples.size() != sampleCount_ || sampleCount_ <= 0
+        || channel < 0 || channel >= channelCount_) {
+        return false;  // пирамида не от этих сэмплов — пусть считает вызывающий
+    }
+    from = std::max<qint64>(0, from);
+    to = std::min<qint64>(to, sampleCount_);
+    if (to <= from) {
+        return false;
+    }
+
+    const qint64 span = to - from;
+
+    // Вблизи (несколько сэмплов на пиксель) дешевле и точнее прочитать напрямую
+    if (span <= kBaseBucketSamples * 2 || levels_.isEmpty()) {
+        bestMinMaxKernel()(samples.constData() + from, span, minValue, maxValue);
+        return true;
+    }
+
+    minValue = samples[from];
+    maxValue = minValue;
+
+    const Level& level = levels_[levelForSpan(span)];
     const qint64 bucketSamples = level.bucketSamples;
 
     // Берём все корзины, задевающие отрезок. Края слегка захватываются с
     // запасом: для волны важно не потерять всплеск, а лишний сэмпл соседней
     // корзины на глаз неразличим (и всё равно попадёт в соседний пиксель)
     const qint64 firstBucket = from / bucketSamples;
-    const qint64 lastBucket = std::min<qint64>((to - 1) / bucketSamples,
-                                               level.buckets.size() - 1);
+    const qint64 lastBucket = std::min<qint64>((to - 1) / bucketSamples, level.bucketCount - 1);
+    const Bucket* buckets = level.buckets.constData();
     for (qint64 bucket = firstBucket; bucket <= lastBucket; ++bucket) {
-        const Bucket& value = level.buckets[int(bucket)];
+        const Bucket& value = buckets[bucket * channelCount_ + channel];
         minValue = std::min(minValue, value.min);
         maxValue = std::max(maxValue, value.max);
     }
     return true;
 }
+
+bool WaveformPeaks::rangeAll(const QVector<QVector<float>>& channels, qint64 from, qint64 to,
+                             float* minValues, float* maxValues) const
+{
+    if (channels.size() != channelCount_ || sampleCount_ <= 0
+        || !matchesChannels(channels, sampleCount_)) {
+        return false;
+    }
+    from = std::max<qint64>(0, from);
+    to = std::min<qint64>(to, sampleCount_);
+    if (to <= from) {
+        return false;
+    }
+
+    const qint64 span = to - from;
+    if (span <= kBaseBucketSamples * 2 || levels_.isEmpty()) {
+        const MinMaxKernel minMax = bestMinMaxKernel();
+        for (int ch = 0; ch < channelCount_; ++ch) {
+            minMax(channels[ch].constData() + from, span, minValues[ch], maxValues[ch]);
+        }
+        return true;
+    }
+
+    for (int ch = 0; ch < channelCount_; ++ch) {
+        minValues[ch] = channels[ch][from];
+        maxValues[ch] = minValues[ch];
+    }
+
+    // Корзины всех каналов лежат подряд: один проход по памяти на все каналы
+    const Level& level = levels_[levelForSpan(span)];
+    const qint64 bucketSamples = level.bucketSamples;
+    const qint64 firstBucket = from / bucketSamples;
+    const qint64 lastBucket = std::min<qint64>((to - 1) / bucketSamples, level.bucketCount - 1);
+    const Bucket* buckets = level.buckets.constData();
+    for (qint64 bucket = firstBucket; bucket <= lastBucket; ++bucket) {
+        const Bucket* row = buckets + bucket * channelCount_;
+        for (int ch = 0; ch < channelCount_; ++ch) {
+            minValues[ch] = std::min(minValues[ch], row[ch].min);
+            maxValues[ch] = std::max(maxValues[ch], row[ch].max);
+        }
+    }
+    return true;
+}
@@ -0,0 +1,104 @@
+#include "../include/waveformrasterizer.h"
+
+#include <QtCore/QtMath>
+
+namespace {
+
+// src поверх dst, оба premultiplied: dst * (255 − αsrc) / 255 + src
+inline quint32 blendOver(quint32 src, quint32 dst)
+{
+    const quint32 inverse = 255 - (src >> 24);
+    quint32 rb = (dst & 0x00ff00ff) * inverse;
+    quint32 ag = ((dst >> 8) & 0x00ff00ff) * inverse;
+    rb = ((rb + ((rb >> 8) & 0x00ff00ff) + 0x00800080) >> 8) & 0x00ff00ff;
+    ag = (ag + ((ag >> 8) & 0x00ff00ff) + 0x00800080) & 0xff00ff00;
+    return src + (rb | ag);
+}
+
+} // namespace
+
+WaveformRasterizer::WaveformRasterizer(const QColor& low, const QColor& mid, const QColor& high)
+{
+    const QColor colors[3] = { low, mid, high };
+    for (int i = 0; i < 3; ++i) {
+        bandColor_[i] = qPremultiply(colors[i].rgba());
+        opaque_ = opaque_ && colors[i].alpha() == 255;
+    }
+}
+
+void WaveformRasterizer::draw(QImage& image, int left, int columnCount, int channelCount,
+                              const float* minValues, const float* maxValues,
+                              const float* centerY, float halfHeight)
+{
+    if (image.isNull() || columnCount <= 0 || channelCount <= 0) {
+        return;
+    }
+    if (image.format() != QImage::Format_ARGB32_Premultiplied
+        && image.format() != QImage::Format_RGB32) {
+        return;
+    }
+
+    const int width = image.width();
+    const int height = image.height();
+    const int first = qMax(0, left);
+    const int last = qMin(width, left + columnCount);
+    if (first >= last) {
+        return;
+    }
+    const int spanCount = last - first;
+    spanTop_.resize(spanCount);
+    spanBottom_.resize(spanCount);
+    spanColor_.resize(spanCount);
+
+    uchar* bits = image.bits();
+    const qsizetype stride = image.bytesPerLine();
+
+    for (int ch = 0; ch < channelCount; ++ch) {
+        // Столбцы канала → отрезки строк [top, bottom] и цвет полосы
+        int yMin = height;
+        int yMax = -1;
+        for (int i = 0; i < spanCount; ++i) {
+            const int column = first + i - left;
+            const float minValue = qMin(0.0f, minValues[column * channelCount + ch]);
+            const float maxValue = qMax(0.0f, maxValues[column * channelCount + ch]);
+
+            const float range = maxValue - minValue;
+            spanColor_[i] = bandColor_[range < 0.3f ? 0 : (range < 0.6f ? 1 : 2)];
+
+            // Границы в float ограничиваем до перевода в int: выбросы не переполнят
+            const float topY = qBound(-1.0f, centerY[ch] - maxValue * halfHeight, float(height));
+            const float bottomY = qBound(-1.0f, centerY[ch] - minValue * halfHeight, float(height));
+            const int top = qMax(0, qFloor(topY));
+            const int bottom = qMin(height - 1, qFloor(bottomY));
+            if (top > bottom) {
+                spanTop_[i] = height;   // столбец целиком за краем — пустой отрезок
+                spanBottom_[i] = -1;
+                continue;
+            }
+            spanTop_[i] = top;
+            spanBottom_[i] = bottom;
+            yMin = qMin(yMin, top);
+            yMax = qMax(yMax, bottom);
+        }
+
+        // Построчное заполнение: строка — непрерывный кусок памяти
+        const int* tops = spanTop_.constData();
+        const int* bottoms = spanBottom_.constData();
+        const quint32* spanColors = spanColor_.constData();
+        for (int y = yMin; y <= yMax; ++y) {
+            quint32* row = reinterpret_cast<quint32*>(bits + y * stride) + first;
+            if (opaque_) {
+                for (int i = 0; i < spanCount; ++i) {
+                    const bool inside = y >= tops[i] && y <= bottoms[i];
+                    row[i] = inside ? spanColors[i] : row[i];
+                }
+            } else {
+                for (int i = 0; i < spanCount; ++i) {
+                    if (y >= tops[i] && y <= bottoms[i]) {
+                        row[i] = blendOver(spanColors[i], row[i]);
+                    }
+                }
+            }
+        }
+    }
+}
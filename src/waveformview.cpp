@@ -2,6 +2,7 @@
 #include "../include/beatvisualizer.h"
 #include "../include/timeutils.h"
 #include "../include/timestretchprocessor.h"
+#include "../include/waveformrasterizer.h"
 #include <QtCore/QtMath>
 #include <QtCore/QPoint>
 #include <QtCore/QRect>
@@ -16,12 +17,15 @@
 #include <QtCore/QDebug>
 #include <QtCore/QDeadlineTimer>
 #include <QtCore/QCoreApplication>
+#include <QtCore/QThread>
+#include <QtCore/QThreadPool>
 #include <QtWidgets/QApplication>
 #include <QtConcurrent/QtConcurrent>
 #include <QtGui/QResizeEvent>
 #include <thread>
 #include <cmath>
 #include <algorithm>
+#include <memory>
 
 // Определение статических констант
 const int WaveformView::minZoom = 1;
@@ -32,6 +36,14 @@ const int WaveformView::markerSpacing = 60;  // Минимальное расс
 // Минимальный сегмент между метками: 50 мс (в таком сегменте нельзя создавать новые метки)
 static const qint64 MIN_MARKER_SEGMENT_MS = 50;
 
+// Сколько более грубых уровней спектрограммы пробовать как подложку, пока
+// плитки нужного уровня считаются
+static const int SPECTROGRAM_FALLBACK_LEVELS = 4;
+
+// Поле изображения волны с каждой стороны окна (доля ширины): прокрутка в его
+// пределах не требует новой отрисовки
+static const float WAVE_RASTER_MARGIN = 0.25f;
+
 namespace {
 
 QRgb spectrogramColorForValue(float v, WaveformView::SpectrogramColorScheme scheme)
@@ -71,23 +83,26 @@ QRgb spectrogramColorForValue(float v, WaveformView::SpectrogramColorScheme sche
     return qRgb(r, g, b);
 }
 
-QVector<QImage> computeSpectrogramImages(const QVector<QVector<float>>& audioDataCopy,
-                                         int sampleRateCopy,
-                                         const WaveformView::SpectrogramSettings& settingsCopy)
-{
-    QVector<QImage> result;
-    result.resize(audioDataCopy.size());
+/** Неизменяемые параметры одного прохода спектрограммы, общие для всех плиток. */
+struct SpectrogramPass {
+    QVector<QVector<float>> audio;   // неявно разделяемая копия: плитки читают её из пула
+    int sampleRate = 0;
+    WaveformView::SpectrogramSettings settings;
+    std::vector<float> window;
+    const DFEngine::FFTPlan* plan = nullptr;
+};
 
-    const int windowSize = settingsCopy.windowSize;
-    const int maxFrames = settingsCopy.maxFrames;
-    const int freqBins = settingsCopy.freqBins;
-    const int zeroPadFactor = qMax(1, settingsCopy.zeroPadFactor);
-    const bool logScale = settingsCopy.logFreqScale;
-    const bool useDb = settingsCopy.dbAmplitude;
-    const float floorDb = settingsCopy.floorDb;
+std::shared_ptr<const SpectrogramPass> makeSpectrogramPass(const QVector<QVector<float>>& audio,
+                                                           int sampleRate,
+                                                           const WaveformView::SpectrogramSettings& settings)
+{
+    auto pass = std::make_shared<SpectrogramPass>();
+    pass->audio = audio;
+    pass->sampleRate = sampleRate;
+    pass->settings = settings;
 
     DFEngine::WindowFunction winType = DFEngine::WindowFunction::BlackmanHarris;
-    switch (settingsCopy.windowFunction) {
+    switch (settings.windowFunction) {
     case WaveformView::SpectrogramWindowFunction::Rectangular:
         winType = DFEngine::WindowFunction::Rectangular;
         break;
@@ -102,230 +117,89 @@ QVector<QImage> computeSpectrogramImages(const QVector<QVector<float>>& audioDat
         break;
     }
 
-    std::vector<float> window;
-    DFEngine::precomputeWindow(window, windowSize, winType);
+    const int windowSize = settings.windowSize;
+    DFEngine::precomputeWindow(pass->window, windowSize, winType);
+    // План (бит-реверс, поворотные множители) общий на все плитки и каналы
+    const unsigned fftSize = DFEngine::nextPow2(windowSize) * unsigned(qMax(1, settings.zeroPadFactor));
+    pass->plan = &DFEngine::FFTPlan::forSize(fftSize);
+    return pass;
+}
 
-    for (int ch = 0; ch < audioDataCopy.size(); ++ch) {
-        const QVector<float>& samples = audioDataCopy[ch];
-        if (samples.size() <= windowSize) {
-            result[ch] = QImage();
-            continue;
+/**
+ * Плитка \a key: кадры уровня key.level (шаг hopForLevel), сразу в пиксели,
+ * без промежуточного массива столбцов. Кадр f начинается с сэмпла f * hop.
+ * Возвращает пустую картинку, если проход устарел (liveGeneration ушёл
+ * вперёд) — тогда досчитывать незачем.
+ */
+QImage computeSpectrogramTile(const SpectrogramPass& pass, const SpectrogramTileKey& key,
+                              const std::atomic<quint64>& liveGeneration, quint64 generation)
+{
+    const QVector<float>& samples = pass.audio[key.channel];
+    const WaveformView::SpectrogramSettings& settings = pass.settings;
+    const int windowSize = settings.windowSize;
+    const int freqBins = settings.freqBins;
+    const qint64 hop = SpectrogramCache::hopForLevel(key.level);
+    const int linearBins = int(pass.plan->binCount());
+
+    const qint64 frameCount = SpectrogramCache::frameCount(samples.size(), windowSize, key.level);
+    const qint64 firstFrame = qint64(key.tile) * SpectrogramCache::kTileColumns;
+    const qint64 lastFrame = qMin(frameCount, firstFrame + SpectrogramCache::kTileColumns);
+    if (lastFrame <= firstFrame) {
+        return QImage();
+    }
+
+    QImage tile(int(lastFrame - firstFrame), freqBins, QImage::Format_RGB32);
+    tile.fill(Qt::black);
+    uchar* bits = tile.bits();
+    const qsizetype bytesPerLine = tile.bytesPerLine();
+
+    std::vector<float> linearMag;
+    std::vector<float> displayMag(size_t(freqBins), 0.f);
+    std::vector<DFEngine::Complex> spectrum;
+
+    for (qint64 frame = firstFrame; frame < lastFrame; ++frame) {
+        if (liveGeneration.load(std::memory_order_relaxed) != generation) {
+            return QImage();
+        }
+        const qint64 start = frame * hop;
+        if (start + windowSize > samples.size()) {
+            break;
         }
 
-        const int totalSamples = samples.size();
-        const int hop = qMax(1, (totalSamples - windowSize) / maxFrames);
-        const int frameCount = qMax(1, (totalSamples - windowSize) / hop);
-
-        const unsigned fftSize = DFEngine::nextPow2(windowSize) * zeroPadFactor;
-        const int linearBins = int(fftSize / 2) + 1;
-
-        std::vector<std::vector<float>> colData(frameCount, std::vector<float>(freqBins, 0.f));
-        std::vector<float> linearMag;
-        std::vector<float> displayMag;
-
-        for (int frame = 0; frame < frameCount; ++frame) {
-            const int start = frame * hop;
-            if (start + windowSize > totalSamples) {
-                break;
-            }
-
-            DFEngine::realFFT(samples.constData() + start, windowSize,
-                              window, zeroPadFactor, linearMag);
-
-            if (useDb) {
-                DFEngine::normalizeDb(linearMag, floorDb);
-            } else {
-                DFEngine::normalizeLinear(linearMag);
-            }
+        pass.plan->magnitudes(samples.constData() + start, unsigned(windowSize),
+                              pass.window.data(), linearMag, spectrum);
 
-            if (logScale) {
-                DFEngine::logFreqCompress(linearMag, displayMag,
-                                          freqBins, float(sampleRateCopy));
-            } else {
-                displayMag.resize(freqBins);
-                for (int k = 0; k < freqBins; ++k) {
-                    const int srcIdx = k * (linearBins - 1) / qMax(freqBins - 1, 1);
-                    displayMag[k] = (srcIdx < int(linearMag.size())) ? linearMag[srcIdx] : 0.f;
-                }
-            }
+        if (settings.dbAmplitude) {
+            DFEngine::normalizeDb(linearMag, settings.floorDb);
+        } else {
+            DFEngine::normalizeLinear(linearMag);
+        }
 
+        if (settings.logFreqScale) {
+            DFEngine::logFreqCompress(linearMag, displayMag,
+                                      freqBins, float(pass.sampleRate));
+        } else {
+            displayMag.resize(size_t(freqBins));
             for (int k = 0; k < freqBins; ++k) {
-                colData[frame][k] = (k < int(displayMag.size())) ? displayMag[k] : 0.f;
+                const int srcIdx = k * (linearBins - 1) / qMax(freqBins - 1, 1);
+                displayMag[k] = (srcIdx < int(linearMag.size())) ? linearMag[srcIdx] : 0.f;
             }
         }
 
-        QImage img(frameCount, freqBins, QImage::Format_RGB32);
+        const int x = int(frame - firstFrame);
         for (int y = 0; y < freqBins; ++y) {
-            QRgb* line = reinterpret_cast<QRgb*>(img.scanLine(y));
             const int bin = freqBins - 1 - y;
-            for (int x = 0; x < frameCount; ++x) {
-                line[x] = spectrogramColorForValue(colData[x][bin], settingsCopy.colorScheme);
-            }
+            const float value = (bin < int(displayMag.size())) ? displayMag[bin] : 0.f;
+            reinterpret_cast<QRgb*>(bits + y * bytesPerLine)[x] =
+                spectrogramColorForValue(value, settings.colorScheme);
         }
-        result[ch] = img;
     }
 
-    return result;
+    return tile;
 }
 
 } // namespace
 
-/**
- * Преобразует позицию в исходном аудио в позицию отображения с учётом меток растяжения.
- * Когда метки перемещены (position != originalPosition), аудио визуально растянуто,
- * и силуэты ударных должны следовать за этим маппингом.
- */
-static qint64 mapOriginalSampleToDisplay(qint64 originalPos,
-                                         const QVector<Marker>& markers,
-                                         qint64 totalOriginalSamples)
-{
-    if (markers.size() < 2 || totalOriginalSamples <= 0) {
-        return originalPos;
-    }
-
-    QVector<Marker> sorted = markers;
-    std::sort(sorted.begin(), sorted.end(), [](const Marker& a, const Marker& b) {
-        return a.originalPosition < b.originalPosition;
-    });
-
-    // До первой метки — линейная интерполяция от 0 до первой метки
-    if (originalPos <= sorted.first().originalPosition) {
-        const Marker& m1 = sorted.first();
-        if (m1.originalPosition <= 0) return originalPos;
-        double t = double(originalPos) / double(m1.originalPosition);
-        return qint64(t * m1.position);
-    }
-
-    // После последней метки — линейная экстраполяция по последнему сегменту
-    if (originalPos >= sorted.last().originalPosition) {
-        const Marker& m0 = sorted[sorted.size() - 2];
-        const Marker& m1 = sorted[sorted.size() - 1];
-        qint64 origLen = m1.originalPosition - m0.originalPosition;
-        qint64 dispLen = m1.position - m0.position;
-        if (origLen <= 0) return originalPos;
-        double t = double(originalPos - m1.originalPosition) / double(origLen);
-        return m1.position + qint64(t * dispLen);
-    }
-
-    // Между метками — линейная интерполяция
-    for (int i = 0; i < sorted.size() - 1; ++i) {
-        const Marker& m0 = sorted[i];
-        const Marker& m1 = sorted[i + 1];
-        if (originalPos >= m0.originalPosition && originalPos < m1.originalPosition) {
-            qint64 origLen = m1.originalPosition - m0.originalPosition;
-            qint64 dispLen = m1.position - m0.position;
-            if (origLen <= 0) return originalPos;
-            double t = double(originalPos - m0.originalPosition) / double(origLen);
-            return m0.position + qint64(t * dispLen);
-        }
-    }
-
-    return originalPos;
-}
-
-static bool markersChangeTimeline(const QVector<Marker>& markers)
-{
-    for (const Marker& m : markers) {
-        if (m.position != m.originalPosition) {
-            return true;
-        }
-    }
-    return false;
-}
-
-static qint64 estimateStretchedLength(const QVector<Marker>& markers, qint64 originalSize)
-{
-    if (markers.size() < 2 || originalSize <= 0) {
-        return originalSize;
-    }
-
-    QVector<Marker> sorted = markers;
-    std::sort(sorted.begin(), sorted.end(), [](const Marker& a, const Marker& b) {
-        return a.originalPosition < b.originalPosition;
-    });
-
-    qint64 displayLen = sorted.last().position;
-    const qint64 origTail = originalSize - sorted.last().originalPosition;
-    if (origTail > 0 && sorted.size() >= 2) {
-        const Marker& m0 = sorted[sorted.size() - 2];
-        const Marker& m1 = sorted.last();
-        const qint64 origSeg = m1.originalPosition - m0.originalPosition;
-        const qint64 dispSeg = m1.position - m0.position;
-        if (origSeg > 0 && dispSeg > 0) {
-            const float tailFactor = qMax(0.1f, float(dispSeg) / float(origSeg));
-            displayLen += qint64(origTail * tailFactor);
-        } else {
-            displayLen += origTail;
-        }
-    } else if (origTail > 0) {
-        displayLen += origTail;
-    }
-
-    return qMax(displayLen, qint64(1));
-}
-
-static qint64 mapDisplaySampleToOriginal(qint64 displayPos,
-                                         const QVector<Marker>& markers,
-                                         qint64 totalOriginalSamples)
-{
-    if (markers.size() < 2 || totalOriginalSamples <= 0) {
-        return qBound(qint64(0), displayPos, totalOriginalSamples - 1);
-    }
-
-    QVector<Marker> sorted = markers;
-    std::sort(sorted.begin(), sorted.end(), [](const Marker& a, const Marker& b) {
-        return a.originalPosition < b.originalPosition;
-    });
-
-    if (displayPos <= sorted.first().position) {
-        const Marker& m1 = sorted.first();
-        if (m1.position <= 0) {
-            return qBound(qint64(0), displayPos, totalOriginalSamples - 1);
-        }
-        const double t = double(displayPos) / double(m1.position);
-        return qBound(qint64(0), qint64(t * m1.originalPosition), totalOriginalSamples - 1);
-    }
-
-    const qint64 displayTailStart = sorted.last().position;
-    const qint64 displayTotal = estimateStretchedLength(markers, totalOriginalSamples);
-    if (displayPos >= displayTailStart) {
-        if (sorted.size() < 2) {
-            return qBound(qint64(0), displayPos, totalOriginalSamples - 1);
-        }
-        const Marker& m0 = sorted[sorted.size() - 2];
-        const Marker& m1 = sorted.last();
-        const qint64 origLen = m1.originalPosition - m0.originalPosition;
-        const qint64 dispLen = m1.position - m0.position;
-        const qint64 origTail = totalOriginalSamples - m1.originalPosition;
-        const qint64 dispTail = qMax<qint64>(1, displayTotal - displayTailStart);
-        if (origLen > 0 && dispLen > 0 && origTail > 0) {
-            const double t = double(displayPos - displayTailStart) / double(dispTail);
-            return qBound(qint64(0),
-                          m1.originalPosition + qint64(t * origTail),
-                          totalOriginalSamples - 1);
-        }
-        return qBound(qint64(0), m1.originalPosition, totalOriginalSamples - 1);
-    }
-
-    for (int i = 0; i < sorted.size() - 1; ++i) {
-        const Marker& m0 = sorted[i];
-        const Marker& m1 = sorted[i + 1];
-        if (displayPos >= m0.position && displayPos < m1.position) {
-            const qint64 origLen = m1.originalPosition - m0.originalPosition;
-            const qint64 dispLen = m1.position - m0.position;
-            if (origLen <= 0 || dispLen <= 0) {
-                return qBound(qint64(0), displayPos, totalOriginalSamples - 1);
-            }
-            const double t = double(displayPos - m0.position) / double(dispLen);
-            return qBound(qint64(0),
-                          m0.originalPosition + qint64(t * origLen),
-                          totalOriginalSamples - 1);
-        }
-    }
-
-    return qBound(qint64(0), displayPos, totalOriginalSamples - 1);
-}
-
 WaveformView::WaveformView(QWidget *parent)
     : QWidget(parent)
     , bpm(120.0f)
@@ -358,8 +232,7 @@ WaveformView::WaveformView(QWidget *parent)
     , realtimeJobGeneration(0)
     , lastTooltipMarkerIndex(-1)
     , renderMode(WaveformRenderMode::Peaks)
-    , spectrogramDirty(true)
-    // spectrogramImages инициализируется пустым QVector автоматически
+    , spectrogramWanted(std::make_shared<SpectrogramWantedTiles>())
 {
     setMinimumHeight(100);
     setMouseTracking(true);
@@ -381,9 +254,14 @@ WaveformView::WaveformView(QWidget *parent)
         }
     });
 
-    spectrogramWatcher = new QFutureWatcher<QVector<QImage>>(this);
-    connect(spectrogramWatcher, &QFutureWatcher<QVector<QImage>>::finished,
-            this, &WaveformView::onSpectrogramReady);
+    // Свой пул: плитки не делят глобальный пул с анализом и растяжением,
+    // и его можно очистить от устаревших плиток, не трогая чужие задачи
+    spectrogramPool = new QThreadPool(this);
+    spectrogramPool->setMaxThreadCount(qMax(1, QThread::idealThreadCount()));
+
+    // Волна — одна задача за раз; пирамида пиков внутри неё строится параллельно сама
+    wavePool = new QThreadPool(this);
+    wavePool->setMaxThreadCount(1);
 }
 
 WaveformView::~WaveformView()
@@ -391,10 +269,16 @@ WaveformView::~WaveformView()
     realtimeStretchShuttingDown = true;
     ++audioSourceGeneration;
 
-    if (spectrogramWatcher) {
-        spectrogramWatcher->cancel();
-        spectrogramWatcher->waitForFinished();
-    }
+    // Задачи пулов пользуются this, пока работают, и шлют ответ с контекстом
+    // this. Ожидание ниже держит this живым до конца каждой задачи; если виджет
+    // удалится раньше, чем дойдёт событие, Qt отбросит доставку по контексту.
+    // Плитки читают this->spectrogramGeneration: дождаться их до разрушения
+    ++spectrogramGeneration;
+    spectrogramPool->clear();
+    spectrogramPool->waitForDone();
+    // Задача волны читает this->audioSourceGeneration и бросает работу по нему
+    wavePool->clear();
+    wavePool->waitForDone();
 
     QDeadlineTimer deadline(60000);
     while (realtimeStretchJobsRunning.load() > 0 && !deadline.hasExpired()) {
@@ -435,9 +319,9 @@ void WaveformView::setAudioData(const QVector<QVector<float>>& channels)
 
     // Нормализация данных
     audioData.clear();
+    audioChannelPeaks.clear();
     for (const auto& channel : channels) {
         QVector<float> normalizedChannel;
-        normalizedChannel.reserve(channel.size());
 
         // Находим максимальное значение для нормализации
         float maxValue = 0.0f;
@@ -445,8 +329,13 @@ void WaveformView::setAudioData(const QVector<QVector<float>>& channels)
             maxValue = qMax(maxValue, qAbs(sample));
         }
 
-        // Нормализуем значения
-        if (maxValue > 0.0f) {
+        audioChannelPeaks.append(maxValue);
+
+        // Нормализуем значения. Уже нормированный канал (правка нормированного
+        // исходника) делит буфер с входом: пирамида пиков исходника подходит
+        // и к нему (см. setAudioData с SourceEdit)
+        if (maxValue > 0.0f && maxValue != 1.0f) {
+            normalizedChannel.reserve(channel.size());
             for (float sample : channel) {
                 normalizedChannel.append(sample / maxValue);
             }
@@ -463,8 +352,7 @@ void WaveformView::setAudioData(const QVector<QVector<float>>& channels)
     realtimeStretchDirty = false;
 
     // Сброс кеша спектрограммы
-    spectrogramImages.clear();
-    spectrogramDirty = true;
+    invalidateSpectrogram();
     invalidateWavePixmapCache();
     invalidateWavePeaks();
     markMarkersCacheDirty();
@@ -473,6 +361,7 @@ void WaveformView::setAudioData(const QVector<QVector<float>>& channels)
     zoomLevel = 1.0f;
     horizontalOffset = 0.0f;
     gridStartSample = 0;
+    refreshDeviations();
     emit zoomChanged(zoomLevel);
 
     // Обновляем время всех меток при загрузке нового аудио
@@ -486,9 +375,139 @@ void WaveformView::setAudioData(const QVector<QVector<float>>& channels)
     update();
 }
 
+void WaveformView::setAudioData(const QVector<QVector<float>>& data, const SourceEdit& edit)
+{
+    // Пирамида исходника, от которого отсчитана правка, — до замены данных
+    WaveformPeaks peaks;
+    if (edit.sourceGeneration == audioSourceGeneration && edit.from <= edit.to) {
+        if (const TrackPeaks* entry = findTrackPeaks(originalAudioData)) {
+            peaks = entry->peaks;
+        }
+    }
+
+    setAudioData(data);
+
+    // Нормализация делит канал на его пик: вне правки сэмплы прежние, только
+    // если делить не пришлось (исходник уже нормирован, пик правкой не задет)
+    if (!peaks.isValid() || audioData.isEmpty() || peaks.channelCount() != audioData.size()
+        || peaks.sampleCount() != audioData[0].size() || edit.to > audioData[0].size()) {
+        return;
+    }
+    for (float peak : audioChannelPeaks) {
+        if (peak != 1.0f && peak != 0.0f) {
+            return;
+        }
+    }
+    TrackPeaks entry;
+    for (const QVector<float>& channel : audioData) {
+        entry.sources.append(channel.constData());
+    }
+    entry.size = audioData[0].size();
+    entry.peaks = std::move(peaks);
+    entry.peaks.update(audioData, edit.from, edit.to);
+    storeTrackPeaks(std::move(entry));
+}
+
+bool WaveformView::updateAudioTail(qint64 fromSample, const QVector<QVector<float>>& tail)
+{
+    if (audioData.isEmpty() || audioData[0].isEmpty() || tail.size() != audioData.size()
+        || audioChannelPeaks.size() != audioData.size()) {
+        return false;
+    }
+    const qint64 oldSize = audioData[0].size();
+    if (fromSample < 0 || fromSample > oldSize) {
+        return false;
+    }
+    for (int ch = 0; ch < audioData.size(); ++ch) {
+        if (audioData[ch].size() != oldSize || tail[ch].size() != tail[0].size()) {
+            return false;
+        }
+        // Превью растяжения показывает не исходник — дописывать его нельзя
+        if (!originalAudioData.isEmpty()
+            && (ch >= originalAudioData.size()
+                || originalAudioData[ch].constData() != audioData[ch].constData())) {
+            return false;
+        }
+    }
+
+    QVector<const float*> oldSources;
+    for (const QVector<float>& channel : audioData) {
+        oldSources.append(channel.constData());
+    }
+
+    // Иначе append скопировал бы всю дорожку: исходник делит буфер с audioData
+    originalAudioData.clear();
+
+    bool renormalized = false;
+    for (int ch = 0; ch < audioData.size(); ++ch) {
+        float tailPeak = 0.0f;
+        for (float sample : tail[ch]) {
+            tailPeak = qMax(tailPeak, qAbs(sample));
+        }
+        // Дозапись громче прежнего пика: пересчитываем нормализацию канала
+        // (редко — обычно пик устаканивается в первые секунды захвата)
+        float& peak = audioChannelPeaks[ch];
+        if (tailPeak > peak) {
+            if (peak > 0.0f) {
+                const float scale = peak / tailPeak;
+                for (float& sample : audioData[ch]) {
+                    sample *= scale;
+                }
+            }
+            peak = tailPeak;
+            renormalized = true;
+        }
+
+        QVector<float>& channel = audioData[ch];
+        channel.resize(fromSample);
+        channel.reserve(fromSample + tail[ch].size());
+        if (peak > 0.0f) {
+            for (float sample : tail[ch]) {
+                channel.append(sample / peak);
+            }
+        } else {
+            channel.append(tail[ch]);
+        }
+    }
+
+    originalAudioData = audioData;
+    ++audioSourceGeneration; // Результаты фоновых задач со старыми данными будут отброшены
+    realtimeStretchDirty = false;
+
+    // Пирамиду досчитываем с места правки; после смены нормализации — заново
+    if (renormalized) {
+        invalidateWavePeaks();
+    } else {
+        for (TrackPeaks& entry : wavePeaks) {
+            if (entry.sources != oldSources) {
+                continue;
+            }
+            entry.peaks.splice(audioData, fromSample, oldSize - fromSample, tail[0].size());
+            entry.sources.clear();
+            for (const QVector<float>& channel : audioData) {
+                entry.sources.append(channel.constData());
+            }
+            entry.size = audioData[0].size();
+        }
+    }
+
+    invalidateSpectrogram();
+    invalidateWavePixmapCache();
+    scheduleUpdate();
+    return true;
+}
+
 void WaveformView::setBPM(float newBpm)
 {
     bpm = newBpm;
+    refreshDeviations();
+    update();
+}
+
+void WaveformView::setTempoMap(const TempoMap& map)
+{
+    tempoMap = map;
+    refreshDeviations();
     update();
 }
 
@@ -497,7 +516,6 @@ void WaveformView::setZoomLevel(float zoom)
     float newZoom = qBound(float(minZoom), zoom, float(maxZoom));
     if (!qFuzzyCompare(newZoom, zoomLevel)) {
         zoomLevel = newZoom;
-        invalidateWavePixmapCache();
         emit zoomChanged(zoomLevel);
         update();
     }
@@ -546,7 +564,6 @@ void WaveformView::zoomAtPixelX(int angleDeltaY, float pixelX)
     }
 
     horizontalOffset = newOffset;
-    invalidateWavePixmapCache();
     emit zoomChanged(zoomLevel);
     emit horizontalOffsetChanged(horizontalOffset);
     update();
@@ -555,6 +572,7 @@ void WaveformView::zoomAtPixelX(int angleDeltaY, float pixelX)
 void WaveformView::setSampleRate(int rate)
 {
     sampleRate = rate;
+    refreshDeviations();
 
     // Обновляем время всех меток при изменении sampleRate
     for (Marker& marker : markers) {
@@ -592,122 +610,463 @@ void WaveformView::ensureSortedMarkersCache()
     markersSortDirty = false;
 }
 
+/** Снимок для фоновой отрисовки волны: всё, что нужно, без обращения к виджету. */
+struct WaveformView::WaveRenderJob {
+    WaveRaster target;
+    QVector<QVector<float>> channels;   // audioData или originalAudioData (warped)
+    WaveformPeaks peaks;                // пустая — пирамида строится в задаче
+    TimeWarpMap warp;
+    QColor background;
+    QColor lowColor;
+    QColor midColor;
+    QColor highColor;
+};
+
+struct WaveformView::WaveRenderResult {
+    WaveRaster target;
+    QVector<QVector<float>> channels;   // по ним построена builtPeaks
+    QImage image;                       // пустое — задача брошена
+    WaveformPeaks builtPeaks;
+};
+
 void WaveformView::invalidateWavePixmapCache()
 {
-    wavePixmapDirty = true;
+    // Геометрия окна сверяется отдельно (waveRasterTarget); здесь — содержимое:
+    // цвета, метки, пики
+    ++waveContentVersion;
 }
 
-bool WaveformView::isWavePixmapCacheValid() const
+WaveformView::WaveRaster WaveformView::waveRasterTarget(const ViewportGeometry& vp) const
 {
-    if (wavePixmapDirty || cachedWavePixmap.isNull()) {
+    WaveRaster target;
+    target.startSample = vp.startSample;
+    target.samplesPerPixel = vp.samplesPerPixel;
+    target.marginColumns = int(width() * WAVE_RASTER_MARGIN);
+    target.viewWidth = width();
+    target.viewHeight = height();
+    target.verticalOffset = verticalOffset;
+    target.audioGeneration = audioSourceGeneration.load();
+    target.contentVersion = waveContentVersion;
+    target.warped = needsWarpedWaveformPreview();
+    return target;
+}
+
+bool WaveformView::waveRasterCovers(const WaveRaster& target) const
+{
+    const WaveRaster& raster = cachedWaveRaster;
+    if (cachedWavePixmap.isNull()) {
         return false;
     }
-    if (cachedWaveSize != size()) {
+    if (raster.audioGeneration != target.audioGeneration
+        || raster.contentVersion != target.contentVersion
+        || raster.warped != target.warped) {
         return false;
     }
-    if (cachedWaveAudioGeneration != audioSourceGeneration) {
+    // Тот же масштаб (значения считаются одинаково, поэтому сравнение точное)
+    // и та же полоса по вертикали
+    if (raster.samplesPerPixel != target.samplesPerPixel
+        || raster.verticalOffset != target.verticalOffset
+        || raster.viewHeight != target.viewHeight) {
         return false;
     }
-    if (cachedWaveUsesWarpedPreview != needsWarpedWaveformPreview()) {
-        return false;
+    // Окно целиком внутри изображения вместе с полями
+    const double shift = double(target.startSample - raster.startSample) / double(raster.samplesPerPixel);
+    return shift >= -raster.marginColumns
+        && shift + target.viewWidth <= raster.viewWidth + raster.marginColumns;
+}
+
+void WaveformView::requestWaveRaster(const WaveRaster& target)
+{
+    // Одна задача за раз: по её завершении paintEvent сверит окно и при
+    // необходимости запросит следующую — промежуточные окна пропускаются
+    if (waveRenderActive || audioData.isEmpty() || audioData[0].isEmpty()
+        || target.viewWidth <= 0 || target.viewHeight <= 0) {
+        return;
+    }
+
+    auto job = std::make_shared<WaveRenderJob>();
+    job->target = target;
+    // Неявно разделяемые копии: поток GUI тем временем может менять свои данные
+    job->channels = target.warped ? originalAudioData : audioData;
+    if (target.warped) {
+        job->warp = timeWarpMap();
+    }
+    if (const TrackPeaks* entry = findTrackPeaks(job->channels)) {
+        job->peaks = entry->peaks;
     }
-    const int zoomKey = int(zoomLevel * 1000.f);
-    const int hOffsetKey = int(horizontalOffset * 1000.f);
-    const int vOffsetKey = int(verticalOffset * 1000.f);
-    return cachedWaveZoomKey == zoomKey
-        && cachedWaveHorizontalOffsetKey == hOffsetKey
-        && cachedWaveVerticalOffsetKey == vOffsetKey;
+    job->background = colors.getBackgroundColor();
+    job->lowColor = colors.getLowColor();
+    job->midColor = colors.getMidColor();
+    job->highColor = colors.getHighColor();
+
+    waveRenderActive = true;
+    wavePool->start(QRunnable::create([this, job]() {
+        const std::shared_ptr<WaveRenderResult> result = renderWaveRaster(*job, audioSourceGeneration);
+        // this жив до конца задачи — см. ~WaveformView
+        QMetaObject::invokeMethod(this, [this, result]() {
+            onWaveRasterReady(result);
+        }, Qt::QueuedConnection);
+    }));
 }
 
-void WaveformView::regenerateWavePixmap()
+void WaveformView::onWaveRasterReady(const std::shared_ptr<WaveRenderResult>& result)
 {
-    if (audioData.isEmpty() || width() <= 0 || height() <= 0) {
-        cachedWavePixmap = QPixmap();
-        wavePixmapDirty = true;
+    waveRenderActive = false;
+    if (realtimeStretchShuttingDown) {
         return;
     }
 
-    cachedWavePixmap = QPixmap(size());
-    cachedWavePixmap.fill(colors.getBackgroundColor());
+    const bool fresh = result->target.audioGeneration == audioSourceGeneration.load();
+    // Пирамиду, построенную в фоне, оставляем себе: следующие кадры её не ждут
+    if (fresh && result->builtPeaks.isValid() && !findTrackPeaks(result->channels)) {
+        TrackPeaks entry;
+        for (const QVector<float>& channel : result->channels) {
+            entry.sources.append(channel.constData());
+        }
+        entry.size = result->channels[0].size();
+        entry.peaks = result->builtPeaks;
+        storeTrackPeaks(std::move(entry));
+    }
 
-    QPainter pixmapPainter(&cachedWavePixmap);
-    pixmapPainter.setRenderHint(QPainter::Antialiasing, false);
+    if (result->image.isNull()) {
+        // Брошена из-за смены аудио — окно запросит новую; иначе рисовать нечего
+        if (!fresh) {
+            scheduleUpdate();
+        }
+        return;
+    }
+    // Даже устаревшее изображение ближе к текущему окну, чем прежнее
+    cachedWaveRaster = result->target;
+    cachedWavePixmap = QPixmap::fromImage(std::move(result->image));
+    scheduleUpdate();
+}
 
-    const float channelHeight = float(height()) / float(qMax(1, audioData.size()));
-    for (int i = 0; i < audioData.size(); ++i) {
-        const QRectF channelRect(0, i * channelHeight, width(), channelHeight);
-        if (needsWarpedWaveformPreview() && i >= originalAudioData.size()) {
-            continue;
+void WaveformView::drawWaveRaster(QPainter& painter, const WaveRaster& target)
+{
+    const WaveRaster& raster = cachedWaveRaster;
+    if (cachedWavePixmap.isNull() || raster.samplesPerPixel <= 0.0f || target.samplesPerPixel <= 0.0f) {
+        return;
+    }
+
+    // Столбец c изображения начинается с сэмпла startSample + (c − поле) · samplesPerPixel
+    const double scaleX = double(raster.samplesPerPixel) / double(target.samplesPerPixel);
+    const double left = double(raster.startSample - target.startSample) / double(target.samplesPerPixel)
+                      - raster.marginColumns * scaleX;
+    if (waveRasterCovers(target)) {
+        painter.drawPixmap(qRound(left), 0, cachedWavePixmap);
+        return;
+    }
+
+    // Новое изображение ещё считается: прежнее сдвигаем и растягиваем под окно
+    const double channelHeight = double(height()) / double(qMax(1, audioData.size()));
+    const double top = double(raster.verticalOffset - target.verticalOffset) * channelHeight;
+    const double scaleY = double(height()) / double(qMax(1, raster.viewHeight));
+    const QRectF placed(left, top, cachedWavePixmap.width() * scaleX, cachedWavePixmap.height() * scaleY);
+    painter.drawPixmap(placed, cachedWavePixmap, QRectF(cachedWavePixmap.rect()));
+}
+
+std::shared_ptr<WaveformView::WaveRenderResult>
+WaveformView::renderWaveRaster(const WaveRenderJob& job, const std::atomic<quint64>& audioGeneration)
+{
+    auto result = std::make_shared<WaveRenderResult>();
+    result->target = job.target;
+    result->channels = job.channels;
+    const QVector<QVector<float>>& channels = job.channels;
+    if (channels.isEmpty() || channels[0].isEmpty()) {
+        return result;
+    }
+    const WaveRaster& target = job.target;
+    const int numCh = channels.size();
+    const qint64 totalSamples = channels[0].size();
+
+    // Пики берём из пирамиды: точные min/max без прореживания и без прохода
+    // по сырым сэмплам; все каналы столбца — одним чтением. Пирамиды ещё нет
+    // (дорожка только открыта) — строим её здесь, а не в потоке GUI
+    const WaveformPeaks* peaks = job.peaks.isValid() ? &job.peaks : nullptr;
+    if (!peaks) {
+        result->builtPeaks.buildChannels(channels);
+        if (result->builtPeaks.isValid()) {
+            peaks = &result->builtPeaks;
+        }
+    }
+
+    // Метки сдвинуты, а растянутое превью ещё не готово: столбцы таймлайна
+    // переводятся в исходные сэмплы картой времени
+    const qint64 displayLength = target.warped ? job.warp.displaySize() : totalSamples;
+    const int columnCount = target.viewWidth + 2 * target.marginColumns;
+    const double samplesPerPixel = target.samplesPerPixel;
+
+    // min/max всех столбцов складываются подряд (столбец за столбцом, каналы
+    // рядом) и рисуются растеризатором одним проходом по строкам
+    QVector<float> columnMin(columnCount * numCh, 0.0f);
+    QVector<float> columnMax(columnCount * numCh, 0.0f);
+    int firstColumn = -1;
+    int lastColumn = -1;
+
+    for (int x = 0; x < columnCount; ++x) {
+        if ((x & 255) == 0 && audioGeneration.load() != target.audioGeneration) {
+            return result;  // аудио сменилось — изображение уже не нужно
+        }
+
+        // Поля продолжают границы столбцов видимого окна влево и вправо
+        const qint64 displayStart =
+            target.startSample + qint64(std::floor((x - target.marginColumns) * samplesPerPixel));
+        const qint64 displayEnd =
+            target.startSample + qint64(std::floor((x + 1 - target.marginColumns) * samplesPerPixel));
+        if (displayStart >= displayLength) {
+            break;
         }
-        const QVector<float>& sourceSamples =
-            needsWarpedWaveformPreview() ? originalAudioData[i] : audioData[i];
-        if (sourceSamples.isEmpty()) {
+        if (displayEnd <= 0) {
+            continue;  // левое поле до начала дорожки
+        }
+
+        qint64 from = qMax<qint64>(0, displayStart);
+        qint64 to = qMin(displayLength, qMax(displayEnd, from + 1));
+        if (target.warped) {
+            const qint64 origStart = job.warp.toOriginal(from);
+            const qint64 origEnd = job.warp.toOriginal(to - 1);
+            from = qBound(qint64(0), qMin(origStart, origEnd), totalSamples - 1);
+            to = qBound(qint64(0), qMax(origStart, origEnd), totalSamples - 1) + 1;
+        }
+
+        if (firstColumn < 0) {
+            firstColumn = x;
+        }
+        lastColumn = x;
+        float* minValues = columnMin.data() + x * numCh;
+        float* maxValues = columnMax.data() + x * numCh;
+        if (peaks && peaks->rangeAll(channels, from, to, minValues, maxValues)) {
             continue;
         }
-        if (needsWarpedWaveformPreview()) {
-            drawWarpedWaveformPreview(pixmapPainter, sourceSamples, channelRect);
-        } else {
-            drawWaveform(pixmapPainter, sourceSamples, channelRect);
+
+        // Запасной путь (например, каналы разной длины)
+        for (int ch = 0; ch < numCh; ++ch) {
+            const QVector<float>& samples = channels[ch];
+            const qint64 channelLast = qMin<qint64>(to, samples.size());
+            for (qint64 s = from; s < channelLast; ++s) {
+                minValues[ch] = qMin(minValues[ch], samples[s]);
+                maxValues[ch] = qMax(maxValues[ch], samples[s]);
+            }
         }
     }
 
-    cachedWaveZoomKey = int(zoomLevel * 1000.f);
-    cachedWaveHorizontalOffsetKey = int(horizontalOffset * 1000.f);
-    cachedWaveVerticalOffsetKey = int(verticalOffset * 1000.f);
-    cachedWaveSize = size();
-    cachedWaveAudioGeneration = audioSourceGeneration;
-    cachedWaveUsesWarpedPreview = needsWarpedWaveformPreview();
-    wavePixmapDirty = false;
+    QImage image(columnCount, target.viewHeight, QImage::Format_ARGB32_Premultiplied);
+    if (image.isNull()) {
+        return result;
+    }
+    image.fill(job.background);
+
+    if (firstColumn >= 0) {
+        // Полосы каналов с вертикальным смещением
+        const float channelHeight = float(target.viewHeight) / float(numCh);
+        QVector<float> centerY(numCh);
+        for (int ch = 0; ch < numCh; ++ch) {
+            centerY[ch] = (float(ch) + 0.5f - target.verticalOffset) * channelHeight;
+        }
+        // Цвет столбца — по размаху (низкие/средние/высокие)
+        WaveformRasterizer rasterizer(job.lowColor, job.midColor, job.highColor);
+        rasterizer.draw(image, firstColumn, lastColumn - firstColumn + 1, numCh,
+                        columnMin.constData() + firstColumn * numCh,
+                        columnMax.constData() + firstColumn * numCh,
+                        centerY.constData(), channelHeight * 0.5f);
+    }
+    result->image = std::move(image);
+    return result;
+}
+
+void WaveformView::invalidateSpectrogram()
+{
+    // Новое поколение: уже запущенные плитки бросят работу на ближайшем кадре,
+    // а ещё не начатые снимаем с очереди пула
+    ++spectrogramGeneration;
+    spectrogramPool->clear();
+    spectrogramCache.clear();
+    spectrogramPendingTiles.clear();
+}
+
+quint64 WaveformView::spectrogramSettingsKey() const
+{
+    // maxFrames не входит: он влияет только на выбор уровня, не на пиксели плитки
+    const SpectrogramSettings& s = spectrogramSettings;
+    return quint64(qHashMulti(0, s.windowSize, s.freqBins, s.logFreqScale, s.dbAmplitude,
+                              s.zeroPadFactor, s.floorDb, int(s.colorScheme),
+                              int(s.windowFunction), sampleRate));
 }
 
-void WaveformView::scheduleSpectrogramRegeneration()
+int WaveformView::spectrogramLevelFor(const ViewportGeometry& vp) const
 {
-    if (renderMode != WaveformRenderMode::Spectrogram || audioData.isEmpty() || !spectrogramWatcher) {
+    // Окно задано в сэмплах отображения; при растяжении их число отличается от audioData
+    const qint64 displayCount = qMax<qint64>(1, displaySampleCount());
+    const double audioPerDisplay = double(audioData[0].size()) / double(displayCount);
+    const int columns = qMax(1, qMin(width(), spectrogramSettings.maxFrames));
+    return SpectrogramCache::levelForSamplesPerColumn(
+        double(vp.visibleSamples) * audioPerDisplay / double(columns));
+}
+
+void WaveformView::requestSpectrogramTiles(const ViewportGeometry& vp)
+{
+    if (renderMode != WaveformRenderMode::Spectrogram || audioData.isEmpty()
+        || audioData[0].isEmpty()) {
         return;
     }
-    if (spectrogramComputationInProgress.load()) {
-        return;
+
+    const quint64 settingsKey = spectrogramSettingsKey();
+    const int level = spectrogramLevelFor(vp);
+    const qint64 hop = SpectrogramCache::hopForLevel(level);
+    const int windowSize = spectrogramSettings.windowSize;
+    const qint64 tileSamples = hop * SpectrogramCache::kTileColumns;
+
+    const double audioPerDisplay =
+        double(audioData[0].size()) / double(qMax<qint64>(1, displaySampleCount()));
+    const double viewStart = double(vp.startSample) * audioPerDisplay;
+    const double viewEnd = double(qint64(vp.startSample) + vp.visibleSamples) * audioPerDisplay;
+    const double viewCenter = 0.5 * (viewStart + viewEnd);
+
+    struct PendingTile {
+        SpectrogramTileKey key;
+        double distance;
+    };
+    QVector<PendingTile> pending;
+    QSet<SpectrogramTileKey> wanted;
+
+    for (int ch = 0; ch < audioData.size(); ++ch) {
+        const qint64 tileCount =
+            SpectrogramCache::tileCount(audioData[ch].size(), windowSize, level);
+        if (tileCount <= 0) {
+            continue;
+        }
+        // Видимые плитки и по одной с каждой стороны — под ближайшую прокрутку
+        const qint64 firstTile = qMax<qint64>(0, qint64(viewStart) / tileSamples - 1);
+        const qint64 lastTile = qMin<qint64>(tileCount - 1, qint64(viewEnd) / tileSamples + 1);
+        for (qint64 tile = firstTile; tile <= lastTile; ++tile) {
+            const SpectrogramTileKey key { settingsKey, ch, level, int(tile) };
+            wanted.insert(key);
+            if (spectrogramPendingTiles.contains(key) || spectrogramCache.contains(key)) {
+                continue;
+            }
+            const double middle = double(tile * tileSamples + tileSamples / 2 + windowSize / 2);
+            pending.append(PendingTile { key, qAbs(middle - viewCenter) });
+        }
     }
 
-    spectrogramComputationInProgress = true;
-    spectrogramDirty = false;
-    const QVector<QVector<float>> audioCopy = audioData;
-    const int sampleRateCopy = sampleRate;
-    const SpectrogramSettings settingsCopy = spectrogramSettings;
+    // Задачи прошлых запросов, ещё стоящие в очереди, сверяются с этим набором
+    // и пропускаются, если окно от них уже ушло
+    spectrogramWanted->assign(wanted);
+    if (pending.isEmpty()) {
+        return;
+    }
 
-    const QFuture<QVector<QImage>> future = QtConcurrent::run(
-        [audioCopy, sampleRateCopy, settingsCopy]() {
-            return computeSpectrogramImages(audioCopy, sampleRateCopy, settingsCopy);
-        });
-    spectrogramWatcher->setFuture(future);
+    // Середина окна заполняется первой
+    std::stable_sort(pending.begin(), pending.end(),
+                     [](const PendingTile& a, const PendingTile& b) {
+                         return a.distance < b.distance;
+                     });
+
+    const std::shared_ptr<const SpectrogramPass> pass =
+        makeSpectrogramPass(audioData, sampleRate, spectrogramSettings);
+    const std::shared_ptr<const SpectrogramWantedTiles> wantedTiles = spectrogramWanted;
+    const quint64 generation = spectrogramGeneration.load();
+
+    for (const PendingTile& item : pending) {
+        const SpectrogramTileKey key = item.key;
+        spectrogramPendingTiles.insert(key);
+        spectrogramPool->start(QRunnable::create([this, pass, wantedTiles, generation, key]() {
+            QImage image;
+            if (wantedTiles->contains(key)) {
+                image = computeSpectrogramTile(*pass, key, spectrogramGeneration, generation);
+            }
+            // Ответ приходит и для пропущенной плитки: её надо снять с ожидания
+            // (this жив — см. ~WaveformView)
+            QMetaObject::invokeMethod(this, [this, generation, key, image]() {
+                onSpectrogramTileReady(generation, key, image);
+            }, Qt::QueuedConnection);
+        }));
+    }
 }
 
-void WaveformView::onSpectrogramReady()
+void WaveformView::onSpectrogramTileReady(quint64 generation, const SpectrogramTileKey& key,
+                                          const QImage& image)
 {
-    spectrogramComputationInProgress = false;
-    if (realtimeStretchShuttingDown || !spectrogramWatcher) {
+    if (realtimeStretchShuttingDown || generation != spectrogramGeneration.load()) {
         return;
     }
-    if (spectrogramWatcher->isCanceled()) {
-        if (spectrogramDirty) {
-            scheduleSpectrogramRegeneration();
-        }
-        return;
+    spectrogramPendingTiles.remove(key);
+    if (!image.isNull()) {
+        spectrogramCache.insert(key, image);
+        scheduleUpdate();
+    } else if (spectrogramWanted->contains(key)) {
+        // Пропущена, пока окно было в стороне, а теперь снова нужна
+        scheduleUpdate();
     }
+}
 
-    if (spectrogramDirty) {
-        scheduleSpectrogramRegeneration();
+void WaveformView::drawSpectrogram(QPainter& painter, const ViewportGeometry& vp)
+{
+    const int numCh = audioData.size();
+    const float channelHeight = float(height()) / float(qMax(1, numCh));
+    if (audioData[0].isEmpty() || vp.visibleSamples <= 0) {
         return;
     }
 
-    spectrogramImages = spectrogramWatcher->result();
-    update();
+    const quint64 settingsKey = spectrogramSettingsKey();
+    const int targetLevel = spectrogramLevelFor(vp);
+    const int windowSize = spectrogramSettings.windowSize;
+
+    const double audioPerDisplay =
+        double(audioData[0].size()) / double(qMax<qint64>(1, displaySampleCount()));
+    const double viewStart = double(vp.startSample) * audioPerDisplay;
+    const double pixelsPerSample = double(width()) / (double(vp.visibleSamples) * audioPerDisplay);
+
+    // Сначала подложка из более грубых уровней, затем более мелкий (остался
+    // от прошлого масштаба), нужный уровень — поверх всех
+    QVector<int> levels;
+    for (int level = qMin(SpectrogramCache::kMaxLevel, targetLevel + SPECTROGRAM_FALLBACK_LEVELS);
+         level > targetLevel; --level) {
+        levels.append(level);
+    }
+    if (targetLevel > 0) {
+        levels.append(targetLevel - 1);
+    }
+    levels.append(targetLevel);
+
+    for (int ch = 0; ch < numCh; ++ch) {
+        const int top = int(ch * channelHeight);
+        const int bottom = int((ch + 1) * channelHeight);
+        for (int level : levels) {
+            const qint64 hop = SpectrogramCache::hopForLevel(level);
+            const qint64 tileSamples = hop * SpectrogramCache::kTileColumns;
+            const qint64 tileCount = SpectrogramCache::tileCount(audioData[ch].size(), windowSize, level);
+            // Столбец кадра f покрывает [f*hop + (окно - hop)/2, +hop): центр кадра посередине
+            const double columnOffset = 0.5 * double(windowSize - hop);
+            const qint64 firstTile = qMax<qint64>(0, qint64(viewStart - columnOffset) / tileSamples);
+            const qint64 lastTile = qMin<qint64>(
+                tileCount - 1,
+                qint64(viewStart + double(width()) / pixelsPerSample) / tileSamples);
+
+            for (qint64 tile = firstTile; tile <= lastTile; ++tile) {
+                const QImage* image =
+                    spectrogramCache.find(SpectrogramTileKey { settingsKey, ch, level, int(tile) });
+                if (!image) {
+                    continue;  // ещё считается — на её месте подложка или фон
+                }
+                const double tileStart = double(tile * tileSamples) + columnOffset;
+                // Целые края: соседние плитки стыкуются без щелей и наложений
+                const int left = qFloor((tileStart - viewStart) * pixelsPerSample);
+                const int right = qFloor((tileStart + double(image->width() * hop) - viewStart)
+                                         * pixelsPerSample);
+                if (right <= left) {
+                    continue;
+                }
+                painter.drawImage(QRect(left, top, right - left, bottom - top), *image);
+            }
+        }
+    }
 }
 
 void WaveformView::resizeEvent(QResizeEvent* event)
 {
     QWidget::resizeEvent(event);
-    invalidateWavePixmapCache();
+    // Кеш волны сверяет размер окна сам (waveRasterTarget)
 }
 
 void WaveformView::setMarkers(const QVector<Marker>& newMarkers)
@@ -732,9 +1091,25 @@ void WaveformView::setBeatInfo(const QVector<BPMAnalyzer::BeatInfo>& newBeats)
     if (!beats.isEmpty()) {
         gridStartSample = beats.first().position;
     }
+    deviationModel.setBeats(beats);
+    refreshDeviations();
     update();
 }
 
+void WaveformView::refreshDeviations()
+{
+    if (deviationModel.isEmpty() || sampleRate <= 0) {
+        return;
+    }
+    if (tempoMap.isVariable()) {
+        deviationModel.evaluate(tempoMap, sampleRate);
+        return;
+    }
+    BPMAnalyzer::DeviationOptions options;
+    options.gridStartSample = gridStartSample;
+    deviationModel.evaluate(bpm, sampleRate, options);
+}
+
 void WaveformView::paintEvent(QPaintEvent* event)
 {
     Q_UNUSED(event)
@@ -754,40 +1129,12 @@ void WaveformView::paintEvent(QPaintEvent* event)
         ViewportGeometry vp = getViewportGeometry(displaySampleCount(), width());
 
         if (renderMode == WaveformRenderMode::Spectrogram) {
-            if (spectrogramDirty && !spectrogramComputationInProgress.load()) {
-                scheduleSpectrogramRegeneration();
-            }
+            requestSpectrogramTiles(vp);
 
-            // ---- Отрисовка по каналам ----
+            // ---- Отрисовка по каналам: готовые плитки, остальные дорисуются по мере расчёта ----
             const int numCh = audioData.size();
             const float channelHeight = float(height()) / float(qMax(1, numCh));
-            const qint64 totalSamples = audioData[0].size();
-
-            auto sampleToFrame = [](qint64 sample, qint64 total, int frames) -> int {
-                if (total <= 0) return 0;
-                int f = int(double(sample) / double(total) * frames);
-                return qBound(0, f, frames - 1);
-            };
-
-            for (int ch = 0; ch < numCh; ++ch) {
-                if (ch >= spectrogramImages.size()) break;
-                const QImage& img = spectrogramImages[ch];
-                if (img.isNull()) continue;
-
-                int frameCount = img.width();
-                int freqBinsH  = img.height();
-
-                QRectF chRect(0, ch * channelHeight, width(), channelHeight);
-
-                int startFrame = sampleToFrame(vp.startSample, totalSamples, frameCount);
-                qint64 endSample = qint64(vp.startSample) + qint64(vp.visibleSamples);
-                int endFrame = sampleToFrame(endSample, totalSamples, frameCount) + 1;
-                endFrame = qBound(startFrame + 1, endFrame, frameCount);
-                int subWidth = qMax(1, endFrame - startFrame);
-
-                QImage sub = img.copy(startFrame, 0, subWidth, freqBinsH);
-                painter.drawImage(chRect, sub);
-            }
+            drawSpectrogram(painter, vp);
 
             painter.setRenderHint(QPainter::Antialiasing, false);
             painter.setPen(QPen(QColor(80, 80, 80), 1));
@@ -796,12 +1143,12 @@ void WaveformView::paintEvent(QPaintEvent* event)
                 painter.drawLine(QPointF(0, y), QPointF(width(), y));
             }
         } else {
-            if (!isWavePixmapCacheValid()) {
-                regenerateWavePixmap();
-            }
-            if (!cachedWavePixmap.isNull()) {
-                painter.drawPixmap(0, 0, cachedWavePixmap);
+            // Волна рисуется в фоне; пока новое изображение считается, показываем прежнее
+            const WaveRaster waveTarget = waveRasterTarget(vp);
+            if (!waveRasterCovers(waveTarget)) {
+                requestWaveRaster(waveTarget);
             }
+            drawWaveRaster(painter, waveTarget);
 
             const float channelHeight = height() / float(audioData.size());
             for (int i = 0; i < audioData.size(); ++i) {
@@ -818,9 +1165,9 @@ void WaveformView::paintEvent(QPaintEvent* event)
                 if (beatVisualizationSettings.showBeatWaveform && !beats.isEmpty()) {
                     QVector<BPMAnalyzer::BeatInfo> displayBeats = beats;
                     if (!originalAudioData.isEmpty() && markers.size() >= 2) {
-                        qint64 refSize = originalAudioData[0].size();
+                        const TimeWarpMap& warp = timeWarpMap();
                         for (BPMAnalyzer::BeatInfo& b : displayBeats) {
-                            b.position = mapOriginalSampleToDisplay(b.position, markers, refSize);
+                            b.position = warp.toDisplay(b.position);
                         }
                     }
                     BeatVisualizer::drawBeatWaveform(painter, sourceSamples, displayBeats,
@@ -854,27 +1201,54 @@ void WaveformView::paintEvent(QPaintEvent* event)
     drawMarkers(painter, rect());
 }
 
-const WaveformPeaks* WaveformView::peaksFor(const QVector<float>& samples)
+const WaveformPeaks* WaveformView::peaksFor(const QVector<QVector<float>>& channels)
 {
-    if (samples.isEmpty()) {
+    if (channels.isEmpty() || channels[0].isEmpty()) {
         return nullptr;
     }
-    for (ChannelPeaks& entry : wavePeaks) {
-        if (entry.source == samples.constData() && entry.size == samples.size()) {
-            return &entry.peaks;
+    if (const TrackPeaks* entry = findTrackPeaks(channels)) {
+        return entry->peaks.isValid() ? &entry->peaks : nullptr;
+    }
+
+    TrackPeaks entry;
+    entry.sources.reserve(channels.size());
+    for (const QVector<float>& channel : channels) {
+        entry.sources.append(channel.constData());
+    }
+    entry.size = channels[0].size();
+    entry.peaks.buildChannels(channels);
+    storeTrackPeaks(std::move(entry));
+    return wavePeaks.last().peaks.isValid() ? &wavePeaks.last().peaks : nullptr;
+}
+
+const WaveformView::TrackPeaks* WaveformView::findTrackPeaks(const QVector<QVector<float>>& channels) const
+{
+    if (channels.isEmpty()) {
+        return nullptr;
+    }
+    for (const TrackPeaks& entry : wavePeaks) {
+        if (entry.size != channels[0].size() || entry.sources.size() != channels.size()) {
+            continue;
+        }
+        bool same = true;
+        for (int ch = 0; ch < channels.size() && same; ++ch) {
+            same = entry.sources[ch] == channels[ch].constData();
+        }
+        if (same) {
+            return &entry;
         }
     }
+    return nullptr;
+}
 
-    // Держим по одной пирамиде на канал: больше буферов одновременно не рисуем
-    if (wavePeaks.size() >= 4) {
+void WaveformView::storeTrackPeaks(TrackPeaks entry)
+{
+    wavePeaks.removeIf([&entry](const TrackPeaks& other) { return other.sources == entry.sources; });
+    // Держим пирамиды исходного и растянутого аудио: больше буферов одновременно не рисуем
+    if (wavePeaks.size() >= 2) {
         wavePeaks.removeFirst();
     }
-    ChannelPeaks entry;
-    entry.source = samples.constData();
-    entry.size = samples.size();
-    entry.peaks.build(samples);
     wavePeaks.append(std::move(entry));
-    return &wavePeaks.last().peaks;
 }
 
 void WaveformView::invalidateWavePeaks()
@@ -882,69 +1256,27 @@ void WaveformView::invalidateWavePeaks()
     wavePeaks.clear();
 }
 
-void WaveformView::drawWaveform(QPainter& painter, const QVector<float>& samples, const QRectF& rect)
+const WaveformPeaks* WaveformView::sourcePeaks()
 {
-    if (samples.isEmpty()) return;
-
-    // Количество сэмплов на пиксель с учетом масштаба
-    float samplesPerPixel = float(samples.size()) / (rect.width() * zoomLevel);
-
-    // Вычисляем начальный сэмпл с учетом смещения и масштаба
-    int visibleSamples = int(rect.width() * samplesPerPixel);
-    int maxStartSample = qMax(0, samples.size() - visibleSamples);
-    int startSample = int(horizontalOffset * maxStartSample);
-
-    // Применяем вертикальное смещение
-    QRectF adjustedRect = rect;
-    adjustedRect.translate(0, -verticalOffset * rect.height());
-
-    const float centerY = adjustedRect.center().y();
-    const float halfHeight = adjustedRect.height() * 0.5f;
-
-    // Пики берём из пирамиды: точные min/max без прореживания и без прохода
-    // по сырым сэмплам на каждой перерисовке
-    const WaveformPeaks* peaks = peaksFor(samples);
-
-    for (int x = 0; x < rect.width(); ++x) {
-        int currentSample = startSample + int(x * samplesPerPixel);
-        int nextSample = startSample + int((x + 1) * samplesPerPixel);
-
-        if (currentSample >= samples.size()) break;
-
-        float minValue = 0, maxValue = 0;
-        const int lastSample = qMin(nextSample, samples.size());
-        float peakMin = 0.0f;
-        float peakMax = 0.0f;
-        if (peaks && peaks->range(samples, currentSample, lastSample, peakMin, peakMax)) {
-            minValue = qMin(0.0f, peakMin);
-            maxValue = qMax(0.0f, peakMax);
-        } else {
-            // Запасной путь (например, буфер сменился прямо сейчас)
-            for (int s = currentSample; s < lastSample; ++s) {
-                minValue = qMin(minValue, samples[s]);
-                maxValue = qMax(maxValue, samples[s]);
-            }
-        }
-
-        // Определяем цвет в зависимости от частоты
-        float frequency = qAbs(maxValue - minValue);
-        QColor waveColor;
-        if (frequency < 0.3f) {
-            waveColor = colors.getLowColor();
-        } else if (frequency < 0.6f) {
-            waveColor = colors.getMidColor();
-        } else {
-            waveColor = colors.getHighColor();
-        }
-
-        painter.setPen(waveColor);
+    return peaksFor(getSourceAudioData());
+}
 
-        // Рисуем вертикальную линию от минимума до максимума
-        float topY = centerY - (maxValue * halfHeight);
-        float bottomY = centerY - (minValue * halfHeight);
-        painter.drawLine(QPointF(adjustedRect.x() + x, topY),
-                        QPointF(adjustedRect.x() + x, bottomY));
+bool WaveformView::adoptSourcePeaks(const WaveformPeaks& peaks)
+{
+    const QVector<QVector<float>>& channels = getSourceAudioData();
+    if (!peaks.isValid() || channels.isEmpty() || peaks.channelCount() != channels.size()
+        || peaks.sampleCount() != channels[0].size()) {
+        return false;
     }
+    TrackPeaks entry;
+    for (const QVector<float>& channel : channels) {
+        entry.sources.append(channel.constData());
+    }
+    entry.size = channels[0].size();
+    entry.peaks = peaks;
+    storeTrackPeaks(std::move(entry));
+    invalidateWavePixmapCache();
+    return true;
 }
 
 bool WaveformView::needsWarpedWaveformPreview() const
@@ -958,7 +1290,7 @@ bool WaveformView::needsWarpedWaveformPreview() const
     if (originalAudioData.size() != audioData.size()) {
         return false;
     }
-    if (!markersChangeTimeline(markers)) {
+    if (!timeWarpMap().changesTimeline()) {
         return false;
     }
     // Полноценное превью уже применено — рисуем готовые сэмплы
@@ -973,80 +1305,25 @@ qint64 WaveformView::displaySampleCount() const
     if (audioData.isEmpty() || audioData[0].isEmpty()) {
         return 0;
     }
-    const qint64 originalSize =
-        originalAudioData.isEmpty() ? audioData[0].size() : originalAudioData[0].size();
     if (needsWarpedWaveformPreview()) {
-        return estimateStretchedLength(markers, originalSize);
+        return timeWarpMap().displaySize();
     }
     return audioData[0].size();
 }
 
 bool WaveformView::hasTimelineStretch() const
 {
-    return markersChangeTimeline(markers);
+    return timeWarpMap().changesTimeline();
 }
 
-void WaveformView::drawWarpedWaveformPreview(QPainter& painter,
-                                             const QVector<float>& samples,
-                                             const QRectF& rect)
+const TimeWarpMap& WaveformView::timeWarpMap() const
 {
-    if (samples.isEmpty()) {
-        return;
-    }
-
-    const qint64 displayLength = estimateStretchedLength(markers, samples.size());
-    float samplesPerPixel = float(displayLength) / (rect.width() * zoomLevel);
-    int visibleSamples = int(rect.width() * samplesPerPixel);
-    int maxStartSample = qMax(0, int(displayLength) - visibleSamples);
-    int startDisplaySample = int(horizontalOffset * maxStartSample);
-
-    QRectF adjustedRect = rect;
-    adjustedRect.translate(0, -verticalOffset * rect.height());
-
-    const float centerY = adjustedRect.center().y();
-    const float halfHeight = adjustedRect.height() * 0.5f;
-
-    for (int x = 0; x < int(rect.width()); ++x) {
-        const qint64 displayStart = startDisplaySample + qint64(x * samplesPerPixel);
-        const qint64 displayEnd = startDisplaySample + qint64((x + 1) * samplesPerPixel);
-
-        const qint64 origStart = mapDisplaySampleToOriginal(displayStart, markers, samples.size());
-        const qint64 origEnd = mapDisplaySampleToOriginal(qMax(displayStart, displayEnd - 1),
-                                                          markers,
-                                                          samples.size());
-
-        float minValue = 0.0f;
-        float maxValue = 0.0f;
-        const qint64 from = qBound(qint64(0), qMin(origStart, origEnd), qint64(samples.size() - 1));
-        const qint64 to = qBound(qint64(0), qMax(origStart, origEnd), qint64(samples.size() - 1));
-        const qint64 span = qMax<qint64>(1, to - from + 1);
-        const qint64 step = qMax<qint64>(1, span / 200);
-
-        for (qint64 s = from; s <= to; s += step) {
-            const int idx = int(s);
-            if (idx < 0 || idx >= samples.size()) {
-                continue;
-            }
-            minValue = qMin(minValue, samples[idx]);
-            maxValue = qMax(maxValue, samples[idx]);
-        }
-
-        const float frequency = qAbs(maxValue - minValue);
-        QColor waveColor;
-        if (frequency < 0.3f) {
-            waveColor = colors.getLowColor();
-        } else if (frequency < 0.6f) {
-            waveColor = colors.getMidColor();
-        } else {
-            waveColor = colors.getHighColor();
-        }
-
-        painter.setPen(waveColor);
-        const float topY = centerY - (maxValue * halfHeight);
-        const float bottomY = centerY - (minValue * halfHeight);
-        painter.drawLine(QPointF(adjustedRect.x() + x, topY),
-                         QPointF(adjustedRect.x() + x, bottomY));
+    const QVector<QVector<float>>& source = getSourceAudioData();
+    const qint64 originalSize = source.isEmpty() ? 0 : source[0].size();
+    if (!timeWarp.isBuiltFor(markers, originalSize)) {
+        timeWarp = TimeWarpMap(markers, originalSize);
     }
+    return timeWarp;
 }
 
 void WaveformView::drawGrid(QPainter& painter, const QRect& rect)
@@ -1074,6 +1351,24 @@ void WaveformView::drawBeatLines(QPainter& painter, const QRect& rect)
 
     ViewportGeometry vp = getViewportGeometry(displaySampleCount(), rect.width());
 
+    if (tempoMap.isVariable()) {
+        // Переменный темп: доли — по карте, деление такта то же
+        const double beatsPerSubdivision = double(barLengthInQuarters) / subdivisionsPerBar;
+        const int firstSub = int(std::floor(tempoMap.beatAtSample(double(vp.startSample)) / beatsPerSubdivision));
+        for (int sub = firstSub; ; ++sub) {
+            const double samplePos = tempoMap.sampleAtBeat(sub * beatsPerSubdivision);
+            if (samplePos < double(vp.startSample)) continue;
+
+            const float x = float((samplePos - double(vp.startSample)) / vp.samplesPerPixel);
+            if (x >= rect.width()) break;
+
+            const bool isStrongBeat = (sub % subdivisionsPerBar) == 0;
+            painter.setPen(QPen(colors.getBeatColor(), isStrongBeat ? 2.0 : 1.0));
+            painter.drawLine(QPointF(rect.x() + x, rect.top()), QPointF(rect.x() + x, rect.bottom()));
+        }
+        return;
+    }
+
     int firstSubdivision = 0;
     if (gridStartSample > 0) {
         float subsFromGrid = float(vp.startSample - gridStartSample) / samplesPerSubdivision;
@@ -1115,6 +1410,9 @@ void WaveformView::applyGridStartSample(qint64 newGrid, bool moveMarkers)
     }
 
     gridStartSample = newGrid;
+    tempoMap.shift(double(delta));
+    // Темп прежний: отклонения сдвигаются на месте, без calculateDeviations
+    deviationModel.shiftGrid(double(delta));
 
     if (moveMarkers) {
         for (Marker& m : markers) {
@@ -1156,6 +1454,14 @@ qint64 WaveformView::snapSampleToGrid(qint64 samplePos) const
     int subdivisionsPerBar = (beatsPerBar == 6 || beatsPerBar == 12) ? 8 : 4;
     float samplesPerSubdivision = samplesPerBar / float(subdivisionsPerBar);
 
+    if (tempoMap.isVariable()) {
+        const double beatsPerSubdivision = double(barLengthInQuarters) / subdivisionsPerBar;
+        // Как и у постоянной сетки — не раньше опорной линии (доли 0)
+        const double sub = qMax(0.0, std::round(tempoMap.beatAtSample(double(samplePos)) / beatsPerSubdivision));
+        const qint64 snapped = qint64(std::llround(tempoMap.sampleAtBeat(sub * beatsPerSubdivision)));
+        return qBound(qint64(0), snapped, qint64(audioData[0].size() - 1));
+    }
+
     float subsFromStart;
     if (gridStartSample > 0) {
         subsFromStart = float(samplePos - gridStartSample) / samplesPerSubdivision;
@@ -2157,10 +2463,6 @@ void WaveformView::setWaveformRenderMode(WaveformRenderMode mode)
         return;
     }
     renderMode = mode;
-    if (renderMode == WaveformRenderMode::Spectrogram) {
-        spectrogramImages.clear();
-        spectrogramDirty = true;
-    }
     update();
 }
 
@@ -2169,9 +2471,9 @@ void WaveformView::setSpectrogramSettings(const SpectrogramSettings& s)
     if (spectrogramSettings == s) {
         return;
     }
+    // Кеш не сбрасываем: у плиток других настроек другой ключ, и при возврате
+    // к прежним настройкам они снова пригодятся
     spectrogramSettings = s;
-    spectrogramImages.clear();
-    spectrogramDirty = true;
     if (renderMode == WaveformRenderMode::Spectrogram) {
         update();
     }
@@ -2989,11 +3291,9 @@ void WaveformView::startRealtimeStretchJob()
             if (fresh && !audio.isEmpty() && !audio[0].isEmpty()) {
                 self->audioData = audio;
                 self->invalidateWavePeaks();
-
-                if (self->renderMode == WaveformRenderMode::Spectrogram) {
-                    self->spectrogramImages.clear();
-                    self->spectrogramDirty = true;
-                }
+                // Кеш спектрограммы переживает смену режима, поэтому
+                // сбрасывается при любой смене аудио
+                self->invalidateSpectrogram();
                 self->scheduleUpdate();
             } else {
                 self->realtimeStretchDirty = true;
@@ -3011,8 +3311,7 @@ void WaveformView::updateOriginalData(const QVector<QVector<float>>& newData)
     originalAudioData = newData;
     ++audioSourceGeneration; // Результаты фоновых задач со старыми данными будут отброшены
     realtimeStretchDirty = false;
-    spectrogramImages.clear();
-    spectrogramDirty = true;
+    invalidateSpectrogram();
 }
 
 void WaveformView::applyStretchedPreview(const QVector<QVector<float>>& channels)
@@ -3028,10 +3327,7 @@ void WaveformView::applyStretchedPreview(const QVector<QVector<float>>& channels
 
     audioData = channels;
     invalidateWavePeaks();
-    if (renderMode == WaveformRenderMode::Spectrogram) {
-        spectrogramImages.clear();
-        spectrogramDirty = true;
-    }
+    invalidateSpectrogram();
     invalidateWavePixmapCache();
     scheduleUpdate();
 }
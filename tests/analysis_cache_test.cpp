@@ -0,0 +1,379 @@
+// Кеш анализа на диске (AnalysisCache): запись читается обратно без потерь,
+// битый или чужой файл не принимается за правду, папка держит бюджет.
+//
+// Из кеша при повторном открытии берутся сетка долей, пики и ноты — ошибка
+// здесь незаметно подменяет анализ дорожки чужим или испорченным.
+
+#include <QtTest/QTest>
+#include <QtCore/QDateTime>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QTemporaryDir>
+
+#include "../include/analysiscache.h"
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+namespace {
+
+QVector<QVector<float>> makeChannels(int size)
+{
+    QVector<QVector<float>> channels(2, QVector<float>(size));
+    for (int i = 0; i < size; ++i) {
+        channels[0][i] = float(std::sin(i * 0.013));
+        channels[1][i] = float(0.5 * std::cos(i * 0.007));
+    }
+    return channels;
+}
+
+KeyAnalyzer::KeyInfo makeKey(KeyAnalyzer::Key key, const QString& name)
+{
+    KeyAnalyzer::KeyInfo info;
+    info.key = key;
+    info.keyName = name;
+    info.confidence = 0.8f;
+    info.strength = 0.6f;
+    info.isMajor = (int(key) % 2) == 0;
+    return info;
+}
+
+AnalysisCacheEntry makeEntry()
+{
+    const QVector<QVector<float>> channels = makeChannels(100000);
+    AnalysisCacheEntry entry;
+    entry.sampleRate = 44100;
+    entry.channelCount = channels.size();
+    entry.sampleCount = channels[0].size();
+    entry.peaks.buildChannels(channels);
+
+    entry.hasBeats = true;
+    entry.beats.bpm = 123.5f;
+    entry.beats.confidence = 0.9f;
+    entry.beats.gridStartSample = 777;
+    entry.beats.isFixedTempo = false;
+    entry.beats.hasPreliminaryBPM = true;
+    entry.beats.preliminaryBPM = 61.75f;
+    entry.beatsOptionsKey = 0x0123456789abcdefULL;
+    for (int i = 0; i < 50; ++i) {
+        BPMAnalyzer::BeatInfo beat;
+        beat.position = 777 + i * 21400;
+        beat.expectedPosition = beat.position + (i % 3) - 1;
+        beat.confidence = 0.5f + i * 0.01f;
+        beat.deviation = (i % 5) * 0.01f;
+        beat.energy = float(i);
+        entry.beats.beats.append(beat);
+    }
+
+    entry.hasPitchAnalysis = true;
+    entry.keyGrid.bpm = 123.5f;
+    entry.keyGrid.beatsPerBar = 3;
+    entry.keyGrid.gridStartSample = 777;
+    entry.perBarKey.primaryKey = makeKey(KeyAnalyzer::A_MINOR, QStringLiteral("A Minor"));
+    entry.perBarKey.hasModulation = true;
+    for (int bar = 0; bar < 4; ++bar) {
+        KeyAnalyzer::BarKey barKey;
+        barKey.barIndex = bar;
+        barKey.startSample = 777 + bar * 64200;
+        barKey.endSample = barKey.startSample + 64200;
+        barKey.key = bar < 3 ? entry.perBarKey.primaryKey
+                             : makeKey(KeyAnalyzer::C_MAJOR, QStringLiteral("C Major"));
+        entry.perBarKey.bars.append(barKey);
+    }
+    KeyAnalyzer::KeyRegion region;
+    region.startBar = 0;
+    region.endBar = 2;
+    region.startSample = 777;
+    region.endSample = 777 + 3 * 64200;
+    region.key = entry.perBarKey.primaryKey;
+    entry.perBarKey.regions.append(region);
+
+    PitchDetector::PitchNote note;
+    note.startSample = 1000;
+    note.endSample = 5000;
+    note.midiPitch = 64.25f;
+    note.detectedPitch = 64.0f;
+    note.confidence = 0.7f;
+    entry.notes.append(note);
+    note.startSample = 9000;
+    note.endSample = 12000;
+    note.sourceStartSample = 6000;
+    note.sourceEndSample = 9000;
+    entry.notes.append(note);
+    return entry;
+}
+
+void comparePeaks(const WaveformPeaks& a, const WaveformPeaks& b)
+{
+    const QVector<QVector<float>> channels = makeChannels(int(a.sampleCount()));
+    QCOMPARE(a.sampleCount(), b.sampleCount());
+    QCOMPARE(a.channelCount(), b.channelCount());
+    for (qint64 span : { qint64(300), qint64(9000), a.sampleCount() }) {
+        for (qint64 from = 0; from + span <= a.sampleCount(); from += span + 1234) {
+            float minsA[2] = {};
+            float maxsA[2] = {};
+            float minsB[2] = {};
+            float maxsB[2] = {};
+            QVERIFY(a.rangeAll(channels, from, from + span, minsA, maxsA));
+            QVERIFY(b.rangeAll(channels, from, from + span, minsB, maxsB));
+            for (int ch = 0; ch < 2; ++ch) {
+                QCOMPARE(minsA[ch], minsB[ch]);
+                QCOMPARE(maxsA[ch], maxsB[ch]);
+            }
+        }
+    }
+}
+
+} // namespace
+
+class AnalysisCacheTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testRoundTrip();
+    void testOptionalSections();
+    void testRejectsDamagedData();
+    void testRejectsOversizedPeaksHeader();
+    void testOptionsKey();
+    void testStoreAndLoad();
+    void testBudgetEvictsOldest();
+    void testContentHash();
+};
+
+// Всё записанное читается обратно как было
+void AnalysisCacheTest::testRoundTrip()
+{
+    const AnalysisCacheEntry entry = makeEntry();
+    const QByteArray bytes = AnalysisCache::encode(entry);
+
+    AnalysisCacheEntry out;
+    QVERIFY(AnalysisCache::decode(bytes.constData(), bytes.size(), out));
+    QCOMPARE(out.sampleRate, entry.sampleRate);
+    QCOMPARE(out.channelCount, entry.channelCount);
+    QCOMPARE(out.sampleCount, entry.sampleCount);
+    comparePeaks(out.peaks, entry.peaks);
+
+    QVERIFY(out.hasBeats);
+    QCOMPARE(out.beats.bpm, entry.beats.bpm);
+    QCOMPARE(out.beats.gridStartSample, entry.beats.gridStartSample);
+    QCOMPARE(out.beats.isFixedTempo, false);
+    QCOMPARE(out.beats.hasPreliminaryBPM, true);
+    QCOMPARE(out.beats.preliminaryBPM, entry.beats.preliminaryBPM);
+    QCOMPARE(out.beatsOptionsKey, entry.beatsOptionsKey);
+    QCOMPARE(out.beats.beats.size(), entry.beats.beats.size());
+    for (int i = 0; i < out.beats.beats.size(); ++i) {
+        QCOMPARE(out.beats.beats[i].position, entry.beats.beats[i].position);
+        QCOMPARE(out.beats.beats[i].expectedPosition, entry.beats.beats[i].expectedPosition);
+        QCOMPARE(out.beats.beats[i].deviation, entry.beats.beats[i].deviation);
+        QCOMPARE(out.beats.beats[i].energy, entry.beats.beats[i].energy);
+    }
+
+    QVERIFY(out.hasPitchAnalysis);
+    QCOMPARE(out.keyGrid.beatsPerBar, 3);
+    QCOMPARE(out.keyGrid.gridStartSample, qint64(777));
+    QCOMPARE(out.perBarKey.primaryKey.key, KeyAnalyzer::A_MINOR);
+    QCOMPARE(out.perBarKey.primaryKey.keyName, QStringLiteral("A Minor"));
+    QVERIFY(out.perBarKey.hasModulation);
+    QCOMPARE(out.perBarKey.bars.size(), 4);
+    QCOMPARE(out.perBarKey.bars[3].key.keyName, QStringLiteral("C Major"));
+    QCOMPARE(out.perBarKey.bars[3].startSample, entry.perBarKey.bars[3].startSample);
+    QCOMPARE(out.perBarKey.regions.size(), 1);
+    QCOMPARE(out.perBarKey.regions[0].endBar, 2);
+
+    QCOMPARE(out.notes.size(), 2);
+    QCOMPARE(out.notes[0].midiPitch, 64.25f);
+    QCOMPARE(out.notes[0].sourceStartSample, qint64(-1));
+    QCOMPARE(out.notes[1].sourceStart(), qint64(6000));
+    QVERIFY(out.notes[1].isMovedInTime());
+}
+
+// Без нот и пиков их секции не пишутся, флаги не взводятся
+void AnalysisCacheTest::testOptionalSections()
+{
+    AnalysisCacheEntry entry = makeEntry();
+    entry.hasPitchAnalysis = false;
+    entry.peaks.clear();
+    const QByteArray bytes = AnalysisCache::encode(entry);
+
+    AnalysisCacheEntry out;
+    QVERIFY(AnalysisCache::decode(bytes.constData(), bytes.size(), out));
+    QVERIFY(out.hasBeats);
+    QVERIFY(!out.hasPitchAnalysis);
+    QVERIFY(!out.peaks.isValid());
+    QVERIFY(out.notes.isEmpty());
+}
+
+// Обрезанный файл, чужая версия и пики от другой длины — отказ
+void AnalysisCacheTest::testRejectsDamagedData()
+{
+    const AnalysisCacheEntry entry = makeEntry();
+    const QByteArray bytes = AnalysisCache::encode(entry);
+    AnalysisCacheEntry out;
+
+    for (qsizetype size : { qsizetype(0), qsizetype(10), bytes.size() / 2, bytes.size() - 1 }) {
+        QVERIFY(!AnalysisCache::decode(bytes.constData(), size, out));
+    }
+
+    QByteArray otherVersion = bytes;
+    otherVersion[4] = char(otherVersion[4] + 1);
+    QVERIFY(!AnalysisCache::decode(otherVersion.constData(), otherVersion.size(), out));
+
+    AnalysisCacheEntry mismatched = entry;
+    mismatched.sampleCount += 1;
+    const QByteArray mismatchedBytes = AnalysisCache::encode(mismatched);
+    QVERIFY(!AnalysisCache::decode(mismatchedBytes.constData(), mismatchedBytes.size(), out));
+}
+
+// Заголовок пиков с огромными счётчиками отвергается по размеру блока,
+// а не переполняет произведение и не задаёт размер выделения
+void AnalysisCacheTest::testRejectsOversizedPeaksHeader()
+{
+    const QByteArray good = makeEntry().peaks.serialize();
+    QVERIFY(good.size() > 24);
+
+    struct Header {
+        quint32 magic;
+        qint32 channelCount;
+        qint64 sampleCount;
+        qint64 bucketSamples;
+    };
+    Header header {};
+    std::memcpy(&header, good.constData(), sizeof(header));
+
+    const QPair<qint32, qint64> hostile[] = {
+        { std::numeric_limits<qint32>::max(), std::numeric_limits<qint64>::max() },
+        { 2, std::numeric_limits<qint64>::max() },
+        { std::numeric_limits<qint32>::max(), header.sampleCount },
+        // 2^54 корзин × 1024 канала × 8 байт = 2^67: произведение в qint64 — 0,
+        // ровно как у блока из одного заголовка
+        { 1024, qint64(1) << 62 },
+    };
+    for (const auto& counts : hostile) {
+        QByteArray bytes = good;
+        Header bad = header;
+        bad.channelCount = counts.first;
+        bad.sampleCount = counts.second;
+        std::memcpy(bytes.data(), &bad, sizeof(bad));
+        WaveformPeaks peaks;
+        QVERIFY(!peaks.deserialize(bytes.constData(), bytes.size()));
+        QVERIFY(!peaks.isValid());
+        QVERIFY(!peaks.deserialize(bytes.constData(), qint64(sizeof(bad))));
+    }
+
+    WaveformPeaks peaks;
+    QVERIFY(peaks.deserialize(good.constData(), good.size()));
+}
+
+// Отпечаток настроек различает всё, что меняет сетку долей и фазу такта
+void AnalysisCacheTest::testOptionsKey()
+{
+    const BPMAnalyzer::AnalysisOptions base;
+    const quint64 key = AnalysisCache::optionsKey(base);
+    QCOMPARE(AnalysisCache::optionsKey(base), key);
+
+    BPMAnalyzer::AnalysisOptions options = base;
+    options.beatsPerBar = 3;
+    QVERIFY(AnalysisCache::optionsKey(options) != key);
+
+    options = base;
+    options.useMixxxAlgorithm = !base.useMixxxAlgorithm;
+    QVERIFY(AnalysisCache::optionsKey(options) != key);
+
+    options = base;
+    options.minBPM = base.minBPM + 10.0f;
+    QVERIFY(AnalysisCache::optionsKey(options) != key);
+
+    options = base;
+    options.maxBPM = base.maxBPM - 10.0f;
+    QVERIFY(AnalysisCache::optionsKey(options) != key);
+
+    // Начальный темп учитывается только когда включён
+    options = base;
+    options.useInitialBPM = false;
+    options.initialBPM = base.initialBPM + 7.0f;
+    BPMAnalyzer::AnalysisOptions unused = base;
+    unused.useInitialBPM = false;
+    QCOMPARE(AnalysisCache::optionsKey(options), AnalysisCache::optionsKey(unused));
+    options.useInitialBPM = true;
+    unused.useInitialBPM = true;
+    QVERIFY(AnalysisCache::optionsKey(options) != AnalysisCache::optionsKey(unused));
+}
+
+// Запись через файл; битый файл удаляется при чтении
+void AnalysisCacheTest::testStoreAndLoad()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    AnalysisCache cache(dir.filePath(QStringLiteral("analysis")));
+    const QByteArray hash = QByteArrayLiteral("0123456789abcdef");
+
+    AnalysisCacheEntry out;
+    QVERIFY(!cache.load(hash, out));
+    QVERIFY(cache.store(hash, makeEntry()));
+    QVERIFY(cache.load(hash, out));
+    QCOMPARE(out.beats.bpm, 123.5f);
+    QCOMPARE(out.notes.size(), 2);
+
+    const QString path = cache.directory() + QStringLiteral("/0123456789abcdef.dfac");
+    QVERIFY(QFile::exists(path));
+    QFile file(path);
+    QVERIFY(file.open(QIODevice::ReadWrite));
+    QVERIFY(file.resize(file.size() / 3));
+    file.close();
+    QVERIFY(!cache.load(hash, out));
+    QVERIFY(!QFile::exists(path));
+}
+
+// Сверх бюджета удаляются самые давние записи, свежая остаётся
+void AnalysisCacheTest::testBudgetEvictsOldest()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    AnalysisCache cache(dir.path());
+    const QByteArray hashes[] = { "aa", "bb", "cc", "dd" };
+    for (int i = 0; i < 4; ++i) {
+        QVERIFY(cache.store(hashes[i], makeEntry()));
+        // Время изменения — порядок вытеснения: aa самая давняя
+        QFile file(cache.directory() + QLatin1Char('/') + QString::fromLatin1(hashes[i])
+                   + QStringLiteral(".dfac"));
+        QVERIFY(file.open(QIODevice::ReadWrite));
+        QVERIFY(file.setFileTime(QDateTime::currentDateTimeUtc().addSecs(10 * (i - 5)),
+                                 QFileDevice::FileModificationTime));
+    }
+
+    // Бюджет на две с половиной записи; перезапись dd делает её самой свежей
+    const qint64 entryBytes = AnalysisCache::encode(makeEntry()).size();
+    cache.setBudgetBytes(entryBytes * 2 + entryBytes / 2);
+    QVERIFY(cache.store(QByteArrayLiteral("dd"), makeEntry()));
+
+    const QStringList left = QDir(dir.path()).entryList(QDir::Files);
+    QCOMPARE(left.size(), 2);
+    QVERIFY(left.contains(QStringLiteral("dd.dfac")));
+    QVERIFY(left.contains(QStringLiteral("cc.dfac")));
+}
+
+// Хеш зависит только от содержимого файла
+void AnalysisCacheTest::testContentHash()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    auto write = [&dir](const QString& name, const QByteArray& data) {
+        QFile file(dir.filePath(name));
+        QVERIFY(file.open(QIODevice::WriteOnly));
+        file.write(data);
+    };
+    write(QStringLiteral("a.wav"), QByteArray(100000, 'x'));
+    write(QStringLiteral("copy.wav"), QByteArray(100000, 'x'));
+    write(QStringLiteral("b.wav"), QByteArray(100000, 'x') + 'y');
+
+    const QByteArray a = AnalysisCache::contentHash(dir.filePath(QStringLiteral("a.wav")));
+    QVERIFY(!a.isEmpty());
+    QCOMPARE(AnalysisCache::contentHash(dir.filePath(QStringLiteral("copy.wav"))), a);
+    QVERIFY(AnalysisCache::contentHash(dir.filePath(QStringLiteral("b.wav"))) != a);
+    QVERIFY(AnalysisCache::contentHash(dir.filePath(QStringLiteral("missing.wav"))).isEmpty());
+}
+
+QTEST_APPLESS_MAIN(AnalysisCacheTest)
+#include "analysis_cache_test.moc"
@@ -0,0 +1,200 @@
+// Пакетный анализ (BatchAnalyzer, утилита dontfloat-analyze).
+//
+// Ночной прогон по тысячам стемов: обход не должен терять и дублировать
+// файлы, результат — ложиться туда, где его ждут, а по JSON и меткам — читаться
+// те же доли, что нашёл анализатор.
+
+#include <QtTest/QTest>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QJsonArray>
+#include <QtCore/QJsonDocument>
+#include <QtCore/QJsonObject>
+#include <QtCore/QTemporaryDir>
+
+#include <cmath>
+
+#include "../include/batchanalyzer.h"
+#include "../include/markersfile.h"
+#include "../include/wavwriter.h"
+
+namespace {
+
+constexpr int kSampleRate = 44100;
+constexpr float kBpm = 128.0f;
+
+/** Щелчки kBpm поверх слабого шума, seconds секунд. */
+bool writeClickTrack(const QString& path, int seconds)
+{
+    const int n = kSampleRate * seconds;
+    const int beatInterval = int(60.0f * kSampleRate / kBpm);
+    QVector<float> samples(n);
+    quint32 seed = 1234;
+    for (int i = 0; i < n; ++i) {
+        seed = seed * 1664525u + 1013904223u;
+        const int sinceBeat = i % beatInterval;
+        const float click = sinceBeat < 600 ? 0.9f * std::exp(-sinceBeat / 120.0f) : 0.0f;
+        samples[i] = click + 0.03f * (float(seed >> 8) / 16777216.0f - 0.5f);
+    }
+    WavWriter::WriteOptions options;
+    options.format = WavWriter::SampleFormat::Float32;
+    return WavWriter::writeFile(path, { samples }, kSampleRate, nullptr, options);
+}
+
+bool touch(const QString& path)
+{
+    QFile file(path);
+    return file.open(QIODevice::WriteOnly) && file.write("x") == 1;
+}
+
+BatchAnalyzer::Options clickOptions()
+{
+    // Путь без qm-dsp: на щелчках он даёт ровно kBpm (см. bpm_analyzer_test)
+    BatchAnalyzer::Options options;
+    options.bpmOptions.useMixxxAlgorithm = false;
+    options.bpmOptions.assumeFixedTempo = false;
+    options.detectNotes = false;
+    return options;
+}
+
+} // namespace
+
+class BatchAnalyzerTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testCollectsAudioFilesOnce();
+    void testOutputPathMirrorsTree();
+    void testRunWritesJsonAndMarkers();
+    void testSkipExistingAndFailures();
+};
+
+// Рекурсивный обход: только аудио, без повторов, большие файлы первыми
+void BatchAnalyzerTest::testCollectsAudioFilesOnce()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QVERIFY(QDir(dir.path()).mkpath(QStringLiteral("stems/drums")));
+    const QString big = dir.filePath(QStringLiteral("stems/drums/kick.wav"));
+    const QString mix = dir.filePath(QStringLiteral("mix.WAV"));
+    QVERIFY(writeClickTrack(big, 2));
+    QVERIFY(writeClickTrack(mix, 1));
+    QVERIFY(touch(dir.filePath(QStringLiteral("stems/notes.txt"))));
+
+    const QStringList files = BatchAnalyzer::collectAudioFiles({ dir.path(), big });
+    QCOMPARE(files.size(), 2);
+    QCOMPARE(files[0], QFileInfo(big).absoluteFilePath());
+    QCOMPARE(files[1], QFileInfo(mix).absoluteFilePath());
+
+    const QStringList topOnly = BatchAnalyzer::collectAudioFiles({ dir.path() }, false);
+    QCOMPARE(topOnly, QStringList { QFileInfo(mix).absoluteFilePath() });
+
+    QVERIFY(BatchAnalyzer::collectAudioFiles({ dir.filePath(QStringLiteral("missing")) }).isEmpty());
+}
+
+// Результат рядом с аудио или в outputDir с теми же подпапками
+void BatchAnalyzerTest::testOutputPathMirrorsTree()
+{
+    const QString suffix = QStringLiteral(".dontfloat.json");
+    BatchAnalyzer::Options options;
+    QCOMPARE(BatchAnalyzer::outputPathFor(QStringLiteral("/data/in/a/song.take1.wav"), options, suffix),
+             QStringLiteral("/data/in/a/song.take1.dontfloat.json"));
+
+    options.outputDir = QStringLiteral("/data/out");
+    options.inputRoot = QStringLiteral("/data/in");
+    QCOMPARE(BatchAnalyzer::outputPathFor(QStringLiteral("/data/in/a/b/song.wav"), options, suffix),
+             QStringLiteral("/data/out/a/b/song.dontfloat.json"));
+    QCOMPARE(BatchAnalyzer::outputPathFor(QStringLiteral("/data/in/song.wav"), options, suffix),
+             QStringLiteral("/data/out/song.dontfloat.json"));
+    // Файл вне корня не выводит результат за пределы outputDir
+    QCOMPARE(BatchAnalyzer::outputPathFor(QStringLiteral("/other/song.wav"), options, suffix),
+             QStringLiteral("/data/out/song.dontfloat.json"));
+}
+
+// Пакет на двух потоках: JSON и метки для каждого файла, доли — на щелчках
+void BatchAnalyzerTest::testRunWritesJsonAndMarkers()
+{
+    QTemporaryDir input;
+    QTemporaryDir output;
+    QVERIFY(input.isValid() && output.isValid());
+    QVERIFY(QDir(input.path()).mkpath(QStringLiteral("sub")));
+    QVERIFY(writeClickTrack(input.filePath(QStringLiteral("one.wav")), 20));
+    QVERIFY(writeClickTrack(input.filePath(QStringLiteral("sub/two.wav")), 16));
+
+    BatchAnalyzer::Options options = clickOptions();
+    options.jobs = 2;
+    options.format = BatchAnalyzer::OutputFormat::Both;
+    options.inputRoot = input.path();
+    options.outputDir = output.path();
+
+    const QStringList files = BatchAnalyzer::collectAudioFiles({ input.path() });
+    QCOMPARE(files.size(), 2);
+    // Колбэк зовётся из рабочих потоков (по одному за раз) — проверяем после
+    QVector<BatchAnalyzer::FileResult> results;
+    QVector<int> doneCounts;
+    const BatchAnalyzer::Summary summary = BatchAnalyzer::run(
+        files, options, [&](const BatchAnalyzer::FileResult& result, int done, int total) {
+            results.append(result);
+            doneCounts.append(done * 10 + total);
+        });
+    QCOMPARE(summary.analyzed, 2);
+    QCOMPARE(summary.failed, 0);
+    QCOMPARE(doneCounts, (QVector<int> { 12, 22 }));
+    for (const BatchAnalyzer::FileResult& result : results) {
+        QVERIFY2(result.ok, qPrintable(result.error));
+        QCOMPARE(result.outputs.size(), 2);
+    }
+
+    QFile json(output.filePath(QStringLiteral("sub/two.dontfloat.json")));
+    QVERIFY(json.open(QIODevice::ReadOnly));
+    const QJsonObject root = QJsonDocument::fromJson(json.readAll()).object();
+    QCOMPARE(root.value(QStringLiteral("sampleRate")).toInt(), kSampleRate);
+    QCOMPARE(float(root.value(QStringLiteral("bpm")).toDouble()), kBpm);
+    QVERIFY(root.contains(QStringLiteral("key")));
+    QVERIFY(!root.contains(QStringLiteral("notes")));
+
+    const int beatInterval = int(60.0f * kSampleRate / kBpm);
+    const QJsonArray beats = root.value(QStringLiteral("beats")).toArray();
+    QVERIFY(beats.size() > 16);
+    for (const QJsonValue& beat : beats) {
+        const qint64 sinceBeat = qint64(beat.toDouble()) % beatInterval;
+        QVERIFY(qMin<qint64>(sinceBeat, beatInterval - sinceBeat) < 600);
+    }
+
+    MarkersFileMeta meta;
+    QVector<MarkersFileEntry> entries;
+    QVERIFY(MarkersFile::readFile(output.filePath(QStringLiteral("one_markers.txt")), &meta, &entries));
+    QCOMPARE(meta.bpm, kBpm);
+    QCOMPARE(meta.sampleRate, kSampleRate);
+    QVERIFY(entries.size() > 30);
+}
+
+// Готовые результаты пропускаются; битый файл не роняет пакет
+void BatchAnalyzerTest::testSkipExistingAndFailures()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString good = dir.filePath(QStringLiteral("good.wav"));
+    const QString broken = dir.filePath(QStringLiteral("broken.wav"));
+    QVERIFY(writeClickTrack(good, 12));
+    QVERIFY(touch(broken));
+
+    BatchAnalyzer::Options options = clickOptions();
+    options.analyzeKeys = false;
+    options.jobs = 2;
+
+    BatchAnalyzer::Summary summary = BatchAnalyzer::run({ good, broken }, options);
+    QCOMPARE(summary.analyzed, 1);
+    QCOMPARE(summary.failed, 1);
+    QVERIFY(QFile::exists(dir.filePath(QStringLiteral("good.dontfloat.json"))));
+    QVERIFY(!QFile::exists(dir.filePath(QStringLiteral("broken.dontfloat.json"))));
+
+    options.skipExisting = true;
+    summary = BatchAnalyzer::run({ good }, options);
+    QCOMPARE(summary.skipped, 1);
+    QCOMPARE(summary.analyzed, 0);
+}
+
+QTEST_GUILESS_MAIN(BatchAnalyzerTest)
+#include "batch_analyzer_test.moc"
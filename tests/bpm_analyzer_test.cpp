@@ -1,5 +1,6 @@
 #include <QtTest/QTest>
 #include <QtCore/QVector>
+#include <cmath>
 #include <QtCore/QFileInfo>
 #include <QtCore/QDir>
 #include <QtCore/QCoreApplication>
@@ -11,6 +12,7 @@
 #include <QtMultimedia/QAudioFormat>
 #include "../include/bpmanalyzer.h"
 #include "../include/audiofileservice.h"
+#include "../include/onsetstream.h"
 
 class BPMAnalyzerTest : public QObject
 {
@@ -31,6 +33,17 @@ private slots:
     // Регрессия: длинный сигнал + Mixxx (хвост beat_period после viterbi не должен давать UB / assert STL в Debug MSVC)
     void testMixxxAnalyzeLongSyntheticNoCrash();
 
+    // Onset-функция, набранная блоками при декодировании, даёт тот же анализ, что и весь сигнал
+    void testOnsetStreamMatchesWholeSignal();
+
+    // Путь без qm-dsp: пороги и окна по общей огибающей энергии находят темп щелчков
+    void testFallbackFindsClickTempo();
+
+    // Сильная доля (DownBeat по прорежённому сигналу): такт начинается со смены гармонии
+    void testDownbeatStartsBar();
+    // Начало такта по barPhase — по карте темпа и без неё
+    void testBarStartSample();
+
 private:
     QString getTestDataPath(const QString& filename);
     QVector<QVector<float>> loadAudioFile(const QString& filePath, int& sampleRate);
@@ -314,5 +327,139 @@ void BPMAnalyzerTest::testMixxxAnalyzeLongSyntheticNoCrash()
 #endif
 }
 
+void BPMAnalyzerTest::testOnsetStreamMatchesWholeSignal()
+{
+    constexpr int sampleRate = 44100;
+    const int n = sampleRate * 8;
+    // Щелчки 120 BPM поверх тихого тона
+    QVector<float> left(n);
+    QVector<float> right(n);
+    const int beatInterval = sampleRate / 2;
+    for (int i = 0; i < n; ++i) {
+        const int sinceBeat = i % beatInterval;
+        const float click = sinceBeat < 400 ? 0.8f * std::exp(-sinceBeat / 80.0f) : 0.0f;
+        left[i] = click + 0.05f * std::sin(i * 0.031f);
+        right[i] = click - 0.05f * std::sin(i * 0.017f);
+    }
+    const QVector<float> mono = AudioFileService::toMono({ left, right });
+
+    // Блоки разной длины, как их отдаёт декодер; стерео сводится тем же средним, что toMono
+    OnsetStream stream(sampleRate);
+    int blockFrames = 1;
+    for (int offset = 0; offset < n; offset += blockFrames) {
+        blockFrames = qMin(1 + (offset * 7) % 4099, n - offset);
+        stream.push(left.constData() + offset, right.constData() + offset, blockFrames);
+    }
+    QCOMPARE(stream.sampleCount(), qint64(n));
+
+    OnsetStream whole(sampleRate);
+    whole.push(mono.constData(), int(mono.size()));
+    QCOMPARE(stream.values(), whole.values());
+    QCOMPARE(int(whole.values().size()),
+             (n - whole.windowSize() + whole.stepSize() - 1) / whole.stepSize());
+
+    BPMAnalyzer::AnalysisOptions options;
+    options.useMixxxAlgorithm = true;
+    const BPMAnalyzer::AnalysisResult streamed = BPMAnalyzer::analyzeOnsetStream(stream, options);
+    const BPMAnalyzer::AnalysisResult direct = BPMAnalyzer::analyzeBPM(mono, sampleRate, options);
+    QCOMPARE(streamed.bpm, direct.bpm);
+    QCOMPARE(streamed.gridStartSample, direct.gridStartSample);
+    QCOMPARE(streamed.barPhase, direct.barPhase);
+    QCOMPARE(streamed.beats.size(), direct.beats.size());
+    for (int i = 0; i < direct.beats.size(); ++i) {
+        QCOMPARE(streamed.beats[i].position, direct.beats[i].position);
+    }
+}
+
+void BPMAnalyzerTest::testFallbackFindsClickTempo()
+{
+    constexpr int sampleRate = 44100;
+    const int n = sampleRate * 20;
+    const int beatInterval = int(60.0f * sampleRate / 128.0f);
+    QVector<float> samples(n);
+    quint32 seed = 1234;
+    for (int i = 0; i < n; ++i) {
+        seed = seed * 1664525u + 1013904223u;
+        const int sinceBeat = i % beatInterval;
+        const float click = sinceBeat < 600 ? 0.9f * std::exp(-sinceBeat / 120.0f) : 0.0f;
+        samples[i] = click + 0.03f * (float(seed >> 8) / 16777216.0f - 0.5f);
+    }
+
+    BPMAnalyzer::AnalysisOptions options;
+    options.useMixxxAlgorithm = false;
+    options.assumeFixedTempo = false;
+    const BPMAnalyzer::AnalysisResult result = BPMAnalyzer::analyzeBPM(samples, sampleRate, options);
+    QCOMPARE(result.bpm, 128.0f);
+    QVERIFY(!result.beats.isEmpty());
+
+    // Доли стоят на щелчках: огибающая энергии максимальна у начала щелчка
+    for (const BPMAnalyzer::BeatInfo& beat : result.beats) {
+        const int sinceBeat = int(beat.position % beatInterval);
+        QVERIFY2(qMin(sinceBeat, beatInterval - sinceBeat) < 600,
+                 qPrintable(QStringLiteral("beat at %1").arg(beat.position)));
+    }
+}
+
+void BPMAnalyzerTest::testDownbeatStartsBar()
+{
+#ifdef USE_MIXXX_QM_DSP
+    constexpr int sampleRate = 44100;
+    const int n = sampleRate * 16;
+    const int beatInterval = sampleRate / 2;          // 120 BPM
+    const int barInterval = 4 * beatInterval;
+    const int firstBar = beatInterval;                // затакт в одну долю
+    // Одинаковые щелчки на каждой доле, тон меняется только на сильной доле
+    const float notes[] = { 220.0f, 330.0f, 262.0f, 392.0f };
+    QVector<float> samples(n);
+    double phase = 0.0;
+    for (int i = 0; i < n; ++i) {
+        const int sinceBeat = i % beatInterval;
+        const float click = sinceBeat < 400 ? 0.8f * std::exp(-sinceBeat / 80.0f) : 0.0f;
+        const int bar = i < firstBar ? 0 : 1 + (i - firstBar) / barInterval;
+        phase += 2.0 * M_PI * notes[bar % 4] / sampleRate;
+        samples[i] = click + 0.3f * float(std::sin(phase));
+    }
+
+    OnsetStream stream(sampleRate);
+    stream.push(samples.constData(), n);
+    QCOMPARE(int(stream.decimated().size()),
+             n / 1024 * (1024 / OnsetStream::kDownbeatDecimation));
+
+    BPMAnalyzer::AnalysisOptions options;
+    options.useMixxxAlgorithm = true;
+    const BPMAnalyzer::AnalysisResult result = BPMAnalyzer::analyzeOnsetStream(stream, options);
+    QVERIFY(result.bpm > 0.0f);
+    QVERIFY(result.barPhase >= 0 && result.barPhase < 4);
+
+    // Начало такта — на смене тона (с точностью до положения доли трекера)
+    const qint64 barStart = BPMAnalyzer::barStartSample(result, sampleRate);
+    const qint64 offset = ((barStart - firstBar) % barInterval + barInterval) % barInterval;
+    QVERIFY2(qMin(offset, barInterval - offset) < beatInterval / 8,
+             qPrintable(QStringLiteral("bar start %1, phase %2").arg(barStart).arg(result.barPhase)));
+#else
+    QSKIP("Mixxx qm-dsp не подключён (USE_MIXXX_QM_DSP)");
+#endif
+}
+
+void BPMAnalyzerTest::testBarStartSample()
+{
+    constexpr int sampleRate = 44100;
+    BPMAnalyzer::AnalysisResult result;
+    result.bpm = 120.0f;
+    result.gridStartSample = 1000;
+    QCOMPARE(BPMAnalyzer::barStartSample(result, sampleRate), qint64(1000));
+
+    result.barPhase = 2;
+    QCOMPARE(BPMAnalyzer::barStartSample(result, sampleRate), qint64(1000 + sampleRate));
+
+    // Карта переменного темпа: две доли по 20000, дальше по 18000 сэмплов
+    result.tempoMap = TempoMap::fromBeats({ 1000, 21000, 41000, 59000, 77000, 95000 });
+    QVERIFY(result.tempoMap.isVariable());
+    result.barPhase = 3;
+    const qint64 barStart = BPMAnalyzer::barStartSample(result, sampleRate);
+    QCOMPARE(barStart, qint64(std::llround(result.tempoMap.sampleAtBeat(3.0))));
+    QVERIFY(std::abs(barStart - 59000) < 100);
+}
+
 QTEST_MAIN(BPMAnalyzerTest)
 #include "bpm_analyzer_test.moc"
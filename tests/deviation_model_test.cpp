@@ -0,0 +1,200 @@
+// Отклонения долей в окне (DeviationModel): сдвиг сетки на месте и SIMD-ядра.
+//
+// Стрелки «сдвинуть сетку» и перетаскивание сетки обновляют отклонения через
+// shiftGrid, без полного calculateDeviations. Ошибка здесь — после сдвига
+// метки неровных долей и треугольники на волне расходятся с тем, что дал бы
+// пересчёт с нуля, или результат зависит от процессора.
+
+#include <QtTest/QTest>
+#include <QtCore/QVector>
+
+#include <cmath>
+
+#include "../include/bpmanalyzer.h"
+#include "../include/deviationmodel.h"
+
+namespace {
+
+constexpr int kSampleRate = 44100;
+constexpr float kBpm = 126.0f;
+
+/**
+ * DJ-микс на n долей: джиттер в несколько сотен сэмплов, пропущенные доли и
+ * лишние срабатывания — чтобы сдвиг переводил доли на соседние линии сетки.
+ */
+QVector<BPMAnalyzer::BeatInfo> makeMix(int n, qint64 origin)
+{
+    const double interval = 60.0 * kSampleRate / kBpm;
+    QVector<BPMAnalyzer::BeatInfo> beats;
+    beats.reserve(n);
+    quint32 seed = 42;
+    for (int i = 0; i < n; ++i) {
+        seed = seed * 1664525u + 1013904223u;
+        if (i % 97 == 13) {
+            continue;  // детектор пропустил долю
+        }
+        const double jitter = 800.0 * (double(seed >> 8) / 16777216.0 - 0.5);
+        BPMAnalyzer::BeatInfo beat;
+        beat.position = origin + qint64(std::llround(i * interval + jitter));
+        beat.confidence = 1.0f;
+        beats.append(beat);
+        if (i % 151 == 77) {
+            BPMAnalyzer::BeatInfo extra = beat;
+            extra.position += 300;  // лишнее срабатывание рядом
+            beats.append(extra);
+        }
+    }
+    return beats;
+}
+
+void compareStats(const BPMAnalyzer::DeviationStats& actual,
+                  const BPMAnalyzer::DeviationStats& expected)
+{
+    QCOMPARE(actual.beatCount, expected.beatCount);
+    QCOMPARE(actual.gapCount, expected.gapCount);
+    QCOMPARE(actual.duplicateCount, expected.duplicateCount);
+    QCOMPARE(actual.gridStartSample, expected.gridStartSample);
+    QCOMPARE(actual.gridBPM, expected.gridBPM);
+    QVERIFY(std::abs(actual.meanAbsDeviation - expected.meanAbsDeviation) < 1e-6f);
+    QVERIFY(std::abs(actual.rmsDeviation - expected.rmsDeviation) < 1e-6f);
+    QCOMPARE(actual.medianAbsDeviation, expected.medianAbsDeviation);
+    QCOMPARE(actual.maxAbsDeviation, expected.maxAbsDeviation);
+}
+
+} // namespace
+
+class DeviationModelTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testShiftMatchesFullRecompute();
+    void testShiftAlongTempoMap();
+    void testKernelsAgree();
+    void testDeltasAndWriteBack();
+};
+
+// Сдвиг сетки на месте = calculateDeviations по сдвинутой сетке
+void DeviationModelTest::testShiftMatchesFullRecompute()
+{
+    const qint64 origin = 5000;
+    QVector<BPMAnalyzer::BeatInfo> beats = makeMix(2000, origin);
+
+    BPMAnalyzer::DeviationOptions options;
+    options.gridStartSample = origin;
+    DeviationModel model;
+    model.setBeats(beats);
+    model.evaluate(kBpm, kSampleRate, options);
+    QVERIFY(model.isEvaluated());
+
+    // Шаги стрелками: больше полуинтервала — доли уходят к соседним линиям
+    qint64 grid = origin;
+    for (const qint64 delta : { qint64(-21000), qint64(441), qint64(10500), qint64(-3) }) {
+        grid += delta;
+        const BPMAnalyzer::DeviationStats& shifted = model.shiftGrid(double(delta));
+
+        QVector<BPMAnalyzer::BeatInfo> reference = beats;
+        options.gridStartSample = grid;
+        const BPMAnalyzer::DeviationStats full =
+            BPMAnalyzer::calculateDeviations(reference, kBpm, kSampleRate, options);
+        compareStats(shifted, full);
+
+        QVector<BPMAnalyzer::BeatInfo> written = beats;
+        model.writeTo(written);
+        for (int i = 0; i < reference.size(); ++i) {
+            QCOMPARE(written[i].expectedPosition, reference[i].expectedPosition);
+            QVERIFY(std::abs(written[i].deviation - reference[i].deviation) < 1e-6f);
+        }
+    }
+}
+
+// При переменном темпе сдвигается карта: результат — как по сдвинутой карте
+void DeviationModelTest::testShiftAlongTempoMap()
+{
+    QVector<qint64> positions;
+    for (int i = 0; i < 64; ++i) {
+        positions.append(qint64(i) * 21000);
+    }
+    for (int i = 1; i <= 64; ++i) {
+        positions.append(63 * 21000 + qint64(i) * 19000);
+    }
+    const TempoMap map = TempoMap::fromBeats(positions);
+    QVERIFY(map.isVariable());
+
+    QVector<BPMAnalyzer::BeatInfo> beats;
+    for (int i = 0; i < positions.size(); ++i) {
+        BPMAnalyzer::BeatInfo beat;
+        beat.position = positions[i] + (i % 5 == 2 ? 900 : 0);
+        beats.append(beat);
+    }
+
+    DeviationModel model;
+    model.setBeats(beats);
+    model.evaluate(map, kSampleRate);
+    const BPMAnalyzer::DeviationStats& shifted = model.shiftGrid(-700.0);
+
+    TempoMap moved = map;
+    moved.shift(-700.0);
+    QVector<BPMAnalyzer::BeatInfo> reference = beats;
+    compareStats(shifted, BPMAnalyzer::calculateDeviations(reference, moved, kSampleRate));
+    QCOMPARE(shifted.gapCount, 0);
+    QCOMPARE(shifted.duplicateCount, 0);
+}
+
+// Скалярное и SIMD-ядра дают одно и то же (нечётное число долей — с хвостом)
+void DeviationModelTest::testKernelsAgree()
+{
+    const QVector<BPMAnalyzer::BeatInfo> beats = makeMix(1001, 123);
+    BPMAnalyzer::DeviationOptions options;
+    options.refineTempo = true;
+
+    DeviationModel scalar(DFEngine::SimdKernel::Scalar);
+    scalar.setBeats(beats);
+    const BPMAnalyzer::DeviationStats reference = scalar.evaluate(kBpm, kSampleRate, options);
+    QVERIFY(reference.beatCount > 1000);
+
+    for (const DFEngine::SimdKernel kernel : { DFEngine::SimdKernel::Sse2, DFEngine::SimdKernel::Avx2,
+                                               DFEngine::SimdKernel::Neon }) {
+        if (!DFEngine::isSimdKernelSupported(kernel)) {
+            continue;
+        }
+        DeviationModel simd(kernel);
+        simd.setBeats(beats);
+        compareStats(simd.evaluate(kBpm, kSampleRate, options), reference);
+        for (int i = 0; i < simd.size(); ++i) {
+            QVERIFY(std::abs(simd.expectedPositions()[i] - scalar.expectedPositions()[i]) < 1e-6);
+            QVERIFY(std::abs(simd.deviations()[i] - scalar.deviations()[i]) < 1e-9);
+        }
+    }
+}
+
+// Смещение доли в сэмплах для отрисовки и запись в BeatInfo
+void DeviationModelTest::testDeltasAndWriteBack()
+{
+    const double interval = 60.0 * kSampleRate / kBpm;
+    QVector<BPMAnalyzer::BeatInfo> beats(8);
+    for (int i = 0; i < beats.size(); ++i) {
+        beats[i].position = qint64(std::llround(i * interval)) + (i == 5 ? 1050 : 0);
+    }
+
+    DeviationModel model;
+    QCOMPARE(model.shiftGrid(100.0).beatCount, 0);  // до evaluate сдвигать нечего
+
+    BPMAnalyzer::DeviationOptions options;
+    options.gridStartSample = 0;
+    model.setBeats(beats);
+    model.evaluate(kBpm, kSampleRate, options);
+    QVERIFY(std::abs(model.deltaSamples(5) - 1050.0) < 1.0);
+    QVERIFY(std::abs(model.deltaSamples(4)) < 1.0);
+
+    model.writeTo(beats);
+    QVERIFY(std::abs(beats[5].deviation - float(1050.0 / interval)) < 1e-4f);
+    QCOMPARE(beats[5].expectedPosition, qint64(std::llround(5 * interval)));
+
+    model.clear();
+    QVERIFY(model.isEmpty());
+    QVERIFY(!model.isEvaluated());
+}
+
+QTEST_GUILESS_MAIN(DeviationModelTest)
+#include "deviation_model_test.moc"
@@ -0,0 +1,178 @@
+// План FFT (DFEngine::FFTPlan): спектр совпадает с прямым ДПФ на каждом
+// доступном ядре бабочек, а старые обёртки (realFFT, fft) дают то же, что план.
+//
+// Спектрограмма, WaveformAnalyzer и BeatVisualizer берут спектр отсюда, поэтому
+// ошибка в распаковке половинного FFT или в SIMD-ядре — это неверная картинка.
+
+#include <QtTest/QTest>
+
+#include "../include/fft_engine.h"
+
+#include <cmath>
+#include <complex>
+#include <random>
+
+namespace {
+
+using DFEngine::Complex;
+using DFEngine::FFTPlan;
+using DFEngine::SimdKernel;
+
+/** Прямое ДПФ в double — эталон для сравнения. */
+std::vector<std::complex<double>> referenceDft(const std::vector<float>& x, unsigned fftSize)
+{
+    std::vector<std::complex<double>> out(fftSize / 2 + 1);
+    for (unsigned k = 0; k < out.size(); ++k) {
+        std::complex<double> sum = 0.0;
+        for (unsigned n = 0; n < x.size(); ++n) {
+            const double angle = -2.0 * M_PI * double(k) * double(n) / double(fftSize);
+            sum += double(x[n]) * std::complex<double>(std::cos(angle), std::sin(angle));
+        }
+        out[k] = sum;
+    }
+    return out;
+}
+
+std::vector<float> makeNoise(unsigned count, unsigned seed)
+{
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    std::vector<float> x(count);
+    for (float& v : x) {
+        v = dist(rng);
+    }
+    return x;
+}
+
+/** Наибольшая ошибка относительно максимума эталонного спектра. */
+double relativeError(const std::vector<Complex>& spectrum,
+                     const std::vector<std::complex<double>>& reference)
+{
+    double err = 0.0;
+    double scale = 0.0;
+    for (size_t k = 0; k < reference.size(); ++k) {
+        err = std::max(err, std::abs(reference[k] - std::complex<double>(spectrum[k])));
+        scale = std::max(scale, std::abs(reference[k]));
+    }
+    return scale > 0.0 ? err / scale : err;
+}
+
+} // namespace
+
+class FftEngineTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testPlanMatchesDftOnEveryKernel();
+    void testZeroPaddingAndWindow();
+    void testRealFftWrapperMatchesPlan();
+    void testComplexFftMatchesDft();
+    void testPlanCacheReturnsSamePlan();
+};
+
+// Все размеры от 2 до 8192 и все ядра, которые есть на этом CPU
+void FftEngineTest::testPlanMatchesDftOnEveryKernel()
+{
+    const SimdKernel kernels[] = { SimdKernel::Scalar, SimdKernel::Sse2,
+                                   SimdKernel::Avx2, SimdKernel::Neon };
+    for (SimdKernel kernel : kernels) {
+        if (!DFEngine::isSimdKernelSupported(kernel)) {
+            continue;
+        }
+        for (unsigned size = 2; size <= 8192; size *= 2) {
+            const FFTPlan plan(size, kernel);
+            QCOMPARE(plan.kernel(), kernel);
+            QCOMPARE(plan.binCount(), size / 2 + 1);
+
+            const std::vector<float> x = makeNoise(size, size);
+            std::vector<Complex> spectrum(plan.binCount());
+            plan.forward(x.data(), size, nullptr, spectrum.data());
+
+            const double err = relativeError(spectrum, referenceDft(x, size));
+            QVERIFY2(err < 1e-5,
+                     qPrintable(QStringLiteral("kernel=%1 size=%2 err=%3")
+                                    .arg(int(kernel)).arg(size).arg(err)));
+        }
+    }
+}
+
+// Отсчётов меньше блока: хвост — нули; окно умножается до FFT
+void FftEngineTest::testZeroPaddingAndWindow()
+{
+    const unsigned count = 700;
+    const unsigned size = DFEngine::nextPow2(count) * 2;
+    const FFTPlan plan(size);
+
+    std::vector<float> window;
+    DFEngine::precomputeWindow(window, count, DFEngine::WindowFunction::BlackmanHarris);
+    const std::vector<float> x = makeNoise(count, 7);
+
+    std::vector<float> windowed(count);
+    for (unsigned i = 0; i < count; ++i) {
+        windowed[i] = x[i] * window[i];
+    }
+
+    std::vector<Complex> spectrum(plan.binCount());
+    plan.forward(x.data(), count, window.data(), spectrum.data());
+    QVERIFY(relativeError(spectrum, referenceDft(windowed, size)) < 1e-5);
+}
+
+// realFFT (спектрограмма до плана) и FFTPlan::magnitudes дают одно и то же
+void FftEngineTest::testRealFftWrapperMatchesPlan()
+{
+    const unsigned count = 1000;
+    std::vector<float> window;
+    DFEngine::precomputeWindow(window, count, DFEngine::WindowFunction::Hanning);
+    const std::vector<float> x = makeNoise(count, 11);
+
+    std::vector<float> viaWrapper;
+    DFEngine::realFFT(x.data(), count, window, 2, viaWrapper);
+
+    const FFTPlan& plan = FFTPlan::forSize(DFEngine::nextPow2(count) * 2);
+    std::vector<float> viaPlan;
+    std::vector<Complex> scratch;
+    plan.magnitudes(x.data(), count, window.data(), viaPlan, scratch);
+
+    QCOMPARE(viaWrapper.size(), size_t(plan.binCount()));
+    for (size_t k = 0; k < viaPlan.size(); ++k) {
+        QCOMPARE(viaWrapper[k], viaPlan[k]);
+    }
+}
+
+void FftEngineTest::testComplexFftMatchesDft()
+{
+    const unsigned n = 512;
+    std::mt19937 rng(3);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    std::vector<Complex> buf(n);
+    for (Complex& v : buf) {
+        v = Complex(dist(rng), dist(rng));
+    }
+    const std::vector<Complex> input = buf;
+
+    DFEngine::fft(buf);
+
+    double err = 0.0;
+    for (unsigned k = 0; k < n; ++k) {
+        std::complex<double> sum = 0.0;
+        for (unsigned i = 0; i < n; ++i) {
+            const double angle = -2.0 * M_PI * double(k) * double(i) / double(n);
+            sum += std::complex<double>(input[i]) * std::complex<double>(std::cos(angle), std::sin(angle));
+        }
+        err = std::max(err, std::abs(sum - std::complex<double>(buf[k])));
+    }
+    QVERIFY2(err < 1e-3, qPrintable(QString::number(err)));
+}
+
+// План строится один раз на размер: кадры спектрограммы не пересчитывают таблицы
+void FftEngineTest::testPlanCacheReturnsSamePlan()
+{
+    const FFTPlan& first = FFTPlan::forSize(2048);
+    const FFTPlan& second = FFTPlan::forSize(2048);
+    QCOMPARE(&first, &second);
+    QCOMPARE(FFTPlan::forSize(1500).size(), 2048u);
+}
+
+QTEST_APPLESS_MAIN(FftEngineTest)
+#include "fft_engine_test.moc"
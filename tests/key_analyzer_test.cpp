@@ -1,8 +1,10 @@
 #include <QtTest/QTest>
 #include <QtCore/QVector>
+#include <algorithm>
 #include <cmath>
 
 #include "../include/keyanalyzer.h"
+#include "../include/keyprofile.h"
 
 // Тесты потактового определения тональности и модуляции (смен тональности),
 // как в Melodyne. Используются синтезированные сигналы из чистых синусов:
@@ -21,10 +23,17 @@ private slots:
 
     void testSamplesPerBar();
     void testChromaSingleTone();
+    void testChromaBankMatchesDirectGoertzel();
+    void testDetectKeyFromChromaTonic();
+    void testKrumhanslKesslerScores();
     void testSingleKeyNoModulation();
     void testPerBarModulationDetected();
     void testMergeBarsIntoRegions();
     void testGridStartOffset();
+    void testChromaFramesRebinMatchesSlices();
+    void testTrackKeyFromChromaFrames();
+    void testViterbiSmoothsKeyBlips();
+    void testMinorKeyDecodesAsMinor();
     void testDominantModulationKey();
 
 private:
@@ -117,6 +126,138 @@ void KeyAnalyzerTest::testChromaSingleTone()
     qDebug() << "  ✓ Хрома выделяет верный класс высоты";
 }
 
+void KeyAnalyzerTest::testChromaBankMatchesDirectGoertzel()
+{
+    qDebug() << "\n=== Тест: банк резонаторов против прямого Гёрцеля ===";
+
+    // Аккорд с басом во второй октаве: нижние резонаторы считаются на
+    // прореженном сигнале, верхние — на исходном
+    QVector<float> audio;
+    appendChord(audio, {40, 52, 59, 64, 68, 83, 91}, 88200);
+
+    // Прямой Гёрцель: по проходу на каждую ноту MIDI 36..95
+    QVector<float> direct(12, 0.0f);
+    constexpr double kTwoPi = 6.28318530717958647692;
+    for (int midi = 36; midi <= 95; ++midi) {
+        const double freq = 440.0 * std::pow(2.0, (double(midi) - 69.0) / 12.0);
+        const double coeff = 2.0 * std::cos(kTwoPi * freq / double(kSampleRate));
+        double s1 = 0.0, s2 = 0.0;
+        for (float x : audio) {
+            const double s0 = double(x) + coeff * s1 - s2;
+            s2 = s1;
+            s1 = s0;
+        }
+        const double power = s1 * s1 + s2 * s2 - coeff * s1 * s2;
+        direct[midi % 12] += float(std::sqrt(std::max(0.0, power)) / double(audio.size()));
+    }
+    const float peak = *std::max_element(direct.begin(), direct.end());
+    for (float& v : direct) {
+        v /= peak;
+    }
+
+    const QVector<float> scalar =
+        KeyAnalyzer::computeChromaGoertzel(audio, kSampleRate, DFEngine::SimdKernel::Scalar);
+    for (int i = 0; i < 12; ++i) {
+        QVERIFY2(std::abs(scalar[i] - direct[i]) < 0.02f, "Хрома банка расходится с прямым Гёрцелем");
+    }
+
+    for (const DFEngine::SimdKernel kernel : { DFEngine::SimdKernel::Sse2, DFEngine::SimdKernel::Avx2,
+                                               DFEngine::SimdKernel::Neon }) {
+        if (!DFEngine::isSimdKernelSupported(kernel)) {
+            continue;
+        }
+        const QVector<float> simd = KeyAnalyzer::computeChromaGoertzel(audio, kSampleRate, kernel);
+        for (int i = 0; i < 12; ++i) {
+            QVERIFY2(std::abs(simd[i] - scalar[i]) < 1e-4f, "SIMD-ядро расходится со скалярным");
+        }
+    }
+    qDebug() << "  ✓ Банк совпадает с прямым Гёрцелем, ядра — между собой";
+}
+
+void KeyAnalyzerTest::testDetectKeyFromChromaTonic()
+{
+    qDebug() << "\n=== Тест: тоника и лад по хроме гаммы ===";
+
+    // Гамма от каждой из 12 тоник; трезвучие тоники звучит вдвое громче.
+    // Мажор и параллельный минор — одни и те же ноты, развести их может
+    // только вес ступеней
+    const int majorDegrees[] = { 0, 2, 4, 5, 7, 9, 11 };
+    const int minorDegrees[] = { 0, 2, 3, 5, 7, 8, 10 };
+    for (int tonic = 0; tonic < 12; ++tonic) {
+        QVector<float> major(12, 0.0f);
+        QVector<float> minor(12, 0.0f);
+        for (int i = 0; i < 7; ++i) {
+            const float weight = (i == 0 || i == 2 || i == 4) ? 2.0f : 1.0f;
+            major[(tonic + majorDegrees[i]) % 12] = weight;
+            minor[(tonic + minorDegrees[i]) % 12] = weight;
+        }
+        QCOMPARE(KeyAnalyzer::detectKeyFromChroma(major).key,
+                 static_cast<KeyAnalyzer::Key>(tonic * 2));
+        QCOMPARE(KeyAnalyzer::detectKeyFromChroma(minor).key,
+                 static_cast<KeyAnalyzer::Key>(tonic * 2 + 1));
+
+        // Ровная мажорная гамма без акцентов — всё равно мажор, не параллельный минор
+        QVector<float> flat(12, 0.0f);
+        for (int degree : majorDegrees) {
+            flat[(tonic + degree) % 12] = 1.0f;
+        }
+        QCOMPARE(KeyAnalyzer::detectKeyFromChroma(flat).key,
+                 static_cast<KeyAnalyzer::Key>(tonic * 2));
+    }
+
+    qDebug() << "  ✓ Тоника и лад совпадают с гаммой для всех 24 тональностей";
+}
+
+void KeyAnalyzerTest::testKrumhanslKesslerScores()
+{
+    qDebug() << "\n=== Тест: оценки по профилям Крумхансла–Кесслера ===";
+
+    // Сам профиль, повёрнутый на тонику, коррелирует со своей тональностью на 1
+    float dMajor[12];
+    for (int i = 0; i < 12; ++i) {
+        dMajor[(i + 2) % 12] = KeyProfile::kMajor[i];
+    }
+    QVERIFY(std::abs(KeyProfile::correlation(KeyProfile::kMajor, int(KeyAnalyzer::C_MAJOR)) - 1.0f) < 1e-5f);
+    QVERIFY(std::abs(KeyProfile::correlation(KeyProfile::kMinor, int(KeyAnalyzer::C_MINOR)) - 1.0f) < 1e-5f);
+    QVERIFY(std::abs(KeyProfile::correlation(dMajor, int(KeyAnalyzer::D_MAJOR)) - 1.0f) < 1e-5f);
+
+    // Ровная гамма до мажора: с двоичными шаблонами C и Am давали одну оценку,
+    // теперь — корреляции Пирсона с весами ступеней (посчитаны отдельно)
+    const int majorDegrees[] = { 0, 2, 4, 5, 7, 9, 11 };
+    float scale[12] = {};
+    for (int degree : majorDegrees) {
+        scale[degree] = 1.0f;
+    }
+    const struct { KeyAnalyzer::Key key; float score; } expected[] = {
+        { KeyAnalyzer::C_MAJOR, 0.75641f },
+        { KeyAnalyzer::A_MINOR, 0.71213f },
+        { KeyAnalyzer::G_MAJOR, 0.67745f },
+        { KeyAnalyzer::C_MINOR, 0.09159f },
+        { KeyAnalyzer::F_SHARP_MAJOR, -0.75574f },
+    };
+    for (const auto& pin : expected) {
+        const float score = KeyProfile::correlation(scale, int(pin.key));
+        QVERIFY2(std::abs(score - pin.score) < 1e-4f,
+                 qPrintable(QStringLiteral("%1: %2").arg(KeyAnalyzer::keyToString(pin.key)).arg(score)));
+    }
+
+    float best = 0.0f;
+    QCOMPARE(KeyProfile::bestKey(scale, &best), int(KeyAnalyzer::C_MAJOR));
+    QVERIFY(std::abs(best - 0.75641f) < 1e-4f);
+    const KeyAnalyzer::KeyInfo info =
+        KeyAnalyzer::detectKeyFromChroma(QVector<float>(scale, scale + 12));
+    QCOMPARE(info.key, KeyAnalyzer::C_MAJOR);
+    QVERIFY(std::abs(info.strength - 0.75641f) < 1e-4f);
+    QVERIFY(std::abs(info.confidence - 0.75641f) < 1e-4f);
+
+    // Ровная хрома (и тишина) — ни одной положительной корреляции
+    const float flat[12] = { 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1 };
+    QCOMPARE(KeyProfile::correlation(flat, int(KeyAnalyzer::C_MAJOR)), 0.0f);
+    QCOMPARE(KeyProfile::bestKey(flat), -1);
+
+    qDebug() << "  ✓ Оценки тональностей совпадают с корреляцией по профилям";
+}
+
 void KeyAnalyzerTest::testSingleKeyNoModulation()
 {
     qDebug() << "\n=== Тест: один ключ, без модуляции ===";
@@ -251,6 +392,187 @@ void KeyAnalyzerTest::testGridStartOffset()
     qDebug() << "  ✓ Такт 0 начинается с gridStartSample";
 }
 
+void KeyAnalyzerTest::testChromaFramesRebinMatchesSlices()
+{
+    qDebug() << "\n=== Тест: такты из кадров хромы при смене сетки ===";
+
+    KeyAnalyzer::BarGrid grid;
+    grid.bpm = 120.0f;
+    grid.beatsPerBar = 4;
+    const qint64 spb = qint64(std::llround(KeyAnalyzer::samplesPerBar(grid, kSampleRate)));
+
+    // 16 с: кадры считаются несколькими кусками, стыки не должны быть слышны
+    QVector<float> audio;
+    appendChord(audio, cMajorNotes(), spb * 4);
+    appendChord(audio, fSharpMajorNotes(), spb * 4);
+
+    const KeyAnalyzer::ChromaFrames frames = KeyAnalyzer::computeChromaFrames(audio, kSampleRate);
+    QVERIFY(!frames.isEmpty());
+    QCOMPARE(frames.sampleCount, qint64(audio.size()));
+    // В один поток (пакетный анализ при занятых ядрах) — те же кадры
+    const KeyAnalyzer::ChromaFrames serial =
+        KeyAnalyzer::computeChromaFrames(audio, kSampleRate, DFEngine::bestSimdKernel(), 1);
+    QVERIFY(serial.prefix == frames.prefix);
+
+    // Та же дорожка в 4/4, 3/4 и со сдвигом сетки: тональность такта из кадров —
+    // та же, что по его сэмплам (без сглаживания — такт сам по себе)
+    KeyAnalyzer::BarGrid threeFour = grid;
+    threeFour.beatsPerBar = 3;
+    KeyAnalyzer::BarGrid shifted = grid;
+    shifted.gridStartSample = spb / 3;
+    KeyAnalyzer::AnalysisOptions unsmoothed;
+    unsmoothed.keyChangePenalty = 0.0f;
+    for (const KeyAnalyzer::BarGrid& g : { grid, threeFour, shifted }) {
+        const KeyAnalyzer::PerBarKeyResult res = KeyAnalyzer::analyzeKeyPerBar(frames, g, unsmoothed);
+        QVERIFY(res.bars.size() >= 5);
+        for (const KeyAnalyzer::BarKey& bar : res.bars) {
+            const qint64 end = qMin<qint64>(bar.endSample, audio.size());
+            const QVector<float> slice(audio.begin() + bar.startSample, audio.begin() + end);
+            const KeyAnalyzer::KeyInfo direct =
+                KeyAnalyzer::detectKeyFromChroma(KeyAnalyzer::computeChromaGoertzel(slice, kSampleRate));
+            QCOMPARE(bar.key.key, direct.key);
+        }
+    }
+
+    const KeyAnalyzer::PerBarKeyResult res = KeyAnalyzer::analyzeKeyPerBar(frames, grid);
+    QCOMPARE(res.bars.size(), 8);
+    QCOMPARE(res.regions.size(), 2);
+    QCOMPARE(res.regions[1].startBar, 4);
+    QCOMPARE(res.regions[1].key.key, KeyAnalyzer::F_SHARP_MAJOR);
+    qDebug() << "  ✓ Смена сетки пересобирает такты из тех же кадров";
+}
+
+void KeyAnalyzerTest::testTrackKeyFromChromaFrames()
+{
+    qDebug() << "\n=== Тест: тональность трека из тех же кадров, что и такты ===";
+
+    KeyAnalyzer::BarGrid grid;
+    grid.bpm = 120.0f;
+    grid.beatsPerBar = 4;
+    const qint64 spb = qint64(std::llround(KeyAnalyzer::samplesPerBar(grid, kSampleRate)));
+
+    // 12 с до-мажора, затем 8 с фа-диез-мажора
+    QVector<float> audio;
+    appendChord(audio, cMajorNotes(), spb * 6);
+    appendChord(audio, fSharpMajorNotes(), spb * 4);
+
+    const KeyAnalyzer::ChromaFrames frames = KeyAnalyzer::computeChromaFrames(audio, kSampleRate);
+    const KeyAnalyzer::AnalysisResult track = KeyAnalyzer::analyzeKey(frames);
+    QCOMPARE(track.chromaVector.size(), 12);
+    QCOMPARE(track.primaryKey.key, KeyAnalyzer::C_MAJOR);
+    QCOMPARE(track.secondaryKey.key, KeyAnalyzer::F_SHARP_MAJOR);
+    QVERIFY(track.hasKeyChange);
+    QVERIFY(!track.keyChanges.isEmpty());
+
+    // По сэмплам — тот же результат: внутри те же кадры
+    const KeyAnalyzer::AnalysisResult fromSamples = KeyAnalyzer::analyzeKey(audio, kSampleRate);
+    QCOMPARE(fromSamples.primaryKey.key, track.primaryKey.key);
+    QCOMPARE(fromSamples.secondaryKey.key, track.secondaryKey.key);
+
+    // Такты из тех же кадров согласны с тональностью трека
+    const KeyAnalyzer::PerBarKeyResult perBar = KeyAnalyzer::analyzeKeyPerBar(frames, grid);
+    QCOMPARE(perBar.primaryKey.key, track.primaryKey.key);
+    QCOMPARE(KeyAnalyzer::dominantModulationKey(perBar, perBar.primaryKey.key).key,
+             track.secondaryKey.key);
+
+    // Одна тональность и трек короче окна — без второй тональности
+    QVector<float> single;
+    appendChord(single, cMajorNotes(), kSampleRate);
+    const KeyAnalyzer::AnalysisResult one = KeyAnalyzer::analyzeKey(single, kSampleRate);
+    QCOMPARE(one.primaryKey.key, KeyAnalyzer::C_MAJOR);
+    QCOMPARE(one.secondaryKey.key, KeyAnalyzer::UNKNOWN_KEY);
+    QVERIFY(!one.hasKeyChange);
+    qDebug() << "  ✓ Тональность трека, вторая тональность и такты — из одного прохода";
+}
+
+void KeyAnalyzerTest::testViterbiSmoothsKeyBlips()
+{
+    qDebug() << "\n=== Тест: сглаживание смен тональности (Витерби) ===";
+
+    KeyAnalyzer::BarGrid grid;
+    grid.bpm = 120.0f;
+    grid.beatsPerBar = 4;
+    const qint64 spb = qint64(std::llround(KeyAnalyzer::samplesPerBar(grid, kSampleRate)));
+
+    // До мажор с одним тактом соль мажора (одна нота отличия), затем
+    // настоящая модуляция в фа-диез мажор на три такта
+    QVector<float> audio;
+    appendChord(audio, cMajorNotes(), spb * 3);
+    appendChord(audio, {67, 69, 71, 72, 74, 76, 78}, spb);
+    appendChord(audio, cMajorNotes(), spb * 3);
+    appendChord(audio, fSharpMajorNotes(), spb * 3);
+    const KeyAnalyzer::ChromaFrames frames = KeyAnalyzer::computeChromaFrames(audio, kSampleRate);
+
+    // Без цены смены — каждый такт сам по себе: соль мажор отдельным регионом
+    KeyAnalyzer::AnalysisOptions unsmoothed;
+    unsmoothed.keyChangePenalty = 0.0f;
+    const KeyAnalyzer::PerBarKeyResult raw = KeyAnalyzer::analyzeKeyPerBar(frames, grid, unsmoothed);
+    QCOMPARE(raw.bars.size(), 10);
+    QCOMPARE(raw.regions.size(), 4);
+    QCOMPARE(raw.bars[3].key.key, KeyAnalyzer::G_MAJOR);
+
+    // С ценой по умолчанию такт соседней гаммы не рвёт регион, модуляция остаётся
+    const KeyAnalyzer::PerBarKeyResult smooth = KeyAnalyzer::analyzeKeyPerBar(frames, grid);
+    QCOMPARE(smooth.regions.size(), 2);
+    QCOMPARE(smooth.regions[0].key.key, KeyAnalyzer::C_MAJOR);
+    QCOMPARE(smooth.regions[0].endBar, 6);
+    QCOMPARE(smooth.regions[1].key.key, KeyAnalyzer::F_SHARP_MAJOR);
+    QVERIFY(smooth.bars[3].key.confidence < smooth.bars[2].key.confidence);
+
+    // Путь без цены — ровно detectKeyFromChroma каждого шага
+    QVector<QVector<float>> steps;
+    for (int tonic = 0; tonic < 12; ++tonic) {
+        QVector<float> chroma(12, 0.0f);
+        chroma[tonic] = 1.0f;
+        chroma[(tonic + 4) % 12] = 0.8f;
+        chroma[(tonic + 7) % 12] = 0.6f;
+        chroma[(tonic + 10) % 12] = 0.3f;
+        steps.append(chroma);
+    }
+    const QVector<KeyAnalyzer::Key> path = KeyAnalyzer::decodeKeyPath(steps, 0.0f);
+    QCOMPARE(path.size(), steps.size());
+    for (int i = 0; i < steps.size(); ++i) {
+        QCOMPARE(path[i], KeyAnalyzer::detectKeyFromChroma(steps[i]).key);
+    }
+    // Очень дорогая смена — одна тональность на весь путь
+    const QVector<KeyAnalyzer::Key> sticky = KeyAnalyzer::decodeKeyPath(steps, 100.0f);
+    QVERIFY(std::all_of(sticky.cbegin(), sticky.cend(),
+                        [&sticky](KeyAnalyzer::Key k) { return k == sticky.first(); }));
+    qDebug() << "  ✓ Одиночный такт сглаживается, модуляция сохраняется";
+}
+
+void KeyAnalyzerTest::testMinorKeyDecodesAsMinor()
+{
+    qDebug() << "\n=== Тест: минор не подменяется параллельным мажором ===";
+
+    KeyAnalyzer::BarGrid grid;
+    grid.bpm = 120.0f;
+    grid.beatsPerBar = 4;
+    const qint64 spb = qint64(std::llround(KeyAnalyzer::samplesPerBar(grid, kSampleRate)));
+
+    // Четыре такта ля минора, затем четыре до мажора: ноты одни и те же
+    // (белые клавиши), отличаются только удвоенные звуки тонического трезвучия
+    QVector<float> audio;
+    appendChord(audio, {57, 60, 64, 45, 52, 59, 62, 65, 67}, spb * 4);
+    appendChord(audio, {60, 64, 67, 48, 55, 62, 65, 69, 71}, spb * 4);
+    const KeyAnalyzer::ChromaFrames frames = KeyAnalyzer::computeChromaFrames(audio, kSampleRate);
+
+    const KeyAnalyzer::PerBarKeyResult res = KeyAnalyzer::analyzeKeyPerBar(frames, grid);
+    QCOMPARE(res.bars.size(), 8);
+    QCOMPARE(res.regions.size(), 2);
+    QCOMPARE(res.regions[0].key.key, KeyAnalyzer::A_MINOR);
+    QVERIFY(!res.regions[0].key.isMajor);
+    QCOMPARE(res.regions[1].startBar, 4);
+    QCOMPARE(res.regions[1].key.key, KeyAnalyzer::C_MAJOR);
+
+    // Трек целиком в ля миноре — основная тональность минорная
+    QVector<float> minorOnly;
+    appendChord(minorOnly, {57, 60, 64, 45, 52, 59, 62, 65, 67}, spb * 6);
+    QCOMPARE(KeyAnalyzer::analyzeKey(minorOnly, kSampleRate).primaryKey.key, KeyAnalyzer::A_MINOR);
+
+    qDebug() << "  ✓ Ля минор и до мажор на одних нотах различаются";
+}
+
 void KeyAnalyzerTest::testDominantModulationKey()
 {
     qDebug() << "\n=== Тест: dominantModulationKey (тональность для поля модуляции) ===";
@@ -0,0 +1,286 @@
+// Загрузка файла в окно (LoadPipeline): декодирование → моно → BPM → отклонения.
+//
+// Окно показывает волну по onDecoded и прогресс по onProgress, пока анализ идёт
+// в рабочем потоке; открытие другого файла отменяет загрузку флагом. Ошибка
+// здесь — окно ждёт анализа, прогресс прыгает назад или отменённая загрузка
+// дорисовывает чужой файл.
+
+#include <QtTest/QTest>
+#include <QtCore/QTemporaryDir>
+#include <QtCore/QVector>
+
+#include <atomic>
+#include <cmath>
+
+#include "../include/analysiscache.h"
+#include "../include/loadpipeline.h"
+#include "../include/wavwriter.h"
+
+namespace {
+
+constexpr int kSampleRate = 44100;
+constexpr float kBpm = 128.0f;
+
+/** Щелчки kBpm поверх слабого шума в обоих каналах, seconds секунд. */
+bool writeClickTrack(const QString& path, int seconds)
+{
+    const int n = kSampleRate * seconds;
+    const int beatInterval = int(60.0f * kSampleRate / kBpm);
+    QVector<float> left(n);
+    QVector<float> right(n);
+    quint32 seed = 1234;
+    for (int i = 0; i < n; ++i) {
+        seed = seed * 1664525u + 1013904223u;
+        const int sinceBeat = i % beatInterval;
+        const float click = sinceBeat < 600 ? 0.9f * std::exp(-sinceBeat / 120.0f) : 0.0f;
+        const float noise = 0.03f * (float(seed >> 8) / 16777216.0f - 0.5f);
+        left[i] = click + noise;
+        right[i] = click - noise;
+    }
+    WavWriter::WriteOptions options;
+    options.format = WavWriter::SampleFormat::Float32;
+    return WavWriter::writeFile(path, { left, right }, kSampleRate, nullptr, options);
+}
+
+BPMAnalyzer::AnalysisOptions clickOptions()
+{
+    // Путь без qm-dsp: на щелчках он даёт ровно kBpm (см. bpm_analyzer_test)
+    BPMAnalyzer::AnalysisOptions options;
+    options.useMixxxAlgorithm = false;
+    options.assumeFixedTempo = false;
+    return options;
+}
+
+struct Recorder {
+    QVector<LoadPipeline::Stage> stages;
+    QVector<int> percents;
+    int decodedCalls = 0;
+    int decodedChannels = 0;
+    int percentAtDecoded = -1;
+    int cachedCalls = 0;
+    float cachedBpm = 0.0f;
+
+    LoadPipeline::Callbacks callbacks(std::atomic<bool>* cancelOnDecoded = nullptr)
+    {
+        LoadPipeline::Callbacks result;
+        result.onProgress = [this](LoadPipeline::Stage stage, int percent) {
+            stages.append(stage);
+            percents.append(percent);
+        };
+        result.onDecoded = [this, cancelOnDecoded](const QVector<QVector<float>>& channels, int) {
+            ++decodedCalls;
+            decodedChannels = channels.size();
+            percentAtDecoded = percents.isEmpty() ? -1 : percents.last();
+            if (cancelOnDecoded) {
+                cancelOnDecoded->store(true);
+            }
+        };
+        result.onCached = [this](const AnalysisCacheEntry& cached) {
+            ++cachedCalls;
+            cachedBpm = cached.beats.bpm;
+        };
+        return result;
+    }
+};
+
+} // namespace
+
+class LoadPipelineTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void testDecodedBeforeAnalysis();
+    void testCancelStopsPipeline();
+    void testCacheHitSkipsAnalysis();
+    void testDownbeatSignalForOtherMeter();
+
+private:
+    QTemporaryDir dir;
+    QString clickPath;
+};
+
+void LoadPipelineTest::initTestCase()
+{
+    QVERIFY(dir.isValid());
+    clickPath = dir.filePath(QStringLiteral("clicks.wav"));
+    QVERIFY(writeClickTrack(clickPath, 16));
+}
+
+// Волна — по окончании декодирования, прогресс не откатывается, этапы по порядку
+void LoadPipelineTest::testDecodedBeforeAnalysis()
+{
+    Recorder recorder;
+    const LoadPipeline::Result result =
+        LoadPipeline::run(clickPath, clickOptions(), nullptr, nullptr, recorder.callbacks());
+    QVERIFY2(result.ok, qPrintable(result.error));
+    QVERIFY(!result.cancelled);
+    QCOMPARE(result.sampleRate, kSampleRate);
+    QCOMPARE(result.channels.size(), 2);
+    QCOMPARE(result.analysis.bpm, kBpm);
+
+    QCOMPARE(recorder.decodedCalls, 1);
+    QCOMPARE(recorder.decodedChannels, 2);
+    QCOMPARE(recorder.percentAtDecoded, LoadPipeline::kDecodedPercent);
+
+    QVERIFY(!recorder.percents.isEmpty());
+    QCOMPARE(recorder.percents.last(), 100);
+    for (int i = 1; i < recorder.percents.size(); ++i) {
+        QVERIFY(recorder.percents[i] >= recorder.percents[i - 1]);
+        QVERIFY(int(recorder.stages[i]) >= int(recorder.stages[i - 1]));
+    }
+    QVERIFY(recorder.stages.contains(LoadPipeline::Stage::Analyzing));
+    QCOMPARE(recorder.stages.last(), LoadPipeline::Stage::Deviations);
+
+    // Отклонения уже посчитаны по сетке анализа: доли щелчков на ней
+    QCOMPARE(result.deviations.beatCount, result.analysis.beats.size());
+    QCOMPARE(result.deviations.gridStartSample, result.analysis.gridStartSample);
+    QVERIFY(result.deviations.maxAbsDeviation < 0.1f);
+}
+
+// Отмена после декодирования: анализ не доводится, заранее выставленный флаг —
+// файл даже не декодируется
+void LoadPipelineTest::testCancelStopsPipeline()
+{
+    std::atomic<bool> cancel(false);
+    Recorder recorder;
+    LoadPipeline::Result result = LoadPipeline::run(clickPath, clickOptions(), nullptr, &cancel,
+                                                    recorder.callbacks(&cancel));
+    QVERIFY(result.cancelled);
+    QVERIFY(!result.ok);
+    QCOMPARE(recorder.decodedCalls, 1);
+    QVERIFY(!recorder.stages.contains(LoadPipeline::Stage::Deviations));
+    QVERIFY(recorder.percents.last() < LoadPipeline::kAnalyzedPercent);
+
+    Recorder early;
+    result = LoadPipeline::run(clickPath, clickOptions(), nullptr, &cancel, early.callbacks());
+    QVERIFY(result.cancelled);
+    QCOMPARE(early.decodedCalls, 0);
+    QVERIFY(result.channels.isEmpty());
+}
+
+// Запись кеша по хешу содержимого заменяет анализ целиком: onCached приходит
+// один раз, этапа анализа нет — и на пути без qm-dsp, и с onset-функцией по
+// блокам декодера. Запись другой длины или от других настроек анализа
+// отбрасывается, анализ идёт по сигналу
+void LoadPipelineTest::testCacheHitSkipsAnalysis()
+{
+    QTemporaryDir cacheDir;
+    QVERIFY(cacheDir.isValid());
+    AnalysisCache cache(cacheDir.path());
+
+    Recorder cold;
+    const LoadPipeline::Result first =
+        LoadPipeline::run(clickPath, clickOptions(), &cache, nullptr, cold.callbacks());
+    QVERIFY(first.ok);
+    QVERIFY(!first.cacheHit);
+    QVERIFY(!first.contentHash.isEmpty());
+    QCOMPARE(cold.cachedCalls, 0);
+
+    AnalysisCacheEntry entry;
+    entry.sampleRate = first.sampleRate;
+    entry.channelCount = first.channels.size();
+    entry.sampleCount = first.channels[0].size();
+    entry.hasBeats = true;
+    entry.beats = first.analysis;
+    entry.beats.bpm = 64.0f;
+
+    BPMAnalyzer::AnalysisOptions mixxxOptions = clickOptions();
+    mixxxOptions.useMixxxAlgorithm = true;
+    for (const BPMAnalyzer::AnalysisOptions& options : { clickOptions(), mixxxOptions }) {
+        entry.beatsOptionsKey = AnalysisCache::optionsKey(options);
+        QVERIFY(cache.store(first.contentHash, entry));
+        Recorder warm;
+        const LoadPipeline::Result second =
+            LoadPipeline::run(clickPath, options, &cache, nullptr, warm.callbacks());
+        QVERIFY(second.ok);
+        QVERIFY(second.cacheHit);
+        QCOMPARE(second.contentHash, first.contentHash);
+        QCOMPARE(second.analysis.bpm, 64.0f);
+        QVERIFY(!second.analysis.tempoMap.isEmpty());
+        QCOMPARE(warm.cachedCalls, 1);
+        QCOMPARE(warm.cachedBpm, 64.0f);
+        QCOMPARE(warm.decodedCalls, 1);
+        QVERIFY(!warm.stages.contains(LoadPipeline::Stage::Analyzing));
+        QCOMPARE(warm.percents.last(), 100);
+    }
+
+    // Запись от других настроек (здесь — размер такта) — промах
+    BPMAnalyzer::AnalysisOptions waltzOptions = clickOptions();
+    waltzOptions.beatsPerBar = 3;
+    entry.beatsOptionsKey = AnalysisCache::optionsKey(waltzOptions);
+    QVERIFY(cache.store(first.contentHash, entry));
+    Recorder otherOptions;
+    const LoadPipeline::Result fourFour =
+        LoadPipeline::run(clickPath, clickOptions(), &cache, nullptr, otherOptions.callbacks());
+    QVERIFY(fourFour.ok);
+    QVERIFY(!fourFour.cacheHit);
+    QCOMPARE(otherOptions.cachedCalls, 0);
+    QCOMPARE(fourFour.analysis.bpm, kBpm);
+
+    entry.beatsOptionsKey = AnalysisCache::optionsKey(clickOptions());
+    entry.sampleCount += 1;
+    QVERIFY(cache.store(first.contentHash, entry));
+    Recorder stale;
+    const LoadPipeline::Result third =
+        LoadPipeline::run(clickPath, clickOptions(), &cache, nullptr, stale.callbacks());
+    QVERIFY(third.ok);
+    QVERIFY(!third.cacheHit);
+    QCOMPARE(third.analysis.bpm, kBpm);
+    QVERIFY(stale.stages.contains(LoadPipeline::Stage::Analyzing));
+}
+
+// Сильная доля в размере, выбранном после анализа, — по Result::downbeatSignal:
+// то же, что анализ сразу в этом размере. При попадании в кеш onset-функция не
+// считается, но прорежённый сигнал тот же
+void LoadPipelineTest::testDownbeatSignalForOtherMeter()
+{
+    BPMAnalyzer::AnalysisOptions fourFour = clickOptions();
+    fourFour.useMixxxAlgorithm = true;
+    BPMAnalyzer::AnalysisOptions threeFour = fourFour;
+    threeFour.beatsPerBar = 3;
+
+    QTemporaryDir cacheDir;
+    QVERIFY(cacheDir.isValid());
+    AnalysisCache cache(cacheDir.path());
+
+    Recorder cold;
+    const LoadPipeline::Result first =
+        LoadPipeline::run(clickPath, fourFour, &cache, nullptr, cold.callbacks());
+    QVERIFY(first.ok);
+    QVERIFY(!first.cacheHit);
+    QCOMPARE(BPMAnalyzer::findBarPhase(first.downbeatSignal, first.sampleRate, first.analysis, 4),
+             first.analysis.barPhase);
+
+    Recorder direct;
+    const LoadPipeline::Result waltz =
+        LoadPipeline::run(clickPath, threeFour, nullptr, nullptr, direct.callbacks());
+    QVERIFY(waltz.ok);
+    QCOMPARE(waltz.analysis.beats.size(), first.analysis.beats.size());
+    QCOMPARE(waltz.downbeatSignal, first.downbeatSignal);
+    QCOMPARE(BPMAnalyzer::findBarPhase(first.downbeatSignal, first.sampleRate, first.analysis, 3),
+             waltz.analysis.barPhase);
+
+    AnalysisCacheEntry entry;
+    entry.sampleRate = first.sampleRate;
+    entry.channelCount = first.channels.size();
+    entry.sampleCount = first.channels[0].size();
+    entry.hasBeats = true;
+    entry.beats = first.analysis;
+    entry.beatsOptionsKey = AnalysisCache::optionsKey(fourFour);
+    QVERIFY(cache.store(first.contentHash, entry));
+
+    Recorder warm;
+    const LoadPipeline::Result second =
+        LoadPipeline::run(clickPath, fourFour, &cache, nullptr, warm.callbacks());
+    QVERIFY(second.ok);
+    QVERIFY(second.cacheHit);
+    QVERIFY(!warm.stages.contains(LoadPipeline::Stage::Analyzing));
+    QCOMPARE(second.downbeatSignal, first.downbeatSignal);
+    QCOMPARE(BPMAnalyzer::findBarPhase(second.downbeatSignal, second.sampleRate, second.analysis, 3),
+             waltz.analysis.barPhase);
+}
+
+QTEST_GUILESS_MAIN(LoadPipelineTest)
+#include "load_pipeline_test.moc"
@@ -38,6 +38,7 @@ class MidiExportTest : public QObject
 private slots:
     void testNotesRoundTrip();
     void testEmptyNotesRejected();
+    void testVariableTempoFollowsMap();
     void testImportKeepsOwnTiming();
     void testImportFitsProjectBpm();
     void testImportAlignsToGridStart();
@@ -296,6 +297,49 @@ void MidiExportTest::testNotesRoundTrip()
     QFile::remove(path);
 }
 
+// Карта темпа: 120 BPM четыре доли, дальше 90 — ноты на долях карты
+// ложатся на целые четверти, а не уплывают по одному темпу файла
+void MidiExportTest::testVariableTempoFollowsMap()
+{
+    const double fast = (60.0 / 120.0) * double(kSampleRate);
+    const double slow = (60.0 / 90.0) * double(kSampleRate);
+    QVector<qint64> beats;
+    for (int i = 0; i <= 8; ++i) {
+        beats.append(qint64(i <= 4 ? i * fast : 4 * fast + (i - 4) * slow));
+    }
+    const TempoMap map = TempoMap::fromBeats(beats);
+    QVERIFY(map.isVariable());
+
+    QVector<PitchDetector::PitchNote> notes;
+    for (int i = 0; i < 8; ++i) {
+        PitchDetector::PitchNote note;
+        note.startSample = beats[i];
+        note.endSample = beats[i + 1];
+        note.midiPitch = 60.0f;
+        note.detectedPitch = 60.0f;
+        note.confidence = 1.0f;
+        notes.append(note);
+    }
+
+    MidiExporter::Options options;
+    options.bpm = kBpm;
+    options.sampleRate = kSampleRate;
+    options.tempoMap = map;
+
+    const QString path = QDir::temp().filePath(QStringLiteral("dontfloat_midi_export_tempo.mid"));
+    QString error;
+    QVERIFY2(MidiExporter::writeFile(path, notes, options, &error), qPrintable(error));
+
+    const MidiSmf::Song song = MidiSmf::loadFile(path);
+    QVERIFY(std::fabs(song.bpm - 120.0f) < 0.5f);  // первый темп — темп начала
+    QCOMPARE(song.notes.size(), notes.size());
+    for (int i = 0; i < song.notes.size(); ++i) {
+        QVERIFY(std::abs(song.notes[i].startTick - i * MidiExporter::kTicksPerQuarter) <= 1);
+    }
+
+    QFile::remove(path);
+}
+
 void MidiExportTest::testEmptyNotesRejected()
 {
     const QString path = QDir::temp().filePath(QStringLiteral("dontfloat_midi_export_empty.mid"));
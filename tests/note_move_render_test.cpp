@@ -65,6 +65,7 @@ class NoteMoveRenderTest : public QObject
 private slots:
     void testMovedNotesSwapAudio();
     void testMoveMarksPendingEdits();
+    void testEditedRangeBoundsChanges();
     void testUndoOfMoveRestoresOriginalOrder();
     void testSplitKeepsSourceRangesOfBothHalves();
 };
@@ -116,6 +117,39 @@ void NoteMoveRenderTest::testMoveMarksPendingEdits()
     QVERIFY(notes[0].isMovedInTime());
 }
 
+// Вне editedRange коррекция не трогает ни сэмпла: по этому участку окно
+// правит пирамиду пиков, не строя её заново
+void NoteMoveRenderTest::testEditedRangeBoundsChanges()
+{
+    const QVector<QVector<float>> audio = makeMarkedAudio();
+    QVector<PitchDetector::PitchNote> notes;
+    for (int i = 0; i < kNoteCount; ++i) {
+        notes.append(makeNote(i));
+    }
+    const qint64 total = audio[0].size();
+    const QPair<qint64, qint64> none = PitchCorrection::editedRange(notes, total);
+    QCOMPARE(none.first, none.second);
+
+    PitchNoteMoveCommand command(nullptr, &notes, 1, notes[1].startSample,
+                                 qint64(2) * kNoteSamples, QStringLiteral("move"));
+    command.redo();
+    const QPair<qint64, qint64> range = PitchCorrection::editedRange(notes, total);
+    QCOMPARE(range.first, qint64(kNoteSamples));
+    QCOMPARE(range.second, qint64(3) * kNoteSamples);
+
+    const QVector<QVector<float>> out = PitchCorrection::apply(audio, notes, kSampleRate);
+    QCOMPARE(out[0].size(), audio[0].size());
+    bool changedInside = false;
+    for (qint64 i = 0; i < total; ++i) {
+        if (i < range.first || i >= range.second) {
+            QCOMPARE(out[0][i], audio[0][i]);
+        } else if (out[0][i] != audio[0][i]) {
+            changedInside = true;
+        }
+    }
+    QVERIFY(changedInside);
+}
+
 // Ctrl+Z возвращает ноту на место — и звук вместе с ней
 void NoteMoveRenderTest::testUndoOfMoveRestoresOriginalOrder()
 {
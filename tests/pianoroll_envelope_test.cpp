@@ -0,0 +1,132 @@
+// Огибающая волны пианоролла из сведённой пирамиды (PianoRollEngine::EnvelopePyramid).
+//
+// Раньше каждый ресайз или масштаб сводил и перебирал все сэмплы всех
+// каналов. Теперь огибающая читается из пирамиды, и ошибка здесь — это
+// волна под нотами, не совпадающая со звуком.
+
+#include <QtTest/QTest>
+
+#include "../include/pianoroll_engine.h"
+
+#include <cmath>
+
+using namespace PianoRollEngine;
+
+namespace {
+
+QVector<QVector<float>> makeStereo(int frames)
+{
+    QVector<QVector<float>> channels(2, QVector<float>(frames));
+    for (int i = 0; i < frames; ++i) {
+        const float t = float(i);
+        channels[0][i] = 0.4f * std::sin(t * 0.013f) + ((i % 7919) == 0 ? 0.55f : 0.0f);
+        channels[1][i] = 0.3f * std::sin(t * 0.0071f + 1.0f) - ((i % 6007) == 0 ? 0.6f : 0.0f);
+    }
+    return channels;
+}
+
+/** Эталон: сведение по кадрам и прямой перебор столбца — как было до пирамиды. */
+void bruteForceColumn(const QVector<QVector<float>>& channels, qint64 from, qint64 to,
+                      int widgetHeight, int& upper, int& lower)
+{
+    float maxSample = 0.0f;
+    float minSample = 0.0f;
+    for (qint64 frame = from; frame < to && frame < channels[0].size(); ++frame) {
+        float mixed = 0.0f;
+        for (const QVector<float>& channel : channels) {
+            mixed += channel[int(frame)];
+        }
+        mixed /= float(channels.size());
+        maxSample = qMax(maxSample, mixed);
+        minSample = qMin(minSample, mixed);
+    }
+    const int centerY = widgetHeight / 2;
+    const int amplitude = qMax(1, centerY - 1);
+    upper = qBound(0, centerY - int(maxSample * amplitude), widgetHeight - 1);
+    lower = qBound(0, centerY - int(minSample * amplitude), widgetHeight - 1);
+}
+
+} // namespace
+
+class PianoRollEnvelopeTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testWholeTrackCoversEveryPeak();
+    void testViewportMatchesBruteForce();
+    void testRebuildOnlyWhenBuffersChange();
+};
+
+// Вся дорожка в 300 столбцах: ни один всплеск не теряется
+void PianoRollEnvelopeTest::testWholeTrackCoversEveryPeak()
+{
+    const QVector<QVector<float>> channels = makeStereo(200000);
+    const int height = 120;
+    const WaveformEnvelope envelope = buildWaveformEnvelope(channels, 300, height);
+    QCOMPARE(envelope.pixelWidth, 300);
+
+    for (int column = 0; column < envelope.pixelWidth; ++column) {
+        const qint64 from = qint64(column * envelope.samplesPerPixel);
+        const qint64 to = qint64((column + 1) * envelope.samplesPerPixel);
+        int upper = 0, lower = 0;
+        bruteForceColumn(channels, from, to, height, upper, lower);
+        // Корзины пирамиды на краях столбца могут чуть захватить соседний —
+        // огибающая не уже точной, но никогда не теряет пик
+        QVERIFY2(envelope.upper[column] <= upper && envelope.lower[column] >= lower,
+                 qPrintable(QStringLiteral("column %1").arg(column)));
+    }
+}
+
+// Крупный масштаб: столбец короче двух корзин — значения точные; за концом — нулевая линия
+void PianoRollEnvelopeTest::testViewportMatchesBruteForce()
+{
+    const QVector<QVector<float>> channels = makeStereo(50000);
+    EnvelopePyramid pyramid;
+    QVERIFY(pyramid.ensureBuilt(channels));
+    QCOMPARE(pyramid.sampleCount(), qint64(50000));
+
+    const int width = 400;
+    const int height = 90;
+    const Viewport viewport = Viewport::compute(50000, width, 40.0f, 0.999f);
+    const WaveformEnvelope envelope = buildWaveformEnvelope(pyramid, viewport, width, height);
+    QCOMPARE(int(envelope.upper.size()), width);
+
+    for (int column = 0; column < width; ++column) {
+        const qint64 from = viewport.startSample + qint64(column * viewport.samplesPerPixel);
+        const qint64 to = viewport.startSample + qint64((column + 1) * viewport.samplesPerPixel);
+        int upper = 0, lower = 0;
+        bruteForceColumn(channels, from, qMax(to, from + 1), height, upper, lower);
+        QCOMPARE(envelope.upper[column], upper);
+        QCOMPARE(envelope.lower[column], lower);
+    }
+
+    const Viewport beyond { viewport.samplesPerPixel, 0, 0, 60000 };
+    const WaveformEnvelope tail = buildWaveformEnvelope(pyramid, beyond, 10, height);
+    for (int column = 0; column < 10; ++column) {
+        QCOMPARE(tail.upper[column], height / 2);
+        QCOMPARE(tail.lower[column], height / 2);
+    }
+}
+
+// Пирамида пересобирается только при смене буферов — ресайз её не трогает
+void PianoRollEnvelopeTest::testRebuildOnlyWhenBuffersChange()
+{
+    QVector<QVector<float>> channels = makeStereo(10000);
+    EnvelopePyramid pyramid;
+    QVERIFY(pyramid.ensureBuilt(channels));
+    QVERIFY(!pyramid.ensureBuilt(channels));
+
+    // Правка общей копии отделяет буфер канала — это уже другие данные
+    QVector<QVector<float>> edited = channels;
+    edited[1][5000] = 0.9f;
+    QVERIFY(pyramid.ensureBuilt(edited));
+    QVERIFY(!pyramid.ensureBuilt(edited));
+
+    QVERIFY(pyramid.ensureBuilt(QVector<QVector<float>> {}));
+    QVERIFY(pyramid.isEmpty());
+    QVERIFY(buildWaveformEnvelope(pyramid, Viewport(), 100, 50).isEmpty());
+}
+
+QTEST_APPLESS_MAIN(PianoRollEnvelopeTest)
+#include "pianoroll_envelope_test.moc"
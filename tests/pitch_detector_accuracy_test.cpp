@@ -77,6 +77,22 @@ float meanAbsoluteCentsError(const QVector<PitchDetector::PitchNote>& notes,
     return count > 0 ? acc / float(count) : 1.0e9f;
 }
 
+/// Ровный тон с шестью гармониками (1/h), секунда при 44.1 кГц.
+QVector<float> harmonicTone(float midi, int sampleRate)
+{
+    const double hz = 440.0 * std::pow(2.0, (double(midi) - 69.0) / 12.0);
+    QVector<float> mono(sampleRate);
+    for (int i = 0; i < sampleRate; ++i) {
+        const double phase = 2.0 * M_PI * hz * i / sampleRate;
+        double sample = 0.0;
+        for (int h = 1; h <= 6; ++h) {
+            sample += std::sin(h * phase) / h;
+        }
+        mono[i] = float(0.3 * sample);
+    }
+    return mono;
+}
+
 } // namespace
 
 class PitchDetectorAccuracyTest : public QObject
@@ -89,6 +105,7 @@ private slots:
     void detectsCMajorMelody();
     void detectsVibratoCenterNearA3();
     void detectsDetunedE3WithinTolerance();
+    void differencePathsHitSynthesizedTones();
 
 private:
     QVector<PitchDetector::PitchNote> analyze(const QString& wavName);
@@ -189,5 +206,37 @@ void PitchDetectorAccuracyTest::detectsDetunedE3WithinTolerance()
                             .arg(note->detectedPitch).arg(centsError)));
 }
 
+void PitchDetectorAccuracyTest::differencePathsHitSynthesizedTones()
+{
+    constexpr int kSampleRate = 44100;
+
+    // Широкий диапазон по умолчанию даёт длинный лаг — разностная функция
+    // идёт через FFT; узкий (300…1200 Гц) оставляет не больше 64 лагов —
+    // прямой SIMD-цикл. На ровном тоне оба пути должны попадать в центы.
+    PitchDetector::Options wide;
+    PitchDetector::Options narrow;
+    narrow.minFrequencyHz = 300.0f;
+    narrow.maxFrequencyHz = 1200.0f;
+
+    struct Case {
+        float midi;
+        const PitchDetector::Options* options;
+    };
+    const Case cases[] = {
+        {40.35f, &wide}, {57.2f, &wide}, {69.0f, &wide}, {76.6f, &wide},
+        {69.0f, &narrow}, {76.6f, &narrow},
+    };
+    for (const Case& c : cases) {
+        const auto notes = PitchDetector::detectNotes(harmonicTone(c.midi, kSampleRate),
+                                                      kSampleRate, *c.options);
+        QVERIFY2(notes.size() == 1,
+                 qPrintable(QStringLiteral("MIDI %1: %2 notes").arg(c.midi).arg(notes.size())));
+        const float centsError = std::abs(notes.first().detectedPitch - c.midi) * 100.0f;
+        QVERIFY2(centsError < 2.0f,
+                 qPrintable(QStringLiteral("MIDI %1: detected=%2, cents error=%3")
+                                .arg(c.midi).arg(notes.first().detectedPitch).arg(centsError)));
+    }
+}
+
 QTEST_MAIN(PitchDetectorAccuracyTest)
 #include "pitch_detector_accuracy_test.moc"
@@ -67,6 +67,7 @@ private slots:
     void testDifferentContentIsNotAShift();
     void testRenderedOutputReplacesInput();
     void testRenderedOutputOnlyOnItsRange();
+    void testCaptureDirtyFrame();
 };
 
 // Обработанный звук уходит в выход плагина: DAW слышит правки, а не исходник
@@ -221,5 +222,36 @@ void PluginContentShiftTest::testDifferentContentIsNotAShift()
     QVERIFY(!detectContentShift(before, after, &delta));
 }
 
+// Волна в плагине досчитывается с самого раннего изменённого кадра, а не целиком
+void PluginContentShiftTest::testCaptureDirtyFrame()
+{
+    TrackToolSession session;
+    prepareSession(session);
+    QCOMPARE(session.takeCaptureDirtyFrame(), std::int64_t(-1));
+
+    const std::vector<float> clip = makeClip(kBlockSize * 4);
+    feedClip(session, clip, 0);
+    QCOMPARE(session.takeCaptureDirtyFrame(), std::int64_t(0));
+    QCOMPARE(session.takeCaptureDirtyFrame(), std::int64_t(-1));
+
+    // Продолжение прохода: меняется только хвост
+    const std::int64_t end = session.audioBuffer().frameCount();
+    feedClip(session, clip, end);
+    QCOMPARE(session.takeCaptureDirtyFrame(), end);
+
+    // Два блока между опросами — берётся более ранний
+    const std::int64_t end2 = session.audioBuffer().frameCount();
+    feedClip(session, makeClip(kBlockSize), end2);
+    feedClip(session, makeClip(kBlockSize), end2 + kBlockSize);
+    QCOMPARE(session.takeCaptureDirtyFrame(), end2);
+
+    // Новый проход DAW с начала: буфер заменён целиком
+    feedClip(session, clip, 0);
+    QCOMPARE(session.takeCaptureDirtyFrame(), std::int64_t(0));
+
+    session.clearHostCapture();
+    QCOMPARE(session.takeCaptureDirtyFrame(), std::int64_t(0));
+}
+
 QTEST_MAIN(PluginContentShiftTest)
 #include "plugin_content_shift_test.moc"
@@ -0,0 +1,127 @@
+// Кеш плиток спектрограммы (SpectrogramCache): выбор уровня под масштаб,
+// число кадров и плиток на уровне, вытеснение по LRU в пределах бюджета.
+//
+// WaveformView считает и рисует плитки по этим формулам: ошибка в уровне —
+// растянутые столбцы при приближении или лишние FFT при отдалении.
+
+#include <QtTest/QTest>
+
+#include "../include/spectrogramcache.h"
+
+namespace {
+
+QImage makeTile(int width = SpectrogramCache::kTileColumns, int height = 256)
+{
+    QImage image(width, height, QImage::Format_RGB32);
+    image.fill(Qt::black);
+    return image;
+}
+
+} // namespace
+
+class SpectrogramCacheTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testLevelSelection();
+    void testFrameAndTileCounts();
+    void testFindAndKeySeparation();
+    void testLruEvictionWithinBudget();
+};
+
+// Уровень — самый грубый, при котором столбцов не меньше, чем нужно экрану
+void SpectrogramCacheTest::testLevelSelection()
+{
+    QCOMPARE(SpectrogramCache::hopForLevel(0), SpectrogramCache::kMinHop);
+    QCOMPARE(SpectrogramCache::hopForLevel(3), SpectrogramCache::kMinHop * 8);
+
+    QCOMPARE(SpectrogramCache::levelForSamplesPerColumn(1.0), 0);
+    QCOMPARE(SpectrogramCache::levelForSamplesPerColumn(SpectrogramCache::kMinHop), 0);
+    QCOMPARE(SpectrogramCache::levelForSamplesPerColumn(2.0 * SpectrogramCache::kMinHop - 1), 0);
+    QCOMPARE(SpectrogramCache::levelForSamplesPerColumn(2.0 * SpectrogramCache::kMinHop), 1);
+    QCOMPARE(SpectrogramCache::levelForSamplesPerColumn(1000.0), 5);  // 512 <= 1000 < 1024
+    QCOMPARE(SpectrogramCache::levelForSamplesPerColumn(1e12), SpectrogramCache::kMaxLevel);
+
+    for (double spc = 1.0; spc < 1e7; spc *= 1.7) {
+        const int level = SpectrogramCache::levelForSamplesPerColumn(spc);
+        QVERIFY(level == 0 || SpectrogramCache::hopForLevel(level) <= spc);
+        QVERIFY(level == SpectrogramCache::kMaxLevel
+                || SpectrogramCache::hopForLevel(level + 1) > spc);
+    }
+}
+
+void SpectrogramCacheTest::testFrameAndTileCounts()
+{
+    // Канал короче окна — кадров нет, ровно в окно — один кадр
+    QCOMPARE(SpectrogramCache::frameCount(1023, 1024, 0), qint64(0));
+    QCOMPARE(SpectrogramCache::frameCount(1024, 1024, 0), qint64(1));
+    QCOMPARE(SpectrogramCache::frameCount(1024, 1024, 3), qint64(1));
+    QCOMPARE(SpectrogramCache::tileCount(100, 1024, 0), qint64(0));
+
+    // Последний кадр целиком помещается в канал
+    const qint64 samples = 44100;
+    const int window = 1024;
+    for (int level = 0; level <= 6; ++level) {
+        const qint64 hop = SpectrogramCache::hopForLevel(level);
+        const qint64 frames = SpectrogramCache::frameCount(samples, window, level);
+        QVERIFY(frames > 0);
+        QVERIFY((frames - 1) * hop + window <= samples);
+        QVERIFY(frames * hop + window > samples);
+        const qint64 tiles = SpectrogramCache::tileCount(samples, window, level);
+        QCOMPARE(tiles, (frames + SpectrogramCache::kTileColumns - 1) / SpectrogramCache::kTileColumns);
+    }
+}
+
+// Плитки разных настроек, каналов и уровней не подменяют друг друга
+void SpectrogramCacheTest::testFindAndKeySeparation()
+{
+    SpectrogramCache cache;
+    const SpectrogramTileKey a { 1, 0, 2, 5 };
+    const SpectrogramTileKey otherSettings { 2, 0, 2, 5 };
+    const SpectrogramTileKey otherChannel { 1, 1, 2, 5 };
+    const SpectrogramTileKey otherLevel { 1, 0, 3, 5 };
+
+    QVERIFY(!cache.find(a));
+    cache.insert(a, makeTile(10));
+    cache.insert(otherSettings, makeTile(20));
+
+    QVERIFY(cache.contains(a));
+    QCOMPARE(cache.find(a)->width(), 10);
+    QCOMPARE(cache.find(otherSettings)->width(), 20);
+    QVERIFY(!cache.find(otherChannel));
+    QVERIFY(!cache.find(otherLevel));
+
+    // Пустая картинка (отменённая плитка) в кеш не попадает
+    cache.insert(otherLevel, QImage());
+    QVERIFY(!cache.contains(otherLevel));
+
+    cache.clear();
+    QCOMPARE(cache.tileCount(), qsizetype(0));
+}
+
+void SpectrogramCacheTest::testLruEvictionWithinBudget()
+{
+    const qint64 tileBytes = makeTile().sizeInBytes();
+    SpectrogramCache cache;
+    cache.setBudgetBytes(tileBytes * 4);
+    QCOMPARE(cache.budgetBytes(), tileBytes * 4);
+
+    for (int tile = 0; tile < 4; ++tile) {
+        cache.insert(SpectrogramTileKey { 7, 0, 0, tile }, makeTile());
+    }
+    QCOMPARE(cache.tileCount(), qsizetype(4));
+
+    // Обращение освежает плитку 0, вытесняется самая давняя — плитка 1
+    QVERIFY(cache.find(SpectrogramTileKey { 7, 0, 0, 0 }));
+    cache.insert(SpectrogramTileKey { 7, 0, 0, 4 }, makeTile());
+
+    QCOMPARE(cache.tileCount(), qsizetype(4));
+    QVERIFY(cache.usedBytes() <= cache.budgetBytes());
+    QVERIFY(cache.contains(SpectrogramTileKey { 7, 0, 0, 0 }));
+    QVERIFY(!cache.contains(SpectrogramTileKey { 7, 0, 0, 1 }));
+    QVERIFY(cache.contains(SpectrogramTileKey { 7, 0, 0, 4 }));
+}
+
+QTEST_APPLESS_MAIN(SpectrogramCacheTest)
+#include "spectrogram_cache_test.moc"
@@ -0,0 +1,187 @@
+// Карта темпа (TempoMap): «сэмпл ↔ доля» для дорожки с переменным BPM.
+//
+// По ней рисуется сетка волны и пианоролла, ставятся метки выравнивания и
+// считаются тики MIDI. Ошибка здесь — сетка расходится с долями живой записи,
+// а смена темпа снова выглядит как неровные доли.
+
+#include <QtTest/QTest>
+#include <QtCore/QVector>
+
+#include <cmath>
+
+#include "../include/bpmanalyzer.h"
+#include "../include/tempomap.h"
+
+namespace {
+
+constexpr int kSampleRate = 44100;
+
+double samplesPerBeat(double bpm)
+{
+    return 60.0 * kSampleRate / bpm;
+}
+
+/** Доли: first штук в темпе bpmA, затем ещё second в темпе bpmB. */
+QVector<qint64> twoTempoBeats(qint64 start, int first, double bpmA, int second, double bpmB)
+{
+    QVector<qint64> beats;
+    double position = double(start);
+    for (int i = 0; i < first; ++i) {
+        beats.append(qint64(std::llround(position)));
+        position += samplesPerBeat(bpmA);
+    }
+    for (int i = 0; i <= second; ++i) {
+        beats.append(qint64(std::llround(position)));
+        position += samplesPerBeat(bpmB);
+    }
+    return beats;
+}
+
+} // namespace
+
+class TempoMapTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testConstantRoundTrip();
+    void testTempoChangeSplitsSegments();
+    void testRampFollowsBeats();
+    void testSingleOutlierSkipped();
+    void testShiftAndRebase();
+    void testAnalysisMapAndDeviations();
+};
+
+// Один сегмент — обычная сетка BPM, в обе стороны без потерь
+void TempoMapTest::testConstantRoundTrip()
+{
+    const TempoMap map = TempoMap::constant(samplesPerBeat(120.0), 1000);
+    QVERIFY(!map.isEmpty());
+    QVERIFY(!map.isVariable());
+    QCOMPARE(map.sampleAtBeat(0.0), 1000.0);
+    QCOMPARE(map.sampleAtBeat(4.0), 1000.0 + 4.0 * samplesPerBeat(120.0));
+    QVERIFY(std::abs(map.beatAtSample(map.sampleAtBeat(-3.5)) + 3.5) < 1e-9);
+    QVERIFY(std::abs(map.bpmAt(1e7, kSampleRate) - 120.0) < 1e-9);
+
+    const TempoMap empty;
+    QCOMPARE(empty.beatAtSample(12345.0), 0.0);
+    QCOMPARE(empty.samplesPerBeatAt(12345.0), 0.0);
+}
+
+// Скачок 120 → 100 BPM: два сегмента со стыком на общей доле
+void TempoMapTest::testTempoChangeSplitsSegments()
+{
+    const QVector<qint64> beats = twoTempoBeats(0, 32, 120.0, 32, 100.0);
+    const TempoMap map = TempoMap::fromBeats(beats);
+    QVERIFY(map.isVariable());
+    QCOMPARE(map.segments().size(), 2);
+    QVERIFY(std::abs(map.segments()[0].samplesPerBeat - samplesPerBeat(120.0)) < 1.0);
+    QVERIFY(std::abs(map.segments()[1].samplesPerBeat - samplesPerBeat(100.0)) < 1.0);
+    QCOMPARE(map.segments()[1].startBeat, 32.0);
+
+    for (int i = 0; i < beats.size(); ++i) {
+        QVERIFY(std::abs(map.beatAtSample(double(beats[i])) - i) < 1e-3);
+        QVERIFY(std::abs(map.sampleAtBeat(i) - double(beats[i])) < 1.0);
+    }
+}
+
+// Плавное ускорение 110 → 130 BPM: цепочка сегментов, каждая доля — у своей линии
+void TempoMapTest::testRampFollowsBeats()
+{
+    QVector<qint64> beats;
+    double position = 0.0;
+    const int count = 128;
+    for (int i = 0; i < count; ++i) {
+        beats.append(qint64(std::llround(position)));
+        position += samplesPerBeat(110.0 + 20.0 * i / (count - 1));
+    }
+    const TempoMap map = TempoMap::fromBeats(beats);
+    QVERIFY(map.isVariable());
+    for (int i = 0; i < count; ++i) {
+        QVERIFY2(std::abs(map.beatAtSample(double(beats[i])) - i) < 0.1,
+                 qPrintable(QStringLiteral("beat %1").arg(i)));
+    }
+    // Темп растёт от сегмента к сегменту
+    const QVector<TempoMap::Segment>& segments = map.segments();
+    QVERIFY(segments.first().samplesPerBeat > segments.last().samplesPerBeat);
+}
+
+// Одиночный выброс детектора не рвёт сегмент
+void TempoMapTest::testSingleOutlierSkipped()
+{
+    QVector<qint64> beats = twoTempoBeats(500, 64, 120.0, 0, 120.0);
+    beats[20] += qint64(0.3 * samplesPerBeat(120.0));
+    const TempoMap map = TempoMap::fromBeats(beats);
+    QVERIFY(!map.isEmpty());
+    QVERIFY(!map.isVariable());
+    QVERIFY(std::abs(map.samplesPerBeatAt(0.0) - samplesPerBeat(120.0)) < 1.0);
+}
+
+// Перенос опорной линии двигает карту, rebase перенумеровывает доли
+void TempoMapTest::testShiftAndRebase()
+{
+    TempoMap map = TempoMap::fromBeats(twoTempoBeats(1000, 16, 120.0, 16, 90.0));
+    QVERIFY(map.isVariable());
+    const double beatBefore = map.beatAtSample(200000.0);
+
+    map.shift(250.0);
+    QVERIFY(std::abs(map.beatAtSample(200250.0) - beatBefore) < 1e-9);
+
+    const qint64 gridStart = qint64(std::llround(map.sampleAtBeat(4.0)));
+    map.rebase(gridStart);
+    QVERIFY(std::abs(map.beatAtSample(double(gridStart))) < 1e-6);
+    QVERIFY(std::abs(map.beatAtSample(200250.0) - (beatBefore - 4.0)) < 1e-9);
+}
+
+// Результат анализа: карта в единицах выбранного BPM (доли трекера — через одну),
+// отклонения по карте не принимают смену темпа за неровные доли
+void TempoMapTest::testAnalysisMapAndDeviations()
+{
+    BPMAnalyzer::AnalysisResult result;
+    result.bpm = 240.0f;  // гармоника: доли трекера идут вдвое реже
+    const QVector<qint64> beats = twoTempoBeats(2000, 48, 120.0, 48, 105.0);
+    result.gridStartSample = beats.first();
+    for (qint64 position : beats) {
+        BPMAnalyzer::BeatInfo beat;
+        beat.position = position;
+        beat.confidence = 1.0f;
+        result.beats.append(beat);
+    }
+
+    const TempoMap map = BPMAnalyzer::buildTempoMap(result, kSampleRate);
+    QVERIFY(map.isVariable());
+    QVERIFY(std::abs(map.beatAtSample(double(beats.first()))) < 1e-6);
+    QVERIFY(std::abs(map.beatAtSample(double(beats[10])) - 20.0) < 1e-3);
+    QVERIFY(std::abs(map.bpmAt(double(beats.first()), kSampleRate) - 240.0) < 0.5);
+    QVERIFY(std::abs(map.bpmAt(double(beats.last()), kSampleRate) - 210.0) < 0.5);
+
+    QVector<BPMAnalyzer::BeatInfo> byMap = result.beats;
+    const BPMAnalyzer::DeviationStats stats =
+        BPMAnalyzer::calculateDeviations(byMap, map, kSampleRate);
+    QCOMPARE(stats.beatCount, beats.size());
+    QVERIFY(stats.maxAbsDeviation < 0.01f);
+    QCOMPARE(stats.gridStartSample, beats.first());
+    QVERIFY(BPMAnalyzer::findUnalignedBeats(byMap, 0.05f).isEmpty());
+
+    // Та же дорожка по одной сетке — хвост «неровный» целиком
+    QVector<BPMAnalyzer::BeatInfo> byGrid = result.beats;
+    BPMAnalyzer::DeviationOptions options;
+    options.gridStartSample = result.gridStartSample;
+    BPMAnalyzer::calculateDeviations(byGrid, result.bpm, kSampleRate, options);
+    QVERIFY(!BPMAnalyzer::findUnalignedBeats(byGrid, 0.05f).isEmpty());
+
+    // Ровный темп — карта из одного сегмента по bpm
+    BPMAnalyzer::AnalysisResult steady = result;
+    steady.beats.clear();
+    for (qint64 position : twoTempoBeats(2000, 64, 120.0, 0, 120.0)) {
+        BPMAnalyzer::BeatInfo beat;
+        beat.position = position;
+        steady.beats.append(beat);
+    }
+    const TempoMap steadyMap = BPMAnalyzer::buildTempoMap(steady, kSampleRate);
+    QVERIFY(!steadyMap.isVariable());
+    QVERIFY(std::abs(steadyMap.bpmAt(0.0, kSampleRate) - 240.0) < 1e-3);
+}
+
+QTEST_APPLESS_MAIN(TempoMapTest)
+#include "tempo_map_test.moc"
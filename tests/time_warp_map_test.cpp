@@ -0,0 +1,148 @@
+// Карта времени по меткам (TimeWarpMap): исходное аудио ↔ таймлайн.
+//
+// По ней рисуется волна, пока метки тянут и полное превью растяжения ещё не
+// готово, и по ней же на таймлайн ставятся доли. Ошибка здесь — волна и доли
+// съезжают относительно меток.
+
+#include <QtTest/QTest>
+
+#include "../include/timewarpmap.h"
+
+namespace {
+
+Marker makeMarker(qint64 originalPosition, qint64 position)
+{
+    Marker marker(originalPosition);
+    marker.originalPosition = originalPosition;
+    marker.position = position;
+    return marker;
+}
+
+/** Эталон: линейный проход по отрезкам отсортированных меток. */
+qint64 referenceToDisplay(const QVector<Marker>& sorted, qint64 originalPos)
+{
+    for (int i = 0; i + 1 < sorted.size(); ++i) {
+        const Marker& m0 = sorted[i];
+        const Marker& m1 = sorted[i + 1];
+        if (originalPos >= m0.originalPosition && originalPos < m1.originalPosition) {
+            const double t = double(originalPos - m0.originalPosition)
+                           / double(m1.originalPosition - m0.originalPosition);
+            return m0.position + qint64(t * (m1.position - m0.position));
+        }
+    }
+    return -1;
+}
+
+} // namespace
+
+class TimeWarpMapTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testIdentityWithoutMovedMarkers();
+    void testMatchesSegmentInterpolation();
+    void testInverseRoundTrip();
+    void testEdgesAndTail();
+    void testCrossedMarkers();
+    void testRebuildDetection();
+};
+
+// Метки на месте: карта ничего не сдвигает
+void TimeWarpMapTest::testIdentityWithoutMovedMarkers()
+{
+    const QVector<Marker> markers { makeMarker(0, 0), makeMarker(5000, 5000), makeMarker(9000, 9000) };
+    const TimeWarpMap warp(markers, 10000);
+    QVERIFY(!warp.changesTimeline());
+    QCOMPARE(warp.displaySize(), qint64(10000));
+    for (qint64 pos = 0; pos < 10000; pos += 37) {
+        QCOMPARE(warp.toDisplay(pos), pos);
+        QCOMPARE(warp.toOriginal(pos), pos);
+    }
+
+    const TimeWarpMap empty(QVector<Marker> {}, 1000);
+    QCOMPARE(empty.toOriginal(5000), qint64(999));  // в пределах исходного аудио
+    QCOMPARE(empty.toDisplay(5000), qint64(5000));
+}
+
+// Внутри меток — линейная интерполяция по своему отрезку, на 300 метках
+void TimeWarpMapTest::testMatchesSegmentInterpolation()
+{
+    QVector<Marker> markers;
+    qint64 display = 0;
+    for (int i = 0; i < 300; ++i) {
+        markers.append(makeMarker(qint64(i) * 22050, display));
+        display += 22050 + ((i % 7) - 3) * 1500;  // доли то сжаты, то растянуты
+    }
+    // Порядок в векторе не важен: карта сортирует сама
+    std::reverse(markers.begin(), markers.end());
+    const TimeWarpMap warp(markers, 300 * 22050);
+    QVERIFY(warp.changesTimeline());
+
+    std::reverse(markers.begin(), markers.end());
+    for (qint64 pos = 1; pos < markers.last().originalPosition; pos += 997) {
+        QCOMPARE(warp.toDisplay(pos), referenceToDisplay(markers, pos));
+    }
+}
+
+// Обратно и туда: позиция возвращается с точностью до сэмпла на растяжение
+void TimeWarpMapTest::testInverseRoundTrip()
+{
+    const QVector<Marker> markers { makeMarker(0, 0), makeMarker(10000, 20000),
+                                    makeMarker(30000, 25000), makeMarker(40000, 45000) };
+    const TimeWarpMap warp(markers, 50000);
+    for (qint64 pos = 0; pos < 50000; pos += 101) {
+        const qint64 back = warp.toOriginal(warp.toDisplay(pos));
+        QVERIFY2(qAbs(back - pos) <= 4,
+                 qPrintable(QStringLiteral("pos=%1 back=%2").arg(pos).arg(back)));
+    }
+}
+
+// До первой метки — масштаб от нуля, после последней — хвост последнего отрезка
+void TimeWarpMapTest::testEdgesAndTail()
+{
+    const QVector<Marker> markers { makeMarker(1000, 2000), makeMarker(3000, 6000) };
+    const TimeWarpMap warp(markers, 5000);
+    QCOMPARE(warp.toDisplay(500), qint64(1000));
+    QCOMPARE(warp.toOriginal(1000), qint64(500));
+
+    // Хвост 2000 сэмплов тянется вдвое, как последний отрезок
+    QCOMPARE(warp.displaySize(), qint64(6000 + 4000));
+    QCOMPARE(warp.toDisplay(4000), qint64(8000));
+    QCOMPARE(warp.toOriginal(8000), qint64(4000));
+    QCOMPARE(warp.toOriginal(1000000), qint64(4999));
+}
+
+// Метки перекрестились: поиск по таймлайну не ломается
+void TimeWarpMapTest::testCrossedMarkers()
+{
+    const QVector<Marker> markers { makeMarker(0, 0), makeMarker(1000, 3000),
+                                    makeMarker(2000, 2500), makeMarker(4000, 5000) };
+    const TimeWarpMap warp(markers, 6000);
+    // [0, 3000) таймлайна — первый отрезок, дальше [2500, 5000) — третий
+    QCOMPARE(warp.toOriginal(1500), qint64(500));
+    QCOMPARE(warp.toOriginal(4000), qint64(3200));
+    for (qint64 pos = 0; pos < 8000; pos += 13) {
+        const qint64 original = warp.toOriginal(pos);
+        QVERIFY(original >= 0 && original < 6000);
+    }
+}
+
+// Карта узнаёт, что метки сдвинули, и не пересобирается зря
+void TimeWarpMapTest::testRebuildDetection()
+{
+    QVector<Marker> markers { makeMarker(0, 0), makeMarker(1000, 1200) };
+    const TimeWarpMap warp(markers, 2000);
+    QVERIFY(warp.isBuiltFor(markers, 2000));
+    QVERIFY(!warp.isBuiltFor(markers, 2001));
+
+    markers[1].isSelected = true;  // не влияет на время
+    QVERIFY(warp.isBuiltFor(markers, 2000));
+    markers[1].position = 1300;
+    QVERIFY(!warp.isBuiltFor(markers, 2000));
+    markers.append(makeMarker(1500, 1500));
+    QVERIFY(!warp.isBuiltFor(markers, 2000));
+}
+
+QTEST_APPLESS_MAIN(TimeWarpMapTest)
+#include "time_warp_map_test.moc"
@@ -0,0 +1,152 @@
+// Ядро плагина и приложение анализируют один звук одними функциями: тональность
+// по хроме (KeyProfile) и сетку по долям трекера (BeatGridFit). Тест сверяет
+// Dontfloat::PluginCore с KeyAnalyzer и проверяет общий подбор сетки.
+
+#include <QtTest/QTest>
+#include <QtCore/QVector>
+
+#include "../include/beatgridfit.h"
+#include "../include/keyanalyzer.h"
+#include "../include/keyprofile.h"
+#include "../plugins/core/dontfloat_track_analysis.h"
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+using Dontfloat::PluginCore::TrackKey;
+using Dontfloat::PluginCore::TrackKeyInfo;
+using Dontfloat::PluginCore::trackKeyFromChroma;
+
+namespace {
+
+constexpr int kSampleRate = 44100;
+constexpr double kSamplesPerBeat128 = 60.0 * kSampleRate / 128.0;
+
+// Ступени гаммы от тоники
+constexpr int kMajorSteps[7] = { 0, 2, 4, 5, 7, 9, 11 };
+constexpr int kMinorSteps[7] = { 0, 2, 3, 5, 7, 8, 10 };
+
+/** Хрома гаммы тональности \a key; у тоники, терции и квинты вес \a triadWeight. */
+QVector<float> scaleChroma(int key, float triadWeight)
+{
+    QVector<float> chroma(12, 0.0f);
+    const int tonic = key / 2;
+    const int* steps = key % 2 == 0 ? kMajorSteps : kMinorSteps;
+    for (int i = 0; i < 7; ++i) {
+        const bool triad = i == 0 || i == 2 || i == 4;
+        chroma[(tonic + steps[i]) % 12] = triad ? triadWeight : 1.0f;
+    }
+    return chroma;
+}
+
+/** Доли \a count штук по сетке \a samplesPerBeat от \a start, каждая \a every-я доля сетки. */
+std::vector<std::int64_t> gridBeats(std::int64_t start, double samplesPerBeat, int count, int every = 1)
+{
+    std::vector<std::int64_t> beats;
+    for (int i = 0; i < count; ++i) {
+        beats.push_back(start + std::llround(double(i) * every * samplesPerBeat));
+    }
+    return beats;
+}
+
+void compareKeys(const QVector<float>& chroma)
+{
+    const KeyAnalyzer::KeyInfo app = KeyAnalyzer::detectKeyFromChroma(chroma);
+    const TrackKeyInfo core = trackKeyFromChroma(chroma.constData());
+    QCOMPARE(int(core.key), int(app.key));
+    QCOMPARE(core.isMajor, app.isMajor);
+    QCOMPARE(core.strength, app.strength);
+}
+
+} // namespace
+
+class TrackAnalysisAgreementTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void keyFromChromaMatchesKeyAnalyzer();
+    void silentChromaHasNoKey();
+    void gridFitFoldsTrackerHarmonic();
+    void gridFitSkipsOffGridFirstBeat();
+    void barPhaseCountsGridBeats();
+};
+
+void TrackAnalysisAgreementTest::keyFromChromaMatchesKeyAnalyzer()
+{
+    // Все 24 тональности: гамма с весом трезвучия и ровная гамма
+    for (int key = 0; key < KeyProfile::kKeyCount; ++key) {
+        const QVector<float> weighted = scaleChroma(key, 2.0f);
+        compareKeys(weighted);
+        QCOMPARE(int(trackKeyFromChroma(weighted.constData()).key), key);
+        compareKeys(scaleChroma(key, 1.0f));
+    }
+
+    // Произвольные хромы (линейный конгруэнтный генератор — повторяемо)
+    std::uint32_t state = 12345u;
+    for (int n = 0; n < 200; ++n) {
+        QVector<float> chroma(12);
+        for (float& value : chroma) {
+            state = state * 1664525u + 1013904223u;
+            value = float(state >> 8) / float(1u << 24);
+        }
+        compareKeys(chroma);
+    }
+}
+
+void TrackAnalysisAgreementTest::silentChromaHasNoKey()
+{
+    const QVector<float> silence(12, 0.0f);
+    QCOMPARE(int(trackKeyFromChroma(silence.constData()).key), int(TrackKey::Unknown));
+    QCOMPARE(KeyAnalyzer::detectKeyFromChroma(silence).strength, 0.0f);
+}
+
+void TrackAnalysisAgreementTest::gridFitFoldsTrackerHarmonic()
+{
+    // Трекер отдал каждую вторую долю 128 BPM (64 BPM вне диапазона 70..180)
+    const std::vector<std::int64_t> beats = gridBeats(22050, kSamplesPerBeat128, 100, 2);
+    const BeatGridFit::Fit fit = BeatGridFit::fitGrid(beats.data(), beats.size(), kSampleRate, 70.0f, 180.0f);
+    QVERIFY(std::abs(fit.baseBpm - 64.0f) < 0.01f);
+    QVERIFY(std::abs(fit.bpm - 128.0f) < 0.01f);
+    // Начало сетки — на одной из долей 128 BPM от первой доли трекера
+    const double startBeat = double(fit.gridStart - 22050) / kSamplesPerBeat128;
+    QVERIFY(std::abs(startBeat - std::round(startBeat)) < 0.001);
+    QVERIFY(fit.deviation.average < 0.001f);
+    QVERIFY(std::abs(BeatGridFit::trackerBeatScale(beats.data(), beats.size(),
+                                                   kSamplesPerBeat128) - 2.0) < 1e-9);
+}
+
+void TrackAnalysisAgreementTest::gridFitSkipsOffGridFirstBeat()
+{
+    // Ложная доля на 0.25 с перед настоящими с 1 с: фаза сетки — от второй доли
+    std::vector<std::int64_t> beats = gridBeats(kSampleRate, kSamplesPerBeat128, 64);
+    beats.insert(beats.begin(), kSampleRate / 4);
+    const BeatGridFit::Fit fit =
+        BeatGridFit::fitGrid(beats.data(), beats.size(), kSampleRate, 70.0f, 180.0f, 128.0f);
+    QCOMPARE(fit.bpm, 128.0f);
+    const std::int64_t expected = kSampleRate - std::int64_t(kSamplesPerBeat128);
+    QVERIFY(std::abs(fit.gridStart - expected) <= 1);
+
+    // Одна доля — BPM нет, сетка от этой доли
+    const BeatGridFit::Fit single = BeatGridFit::fitGrid(beats.data(), 1, kSampleRate, 70.0f, 180.0f);
+    QCOMPARE(single.bpm, 0.0f);
+    QCOMPARE(single.gridStart, beats.front());
+}
+
+void TrackAnalysisAgreementTest::barPhaseCountsGridBeats()
+{
+    QCOMPARE(BeatGridFit::barPhase(5.0, 4), 1);
+    QCOMPARE(BeatGridFit::barPhase(-1.0, 4), 3);
+    // 6/8 считается по четвертям — такт в 3 доли сетки
+    QCOMPARE(BeatGridFit::barPhase(7.0, 6), 1);
+
+    // Трекер через долю: такт 4/4 — две его доли, 3/4 в целое число не укладывается
+    const std::vector<std::int64_t> beats = gridBeats(0, kSamplesPerBeat128, 32, 2);
+    QCOMPARE(BeatGridFit::trackerBeatsPerBar(beats.data(), beats.size(), kSamplesPerBeat128, 4), 2);
+    QCOMPARE(BeatGridFit::trackerBeatsPerBar(beats.data(), beats.size(), kSamplesPerBeat128, 3), 0);
+    QCOMPARE(BeatGridFit::trackerBeatsPerBar(beats.data(), 4, kSamplesPerBeat128, 4), 0);
+}
+
+QTEST_MAIN(TrackAnalysisAgreementTest)
+#include "track_analysis_agreement_test.moc"
@@ -33,6 +33,34 @@ QVector<float> makeSignal(int size)
     return samples;
 }
 
+/** Пирамиды совпадают, если на любых отрезках отдают одни и те же min/max. */
+bool samePeaks(const WaveformPeaks& a, const WaveformPeaks& b, const QVector<QVector<float>>& channels)
+{
+    if (a.sampleCount() != b.sampleCount() || a.channelCount() != b.channelCount()) {
+        return false;
+    }
+    const qint64 size = a.sampleCount();
+    const qint64 spans[] = { 300, 5000, 40000, size };
+    for (qint64 span : spans) {
+        for (qint64 from = 0; from + span <= size; from += span / 2 + 111) {
+            float minsA[2] = {};
+            float maxsA[2] = {};
+            float minsB[2] = {};
+            float maxsB[2] = {};
+            if (!a.rangeAll(channels, from, from + span, minsA, maxsA)
+                || !b.rangeAll(channels, from, from + span, minsB, maxsB)) {
+                return false;
+            }
+            for (int ch = 0; ch < a.channelCount(); ++ch) {
+                if (minsA[ch] != minsB[ch] || maxsA[ch] != maxsB[ch]) {
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
 } // namespace
 
 class WaveformPeaksTest : public QObject
@@ -45,6 +73,11 @@ private slots:
     void testShortRangesAndEdges();
     void testRejectsForeignSamples();
     void testEmptyInput();
+    void testEveryKernelMatchesScalar();
+    void testInterleavedChannels();
+    void testMismatchedChannelLengths();
+    void testUpdateMatchesRebuild();
+    void testSpliceMatchesRebuild();
 };
 
 // Пики не у́же истинных и не шире, чем окно, расширенное на одну корзину
@@ -177,5 +210,169 @@ void WaveformPeaksTest::testEmptyInput()
     QVERIFY(!peaks.range({}, 0, 10, peakMin, peakMax));
 }
 
+// SIMD-ядра дают те же min/max, что скалярное, и на длинах, не кратных вектору
+void WaveformPeaksTest::testEveryKernelMatchesScalar()
+{
+    QVector<float> samples = makeSignal(WaveformPeaks::kBaseBucketSamples * 37 + 13);
+    samples[1000] = 0.97f;
+    samples[samples.size() - 1] = -0.99f;  // всплеск в хвосте последней корзины
+
+    WaveformPeaks reference;
+    reference.build(samples, DFEngine::SimdKernel::Scalar);
+
+    const DFEngine::SimdKernel kernels[] = { DFEngine::SimdKernel::Sse2,
+                                             DFEngine::SimdKernel::Avx2,
+                                             DFEngine::SimdKernel::Neon };
+    for (DFEngine::SimdKernel kernel : kernels) {
+        if (!DFEngine::isSimdKernelSupported(kernel)) {
+            continue;
+        }
+        WaveformPeaks peaks;
+        peaks.build(samples, kernel);
+        for (qint64 span : { qint64(600), qint64(5000), qint64(samples.size()) }) {
+            for (qint64 from = 0; from + span <= samples.size(); from += span / 2 + 1) {
+                float refMin = 0.0f;
+                float refMax = 0.0f;
+                float peakMin = 0.0f;
+                float peakMax = 0.0f;
+                QVERIFY(reference.range(samples, from, from + span, refMin, refMax));
+                QVERIFY(peaks.range(samples, from, from + span, peakMin, peakMax));
+                QCOMPARE(peakMin, refMin);
+                QCOMPARE(peakMax, refMax);
+            }
+        }
+    }
+}
+
+// Каналы одной пирамиды не смешиваются: каждый совпадает с отдельной пирамидой
+void WaveformPeaksTest::testInterleavedChannels()
+{
+    QVector<QVector<float>> channels { makeSignal(150000), makeSignal(150000) };
+    for (float& value : channels[1]) {
+        value *= -0.5f;
+    }
+    channels[1][70000] = 0.95f;  // всплеск только в правом канале
+
+    WaveformPeaks stereo;
+    stereo.buildChannels(channels);
+    QVERIFY(stereo.isValid());
+    QCOMPARE(stereo.channelCount(), 2);
+
+    WaveformPeaks mono[2];
+    mono[0].build(channels[0]);
+    mono[1].build(channels[1]);
+
+    const qint64 spans[] = { 100, 700, 30000, 150000 };
+    for (qint64 span : spans) {
+        for (qint64 from = 0; from + span <= channels[0].size(); from += span + 777) {
+            float mins[2] = {};
+            float maxs[2] = {};
+            QVERIFY(stereo.rangeAll(channels, from, from + span, mins, maxs));
+            for (int ch = 0; ch < 2; ++ch) {
+                float refMin = 0.0f;
+                float refMax = 0.0f;
+                QVERIFY(mono[ch].range(channels[ch], from, from + span, refMin, refMax));
+                QCOMPARE(mins[ch], refMin);
+                QCOMPARE(maxs[ch], refMax);
+
+                float channelMin = 0.0f;
+                float channelMax = 0.0f;
+                QVERIFY(stereo.range(ch, channels[ch], from, from + span, channelMin, channelMax));
+                QCOMPARE(channelMin, refMin);
+                QCOMPARE(channelMax, refMax);
+            }
+        }
+    }
+
+    float mins[2] = {};
+    float maxs[2] = {};
+    QVERIFY(stereo.rangeAll(channels, 0, channels[0].size(), mins, maxs));
+    QCOMPARE(maxs[1], 0.95f);
+    QVERIFY(maxs[0] < 0.95f);
+
+    // Чужой набор каналов и несуществующий канал — отказ
+    QVERIFY(!stereo.rangeAll({ channels[0] }, 0, 100, mins, maxs));
+    QVERIFY(!stereo.range(2, channels[0], 0, 100, mins[0], maxs[0]));
+}
+
+// Каналы разной длины в одну сетку корзин не кладутся
+void WaveformPeaksTest::testMismatchedChannelLengths()
+{
+    WaveformPeaks peaks;
+    peaks.buildChannels({ makeSignal(1000), makeSignal(999) });
+    QVERIFY(!peaks.isValid());
+    QCOMPARE(peaks.channelCount(), 0);
+}
+
+// Правка без смены длины: пересчёт корзин отрезка равен полной сборке
+void WaveformPeaksTest::testUpdateMatchesRebuild()
+{
+    QVector<QVector<float>> channels { makeSignal(120000), makeSignal(120000) };
+    WaveformPeaks peaks;
+    peaks.buildChannels(channels);
+
+    for (qint64 i = 50000; i < 50300; ++i) {
+        channels[0][int(i)] = 0.0f;
+        channels[1][int(i)] = (i == 50123) ? 0.99f : -0.01f;
+    }
+    peaks.update(channels, 50000, 50300);
+
+    WaveformPeaks rebuilt;
+    rebuilt.buildChannels(channels);
+    QVERIFY(samePeaks(peaks, rebuilt, channels));
+
+    float mins[2] = {};
+    float maxs[2] = {};
+    QVERIFY(peaks.rangeAll(channels, 0, channels[0].size(), mins, maxs));
+    QCOMPARE(maxs[1], 0.99f);
+}
+
+// Вставка, удаление и дозапись: хвост сдвигается или пересчитывается,
+// итог совпадает с полной сборкой по изменённым данным
+void WaveformPeaksTest::testSpliceMatchesRebuild()
+{
+    struct Edit {
+        qint64 at;
+        qint64 removed;
+        qint64 inserted;
+    };
+    // Кратные корзине сдвиги (хвост копируется) и некратные (пересчитывается)
+    const Edit edits[] = {
+        { 100000, 0, 4096 },   // дозапись блоком в конец
+        { 100000, 0, 1000 },   // дозапись некратным куском
+        { 30000, 512, 0 },     // вырезание кратного отрезка
+        { 30000, 0, 777 },     // вставка в середину
+        { 777, 20000, 3 },     // замена с укорачиванием
+    };
+    for (const Edit& edit : edits) {
+        QVector<QVector<float>> channels { makeSignal(100000), makeSignal(100000) };
+        WaveformPeaks peaks;
+        peaks.buildChannels(channels);
+
+        const QVector<float> inserted = makeSignal(int(edit.inserted) + 5).mid(5);
+        for (QVector<float>& channel : channels) {
+            channel.remove(int(edit.at), int(edit.removed));
+            channel.insert(int(edit.at), int(edit.inserted), 0.0f);
+            std::copy(inserted.begin(), inserted.end(), channel.begin() + edit.at);
+        }
+        peaks.splice(channels, edit.at, edit.removed, edit.inserted);
+        QCOMPARE(peaks.sampleCount(), qint64(channels[0].size()));
+
+        WaveformPeaks rebuilt;
+        rebuilt.buildChannels(channels);
+        QVERIFY2(samePeaks(peaks, rebuilt, channels),
+                 qPrintable(QStringLiteral("at=%1 removed=%2 inserted=%3")
+                                .arg(edit.at).arg(edit.removed).arg(edit.inserted)));
+    }
+
+    // Пирамида от других данных — сборка заново, а не порча
+    QVector<QVector<float>> channels { makeSignal(5000) };
+    WaveformPeaks peaks;
+    peaks.buildChannels({ makeSignal(9000), makeSignal(9000) });
+    peaks.splice(channels, 0, 0, 5000);
+    QCOMPARE(peaks.channelCount(), 1);
+    QCOMPARE(peaks.sampleCount(), qint64(5000));
+}
+
 QTEST_APPLESS_MAIN(WaveformPeaksTest)
 #include "waveform_peaks_test.moc"
@@ -0,0 +1,161 @@
+// Растеризатор волны: столбцы min/max → вертикальные отрезки пикселей в QImage.
+//
+// Кеш волны на экране собирается только им, поэтому ошибка здесь — обрезанные
+// пики, не тот цвет полосы или мусор за пределами столбца.
+
+#include <QtTest/QTest>
+
+#include "../include/waveformrasterizer.h"
+
+namespace {
+
+const QColor kBackground(10, 20, 30);
+const QColor kLow(255, 50, 50);
+const QColor kMid(50, 255, 50);
+const QColor kHigh(50, 50, 255);
+
+QImage makeImage(int width, int height)
+{
+    QImage image(width, height, QImage::Format_ARGB32_Premultiplied);
+    image.fill(kBackground);
+    return image;
+}
+
+/** Строки [top, bottom] столбца \a x, закрашенные не фоном; -1, если пусто. */
+void paintedRows(const QImage& image, int x, int& top, int& bottom)
+{
+    top = -1;
+    bottom = -1;
+    for (int y = 0; y < image.height(); ++y) {
+        if (image.pixel(x, y) != kBackground.rgba()) {
+            if (top < 0) {
+                top = y;
+            }
+            bottom = y;
+        }
+    }
+}
+
+} // namespace
+
+class WaveformRasterizerTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testSpansAndBands();
+    void testSilenceAndClipping();
+    void testChannelLanes();
+    void testTranslucentColors();
+};
+
+// Отрезок от −max до −min вокруг центра, цвет — по размаху столбца
+void WaveformRasterizerTest::testSpansAndBands()
+{
+    QImage image = makeImage(4, 101);
+    const float minValues[] = { -0.1f, -0.2f, -0.5f, 0.2f };
+    const float maxValues[] = { 0.1f, 0.2f, 0.5f, 0.4f };
+    const float centerY[] = { 50.0f };
+
+    WaveformRasterizer rasterizer(kLow, kMid, kHigh);
+    rasterizer.draw(image, 0, 4, 1, minValues, maxValues, centerY, 50.0f);
+
+    int top = 0, bottom = 0;
+    paintedRows(image, 0, top, bottom);
+    QCOMPARE(top, 45);
+    QCOMPARE(bottom, 55);
+    QCOMPARE(image.pixel(0, 50), kLow.rgba());
+
+    paintedRows(image, 1, top, bottom);
+    QCOMPARE(top, 40);
+    QCOMPARE(bottom, 60);
+    QCOMPARE(image.pixel(1, 50), kMid.rgba());
+
+    paintedRows(image, 2, top, bottom);
+    QCOMPARE(top, 25);
+    QCOMPARE(bottom, 75);
+    QCOMPARE(image.pixel(2, 50), kHigh.rgba());
+
+    // Столбец всегда проходит через ноль, как и прежняя отрисовка
+    paintedRows(image, 3, top, bottom);
+    QCOMPARE(top, 30);
+    QCOMPARE(bottom, 50);
+    QCOMPARE(image.pixel(3, 50), kMid.rgba());
+}
+
+// Тишина — точка в центре; выбросы и столбцы за краем не выходят за изображение
+void WaveformRasterizerTest::testSilenceAndClipping()
+{
+    QImage image = makeImage(6, 40);
+    const float minValues[] = { 0.0f, -1e30f, 0.0f, 0.0f, 0.0f, 0.0f };
+    const float maxValues[] = { 0.0f, 1e30f, 0.0f, 0.0f, 0.0f, 0.0f };
+    const float centerY[] = { 20.0f };
+
+    WaveformRasterizer rasterizer(kLow, kMid, kHigh);
+    // Первые два столбца — левее изображения: рисуются только попавшие в него
+    rasterizer.draw(image, -2, 6, 1, minValues, maxValues, centerY, 20.0f);
+
+    int top = 0, bottom = 0;
+    paintedRows(image, 0, top, bottom);
+    QCOMPARE(top, 20);
+    QCOMPARE(bottom, 20);
+    for (int x = 4; x < 6; ++x) {
+        paintedRows(image, x, top, bottom);
+        QCOMPARE(top, -1);  // правее переданных столбцов ничего не трогаем
+    }
+
+    QImage clipped = makeImage(2, 40);
+    rasterizer.draw(clipped, 0, 2, 1, minValues, maxValues, centerY, 20.0f);
+    paintedRows(clipped, 1, top, bottom);
+    QCOMPARE(top, 0);
+    QCOMPARE(bottom, 39);
+    QCOMPARE(clipped.pixel(1, 0), kHigh.rgba());
+}
+
+// Каналы столбца лежат рядом и рисуются в своих полосах
+void WaveformRasterizerTest::testChannelLanes()
+{
+    QImage image = makeImage(2, 100);
+    const float minValues[] = { -0.5f, 0.0f, 0.0f, -1.0f };
+    const float maxValues[] = { 0.5f, 0.0f, 0.0f, 1.0f };
+    const float centerY[] = { 25.0f, 75.0f };
+
+    WaveformRasterizer rasterizer(kLow, kMid, kHigh);
+    rasterizer.draw(image, 0, 2, 2, minValues, maxValues, centerY, 25.0f);
+
+    QCOMPARE(image.pixel(0, 11), kBackground.rgba());
+    QCOMPARE(image.pixel(0, 12), kHigh.rgba());
+    QCOMPARE(image.pixel(0, 37), kHigh.rgba());
+    QCOMPARE(image.pixel(0, 38), kBackground.rgba());
+    QCOMPARE(image.pixel(0, 75), kLow.rgba());
+    QCOMPARE(image.pixel(0, 74), kBackground.rgba());
+
+    QCOMPARE(image.pixel(1, 25), kLow.rgba());
+    QCOMPARE(image.pixel(1, 49), kBackground.rgba());
+    QCOMPARE(image.pixel(1, 50), kHigh.rgba());
+    QCOMPARE(image.pixel(1, 99), kHigh.rgba());
+}
+
+// Полупрозрачные цвета смешиваются с фоном (source-over, как у QPainter)
+void WaveformRasterizerTest::testTranslucentColors()
+{
+    QImage image = makeImage(1, 10);
+    const float minValues[] = { 0.0f };
+    const float maxValues[] = { 0.0f };
+    const float centerY[] = { 5.0f };
+
+    const QColor translucent(255, 255, 255, 128);
+    WaveformRasterizer rasterizer(translucent, translucent, translucent);
+    rasterizer.draw(image, 0, 1, 1, minValues, maxValues, centerY, 5.0f);
+
+    // Половина белого поверх фона: каждый канал — посередине между ними
+    QCOMPARE(image.pixel(0, 4), kBackground.rgba());
+    const QColor result = image.pixelColor(0, 5);
+    QCOMPARE(result.alpha(), 255);
+    QVERIFY(qAbs(result.red() - (10 + (255 - 10) / 2)) <= 1);
+    QVERIFY(qAbs(result.green() - (20 + (255 - 20) / 2)) <= 1);
+    QVERIFY(qAbs(result.blue() - (30 + (255 - 30) / 2)) <= 1);
+}
+
+QTEST_APPLESS_MAIN(WaveformRasterizerTest)
+#include "waveform_rasterizer_test.moc"
@@ -0,0 +1,144 @@
+// dontfloat-analyze — пакетный анализ папки без окна (сервер сборки, ночные прогоны).
+//
+//   dontfloat-analyze [-j N] [-o DIR] [--format json|markers|both] PATH...
+//
+// Каждый файл: BPM и доли, потактовая тональность, ноты. Результат — рядом с
+// аудио или в DIR с той же структурой подпапок. Код выхода 1 — были ошибки.
+
+#include <QtCore/QCommandLineParser>
+#include <QtCore/QCoreApplication>
+#include <QtCore/QDir>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QFileInfo>
+#include <QtCore/QTextStream>
+#include <QtCore/QThread>
+
+#include "../include/batchanalyzer.h"
+#include "dontfloat_version.h"
+
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName(QStringLiteral("dontfloat-analyze"));
+    QCoreApplication::setOrganizationName(QStringLiteral("DONTFLOAT"));
+    QCoreApplication::setApplicationVersion(QStringLiteral(DONTFLOAT_VERSION_STRING));
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral(
+        "Analyses audio files headlessly: BPM and beats, per-bar key and notes."));
+    parser.addHelpOption();
+    parser.addVersionOption();
+    parser.addPositionalArgument(QStringLiteral("paths"),
+                                 QStringLiteral("Audio files or folders to analyse."),
+                                 QStringLiteral("PATH..."));
+
+    const QCommandLineOption jobsOption(
+        { QStringLiteral("j"), QStringLiteral("jobs") },
+        QStringLiteral("Worker threads (default: number of cores)."), QStringLiteral("N"));
+    const QCommandLineOption outputOption(
+        { QStringLiteral("o"), QStringLiteral("output") },
+        QStringLiteral("Output folder (default: next to each audio file)."), QStringLiteral("DIR"));
+    const QCommandLineOption formatOption(
+        { QStringLiteral("f"), QStringLiteral("format") },
+        QStringLiteral("Output format: json, markers or both (default: json)."),
+        QStringLiteral("FORMAT"), QStringLiteral("json"));
+    const QCommandLineOption beatsPerBarOption(
+        QStringLiteral("beats-per-bar"),
+        QStringLiteral("Bar length for per-bar keys and markers (default: 4)."),
+        QStringLiteral("N"), QStringLiteral("4"));
+    const QCommandLineOption noKeysOption(QStringLiteral("no-keys"),
+                                          QStringLiteral("Skip per-bar key analysis."));
+    const QCommandLineOption noNotesOption(QStringLiteral("no-notes"),
+                                           QStringLiteral("Skip note detection."));
+    const QCommandLineOption skipExistingOption(
+        QStringLiteral("skip-existing"),
+        QStringLiteral("Skip files whose results already exist (resume an interrupted run)."));
+    const QCommandLineOption noRecursiveOption(QStringLiteral("no-recursive"),
+                                               QStringLiteral("Do not descend into subfolders."));
+    parser.addOptions({ jobsOption, outputOption, formatOption, beatsPerBarOption, noKeysOption,
+                        noNotesOption, skipExistingOption, noRecursiveOption });
+    parser.process(app);
+
+    QTextStream out(stdout);
+    QTextStream err(stderr);
+
+    const QStringList paths = parser.positionalArguments();
+    if (paths.isEmpty()) {
+        parser.showHelp(1);
+    }
+
+    BatchAnalyzer::Options options;
+    const QString format = parser.value(formatOption).toLower();
+    if (format == QStringLiteral("json")) {
+        options.format = BatchAnalyzer::OutputFormat::Json;
+    } else if (format == QStringLiteral("markers")) {
+        options.format = BatchAnalyzer::OutputFormat::Markers;
+    } else if (format == QStringLiteral("both")) {
+        options.format = BatchAnalyzer::OutputFormat::Both;
+    } else {
+        err << "Unknown format: " << format << Qt::endl;
+        return 2;
+    }
+    if (parser.isSet(jobsOption)) {
+        bool ok = false;
+        options.jobs = parser.value(jobsOption).toInt(&ok);
+        if (!ok || options.jobs < 1) {
+            err << "Invalid job count: " << parser.value(jobsOption) << Qt::endl;
+            return 2;
+        }
+    }
+    bool beatsOk = false;
+    options.beatsPerBar = parser.value(beatsPerBarOption).toInt(&beatsOk);
+    if (!beatsOk || options.beatsPerBar < 1) {
+        err << "Invalid beats per bar: " << parser.value(beatsPerBarOption) << Qt::endl;
+        return 2;
+    }
+    if (parser.isSet(outputOption)) {
+        options.outputDir = QDir(parser.value(outputOption)).absolutePath();
+    }
+    // Структура подпапок в outputDir повторяется от единственной заданной папки
+    if (paths.size() == 1 && QFileInfo(paths.first()).isDir()) {
+        options.inputRoot = QDir(paths.first()).absolutePath();
+    }
+    options.analyzeKeys = !parser.isSet(noKeysOption);
+    options.detectNotes = !parser.isSet(noNotesOption);
+    options.skipExisting = parser.isSet(skipExistingOption);
+
+    const QStringList files = BatchAnalyzer::collectAudioFiles(paths, !parser.isSet(noRecursiveOption));
+    if (files.isEmpty()) {
+        err << "No audio files found." << Qt::endl;
+        return 1;
+    }
+
+    const int jobs = options.jobs > 0 ? options.jobs : QThread::idealThreadCount();
+    out << "Analysing " << files.size() << " file(s) on " << qMin(jobs, int(files.size()))
+        << " thread(s)" << Qt::endl;
+
+    QElapsedTimer timer;
+    timer.start();
+    const BatchAnalyzer::Summary summary = BatchAnalyzer::run(
+        files, options,
+        [&out, &err](const BatchAnalyzer::FileResult& result, int done, int total) {
+            const QString prefix = QStringLiteral("[%1/%2] %3").arg(done).arg(total).arg(result.path);
+            if (result.skipped) {
+                out << prefix << ": skipped (results exist)" << Qt::endl;
+            } else if (!result.ok) {
+                err << prefix << ": " << result.error << Qt::endl;
+            } else {
+                out << prefix << ": " << QString::number(double(result.beats.bpm), 'f', 2) << " BPM";
+                if (!result.keys.bars.isEmpty()) {
+                    out << ", " << result.keys.primaryKey.keyName;
+                }
+                if (!result.notes.isEmpty()) {
+                    out << ", " << result.notes.size() << " notes";
+                }
+                out << " (" << QString::number(double(result.elapsedMs) / 1000.0, 'f', 1) << " s)"
+                    << Qt::endl;
+            }
+        });
+
+    out << "Done in " << QString::number(double(timer.elapsed()) / 1000.0, 'f', 1) << " s: "
+        << summary.analyzed << " analysed, " << summary.skipped << " skipped, "
+        << summary.failed << " failed" << Qt::endl;
+    return summary.failed > 0 ? 1 : 0;
+}
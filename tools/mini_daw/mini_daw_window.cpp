@@ -230,12 +230,20 @@ void PlaybackBar::rebuildEnvelope(int index)
     lane.envelopeUpper.clear();
     lane.envelopeLower.clear();
     const QRect area = trackRect(index);
-    if (lane.channels.isEmpty() || area.width() <= 0 || area.height() <= 2) {
+    if (lane.channels.isEmpty()) {
+        lane.envelopePyramid.clear();
+        return;
+    }
+    // Сведённая пирамида строится один раз на дорожку: ресайз и соседние
+    // дорожки её только читают
+    lane.envelopePyramid.ensureBuilt(lane.channels);
+    if (area.width() <= 0 || area.height() <= 2) {
         return;
     }
     // Огибающая считается тем же движком, что рисует волну в приложении
-    const auto envelope =
-        PianoRollEngine::buildWaveformEnvelope(lane.channels, area.width(), area.height());
+    const auto viewport = PianoRollEngine::Viewport::compute(lane.frames, area.width(), 1.0f, 0.0f);
+    const auto envelope = PianoRollEngine::buildWaveformEnvelope(lane.envelopePyramid, viewport,
+                                                                 area.width(), area.height());
     lane.envelopeUpper = envelope.upper;
     lane.envelopeLower = envelope.lower;
 }
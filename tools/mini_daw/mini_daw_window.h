@@ -12,6 +12,8 @@
 #include <memory>
 #include <vector>
 
+#include "pianoroll_engine.h"
+
 #include "mini_daw_clip_model.h"
 #include "mini_daw_player.h"
 #include "mini_daw_plugin_host.h"
@@ -98,6 +100,7 @@ private:
     /** Одна дорожка панели: звук, огибающая, имя и границы клипов. */
     struct Lane {
         QVector<QVector<float>> channels;
+        PianoRollEngine::EnvelopePyramid envelopePyramid;  ///< сведённые пики, строятся раз на звук
         QVector<int> envelopeUpper;   ///< верхняя огибающая, пиксели по Y
         QVector<int> envelopeLower;
         QString name;